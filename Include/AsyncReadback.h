@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Althea/Allocator.h>
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AltheaEngine {
+class Application;
+} // namespace AltheaEngine
+
+namespace AltheaDemo {
+
+struct ReadbackRegion {
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  VkDeviceSize size;
+};
+
+// Bytes of each requested region, in request order
+using ReadbackData = std::vector<std::vector<std::byte>>;
+using ReadbackCallback = std::function<void(ReadbackData&& data)>;
+
+// Appends a region of a readback to a typed array
+template <typename T>
+void appendReadbackRegion(
+    const std::vector<std::byte>& bytes,
+    std::vector<T>& out) {
+  size_t count = bytes.size() / sizeof(T);
+  size_t offset = out.size();
+  out.resize(offset + count);
+  std::memcpy(out.data() + offset, bytes.data(), count * sizeof(T));
+}
+
+// Copies buffer regions into host-visible staging buffers from inside a
+// frame's command buffer, without waiting on the GPU. Every request sets an
+// event after its copies, a worker thread polls the events and hands the
+// bytes to the request's callback once they land, usually a few frames
+// later. Callbacks run on the worker thread.
+//
+// The ring has a fixed number of staging slots, requests made while all of
+// them are in flight are dropped. The command buffers recording requests
+// need to be submitted for the callbacks to ever run.
+class AsyncReadback {
+public:
+  AsyncReadback(AltheaEngine::Application& app, uint32_t maxRequestsInFlight);
+  // The GPU needs to be done with every recorded request
+  ~AsyncReadback();
+
+  AsyncReadback(const AsyncReadback&) = delete;
+  AsyncReadback& operator=(const AsyncReadback&) = delete;
+
+  // Records copies of the regions, which were last written by compute
+  // shaders. Returns false and records nothing if every slot is in flight.
+  bool request(
+      VkCommandBuffer commandBuffer,
+      const std::vector<ReadbackRegion>& regions,
+      ReadbackCallback&& callback);
+
+  // Blocks until every request so far has been delivered, the command
+  // buffers recording them need to have been submitted
+  void flush();
+
+private:
+  struct Slot {
+    AltheaEngine::BufferAllocation staging;
+    VkDeviceSize capacity = 0;
+    VkEvent event = VK_NULL_HANDLE;
+
+    std::vector<VkDeviceSize> regionSizes;
+    ReadbackCallback callback;
+  };
+
+  void _workerLoop();
+
+  AltheaEngine::Application& m_app;
+  VkDevice m_device;
+
+  std::vector<Slot> m_slots;
+
+  // Guards everything below
+  std::mutex m_mutex;
+  std::condition_variable m_wakeWorker;
+  std::condition_variable m_requestDelivered;
+  std::vector<uint32_t> m_freeSlots;
+  // Slots waiting on the GPU, oldest first
+  std::deque<uint32_t> m_pendingSlots;
+  // Slot the worker is reading out
+  bool m_delivering = false;
+  bool m_stopWorker = false;
+
+  std::thread m_worker;
+};
+
+} // namespace AltheaDemo
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+
+// Tracks the last accesses to a fixed set of resources and turns the hazards
+// at each pass boundary into a single global VkMemoryBarrier, instead of a
+// buffer barrier per buffer. Resources are ids picked by the caller and can
+// stand for any number of buffers, e.g. every chunk of a buffer heap. The
+// tracked state carries over between command buffers, as long as they are
+// submitted to one queue in the order they were recorded.
+class BarrierBatcher {
+public:
+  BarrierBatcher() = default;
+  BarrierBatcher(uint32_t resourceCount);
+
+  // Declare the accesses of the next pass
+  void read(
+      uint32_t resource,
+      VkPipelineStageFlags stages,
+      VkAccessFlags access);
+  void write(
+      uint32_t resource,
+      VkPipelineStageFlags stages,
+      VkAccessFlags access);
+  // Shader reads and writes, e.g. atomics
+  void readWrite(uint32_t resource, VkPipelineStageFlags stages);
+
+  // Records one barrier covering every hazard between the accesses declared
+  // since the last flush and the ones before them. Records nothing if there
+  // are none.
+  void flush(VkCommandBuffer commandBuffer);
+
+  // Forgets every access, only valid once the device is idle
+  void reset();
+
+  uint32_t getFlushCount() const { return m_flushCount; }
+  uint32_t getBarrierCount() const { return m_barrierCount; }
+  void resetCounts() {
+    m_flushCount = 0;
+    m_barrierCount = 0;
+  }
+
+private:
+  struct Access {
+    uint32_t resource;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    bool write;
+  };
+  std::vector<Access> m_pendingAccesses;
+
+  struct ResourceState {
+    VkPipelineStageFlags writeStages = 0;
+    VkAccessFlags writeAccess = 0;
+    // Stages that have waited on the last write
+    VkPipelineStageFlags visibleStages = 0;
+    // Stages that read since the last write, the next write waits on them
+    VkPipelineStageFlags readStages = 0;
+    // Flush the last write was committed in
+    uint32_t writeFlush = 0;
+  };
+  std::vector<ResourceState> m_states;
+  // Counts every flush, unlike m_flushCount
+  uint32_t m_flushIdx = 0;
+
+  uint32_t m_flushCount = 0;
+  uint32_t m_barrierCount = 0;
+};
+
+} // namespace AltheaDemo
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace AltheaDemo {
+namespace Benchmarks {
+
+// CPU-only benchmarks that run without creating a window or a Vulkan device,
+// launched with `AltheaDemo --bench <name> [args...]`. Returns a process exit
+// code.
+int run(const std::string& name, const std::vector<std::string>& args);
+
+} // namespace Benchmarks
+} // namespace AltheaDemo
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaEngine {
+class Application;
+} // namespace AltheaEngine
+
+namespace AltheaDemo {
+
+// GPU timestamps around compute dispatches, accumulated per pass index. Each
+// recorded dispatch takes two queries, dispatches past the pool size are not
+// timed. Meant for command buffers that are waited on before collect() is
+// called, e.g. SingleTimeCommandBuffer.
+class ComputePassTimer {
+public:
+  ComputePassTimer(
+      AltheaEngine::Application& app,
+      uint32_t passCount,
+      uint32_t maxDispatches);
+  ~ComputePassTimer();
+
+  ComputePassTimer(const ComputePassTimer&) = delete;
+  ComputePassTimer& operator=(const ComputePassTimer&) = delete;
+
+  // Needs to be recorded before any timed dispatch in the command buffer
+  void reset(VkCommandBuffer commandBuffer);
+
+  void beginDispatch(VkCommandBuffer commandBuffer, uint32_t passIdx);
+  void endDispatch(VkCommandBuffer commandBuffer);
+
+  // Reads back the timestamps of the last submission and adds them to the
+  // per-pass totals
+  void collect();
+
+  double getPassMs(uint32_t passIdx) const { return m_passMs[passIdx]; }
+  uint32_t getPassDispatches(uint32_t passIdx) const {
+    return m_passDispatches[passIdx];
+  }
+
+private:
+  VkDevice m_device;
+  VkQueryPool m_queryPool = VK_NULL_HANDLE;
+  double m_msPerTick;
+
+  uint32_t m_maxDispatches;
+  // Pass index of each dispatch recorded since the last reset
+  std::vector<uint32_t> m_dispatchPasses;
+  bool m_timingDispatch = false;
+
+  std::vector<double> m_passMs;
+  std::vector<uint32_t> m_passDispatches;
+};
+
+} // namespace AltheaDemo
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "SpatialHashCpu.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// Same cell colouring as computeCellColor in SimResources.glsl
+uint32_t computeCellColor(const glm::mat4& worldToGrid, const glm::vec3& pos);
+
+// CPU reference of the particle contact projection, iterated either in Jacobi
+// order or in the graph-coloured Gauss-Seidel order of
+// Shaders/ParticleSystem/GaussSeidelStep.comp.glsl. Both orders apply the
+// same per-particle update, the sum of the corrections that move the particle
+// half way out of each contact. Walls are left out, so the two orders can be
+// compared on contacts alone.
+class ContactSolverCpu {
+public:
+  // Copies the inserted positions and cell ranges out of the spatial hash.
+  // Each particle's colour comes from the position its cell was computed
+  // from.
+  void init(
+      const SpatialHashCpu& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& cellPositions,
+      const std::vector<uint32_t>& globalIndices,
+      float particleRadius);
+  void init(
+      const SortedSpatialHashCpu& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& cellPositions,
+      const std::vector<uint32_t>& globalIndices,
+      float particleRadius);
+
+  // Updates every particle from the previous iterate
+  void jacobiIteration();
+  // One sweep per cell colour, each updating its particles in place
+  void gaussSeidelIteration();
+
+  // Total penetration depth over all contact pairs
+  double computePenetration() const;
+
+  glm::vec3 getPosition(uint32_t globalParticleIdx) const {
+    return m_positions[globalParticleIdx];
+  }
+
+private:
+  template <typename TSpatialHash>
+  void _init(
+      const TSpatialHash& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& cellPositions,
+      const std::vector<uint32_t>& globalIndices,
+      float particleRadius);
+
+  // Walks the 8 cells around the particle, calls fn with the bucket-entry
+  // index of every other particle in them
+  template <typename TFunc>
+  void _forEachNeighbor(
+      uint32_t globalParticleIdx,
+      const glm::vec3& particlePos,
+      TFunc&& fn) const;
+
+  glm::mat4 m_worldToGrid;
+  float m_particleRadius = 0.0f;
+
+  // Range of bucket entries of each spatial hash slot
+  std::vector<uint32_t> m_rangeStarts;
+  std::vector<uint32_t> m_rangeEnds;
+
+  // Indexed by bucket entry, only entries within a range are used
+  std::vector<glm::vec3> m_positions;
+  std::vector<glm::vec3> m_prevIterate;
+  std::vector<uint8_t> m_colors;
+};
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
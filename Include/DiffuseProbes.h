@@ -31,6 +31,8 @@
 #include <Althea/Common/GlobalIllumination.h>
 #include <glm/glm.hpp>
 
+#include "BarrierBatcher.h"
+
 #include <vector>
 
 using namespace AltheaEngine;
@@ -67,14 +69,31 @@ private:
   void createModels(Application& app, SingleTimeCommandBuffer& commandBuffer);
   std::vector<Model> m_models;
 
+  // The scene and acceleration structure, created once in initGame and kept
+  // across swapchain re-creation
   void createGlobalResources(
       Application& app,
       SingleTimeCommandBuffer& commandBuffer);
   GlobalHeap m_heap;
-  GlobalResources m_globalResources;
   GlobalUniformsResource m_globalUniforms;
   AccelerationStructure m_accelerationStructure;
 
+  // The reservoirs and RT target, re-created with the swapchain, and the
+  // GBuffer, re-created only when the extent changes
+  void createScreenResources(
+      Application& app,
+      SingleTimeCommandBuffer& commandBuffer);
+  GlobalResources m_globalResources;
+  // The extent the GBuffer in m_globalResources was created at
+  VkExtent2D m_globalResourcesExtent{};
+
+  // The shader indexes the reservoir buffers from the first handle, so their
+  // handles are registered as one contiguous range
+  void registerReservoirHandles(uint32_t bufferCount);
+  std::vector<BufferHandle> m_reservoirHandles;
+  // The whole reservoir heap is tracked as one resource
+  BarrierBatcher m_reservoirBarriers;
+
   void
   createGBufferPass(Application& app, SingleTimeCommandBuffer& commandBuffer);
   RenderPass m_gBufferPass;
@@ -96,10 +115,14 @@ private:
   };
   SphereMesh m_sphere;
   ComputePipeline m_probePlacementPass;
+
+  // Draws the probes over the RT target, sized to the swapchain
+  void createCompositingPass(Application& app);
   RenderPass m_compositingPass;
   FrameBuffer m_compositingFrameBufferA;
   FrameBuffer m_compositingFrameBufferB;
 
+  // The handles are registered once and outlive the target
   struct RtTarget {
     ImageResource target{};
     ImageHandle targetImageHandle{};
@@ -108,13 +131,14 @@ private:
   RtTarget m_rtTarget;
 
   TransientUniforms<GlobalIllumination::Uniforms> m_giUniforms;
-  StructuredBufferHeap<GlobalIllumination::Reservoir> m_reservoirHeap;
+  std::vector<StructuredBuffer<GlobalIllumination::Reservoir>> m_reservoirHeap;
 
   StructuredBuffer<GlobalIllumination::Probe> m_probes;
   StructuredBuffer<uint32_t> m_spatialHash;
   
   StructuredBuffer<VkDrawIndexedIndirectCommand> m_probeController;
 
+  void createDisplayPass(Application& app);
   RenderPass m_displayPass;
   SwapChainFrameBufferCollection m_displayPassSwapChainFrameBuffers;
 
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "BarrierBatcher.h"
+
+#include <Althea/ComputePipeline.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/StructuredBuffer.h>
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaEngine {
+class Application;
+} // namespace AltheaEngine
+
+namespace AltheaDemo {
+class ComputePassTimer;
+
+// Order of the primitives' compute passes, for ComputePassTimer
+#define PRIMITIVE_SCAN_BLOCKS_PASS 0
+#define PRIMITIVE_SCAN_BLOCK_SUMS_PASS 1
+#define PRIMITIVE_SCAN_APPLY_PASS 2
+#define PRIMITIVE_SORT_COUNT_PASS 3
+#define PRIMITIVE_SORT_SCATTER_PASS 4
+#define PRIMITIVE_SEGMENTED_REDUCE_PASS 5
+#define PRIMITIVE_PASS_COUNT 6
+
+// Compute building blocks over buffers registered to a GlobalHeap: exclusive
+// scan, stable key-value radix sort and segmented reduction, with workgroup
+// scans and reductions built on subgroup arithmetic (see
+// Shaders/Primitives/Workgroup.glsl). Buffers are passed as heap handles, so
+// any registered buffer works, including one chunk of a bigger heap.
+//
+// Each call records its dispatches and the barriers between them. Callers
+// make their inputs visible to compute shaders before the call and treat the
+// outputs as compute shader writes after it, e.g. by declaring a compute
+// write on their own BarrierBatcher before the call. PrimitivesCpu.h has the
+// CPU references.
+class GpuPrimitives {
+public:
+  GpuPrimitives() = default;
+  // Scans and sorts are bounded by maxCount, their scratch buffers are
+  // registered to the heap. Segmented reductions have no bound.
+  GpuPrimitives(
+      AltheaEngine::Application& app,
+      AltheaEngine::GlobalHeap& heap,
+      uint32_t maxCount);
+
+  // In-place exclusive prefix sum of count uints
+  void exclusiveScan(
+      VkCommandBuffer commandBuffer,
+      uint32_t valuesHandle,
+      uint32_t count);
+
+  // Stable in-place sort of count uint key-value pairs by the low keyBits bits
+  // of their keys
+  void sortKeyValues(
+      VkCommandBuffer commandBuffer,
+      uint32_t keysHandle,
+      uint32_t valuesHandle,
+      uint32_t count,
+      uint32_t keyBits = 32);
+
+  // sums[i] is the sum of the floats in
+  // values[segmentOffsets[i], segmentOffsets[i + 1]), segmentOffsets holds
+  // segmentCount + 1 uints
+  void segmentedReduce(
+      VkCommandBuffer commandBuffer,
+      uint32_t valuesHandle,
+      uint32_t segmentOffsetsHandle,
+      uint32_t sumsHandle,
+      uint32_t segmentCount);
+
+  uint32_t getMaxCount() const { return m_maxCount; }
+
+  // Times every dispatch under its PRIMITIVE_*_PASS index while set
+  void setPassTimer(ComputePassTimer* pPassTimer) { m_pPassTimer = pPassTimer; }
+
+private:
+  template <typename TPushConstants>
+  void _dispatch(
+      VkCommandBuffer commandBuffer,
+      uint32_t passIdx,
+      const TPushConstants& push,
+      uint32_t groupCount);
+
+  AltheaEngine::GlobalHeap* m_pHeap = nullptr;
+  uint32_t m_maxCount = 0;
+
+  std::vector<AltheaEngine::ComputePipeline> m_passes;
+
+  AltheaEngine::StructuredBuffer<uint32_t> m_scanBlockSums;
+  // Digit counts of each radix sort pass, scanned in place
+  AltheaEngine::StructuredBuffer<uint32_t> m_sortHistogram;
+  // The radix sort ping-pongs between the caller's buffers and these
+  AltheaEngine::StructuredBuffer<uint32_t> m_sortKeys;
+  AltheaEngine::StructuredBuffer<uint32_t> m_sortValues;
+
+  // Every buffer the primitives touch is tracked as one resource, each
+  // dispatch depends on the one before it
+  BarrierBatcher m_barriers;
+  ComputePassTimer* m_pPassTimer = nullptr;
+};
+
+} // namespace AltheaDemo
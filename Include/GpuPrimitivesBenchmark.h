@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace AltheaEngine {
+class Application;
+} // namespace AltheaEngine
+
+namespace AltheaDemo {
+
+// Times the GpuPrimitives on random inputs and checks their results against
+// the CPU twins in PrimitivesCpu.h, launched with
+// `AltheaDemo --primitives-bench [args...]`. Only needs compute and timestamp
+// queries from the device, same as the headless sim benchmark. Returns a
+// process exit code, failing if any result mismatches.
+class GpuPrimitivesBenchmark {
+public:
+  // Args: [count = 4M] [iterations = 10] [segmentSize = 1024]
+  static int run(
+      AltheaEngine::Application& app,
+      const std::vector<std::string>& args);
+};
+
+} // namespace AltheaDemo
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace AltheaEngine {
+class Application;
+} // namespace AltheaEngine
+
+namespace AltheaDemo {
+class ComputePassTimer;
+
+namespace ParticleSystem {
+class ParticleSystem;
+
+// Steps the particle sim at a fixed timestep without presenting or creating
+// any render passes, launched with `AltheaDemo --sim-bench [args...]`. Only
+// needs compute and timestamp queries from the device, so it also runs on
+// software implementations like lavapipe. Application still opens a window,
+// use a virtual display (e.g. xvfb-run) on machines without one. Writes
+// per-pass GPU timings, throughput and spatial hash statistics to a JSON
+// file. Returns a process exit code.
+class HeadlessSimBenchmark {
+public:
+  // Args: [substeps = 600] [particleCount = 100000]
+  //       [outputPath = sim-benchmark.json]
+  //       [localSizeX = 0] [tasksPerThread = 0]
+  // The last two override the sim passes' tunables, 0 keeps the default.
+  // Sweeping them only re-creates the pipelines.
+  static int run(
+      AltheaEngine::Application& app,
+      const std::vector<std::string>& args);
+
+private:
+  // Creates the sim's resources and applies the specialization overrides
+  static void _createSim(
+      AltheaEngine::Application& app,
+      ParticleSystem& sim,
+      uint32_t particleCount,
+      uint32_t localSizeX,
+      uint32_t tasksPerThread);
+
+  // Steps the sim one sim step per frame, timing every pass. Returns the wall
+  // time, recordMs gets the CPU time spent recording.
+  static double _runFrames(
+      AltheaEngine::Application& app,
+      ParticleSystem& sim,
+      ComputePassTimer& timer,
+      ComputePassTimer& primitivesTimer,
+      uint32_t frameCount,
+      double& recordMs);
+};
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ParticleSystem.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// Same key as computeMortonKey in Shaders/ParticleSystem/SimResources.glsl:
+// the Z-order index of the block containing the position, with the bounds
+// split into 2^MORTON_BITS_PER_AXIS blocks along each axis. The sim uses its
+// kill bounds. Positions outside are clamped to the edge blocks.
+uint32_t computeMortonKey(
+    const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax,
+    const glm::vec3& pos);
+
+// CPU reference of the GPU Morton reorder. Writes the particle order sorted by
+// Morton key to order, i.e. order[dstIdx] = srcIdx. Unlike the GPU scatter
+// the sort is stable, so only the key sequence of the two can be compared.
+void computeMortonOrder(
+    const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax,
+    const std::vector<glm::vec3>& positions,
+    std::vector<uint32_t>& order);
+
+// Number of adjacent particle pairs whose Morton keys are out of order, 0 for
+// a correctly reordered particle buffer.
+uint32_t countMortonOrderInversions(
+    const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax,
+    const std::vector<glm::vec3>& positions);
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "SpatialHashCpu.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// CPU reference of Shaders/ParticleSystem/BuildNeighborList.comp.glsl. For
+// each particle, lists the bucket-entry indices of the other particles within
+// searchRadius among the 8 cells the Jacobi step checks, in the order the GPU
+// walks them. Uses the same NEIGHBOR_LIST_SIZE stride as the GPU lists, with
+// the neighbour count in the first entry, so a download can be compared
+// list by list.
+class NeighborListCpu {
+public:
+  // globalIndices maps each particle to its bucket entry, as written by the
+  // hash build
+  void build(
+      const SpatialHashCpu& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<uint32_t>& globalIndices,
+      float searchRadius);
+  void build(
+      const SortedSpatialHashCpu& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<uint32_t>& globalIndices,
+      float searchRadius);
+
+  uint32_t getNeighborCount(uint32_t particleIdx) const {
+    return m_lists[particleIdx * NEIGHBOR_LIST_SIZE];
+  }
+
+  uint32_t getNeighbor(uint32_t particleIdx, uint32_t neighborIdx) const {
+    return m_lists[particleIdx * NEIGHBOR_LIST_SIZE + 1 + neighborIdx];
+  }
+
+  // Particles with more neighbours than fit in a list
+  uint32_t getOverflowCount() const { return m_overflowCount; }
+
+  size_t getMemoryBytes() const { return m_lists.size() * sizeof(uint32_t); }
+
+  const std::vector<uint32_t>& getLists() const { return m_lists; }
+
+private:
+  template <typename TSpatialHash>
+  void _build(
+      const TSpatialHash& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<uint32_t>& globalIndices,
+      float searchRadius);
+
+  std::vector<uint32_t> m_lists;
+  uint32_t m_overflowCount = 0;
+};
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace AltheaDemo {
+
+inline uint32_t getWorkerCount() {
+  uint32_t count = std::thread::hardware_concurrency();
+  return count == 0 ? 1 : count;
+}
+
+// Splits [0, count) into one contiguous range per worker and calls
+// fn(rangeStart, rangeEnd) on each from its own thread. The calling thread
+// processes the last range and returns once every range is done. Ranges are
+// never smaller than minRangeSize, so small inputs stay single-threaded.
+template <typename TFunc>
+void parallelFor(uint32_t count, TFunc&& fn, uint32_t minRangeSize = 4096) {
+  if (count == 0)
+    return;
+
+  uint32_t maxRanges = (count - 1) / std::max(minRangeSize, 1u) + 1;
+  uint32_t rangeCount = std::min(getWorkerCount(), maxRanges);
+  uint32_t rangeSize = (count - 1) / rangeCount + 1;
+
+  std::vector<std::thread> workers;
+  workers.reserve(rangeCount - 1);
+  for (uint32_t rangeIdx = 0; rangeIdx + 1 < rangeCount; ++rangeIdx) {
+    uint32_t start = std::min(rangeIdx * rangeSize, count);
+    uint32_t end = std::min(start + rangeSize, count);
+    workers.emplace_back([&fn, start, end]() { fn(start, end); });
+  }
+
+  fn(std::min((rangeCount - 1) * rangeSize, count), count);
+
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+} // namespace AltheaDemo
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ParticleSystem.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// Same test as isParticleDead in Shaders/ParticleSystem/SimResources.glsl:
+// particles outside the kill bounds are dead, and so are NaN positions.
+bool isParticleDead(
+    const glm::vec3& killBoundsMin,
+    const glm::vec3& killBoundsMax,
+    const glm::vec3& position);
+
+// CPU reference of the GPU compaction. Appends the live particles to out, in
+// their original order, which is exactly what the GPU packs them into.
+void compactParticles(
+    const glm::vec3& killBoundsMin,
+    const glm::vec3& killBoundsMax,
+    const std::vector<Particle>& particles,
+    std::vector<Particle>& out);
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
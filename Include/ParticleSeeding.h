@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ParallelFor.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// PCG hash (Jarzynski and Olano, "Hash Functions for GPU Rendering"). Used as
+// a counter-based RNG: the value for a counter doesn't depend on any other
+// value drawn, so particles can be seeded in any order from any thread.
+inline uint32_t pcgHash(uint32_t v) {
+  uint32_t state = v * 747796405u + 2891336453u;
+  uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Spawn position of a particle, drawn from the same box the original rand()
+// based reset used. The same seed and particle index always give the same
+// position.
+glm::vec3 computeSpawnPosition(uint32_t seed, uint32_t particleIdx);
+
+// Calls fn(particleIdx, position) for every particle in
+// [firstParticleIdx, firstParticleIdx + particleCount), split across worker
+// threads. fn is called concurrently and must only write per-particle data.
+template <typename TFunc>
+void seedParticles(
+    uint32_t seed,
+    uint32_t firstParticleIdx,
+    uint32_t particleCount,
+    TFunc&& fn) {
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = firstParticleIdx + start;
+         particleIdx < firstParticleIdx + end;
+         ++particleIdx)
+      fn(particleIdx, computeSpawnPosition(seed, particleIdx));
+  });
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
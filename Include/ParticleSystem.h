@@ -1,5 +1,9 @@
 #pragma once
 
+#include "AsyncReadback.h"
+#include "BarrierBatcher.h"
+#include "GpuPrimitives.h"
+
 #include <Althea/Allocator.h>
 #include <Althea/BufferHeap.h>
 #include <Althea/CameraController.h>
@@ -27,17 +31,39 @@
 #include <glm/glm.hpp>
 
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 using namespace AltheaEngine;
 
 #define PARTICLES_PER_BUCKET 16
 
+// The bucket build hands out buckets from this many free lists, to spread the
+// allocation atomics out
+#define BUCKET_FREE_LIST_COUNT 32
+
+// Per-particle neighbour list stride, the first entry holds the neighbour
+// count so each list fits NEIGHBOR_LIST_SIZE - 1 neighbours
+#define NEIGHBOR_LIST_SIZE 32
+
+// The Morton reorder sorts by the Z-order key of blocks of the kill bounds,
+// split into 2^MORTON_BITS_PER_AXIS blocks along each axis
+#define MORTON_BITS_PER_AXIS 7
+#define MORTON_KEY_COUNT (1 << (3 * MORTON_BITS_PER_AXIS))
+
+// Upper bound on the number of sim chunks, sizes the chunk handle table in
+// SimUniforms
+#define MAX_SIM_CHUNKS 128
+
 namespace AltheaEngine {
 class Application;
 } // namespace AltheaEngine
 
 namespace AltheaDemo {
+class ComputePassTimer;
+
 namespace ParticleSystem {
 
 struct LiveValues {
@@ -47,11 +73,47 @@ struct LiveValues {
   bool checkbox2;
 };
 
+// Constants of the position-based fluids density constraint, precomputed once
+// so the shaders don't evaluate the kernel normalisations per pair. See
+// computePbfParams in PbfSolverCpu.h. Mirrors PbfParams in SimResources.glsl.
+struct PbfParams {
+  // The smoothing kernel radius h
+  float kernelRadius;
+  // Poly6 kernel W(d) = poly6Scale * (h^2 - d^2)^3
+  float poly6Scale;
+  // Spiky kernel gradient spikyGradScale * (h - |r|)^2 * r / |r|
+  float spikyGradScale;
+  float restDensity;
+
+  // Constraint relaxation epsilon, bounds the multipliers of particles with
+  // few neighbours
+  float relaxation;
+  // Artificial pressure -tensileStrength * (W(d) * tensileInvKernel)^4
+  float tensileStrength;
+  float tensileInvKernel;
+  uint32_t padding;
+};
+
+// Tunables of the sim passes, compiled in as the defines in
+// SimSpecialization.glsl. Variants only re-create the pipelines, not the sim
+// resources.
+struct SimSpecialization {
+  // Workgroup size of every sim pass
+  uint32_t localSizeX;
+  // Neighbour tasks each thread of the Jacobi step holds in shared memory
+  uint32_t tasksPerThread;
+  float cameraRadius;
+};
+
 struct PushConstants {
   uint32_t globalResourcesHandle;
   uint32_t globalUniformsHandle;
   uint32_t simUniformsHandle;
   uint32_t iteration;
+  uint32_t hashEpoch;
+  // Index of the sim step within the frame, only the first one applies the
+  // frame's emission and reset
+  uint32_t simStep;
 };
 
 struct Particle {
@@ -75,11 +137,16 @@ struct SimUniforms {
   // Uniform grid params
   glm::mat4 gridToWorld;
   glm::mat4 worldToGrid;
+  // The previous frame's camera, the one its depth was rendered with
+  glm::mat4 hiZViewProjection;
 
   glm::vec3 interactionLocation;
-  uint32_t padding;
+  // How far the rendered particles trail the latest sim step, as a fraction
+  // of a sim step
+  float renderDelay;
 
-  uint32_t particleCount;
+  // Particles the allocated chunks fit, emission is clamped to it on the GPU
+  uint32_t particleCapacity;
   uint32_t particlesPerBuffer;
   uint32_t spatialHashSize;
   uint32_t spatialHashEntriesPerBuffer;
@@ -94,18 +161,275 @@ struct SimUniforms {
   uint32_t particleBucketsPerBuffer;
   uint32_t freeListsCount;
 
-  uint32_t particlesHeap;
-  uint32_t spatialHashHeap;
-  uint32_t bucketHeap;
   uint32_t nextFreeBucket;
+  uint32_t particleEntriesPerBuffer;
+  uint32_t scanBlockSums;
+  uint32_t chunkCount;
+
+  uint32_t mortonKeyCounts;
+  uint32_t padding0;
+  float neighborSkinRadius;
+  uint32_t hashTelemetry;
+
+  uint32_t simCounters;
+  // Starts the particle count over from addedParticles
+  uint32_t resetParticles;
+  uint32_t particleIndexCount;
+  // Seed the emitted particles are respawned from
+  uint32_t spawnSeed;
+
+  // Particles outside these are removed by the next compaction
+  glm::vec3 killBoundsMin;
+  // Particles the solver moves slower than sleepSpeed fall asleep once their
+  // cell hasn't seen motion for sleepSubsteps substeps
+  float sleepSpeed;
+  glm::vec3 killBoundsMax;
+  uint32_t sleepSubsteps;
+
+  PbfParams pbf;
+
+  // GBuffer resolution, only set when rendering
+  uint32_t screenWidth;
+  uint32_t screenHeight;
+  // Max depth pyramid of the previous frame, see HI_Z_HEAP in
+  // SimResources.glsl
+  uint32_t hiZ;
+  // Which of the GBuffer's two depth images the previous frame wrote
+  uint32_t hiZDepthIndex;
+
+  uint32_t hiZLevelCount;
+  // Only draw the particles that pass the frustum test, and the Hi-Z test
+  // too if cullOcclusion is set
+  uint32_t cullParticles;
+  uint32_t cullOcclusion;
+  // Splatted and smoothed particle depth, see FluidSurface.glsl
+  uint32_t fluidDepth;
+
+  // World-space radius the fluid depth is smoothed over, and how far apart
+  // in depth samples can be to still be smoothed together
+  float fluidSmoothingRadius;
+  float fluidDepthRange;
+  // Set while the fluid surface is drawn, the impostors then only draw the
+  // particles too close to the camera for the fluid splat
+  uint32_t fluidSurface;
+  uint32_t padding;
+
+  // First heap handle of each sim chunk, packed into uvec4s on the GLSL side
+  uint32_t chunkHandles[MAX_SIM_CHUNKS];
 
   LiveValues liveValues;
 };
 
+// Live particle count and the indirect arguments sized by it, written on the
+// GPU at the start of every frame. Mirrors SIM_COUNTERS in SimResources.glsl.
+struct SimCounters {
+  VkDispatchIndirectCommand particleDispatch;
+  uint32_t particleCount;
+  VkDrawIndexedIndirectCommand particleDraw;
+  VkDrawIndirectCommand particleImpostorDraw;
+  uint32_t addedParticles;
+  // Summed over the step's substeps
+  uint32_t sleepingParticles;
+};
+
+// Bucket build telemetry, summed over a frame's substeps by the bucket alloc
+// and insert passes. Mirrors HASH_TELEMETRY_STATS in SimResources.glsl.
+struct HashTelemetry {
+  uint32_t occupiedSlots;
+  // Slots more than one distinct cell was inserted into, and the particles
+  // inserted after the slot's first cell
+  uint32_t collidingSlots;
+  uint32_t collidedParticles;
+  // Slots with more than PARTICLES_PER_BUCKET particles, and the particles
+  // that didn't fit in the bucket
+  uint32_t overfullSlots;
+  uint32_t overflowedParticles;
+  // Max over the frame, not summed
+  uint32_t maxSlotParticles;
+  uint32_t padding[2];
+  uint32_t freeListAllocs[BUCKET_FREE_LIST_COUNT];
+};
+
+// CPU-side counters shown in the UI
+struct SimStats {
+  // Spatial hash clear writes avoided by tagging slots with an epoch instead,
+  // 0 with the prefix-sum build
+  uint64_t hashClearBytesPerSubstep;
+  uint64_t hashClearBytesSaved;
+
+  uint32_t chunkCount;
+  uint64_t chunkBytes;
+
+  // Only with hash telemetry enabled, from the latest frame read back. 0
+  // substeps until the first readback is delivered.
+  HashTelemetry hashTelemetry;
+  uint32_t hashTelemetrySubsteps;
+  // Allocations from the busiest free list over the mean, 1 is perfectly even
+  float freeListSkew;
+
+  // Vertices the GBuffer pass processes for the particles each frame, at the
+  // emitted particle count
+  uint64_t particleVertices;
+
+  // Only with culling enabled, from the latest frame read back. Particles
+  // drawn over the live particles, 1 until the first readback is delivered.
+  float visibleFraction;
+
+  // Only with sleeping enabled, from the latest step read back. Particle
+  // substeps asleep over all particle substeps, 0 until the first readback is
+  // delivered.
+  float sleepingFraction;
+  // The same counts summed over every step read back so far
+  uint64_t sleepingParticleSubsteps;
+  uint64_t particleSubsteps;
+};
+
+// Per-particle sim storage for one chunk of particles. The sim heaps grow a
+// chunk at a time as particles are emitted and shrink back on reset. A
+// chunk's buffers take consecutive heap handles, in declaration order, so the
+// shaders find all of them from the first handle (see the CHUNK_*_OFFSET
+// defines in SimResources.glsl). Released chunks' handles are reused by the
+// next chunks grown.
+struct SimChunk {
+  // PARTICLE_LAYOUT_AOS
+  StructuredBuffer<Particle> particles;
+  // PARTICLE_LAYOUT_SOA
+  StructuredBuffer<glm::vec4> positions;
+  StructuredBuffer<glm::vec4> prevPositions;
+  StructuredBuffer<uint32_t> globalIndices;
+  StructuredBuffer<uint32_t> debug;
+  // The solved position each particle started the current step from, for
+  // interpolating the rendered particles. Its own stream with either layout.
+  StructuredBuffer<glm::vec4> stepPositions;
+
+  StructuredBuffer<uint32_t> spatialHash;
+
+  // SPATIAL_HASH_BUILD_BUCKETS
+  StructuredBuffer<uint32_t> spatialHashEpochs;
+  StructuredBuffer<ParticleBucket> buckets;
+  // Only with hash telemetry enabled
+  StructuredBuffer<glm::uvec2> slotTelemetry;
+
+  // SPATIAL_HASH_BUILD_PREFIX_SUM
+  StructuredBuffer<uint32_t> cellStart;
+  StructuredBuffer<ParticleEntry> particleEntries;
+
+  // Only with culling enabled, the particle draws' instances
+  StructuredBuffer<uint32_t> visibleParticles;
+
+  // Only with neighbour lists enabled
+  StructuredBuffer<uint32_t> neighborLists;
+
+  // Only with sleeping enabled, one per spatial hash slot
+  StructuredBuffer<uint32_t> cellMotionEpochs;
+
+  // Only with the density constraint enabled, one per particle entry
+  StructuredBuffer<float> entryLambdas;
+
+  // Only with the Morton reorder or compaction enabled
+  StructuredBuffer<Particle> reorderScratch;
+
+  // Only with compaction enabled
+  StructuredBuffer<uint32_t> liveOffsets;
+
+  uint32_t firstHandle;
+};
+
 #define SIM_PASS 0
 #define BUCKET_ALLOC_PASS 1
 #define BUCKET_INSERT_PASS 2
 #define JACOBI_STEP_PASS 3
+#define CELL_SCAN_BLOCKS_PASS 4
+#define CELL_SCAN_BLOCK_SUMS_PASS 5
+#define CELL_SCAN_APPLY_PASS 6
+#define MORTON_KEYS_PASS 7
+#define MORTON_SCATTER_PASS 8
+#define MORTON_COPY_BACK_PASS 9
+#define NEIGHBOR_LIST_PASS 10
+#define GAUSS_SEIDEL_STEP_PASS 11
+#define SIM_COUNTERS_PASS 12
+#define COMPACT_FLAGS_PASS 13
+#define LIVE_SCAN_BLOCKS_PASS 14
+#define LIVE_SCAN_BLOCK_SUMS_PASS 15
+#define LIVE_SCAN_APPLY_PASS 16
+#define COMPACT_SCATTER_PASS 17
+#define COMPACT_COPY_BACK_PASS 18
+#define SIM_COUNTERS_COMPACTED_PASS 19
+#define PBF_LAMBDA_PASS 20
+#define HI_Z_PASS 21
+#define CULL_RESET_PASS 22
+#define CULL_PASS 23
+#define FLUID_CLEAR_PASS 24
+#define FLUID_SPLAT_PASS 25
+#define FLUID_SMOOTH_PASS 26
+
+// Sim buffers tracked by the barrier batcher, each covers that buffer in
+// every chunk
+#define SIM_RESOURCE_PARTICLES 0
+// Spatial hash slots, plus the epochs, cell starts and slot telemetry
+#define SIM_RESOURCE_HASH 1
+// Particle buckets or the packed particle entries
+#define SIM_RESOURCE_ENTRIES 2
+#define SIM_RESOURCE_FREE_LISTS 3
+#define SIM_RESOURCE_SCAN_BLOCK_SUMS 4
+// Morton key counts
+#define SIM_RESOURCE_MORTON_KEYS 5
+#define SIM_RESOURCE_REORDER_SCRATCH 6
+#define SIM_RESOURCE_NEIGHBOR_LISTS 7
+#define SIM_RESOURCE_HASH_TELEMETRY 8
+#define SIM_RESOURCE_COUNTERS 9
+#define SIM_RESOURCE_LIVE_OFFSETS 10
+#define SIM_RESOURCE_ENTRY_LAMBDAS 11
+// The max depth pyramid, not per chunk
+#define SIM_RESOURCE_HI_Z 12
+#define SIM_RESOURCE_VISIBLE_PARTICLES 13
+// The screen-space fluid depth targets, not per chunk
+#define SIM_RESOURCE_FLUID_DEPTH 14
+// The epoch each cell last saw motion at, read by the sleeping test
+#define SIM_RESOURCE_CELL_MOTION 15
+#define SIM_RESOURCE_COUNT 16
+
+// Spatial hash build modes
+// - Buckets: Every occupied slot is handed a fixed-size ParticleBucket from
+//   the sharded free lists, cells with more than PARTICLES_PER_BUCKET
+//   particles overflow
+// - Prefix sum: Count particles per slot, scan the counts and scatter the
+//   particle entries into one densely packed array, any occupancy works and
+//   memory scales with the particle count
+#define SPATIAL_HASH_BUILD_BUCKETS 0
+#define SPATIAL_HASH_BUILD_PREFIX_SUM 1
+
+// Particle storage layouts
+// - AoS: One interleaved Particle struct per particle, every access pulls in
+//   the whole 32 bytes
+// - SoA: position, prevPosition, globalIndex and debug color each live in
+//   their own heap, passes only fetch the fields they touch
+#define PARTICLE_LAYOUT_AOS 0
+#define PARTICLE_LAYOUT_SOA 1
+
+// Constraint solvers
+// - Jacobi: Every iteration updates all particles at once from the previous
+//   iterate, ping-ponging between the two positions of each bucket entry
+// - Gauss-Seidel: Every iteration sweeps the 8 cell colours one after
+//   another, updating the particles of each colour in place so later sweeps
+//   see the earlier ones' corrections
+#define PARTICLE_SOLVER_JACOBI 0
+#define PARTICLE_SOLVER_GAUSS_SEIDEL 1
+
+// Particle rendering, switchable at runtime from the UI
+// - Mesh: An instance of a subdivided sphere mesh per particle
+// - Impostors: One camera-facing quad per particle, the fragment shader
+//   ray-casts the sphere and writes its depth
+// - Fluid: The particles' depth is splatted into a screen-sized buffer and
+//   smoothed into one continuous surface, which a full-screen subpass writes
+//   into the GBuffer. Past the splat, the cost scales with the resolution.
+#define PARTICLE_RENDER_MESH 0
+#define PARTICLE_RENDER_IMPOSTORS 1
+#define PARTICLE_RENDER_FLUID 2
+
+// Cells are coloured by the parity of their coordinates, same as
+// computeCellColor in SimResources.glsl
+#define CELL_COLOR_COUNT 8
 
 class ParticleSystem : public IGameInstance {
 public:
@@ -125,30 +449,215 @@ public:
       const FrameContext& frame) override;
 
 private:
+  // Drives the sim without the render passes
+  friend class HeadlessSimBenchmark;
+
   bool m_adjustingExposure = false;
 
   std::unique_ptr<CameraController> m_pCameraController;
 
   void _resetParticles(Application& app, VkCommandBuffer commandBuffer);
+  void _seedParticles(
+      Application& app,
+      VkCommandBuffer commandBuffer,
+      uint32_t chunkIdx);
+  uint32_t m_seed = 0;
 
+  // Resources that live as long as the game, created in initGame. Window
+  // resizes keep these, along with the sim state.
   void _createGlobalResources(
       Application& app,
       SingleTimeCommandBuffer& commandBuffer);
   GlobalHeap m_heap;
-  GlobalResources m_globalResources;
   GlobalUniformsResource m_globalUniforms;
 
+  // Everything sized to the swapchain, re-created in createRenderState. The
+  // GBuffer lives in the global resources, so those are re-created too.
+  void _createScreenResources(
+      Application& app,
+      SingleTimeCommandBuffer& commandBuffer);
+  GlobalResources m_globalResources;
+
   void
   _createSimResources(Application& app, SingleTimeCommandBuffer& commandBuffer);
   std::vector<ComputePipeline> m_computePasses;
 
+  // (Re-)creates the sim pipelines from m_simShaderDefs and
+  // m_simSpecialization. The sim resources need to exist already and the
+  // previous pipelines can't be in use.
+  void _createSimPasses(Application& app);
+  ShaderDefines m_simShaderDefs;
+  SimSpecialization m_simSpecialization{};
+
+  // Fills in the sim uniforms and push constants for this frame's substeps,
+  // emits particles while the right mouse button is held
+  void _updateSimUniforms(
+      Application& app,
+      const FrameContext& frame,
+      uint32_t inputMask);
   TransientUniforms<SimUniforms> m_simUniforms;
-  PushConstants m_push;
+  // CPU copy of the latest uniforms, for checking downloads against
+  SimUniforms m_lastSimUniforms{};
+  PushConstants m_push{};
+
+  // Fixed timestep accumulator. Frame time is banked and spent in whole sim
+  // steps, the remainder sets how far to interpolate the rendered particles.
+  void _advanceSimClock(float frameTime);
+  float m_simTimeAccumulator = 0.0f;
+  // Sim steps the next draw records. The headless benchmark never advances
+  // the clock and steps once per frame.
+  uint32_t m_pendingSimSteps = 1;
+  float m_renderAlpha = 1.0f;
+
+  // Records the reorder and all substeps of one sim step
+  void _stepSim(VkCommandBuffer commandBuffer);
+  uint32_t _getSubstepsPerFrame() const;
+  float _getSimStepTime() const;
+
+  // Creates only what the sim passes need and spawns particleCount particles,
+  // for running the sim without a swapchain or any render passes
+  void _createHeadlessResources(
+      Application& app,
+      SingleTimeCommandBuffer& commandBuffer,
+      uint32_t particleCount);
+
+  // Grows or shrinks the sim chunks to fit particleCount particles
+  void _resizeSimChunks(
+      Application& app,
+      VkCommandBuffer commandBuffer,
+      uint32_t particleCount);
+  void _addSimChunk(Application& app, VkCommandBuffer commandBuffer);
+  std::vector<SimChunk> m_chunks;
+  // First handle of each released chunk's handle range
+  std::vector<uint32_t> m_freeChunkHandles;
+  // Runtime cap on the particle count, chunks are never grown past it
+  uint32_t m_particleBudget;
 
-  StructuredBufferHeap<Particle> m_particleBuffer;
-  StructuredBufferHeap<uint32_t> m_spatialHash;
+  uint32_t m_particleLayout;
+
+  // Live particle count and indirect arguments, the CPU only ever requests
+  // particles and never reads the count back
+  StructuredBuffer<SimCounters> m_simCounters;
+
+  // Bucket build resources
   StructuredBuffer<uint32_t> m_freeBucketCounter;
-  StructuredBufferHeap<ParticleBucket> m_buckets;
+
+  void _advanceHashEpoch(VkCommandBuffer commandBuffer);
+  uint32_t m_hashEpoch = 0;
+
+  // Occupancy, collision, overflow and free list counters from the bucket
+  // build, read back at the end of every frame
+  void _copyOutHashTelemetry(VkCommandBuffer commandBuffer);
+  // Picks up the latest telemetry the readback worker delivered
+  void _collectHashTelemetry();
+  bool m_useHashTelemetry;
+  StructuredBuffer<HashTelemetry> m_hashTelemetry;
+  std::mutex m_hashTelemetryMutex;
+  HashTelemetry m_deliveredHashTelemetry{};
+  bool m_hashTelemetryDelivered = false;
+
+  // Reads back the particles and spatial hash after this frame's substeps and
+  // runs SpatialHashUnitTests on them once they land
+  void _readBackForUnitTests(VkCommandBuffer commandBuffer);
+  std::unique_ptr<AsyncReadback> m_pReadback;
+  bool m_flagUnitTests = false;
+
+  // Prefix-sum build resources
+  StructuredBuffer<uint32_t> m_scanBlockSums;
+
+  uint32_t m_hashBuildMode;
+
+  // Scans the counts read by the blocksPassIdx CellScan variant into the end
+  // of each range, the two passes after it finish the scan
+  void _dispatchScan(
+      VkCommandBuffer commandBuffer,
+      uint32_t blocksPassIdx,
+      uint32_t slotCount);
+
+  // Morton reorder resources, the key counts are scanned with m_primitives
+  StructuredBuffer<uint32_t> m_mortonKeyCounts;
+  GpuPrimitives m_primitives;
+
+  void _reorderParticles(VkCommandBuffer commandBuffer);
+  // Sim steps between reorders, 0 disables the reorder
+  uint32_t m_reorderInterval;
+  uint32_t m_stepsSinceReorder = 0;
+  uint32_t m_addedParticles = 0;
+
+  // Removes the particles that left the kill bounds and packs the rest to the
+  // front of the particle range, then runs the frame's counters pass. With
+  // the unit tests flagged, the particles are read back around it and checked
+  // against the CPU reference.
+  void _compactParticles(VkCommandBuffer commandBuffer);
+  // Sim steps between compactions, 0 disables particle death
+  uint32_t m_compactionInterval;
+  uint32_t m_stepsSinceCompaction = 0;
+
+  // Reads back the counters and the live particles, returns false if the
+  // readbacks are backed up
+  bool _readBackParticles(
+      VkCommandBuffer commandBuffer,
+      std::function<void(const SimCounters&, std::vector<Particle>&&)>&&
+          callback);
+
+  // Build per-particle neighbour lists once per substep for the Jacobi
+  // iterations to read, instead of walking the spatial hash every iteration
+  bool m_useNeighborLists;
+
+  // Put particles to sleep in cells that stopped moving, the sleeping ones
+  // skip integration and their solver contacts
+  bool m_useSleeping;
+  // Reads back the sleeping particle count at the end of every sim step
+  void _copyOutSleepStats(VkCommandBuffer commandBuffer);
+  // Picks up the latest count the readback worker delivered
+  void _collectSleepStats();
+  std::mutex m_sleepStatsMutex;
+  SimCounters m_deliveredSleepCounters{};
+  uint64_t m_deliveredSleepingParticleSubsteps = 0;
+  uint64_t m_deliveredParticleSubsteps = 0;
+  bool m_sleepStatsDelivered = false;
+
+  uint32_t m_solverMode;
+
+  // Solve the position-based fluids density constraint in the Jacobi
+  // iterations, instead of only pushing overlapping spheres apart
+  bool m_usePbfDensity;
+  PbfParams m_pbfParams{};
+
+  SimStats m_stats{};
+
+  uint32_t m_particleRenderMode;
+  // The GBuffer resolution, zero when running headless
+  VkExtent2D m_screenExtent{};
+
+  // Splats the particles' depth and smooths it for the fluid surface subpass
+  void _renderFluidDepth(VkCommandBuffer commandBuffer);
+  StructuredBuffer<uint32_t> m_fluidDepth;
+  // The screen-sized buffers' heap handles are registered once with the heap
+  // and pointed at each swapchain's buffers
+  BufferHandle m_fluidDepthHandle{};
+
+  // Frustum and occlusion culls the particle instances before the GBuffer
+  // pass, so the draws only cover the visible particles. Occlusion is tested
+  // against a max depth pyramid of the previous frame's depth.
+  void _cullParticles(VkCommandBuffer commandBuffer);
+  bool m_useParticleCulling;
+  // Every level of the pyramid packed into one buffer, see HI_Z_HEAP in
+  // SimResources.glsl. Sized for the swapchain.
+  StructuredBuffer<float> m_hiZ;
+  BufferHandle m_hiZHandle{};
+  uint32_t m_hiZLevelCount = 0;
+  // The camera the previous frame's depth was rendered with, only valid once
+  // a frame has been drawn since the render state was created
+  glm::mat4 m_prevViewProjection{1.0f};
+  bool m_hasPrevDepth = false;
+  // Reads back the drawn particle count after every cull
+  void _copyOutCullStats(VkCommandBuffer commandBuffer);
+  // Picks up the latest count the readback worker delivered
+  void _collectCullStats();
+  std::mutex m_cullStatsMutex;
+  SimCounters m_deliveredCullCounters{};
+  bool m_cullStatsDelivered = false;
 
   struct SphereMesh {
     VertexBuffer<glm::vec3> vertices;
@@ -174,8 +683,16 @@ private:
       const FrameContext& frame);
 
   void _dispatchComputePass(VkCommandBuffer commandBuffer, uint32_t passIdx, uint32_t groupCount);
-  void _readAfterWriteBarrier(VkCommandBuffer commandBuffer);
-  void _writeAfterReadBarrier(VkCommandBuffer commandBuffer);
+  // Dispatches one thread per live particle, with the group count the
+  // counters pass wrote
+  void _dispatchParticlePass(VkCommandBuffer commandBuffer, uint32_t passIdx);
+  void _bindComputePass(VkCommandBuffer commandBuffer, uint32_t passIdx);
+  // Times every dispatch while set
+  ComputePassTimer* m_pPassTimer = nullptr;
+  // Declares the sim buffers a pass reads and writes, so the dispatch only
+  // waits on the passes it depends on
+  void _declarePassAccesses(uint32_t passIdx);
+  BarrierBatcher m_barriers;
 
   uint32_t m_writeIndex = 0;
 
@@ -183,6 +700,8 @@ private:
   float m_exposure = 0.3f;
 
   bool m_flagReset = false;
+  // Particles requested so far, sizes the chunks. The GPU holds the actual
+  // count, which never exceeds this.
   uint32_t m_activeParticleCount = 100000; // 0;
 };
 } // namespace ParticleSystem
@@ -32,6 +32,8 @@
 #include <Althea/Common/GlobalIllumination.h>
 #include <glm/glm.hpp>
 
+#include "BarrierBatcher.h"
+
 #include <vector>
 
 using namespace AltheaEngine;
@@ -68,15 +70,30 @@ private:
   void createModels(Application& app, SingleTimeCommandBuffer& commandBuffer);
   std::vector<Model> m_models;
 
+  // The scene, lights and acceleration structure, created once in initGame
+  // and kept across swapchain re-creation
   void createGlobalResources(
       Application& app,
       SingleTimeCommandBuffer& commandBuffer);
   GlobalHeap m_heap;
-  GlobalResources m_globalResources;
   GlobalUniformsResource m_globalUniforms;
   PointLightCollection m_pointLights;
   AccelerationStructure m_accelerationStructure;
 
+  // The reservoirs and RT target, re-created with the swapchain, and the
+  // GBuffer, re-created only when the extent changes
+  void createScreenResources(
+      Application& app,
+      SingleTimeCommandBuffer& commandBuffer);
+  GlobalResources m_globalResources;
+  // The extent the GBuffer in m_globalResources was created at
+  VkExtent2D m_globalResourcesExtent{};
+
+  // The shader indexes the reservoir buffers from the first handle, so their
+  // handles are registered as one contiguous range
+  void registerReservoirHandles(uint32_t bufferCount);
+  std::vector<BufferHandle> m_reservoirHandles;
+
   void createGBufferPass(Application& app, SingleTimeCommandBuffer& commandBuffer);
   RenderPass m_gBufferPass;
   FrameBuffer m_gBufferFrameBufferA;
@@ -86,9 +103,11 @@ private:
   RayTracingPipeline m_directSamplingPass;
   RayTracingPipeline m_spatialResamplingPass;
 
-  void reservoirBarrier(VkCommandBuffer commandBuffer);
+  // The whole reservoir heap is tracked as one resource
+  BarrierBatcher m_reservoirBarriers;
 
-   // ping-pong buffers
+   // ping-pong buffers, the handles are registered once and outlive the
+   // target
   struct RtTarget {
     ImageResource target{};
     ImageHandle targetImageHandle{};
@@ -99,6 +118,7 @@ private:
   TransientUniforms<GlobalIllumination::Uniforms> m_giUniforms;
   std::vector<StructuredBuffer<GlobalIllumination::Reservoir>> m_reservoirHeap;
 
+  void createDisplayPass(Application& app);
   RenderPass m_displayPass;
   SwapChainFrameBufferCollection m_displayPassSwapChainFrameBuffers;
 
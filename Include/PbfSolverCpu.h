@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "SpatialHashCpu.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// Precomputes the density constraint's kernel normalisations for kernel
+// radius kernelRadius. The rest density is the kernel sum of a particle in a
+// cubic lattice restSpacing apart, so a fluid at rest settles at that spacing.
+// The artificial pressure reaches tensileStrength for particles
+// tensileDistance apart.
+PbfParams computePbfParams(
+    float kernelRadius,
+    float restSpacing,
+    float relaxation,
+    float tensileStrength,
+    float tensileDistance);
+
+// CPU reference of the position-based fluids Jacobi iteration,
+// Shaders/ParticleSystem/PbfLambda.comp.glsl followed by the PBF_DENSITY
+// update of ProjectedJacobiStep.comp.glsl. Walks the same 8 cells with the
+// same kernels and constants. Walls are left out like in ContactSolverCpu,
+// so iterations only see the density constraint.
+class PbfSolverCpu {
+public:
+  // Copies the inserted positions and cell ranges out of the spatial hash
+  void init(
+      const SpatialHashCpu& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<uint32_t>& globalIndices,
+      const PbfParams& params);
+  void init(
+      const SortedSpatialHashCpu& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<uint32_t>& globalIndices,
+      const PbfParams& params);
+
+  // Computes every particle's lambda, then moves every particle by the
+  // lambdas around it, both from the previous iterate
+  void jacobiIteration();
+
+  // Mean density over the rest density past 1, over all particles. Only
+  // compression is corrected, so this is what the iterations drive to 0.
+  double computeCompression() const;
+
+  glm::vec3 getPosition(uint32_t globalParticleIdx) const {
+    return m_positions[globalParticleIdx];
+  }
+
+private:
+  template <typename TSpatialHash>
+  void _init(
+      const TSpatialHash& spatialHash,
+      const glm::mat4& worldToGrid,
+      const std::vector<uint32_t>& globalIndices,
+      const PbfParams& params);
+
+  // Walks the 8 cells around the particle, calls fn with the bucket-entry
+  // index of every other particle in them
+  template <typename TFunc>
+  void _forEachNeighbor(
+      uint32_t globalParticleIdx,
+      const glm::vec3& particlePos,
+      TFunc&& fn) const;
+
+  // Calls fn with the bucket-entry index of every particle, spread across
+  // the workers by slot
+  template <typename TFunc> void _forEachParticle(TFunc&& fn) const;
+
+  float _computeDensity(uint32_t globalParticleIdx) const;
+
+  glm::mat4 m_worldToGrid;
+  PbfParams m_params{};
+
+  // Range of bucket entries of each spatial hash slot
+  std::vector<uint32_t> m_rangeStarts;
+  std::vector<uint32_t> m_rangeEnds;
+
+  // Indexed by bucket entry, only entries within a range are used
+  std::vector<glm::vec3> m_positions;
+  std::vector<glm::vec3> m_prevIterate;
+  std::vector<float> m_lambdas;
+};
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+
+// CPU references of the GpuPrimitives, multithreaded with parallelFor. The
+// hot loops run over contiguous arrays with independent lanes, so they
+// auto-vectorize without needing fast-math or intrinsics.
+
+// In-place exclusive prefix sum, same result as GpuPrimitives::exclusiveScan
+void exclusiveScanCpu(std::vector<uint32_t>& values);
+
+// Stable in-place LSD radix sort by the low keyBits bits of the keys. A stable
+// sort has a single result, so this matches GpuPrimitives::sortKeyValues
+// exactly even though it uses wider digits.
+void sortKeyValuesCpu(
+    std::vector<uint32_t>& keys,
+    std::vector<uint32_t>& values,
+    uint32_t keyBits = 32);
+
+// sums[i] is the sum of values[segmentOffsets[i], segmentOffsets[i + 1]).
+// Floats are summed in a different order than on the GPU, so results only
+// match up to rounding.
+void segmentedReduceCpu(
+    const std::vector<float>& values,
+    const std::vector<uint32_t>& segmentOffsets,
+    std::vector<float>& sums);
+
+} // namespace AltheaDemo
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "ParticleSystem.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+// Same hash as Shaders/ParticleSystem/Hash.glsl, including the GLSL integer
+// wrap-around and abs() behavior.
+uint32_t hashCoords(int32_t x, int32_t y, int32_t z);
+
+// The grid cell a world-space position falls into, same as the sim pass.
+glm::ivec3 computeGridCell(const glm::mat4& worldToGrid, const glm::vec3& pos);
+
+// Cells are one particle diameter wide, so every particle a particle can touch
+// lies in the 2x2x2 block of cells around the cell corner nearest to it. Same
+// as computeNeighborhoodBaseCell in SimResources.glsl, returns the min corner
+// cell of that block.
+glm::ivec3
+computeNeighborhoodBaseCell(const glm::mat4& worldToGrid, const glm::vec3& pos);
+
+// How the particles spread over the spatial hash slots, independent of the
+// build mode
+struct SpatialHashStats {
+  uint32_t occupiedSlots;
+  // Slots holding particles from more than one grid cell
+  uint32_t collidingSlots;
+  uint32_t maxSlotParticles;
+  // Slots with more than PARTICLES_PER_BUCKET particles, these overflow their
+  // bucket in the bucket build
+  uint32_t overfullSlots;
+};
+
+// Hashes each particle's cell the same way the sim pass does
+SpatialHashStats computeSpatialHashStats(
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    uint32_t spatialHashSize);
+
+// CPU mirror of the bucket-based spatial hash build in
+// Shaders/ParticleSystem/SimResources.glsl. Each of the three GPU passes
+// (incrementCellParticleCount, allocateBucketForCell, hashInsertPosition) has
+// a per-element equivalent here that uses the same slot encoding, the same
+// sharded free lists and the same 16-entry ParticleBucket layout. Like the
+// GPU, slots are tagged with the epoch of the build that last touched them
+// instead of being cleared, slots from an older epoch read as empty. The batch
+// versions spread the work across all cores, so the CPU build can both
+// validate GPU downloads and serve as a throughput baseline.
+class SpatialHashCpu {
+public:
+  SpatialHashCpu() = default;
+  SpatialHashCpu(
+      uint32_t spatialHashSize,
+      uint32_t particleBucketCount,
+      uint32_t freeListsCount);
+
+  // Runs all three stages. Cells are computed from cellPositions, the
+  // inserted bucket entries come from insertPositions (the sim pass hashes
+  // the pre-integration position but inserts the integrated one). The
+  // resulting global bucket-entry index of each particle is written to
+  // globalIndices.
+  void build(
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& cellPositions,
+      const std::vector<glm::vec3>& insertPositions,
+      std::vector<uint32_t>& globalIndices);
+
+  // Starts a new build by advancing the epoch, every slot reads as empty
+  // afterwards without being touched.
+  void clear();
+
+  // Stage 1: writes the slot index of each particle's cell to slotIndices.
+  void countParticles(
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& positions,
+      std::vector<uint32_t>& slotIndices);
+  // Stage 2
+  void allocateBuckets();
+  // Stage 3: slotIndices in, global bucket-entry indices out.
+  void insertParticles(
+      const std::vector<glm::vec3>& positions,
+      const std::vector<uint32_t>& slotIndices,
+      std::vector<uint32_t>& globalIndices);
+
+  uint32_t incrementCellParticleCount(int32_t i, int32_t j, int32_t k);
+  void allocateBucketForCell(uint32_t slotIdx);
+  uint32_t hashInsertPosition(uint32_t slotIdx, const glm::vec3& position);
+
+  // Returns INVALID_INDEX for slots that were not touched by the current build
+  uint32_t getSlot(uint32_t slotIdx) const;
+
+  // Same as getCellRange in SimResources.glsl, empty for untouched slots
+  void
+  getCellRange(uint32_t slotIdx, uint32_t& rangeStart, uint32_t& rangeEnd)
+      const;
+
+  uint32_t getEpoch() const { return m_epoch; }
+
+  uint32_t getSpatialHashSize() const {
+    return static_cast<uint32_t>(m_spatialHash.size());
+  }
+
+  const ParticleBucket& getBucket(uint32_t bucketIdx) const {
+    return m_buckets[bucketIdx];
+  }
+
+  glm::vec3 getPosition(uint32_t globalParticleIdx) const;
+
+  void copySpatialHash(std::vector<uint32_t>& spatialHash) const;
+
+private:
+  std::vector<std::atomic<uint32_t>> m_spatialHash;
+  std::vector<std::atomic<uint32_t>> m_epochs;
+  uint32_t m_epoch = 0;
+  std::vector<std::atomic<uint32_t>> m_freeLists;
+  std::vector<ParticleBucket> m_buckets;
+};
+
+// CPU mirror of the prefix-sum spatial hash build
+// (SPATIAL_HASH_BUILD_PREFIX_SUM). Particles are counted per slot, the counts
+// are scanned into the end of each cell's range and the particle entries are
+// scattered back to front into one densely packed array, leaving the cell
+// start array holding the start of each range. The resulting cell starts are
+// deterministic and can be compared exactly against a GPU download, only the
+// order of particles within a cell may differ.
+class SortedSpatialHashCpu {
+public:
+  SortedSpatialHashCpu() = default;
+  SortedSpatialHashCpu(uint32_t spatialHashSize, uint32_t particleCapacity);
+
+  void build(
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& cellPositions,
+      const std::vector<glm::vec3>& insertPositions,
+      std::vector<uint32_t>& globalIndices);
+
+  // Zeroes the per-cell counts. Only needed up front, the scan zeroes the
+  // counts as it consumes them, same as CellScan.comp.glsl.
+  void clear();
+
+  // Stage 1: writes the slot index of each particle's cell to slotIndices.
+  void countParticles(
+      const glm::mat4& worldToGrid,
+      const std::vector<glm::vec3>& positions,
+      std::vector<uint32_t>& slotIndices);
+  // Stage 2: inclusive scan of the counts into the cell start array.
+  void scanCellCounts();
+  // Stage 3: slotIndices in, packed particle entry indices out.
+  void scatterParticles(
+      const std::vector<glm::vec3>& positions,
+      const std::vector<uint32_t>& slotIndices,
+      std::vector<uint32_t>& globalIndices);
+
+  // Only valid between the count and scan stages
+  uint32_t getCellCount(uint32_t slotIdx) const {
+    return m_cellCounts[slotIdx].load(std::memory_order_relaxed);
+  }
+
+  // Only valid after the scatter stage
+  void
+  getCellRange(uint32_t slotIdx, uint32_t& rangeStart, uint32_t& rangeEnd)
+      const {
+    rangeStart = m_cellStart[slotIdx].load(std::memory_order_relaxed);
+    rangeEnd = m_cellStart[slotIdx + 1].load(std::memory_order_relaxed);
+  }
+
+  uint32_t getSpatialHashSize() const {
+    return static_cast<uint32_t>(m_cellCounts.size());
+  }
+
+  glm::vec3 getPosition(uint32_t globalParticleIdx) const;
+
+  void copyCellStarts(std::vector<uint32_t>& cellStarts) const;
+
+private:
+  std::vector<std::atomic<uint32_t>> m_cellCounts;
+  // One extra slot at the end holds the end of the last range
+  std::vector<std::atomic<uint32_t>> m_cellStart;
+  std::vector<ParticleEntry> m_particleEntries;
+};
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -11,10 +11,29 @@ struct Particle;
 
 class SpatialHashUnitTests {
 public:
+  // Validates a download of the bucket build's spatial hash, hashEpoch is the
+  // epoch the build was tagged with. particles holds only the live particles.
   static void runTests(
       const SimUniforms& simUniforms,
+      uint32_t hashEpoch,
       const std::vector<Particle>& particles,
-      const std::vector<uint32_t>& spatialHash);
+      const std::vector<uint32_t>& spatialHash,
+      const std::vector<uint32_t>& spatialHashEpochs);
+
+  // Validates a download of the cell start heap from the prefix-sum build
+  static void runPrefixSumTests(
+      const SimUniforms& simUniforms,
+      const std::vector<Particle>& particles,
+      const std::vector<uint32_t>& cellStarts);
+
+  // Validates a compaction against the CPU reference, from downloads of the
+  // particles before and after it. liveParticleCount is the count the GPU
+  // ended up with, before any emission.
+  static void runCompactionTests(
+      const SimUniforms& simUniforms,
+      const std::vector<Particle>& particlesBefore,
+      const std::vector<Particle>& particlesAfter,
+      uint32_t liveParticleCount);
 };
 
 } // namespace ParticleSystem
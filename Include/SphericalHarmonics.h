@@ -25,6 +25,9 @@
 #include <Althea/TransientUniforms.h>
 #include <glm/glm.hpp>
 
+#include "BarrierBatcher.h"
+#include "GpuPrimitives.h"
+
 #include <vector>
 
 using namespace AltheaEngine;
@@ -52,6 +55,7 @@ struct LegendreUniforms {
   glm::vec2 samples[10]{};
   uint32_t sampleCount{};
   uint32_t coeffBuffer{};
+  uint32_t termsBuffer{};
 };
 
 class SphericalHarmonics : public IGameInstance {
@@ -82,6 +86,9 @@ private:
   IBLResources _ibl;
   StructuredBuffer<CoeffSet> _shCoeffs;
   StructuredBuffer<CoeffSet> _legendreCoeffs;
+  // Each coefficient's integration steps, summed into _legendreCoeffs
+  StructuredBuffer<float> _legendreTerms;
+  StructuredBuffer<uint32_t> _legendreSegments;
   TransientUniforms<SHUniforms> _shUniforms;
   TransientUniforms<LegendreUniforms> _legendreUniforms;
 
@@ -93,6 +100,10 @@ private:
 
   void _createComputePass(Application& app);
   ComputePipeline _fitLegendre;
+  GpuPrimitives _primitives;
+  // Tracks _legendreTerms and _legendreCoeffs between the fit, the reduction
+  // and the graph pass
+  BarrierBatcher _legendreBarriers;
   ComputePipeline _shPass;
 
   void _createRenderPass(Application& app);
@@ -1,7 +1,7 @@
 
 #version 450
 
-layout(local_size_x = LOCAL_SIZE_X) in;
+#include "SimSpecialization.glsl"
 
 #include "SimResources.glsl"
 
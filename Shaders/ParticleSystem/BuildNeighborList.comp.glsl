@@ -0,0 +1,60 @@
+
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+
+// Builds each particle's neighbour list once per substep, after the bucket
+// insert. The Jacobi iterations then read the listed entries directly instead
+// of re-hashing the 8 surrounding cells and walking their buckets on every
+// iteration. Candidates come from the same 8 cells and are kept when they are
+// within 2 * particleRadius + neighborSkinRadius, the skin covers how far
+// particles move over the iterations. Lists past NEIGHBOR_LIST_SIZE - 1
+// neighbours are cut off. Sleeping particles skip their contacts, their lists
+// are left empty.
+//
+// The pass is always created, it only does anything with neighbour lists
+// enabled.
+
+void main() {
+#ifdef NEIGHBOR_LISTS
+  uint particleIdx = uint(gl_GlobalInvocationID.x);
+  if (particleIdx >= simCounters.particleCount) {
+    return;
+  }
+
+  uint globalParticleIdx = getParticleGlobalIndex(particleIdx);
+  if (isEntryAsleep(globalParticleIdx)) {
+    getNeighborListEntry(particleIdx, 0) = 0;
+    return;
+  }
+
+  vec3 particlePos = getPosition(globalParticleIdx, 0);
+  ivec3 gridCell = computeNeighborhoodBaseCell(particlePos);
+
+  float searchRadius =
+      2.0 * simUniforms.particleRadius + simUniforms.neighborSkinRadius;
+  float searchRadiusSq = searchRadius * searchRadius;
+
+  uint neighborCount = 0;
+  for (int i = 0; i < 8; ++i) {
+    uint hash = hashCoords(gridCell.x + (i>>2), gridCell.y + ((i>>1)&1), gridCell.z + (i&1));
+    uint rangeStart, rangeEnd;
+    getCellRange(hash % simUniforms.spatialHashSize, rangeStart, rangeEnd);
+
+    for (uint otherParticleIdx = rangeStart; otherParticleIdx < rangeEnd; ++otherParticleIdx) {
+      if (otherParticleIdx == globalParticleIdx)
+        continue;
+
+      vec3 diff = getPosition(otherParticleIdx, 0) - particlePos;
+      if (dot(diff, diff) < searchRadiusSq && neighborCount < NEIGHBOR_LIST_SIZE - 1) {
+        ++neighborCount;
+        getNeighborListEntry(particleIdx, neighborCount) = otherParticleIdx;
+      }
+    }
+  }
+
+  getNeighborListEntry(particleIdx, 0) = neighborCount;
+#endif
+}
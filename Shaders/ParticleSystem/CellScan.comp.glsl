@@ -0,0 +1,107 @@
+
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+
+#include <Primitives/Workgroup.glsl>
+
+// Prefix-sum spatial hash build. Scans the per-slot particle counts into the
+// cell-start heap as an inclusive sum, i.e. each slot ends up holding the end
+// of its cell's range in the packed particle entries. Runs as three
+// dispatches, selected with SCAN_STAGE:
+//  0: Scan each block of SCAN_BLOCK_SIZE slots locally, write the block totals.
+//     The counts are zeroed as they are consumed, so the next substep starts
+//     from an empty hash without a separate clear.
+//  1: A single workgroup turns the block totals into block offsets
+//  2: Add the block offsets back into each slot
+// With SCAN_LIVE_PARTICLES the compaction's live flags are scanned in place
+// instead. Unlike GpuPrimitives::exclusiveScan, these consume their counts as
+// they go and size themselves from GPU-side counts, so they keep their own
+// passes on top of the shared workgroup scan.
+
+#define SCAN_BLOCK_SIZE (LOCAL_SIZE_X * SCAN_ITEMS_PER_THREAD)
+
+#ifdef SCAN_LIVE_PARTICLES
+#define SCAN_SLOT_COUNT simCounters.particleCount
+#define getScanInput(slotIdx) getLiveOffset(slotIdx)
+#define getScanOutput(slotIdx) getLiveOffset(slotIdx)
+#else
+#define SCAN_SLOT_COUNT simUniforms.spatialHashSize
+#define getScanInput(slotIdx) getSpatialHashSlot(slotIdx)
+#define getScanOutput(slotIdx) getCellStart(slotIdx)
+#endif
+
+void main() {
+  uint threadId = gl_LocalInvocationID.x;
+  uint slotCount = SCAN_SLOT_COUNT;
+
+  // Note: No early-outs before workgroupExclusiveAdd, every thread needs to
+  // reach the barriers
+#if SCAN_STAGE == 0
+  uint blockIdx = gl_WorkGroupID.x;
+  uint firstSlot =
+      blockIdx * SCAN_BLOCK_SIZE + threadId * SCAN_ITEMS_PER_THREAD;
+
+  uint partialSums[SCAN_ITEMS_PER_THREAD];
+  uint threadSum = 0;
+  for (uint i = 0; i < SCAN_ITEMS_PER_THREAD; ++i) {
+    uint slotIdx = firstSlot + i;
+    if (slotIdx < slotCount) {
+      threadSum += getScanInput(slotIdx);
+      getScanInput(slotIdx) = 0;
+    }
+    partialSums[i] = threadSum;
+  }
+
+  uint threadOffset = workgroupExclusiveAdd(threadSum);
+
+  for (uint i = 0; i < SCAN_ITEMS_PER_THREAD; ++i) {
+    uint slotIdx = firstSlot + i;
+    if (slotIdx < slotCount)
+      getScanOutput(slotIdx) = threadOffset + partialSums[i];
+  }
+
+  if (threadId == LOCAL_SIZE_X - 1)
+    getScanBlockSum(blockIdx) = threadOffset + threadSum;
+#elif SCAN_STAGE == 1
+  uint blockCount = (slotCount - 1) / SCAN_BLOCK_SIZE + 1;
+  uint blocksPerThread = (blockCount - 1) / LOCAL_SIZE_X + 1;
+  uint firstBlock = threadId * blocksPerThread;
+
+  uint threadSum = 0;
+  for (uint i = 0; i < blocksPerThread; ++i) {
+    uint blockIdx = firstBlock + i;
+    if (blockIdx < blockCount)
+      threadSum += getScanBlockSum(blockIdx);
+  }
+
+  uint blockOffset = workgroupExclusiveAdd(threadSum);
+
+  for (uint i = 0; i < blocksPerThread; ++i) {
+    uint blockIdx = firstBlock + i;
+    if (blockIdx < blockCount) {
+      uint blockSum = getScanBlockSum(blockIdx);
+      getScanBlockSum(blockIdx) = blockOffset;
+      blockOffset += blockSum;
+    }
+  }
+#else
+  uint slotIdx = uint(gl_GlobalInvocationID.x);
+  if (slotIdx >= slotCount) {
+    return;
+  }
+
+  uint rangeEnd =
+      getScanOutput(slotIdx) + getScanBlockSum(slotIdx / SCAN_BLOCK_SIZE);
+  getScanOutput(slotIdx) = rangeEnd;
+
+#ifndef SCAN_LIVE_PARTICLES
+  // The scatter pass moves each slot to the start of its range, the extra
+  // slot at the end stays as the end of the last range
+  if (slotIdx == slotCount - 1)
+    getScanOutput(slotCount) = rangeEnd;
+#endif
+#endif
+}
@@ -0,0 +1,41 @@
+
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+
+// Removes the dead particles and packs the live ones to the front of the
+// particle range, keeping their order. A stream compaction run as dispatches
+// selected with COMPACT_STAGE:
+//  0: Flag the live particles
+//     (CellScan.comp.glsl with SCAN_LIVE_PARTICLES then scans the flags into
+//     each live particle's packed index + 1)
+//  1: Scatter each live particle into the scratch heap at its packed index
+//  2: Copy the packed particles back into the particle heap
+// UpdateSimCounters.comp.glsl with AFTER_COMPACTION then shrinks the count to
+// the live particles. The globalIndex moves along with the rest of the
+// particle, same as in the Morton reorder.
+
+void main() {
+  uint particleIdx = uint(gl_GlobalInvocationID.x);
+  uint particleCount = simCounters.particleCount;
+  if (particleIdx >= particleCount) {
+    return;
+  }
+
+#if COMPACT_STAGE == 0
+  getLiveOffset(particleIdx) =
+      isParticleDead(getParticlePosition(particleIdx)) ? 0 : 1;
+#elif COMPACT_STAGE == 1
+  // Dead particles have the same offset as the particle before them
+  uint liveEnd = getLiveOffset(particleIdx);
+  uint liveStart = particleIdx == 0 ? 0 : getLiveOffset(particleIdx - 1);
+  if (liveEnd != liveStart)
+    getReorderScratch(liveStart) = loadParticle(particleIdx);
+#else
+  uint liveCount = getLiveOffset(particleCount - 1);
+  if (particleIdx < liveCount)
+    storeParticle(particleIdx, getReorderScratch(particleIdx));
+#endif
+}
@@ -1,21 +1,44 @@
 
 #version 450
 
-layout(local_size_x = LOCAL_SIZE_X) in;
+#include "SimSpecialization.glsl"
 
 #include "SimResources.glsl"
 
 void main() {
   uint particleIdx = uint(gl_GlobalInvocationID.x);
-  if (particleIdx >= simUniforms.particleCount) {
+  if (particleIdx >= simCounters.particleCount) {
     return;
   }
 
   // Before this pass the global index represents the grid cell hash this particle lives in. After this pass
   // the global index represents the particle bucket location that the particle has been relocated to
 
-  uint cellHash = getParticle(particleIdx).globalIndex;
-  vec3 position = getParticle(particleIdx).position;
+  uint cellHash = getParticleGlobalIndex(particleIdx);
+  vec3 position = getParticlePosition(particleIdx);
 
-  getParticle(particleIdx).globalIndex = hashInsertPosition(cellHash, position);
+#ifdef PARTICLE_SLEEPING
+  bool asleep = (cellHash & SLEEPING_BIT) != 0;
+  cellHash &= ~SLEEPING_BIT;
+#endif
+
+  uint globalParticleIdx = hashInsertPosition(cellHash, position);
+  getParticleGlobalIndex(particleIdx) = globalParticleIdx;
+
+#ifdef PARTICLE_SLEEPING
+  getParticleEntry(globalParticleIdx).positions[0].w = asleep ? 1.0 : 0.0;
+#endif
+
+#ifdef HASH_TELEMETRY
+  // The sim pass hashed the particle's previous position
+  recordHashInsert(cellHash, getParticlePrevPosition(particleIdx));
+#endif
+
+#ifdef SOLVER_GAUSS_SEIDEL
+  // The Gauss-Seidel sweeps iterate on phase 1 in place. The sim pass hashed
+  // the particle's previous position, tag the entry with that cell's colour.
+  uint color = computeCellColor(getParticlePrevPosition(particleIdx));
+  getParticleEntry(globalParticleIdx).positions[1] =
+      vec4(position, float(color));
+#endif
 }
@@ -0,0 +1,121 @@
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+#include "ParticleRender.glsl"
+#include "FluidSurface.glsl"
+
+// Builds the screen-space fluid surface's depth before the GBuffer pass, in
+// dispatches selected with FLUID_STAGE:
+//  0: One thread per pixel clears target 0 to the background
+//  1: One thread per live particle ray-casts its rendered sphere through
+//     every pixel it covers and keeps the nearest depth. ParticleImpostor.vert
+//     draws the spheres too large to splat.
+//  2: One thread per pixel smooths the depth along one axis, horizontally
+//     from target 0 into target 1 on even iterations and vertically back on
+//     odd ones
+//
+// The smoothing is a separable narrow-range filter (Truong and Yuksel, "A
+// Narrow-Range Filter for Screen-Space Fluid Rendering", 2018). Samples much
+// nearer than the centre pixel are dropped and ones much farther are clamped,
+// so the surface is smoothed without blurring across separate sheets of
+// fluid or bleeding into the background.
+
+void main() {
+#if FLUID_STAGE == 1
+  uint particleIdx = uint(gl_GlobalInvocationID.x);
+  if (particleIdx >= simCounters.particleCount)
+    return;
+
+  vec3 center = getParticleRenderPosition(particleIdx);
+  float radius = PARTICLE_RENDER_SCALE * simUniforms.particleRadius;
+  vec3 viewCenter = (globals.view * vec4(center, 1.0)).xyz;
+  if (!isFluidSplatted(viewCenter, radius))
+    return;
+
+  // Conservative screen bounds of the sphere
+  ivec2 screenSize = getScreenSize();
+  vec4 clipCenter = globals.projection * vec4(viewCenter, 1.0);
+  vec2 centerPixel =
+      (0.5 * clipCenter.xy / clipCenter.w + 0.5) * vec2(screenSize);
+  vec2 extent = getSplatExtent(-viewCenter.z, radius);
+  ivec2 minPixel = max(ivec2(floor(centerPixel - extent)), ivec2(0));
+  ivec2 maxPixel = min(ivec2(ceil(centerPixel + extent)), screenSize - 1);
+
+  for (int y = minPixel.y; y <= maxPixel.y; ++y) {
+    for (int x = minPixel.x; x <= maxPixel.x; ++x) {
+      ivec2 pixel = ivec2(x, y);
+      vec3 ray = getViewRay(pixel);
+      float rayLength = length(ray);
+      vec3 dir = ray / rayLength;
+
+      float b = dot(dir, viewCenter);
+      float h = b * b - dot(viewCenter, viewCenter) + radius * radius;
+      if (h < 0.0)
+        continue;
+
+      // Back to view depth, the ray has unit view depth per rayLength
+      float hitDepth = (b - sqrt(h)) / rayLength;
+      atomicMin(getFluidDepth(0, pixel), floatBitsToUint(hitDepth));
+    }
+  }
+#else
+  ivec2 screenSize = getScreenSize();
+  uint pixelIdx = uint(gl_GlobalInvocationID.x);
+  if (pixelIdx >= uint(screenSize.x * screenSize.y))
+    return;
+
+  ivec2 pixel = ivec2(pixelIdx % screenSize.x, pixelIdx / screenSize.x);
+
+#if FLUID_STAGE == 0
+  getFluidDepth(0, pixel) = FLUID_NO_DEPTH;
+#else
+  uint src = pushConstants.iteration % 2;
+  uint dst = src ^ 1;
+  ivec2 axis = src == 0 ? ivec2(1, 0) : ivec2(0, 1);
+
+  uint depthBits = getFluidDepth(src, pixel);
+  if (depthBits == FLUID_NO_DEPTH) {
+    getFluidDepth(dst, pixel) = FLUID_NO_DEPTH;
+    return;
+  }
+  float depth = uintBitsToFloat(depthBits);
+
+  // The kernel covers the smoothing radius at this depth
+  float focalPixels =
+      0.5 * abs(globals.projection[1][1]) * float(screenSize.y);
+  float radiusPixels = min(
+      simUniforms.fluidSmoothingRadius * focalPixels / depth,
+      float(FLUID_MAX_FILTER_RADIUS));
+  int kernelRadius = int(ceil(radiusPixels));
+  float invTwoSigma2 = 2.0 / max(radiusPixels * radiusPixels, 1.0);
+
+  float range = simUniforms.fluidDepthRange;
+  float depthSum = 0.0;
+  float weightSum = 0.0;
+  for (int i = -kernelRadius; i <= kernelRadius; ++i) {
+    ivec2 samplePixel = pixel + i * axis;
+    if (any(lessThan(samplePixel, ivec2(0))) ||
+        any(greaterThanEqual(samplePixel, screenSize)))
+      continue;
+
+    uint sampleBits = getFluidDepth(src, samplePixel);
+    if (sampleBits == FLUID_NO_DEPTH)
+      continue;
+
+    float sampleDepth = uintBitsToFloat(sampleBits);
+    if (sampleDepth < depth - range)
+      continue;
+    sampleDepth = min(sampleDepth, depth + range);
+
+    float weight = exp(-float(i * i) * invTwoSigma2);
+    depthSum += weight * sampleDepth;
+    weightSum += weight;
+  }
+
+  // The centre sample always counts
+  getFluidDepth(dst, pixel) = floatBitsToUint(depthSum / weightSum);
+#endif
+#endif
+}
@@ -0,0 +1,70 @@
+#version 450
+
+#include "SimResources.glsl"
+#include "FluidSurface.glsl"
+
+layout(location=0) out vec4 GBuffer_Normal;
+layout(location=1) out vec4 GBuffer_Albedo;
+layout(location=2) out vec4 GBuffer_MetallicRoughnessOcclusion;
+
+// Writes the smoothed fluid depth from FluidSurface.comp.glsl into the
+// GBuffer as a surface, so the deferred pass lights it like anything else.
+// Normals come from the depth of the neighbouring pixels.
+
+vec3 getViewPosition(ivec2 pixel, float depth) {
+  return depth * getViewRay(pixel);
+}
+
+// Difference to the neighbour on the side with the smaller depth step, so
+// silhouettes don't bend the normals towards the background. 0 when neither
+// neighbour has any fluid.
+vec3 getViewDerivative(ivec2 pixel, vec3 viewPos, ivec2 axis) {
+  ivec2 screenSize = getScreenSize();
+  vec3 derivative = vec3(0.0);
+  float minStep = uintBitsToFloat(FLUID_NO_DEPTH);
+  for (int side = -1; side <= 1; side += 2) {
+    ivec2 other = pixel + side * axis;
+    if (any(lessThan(other, ivec2(0))) ||
+        any(greaterThanEqual(other, screenSize)))
+      continue;
+
+    uint otherBits = getFluidDepth(0, other);
+    if (otherBits == FLUID_NO_DEPTH)
+      continue;
+
+    vec3 otherPos = getViewPosition(other, uintBitsToFloat(otherBits));
+    float depthStep = abs(otherPos.z - viewPos.z);
+    if (depthStep < minStep) {
+      minStep = depthStep;
+      derivative = float(side) * (otherPos - viewPos);
+    }
+  }
+
+  return derivative;
+}
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  uint depthBits = getFluidDepth(0, pixel);
+  if (depthBits == FLUID_NO_DEPTH)
+    discard;
+
+  vec3 viewPos = getViewPosition(pixel, uintBitsToFloat(depthBits));
+
+  vec3 dx = getViewDerivative(pixel, viewPos, ivec2(1, 0));
+  vec3 dy = getViewDerivative(pixel, viewPos, ivec2(0, 1));
+  vec3 viewNormal = cross(dx, dy);
+  // Isolated pixels face the camera
+  if (dot(viewNormal, viewNormal) == 0.0)
+    viewNormal = -viewPos;
+  viewNormal = normalize(viewNormal);
+  if (dot(viewNormal, viewPos) > 0.0)
+    viewNormal = -viewNormal;
+
+  vec4 clipPos = globals.projection * vec4(viewPos, 1.0);
+  gl_FragDepth = clipPos.z / clipPos.w;
+
+  GBuffer_Normal = vec4(mat3(globals.inverseView) * viewNormal, 1.0);
+  GBuffer_Albedo = vec4(FLUID_COLOR, 1.0);
+  GBuffer_MetallicRoughnessOcclusion = vec4(0.0, 0.05, 1.0, 1.0);
+}
@@ -0,0 +1,62 @@
+#ifndef _FLUIDSURFACE_
+#define _FLUIDSURFACE_
+
+// Screen-space fluid surface shared by FluidSurface.comp.glsl and
+// FluidSurface.frag. Expects SimResources.glsl to be included first.
+
+// Caps the smoothing kernel of the pixels closest to the camera
+#define FLUID_MAX_FILTER_RADIUS 16
+
+// Caps the pixels one particle splats into either side of its centre. The
+// particles that would cover more are drawn as impostors instead.
+#define FLUID_MAX_SPLAT_EXTENT 32
+
+// Background pixels keep +inf
+#define FLUID_NO_DEPTH 0x7F800000
+
+#define FLUID_COLOR vec3(0.1, 0.35, 0.8)
+
+// View depth of the nearest particle surface at each pixel, stored as float
+// bits so the splat can atomicMin them, positive floats order the same as
+// their bits. Two screen-sized targets back to back, the smoothing
+// ping-pongs between them and ends up back in target 0.
+BUFFER_RW(_fluidDepthHeap, FLUID_DEPTH_HEAP{
+  uint depths[];
+});
+#define getFluidDepth(target, pixel)                                  \
+    _fluidDepthHeap[simUniforms.fluidDepth]                           \
+        .depths[                                                      \
+          (target) * simUniforms.screenWidth * simUniforms.screenHeight + \
+          (pixel).y * simUniforms.screenWidth + (pixel).x]
+
+ivec2 getScreenSize() {
+  return ivec2(simUniforms.screenWidth, simUniforms.screenHeight);
+}
+
+// Pixels the sphere at this view depth covers either side of its centre
+vec2 getSplatExtent(float depth, float radius) {
+  vec2 focalPixels =
+      0.5 * abs(vec2(globals.projection[0][0], globals.projection[1][1])) *
+      vec2(getScreenSize());
+  return focalPixels * radius / (depth - radius);
+}
+
+// Whether the particle's sphere is splatted into the fluid depth. Spheres
+// around or too close to the camera are left to the impostors, clipping
+// them to the splat extent would draw them as squares.
+bool isFluidSplatted(vec3 viewCenter, float radius) {
+  float depth = -viewCenter.z;
+  return depth > radius &&
+         all(lessThanEqual(
+             getSplatExtent(depth, radius),
+             vec2(FLUID_MAX_SPLAT_EXTENT)));
+}
+
+// The view-space ray through the pixel's centre, scaled to unit view depth
+vec3 getViewRay(ivec2 pixel) {
+  vec2 ndc = (vec2(pixel) + 0.5) / vec2(getScreenSize()) * 2.0 - 1.0;
+  vec4 ray = globals.inverseProjection * vec4(ndc, 0.0, 1.0);
+  return ray.xyz / -ray.z;
+}
+
+#endif // _FLUIDSURFACE_
@@ -0,0 +1,88 @@
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+#include <Misc/Input.glsl>
+
+#include "ParticleCollision.glsl"
+
+// One colour sweep of the graph-coloured Gauss-Seidel solver. Each
+// iteration runs CELL_COLOR_COUNT sweeps, pushConstants.iteration counts the
+// sweeps. Every thread takes one spatial hash slot and updates the particles
+// of the current colour in it one after another, in place, so each update
+// sees the latest positions of the particles around it instead of the
+// previous iterate like the Jacobi step does.
+//
+// Particles sharing a cell share a slot and are only ever updated by the same
+// thread. Particles of the current colour in other slots were hashed into
+// cells at least a cell away, they are skipped instead of read since another
+// thread may be writing them.
+//
+// Positions are read and written in phase 1, the insert pass initializes it
+// and stores the entry's colour in w. Every update also stores the position
+// it started from in phase 0, so the sim pass sees the last update as the
+// stabilization term like with the Jacobi step.
+
+#define getSolverPosition(globalParticleIdx) \
+    getParticleEntry(globalParticleIdx).positions[1].xyz
+#define getSolverColor(globalParticleIdx) \
+    uint(getParticleEntry(globalParticleIdx).positions[1].w)
+
+void main() {
+  uint slotIdx = uint(gl_GlobalInvocationID.x);
+  if (slotIdx >= simUniforms.spatialHashSize) {
+    return;
+  }
+
+  uint color = pushConstants.iteration % CELL_COLOR_COUNT;
+
+  uint slotStart, slotEnd;
+  getCellRange(slotIdx, slotStart, slotEnd);
+
+  for (uint globalParticleIdx = slotStart; globalParticleIdx < slotEnd; ++globalParticleIdx)
+  {
+    if (getSolverColor(globalParticleIdx) != color)
+      continue;
+
+    vec3 particlePos = getSolverPosition(globalParticleIdx);
+    ivec3 gridCell = computeNeighborhoodBaseCell(particlePos);
+
+    vec3 contactDisp = vec3(0.0);
+    uint contactCount = 0;
+    // Sleeping particles skip their contacts, only the walls can move them
+    bool asleep = isEntryAsleep(globalParticleIdx);
+    for (int i = 0; i < 8 && !asleep; ++i) {
+      uint hash = hashCoords(gridCell.x + (i>>2), gridCell.y + ((i>>1)&1), gridCell.z + (i&1));
+      uint rangeStart, rangeEnd;
+      getCellRange(hash % simUniforms.spatialHashSize, rangeStart, rangeEnd);
+
+      for (uint otherParticleIdx = rangeStart; otherParticleIdx < rangeEnd; ++otherParticleIdx)
+      {
+        if (otherParticleIdx == globalParticleIdx)
+          continue;
+
+        bool inThisSlot = otherParticleIdx >= slotStart && otherParticleIdx < slotEnd;
+        if (!inThisSlot && getSolverColor(otherParticleIdx) == color)
+          continue;
+
+        checkParticleCollision(
+            contactDisp,
+            contactCount,
+            particlePos,
+            getSolverPosition(otherParticleIdx));
+      }
+    }
+
+    vec3 deltaPos = contactDisp;
+
+    vec3 wallDisp = vec3(0.0);
+    uint hasWallCollisions = 0;
+    checkWallCollisions(wallDisp, hasWallCollisions, particlePos);
+    if (hasWallCollisions > 0)
+      deltaPos += 0.5 * wallDisp;
+
+    setPosition(globalParticleIdx, particlePos, 0);
+    getSolverPosition(globalParticleIdx) = particlePos + deltaPos;
+  }
+}
@@ -6,4 +6,20 @@ uint hashCoords(int x, int y, int z) {
   return uint(abs((x * 92837111) ^ (y * 689287499) ^ (z * 283923481)));
 }
 
+// PCG hash, same as pcgHash in ParticleSeeding.h
+uint pcgHash(uint v) {
+  uint state = v * 747796405u + 2891336453u;
+  uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Same as computeSpawnPosition in ParticleSeeding.cpp
+vec3 computeSpawnPosition(uint seed, uint particleIdx) {
+  uint x = pcgHash(particleIdx ^ pcgHash(seed));
+  uint y = pcgHash(x);
+  uint z = pcgHash(y);
+
+  return 0.1 * vec3(x % 300u, y % 3000u, z % 300u) + vec3(35.0);
+}
+
 #endif // _HASH_
@@ -0,0 +1,45 @@
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+
+SAMPLER2D(textureHeap);
+#define prevDepth \
+    RESOURCE(textureHeap, resources.gBuffer.depthAHandle + simUniforms.hiZDepthIndex)
+
+// Builds one level of the max depth pyramid the particle culling tests
+// against, one thread per texel of the level. Level pushConstants.iteration
+// is reduced from the previous frame's GBuffer depth for level 0, or from the
+// level below. Levels round up, so edge texels clamp their 2x2 footprint and
+// every source texel is covered.
+
+void main() {
+#ifdef PARTICLE_CULLING
+  uint level = pushConstants.iteration;
+  uvec2 levelSize = getHiZLevelSize(level);
+  uint texelIdx = uint(gl_GlobalInvocationID.x);
+  if (texelIdx >= levelSize.x * levelSize.y)
+    return;
+
+  uvec2 texel = uvec2(texelIdx % levelSize.x, texelIdx / levelSize.x);
+
+  float maxDepth = 0.0;
+  if (level == 0) {
+    ivec2 srcMax = ivec2(simUniforms.screenWidth, simUniforms.screenHeight) - 1;
+    for (int i = 0; i < 4; ++i) {
+      ivec2 src = min(ivec2(2 * texel) + ivec2(i & 1, i >> 1), srcMax);
+      maxDepth = max(maxDepth, texelFetch(prevDepth, src, 0).r);
+    }
+  } else {
+    uvec2 srcSize = getHiZLevelSize(level - 1);
+    uint srcOffset = getHiZLevelOffset(level - 1);
+    for (uint i = 0; i < 4; ++i) {
+      uvec2 src = min(2 * texel + uvec2(i & 1, i >> 1), srcSize - 1);
+      maxDepth = max(maxDepth, getHiZ(srcOffset, srcSize, src));
+    }
+  }
+
+  getHiZ(getHiZLevelOffset(level), levelSize, texel) = maxDepth;
+#endif
+}
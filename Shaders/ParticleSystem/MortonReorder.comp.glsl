@@ -0,0 +1,37 @@
+
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+
+// Sorts the particles along a Z-order curve, so particles that are close in
+// space end up close in memory. A counting sort over the Morton keys, run as
+// dispatches selected with REORDER_STAGE:
+//  0: Count the particles per Morton key
+//     (GpuPrimitives::exclusiveScan then turns the counts into the start of
+//     each key's range)
+//  1: Scatter each particle into the scratch heap, front to back within its
+//     key's range
+//  2: Copy the sorted particles back into the particle heap
+// The globalIndex moves along with the rest of the particle, so it keeps
+// pointing at the same particle entry.
+
+void main() {
+  uint particleIdx = uint(gl_GlobalInvocationID.x);
+  if (particleIdx >= simCounters.particleCount) {
+    return;
+  }
+
+#if REORDER_STAGE == 0
+  uint key = computeMortonKey(getParticlePosition(particleIdx));
+  atomicAdd(getMortonKeyCount(key), 1);
+#elif REORDER_STAGE == 1
+  Particle particle = loadParticle(particleIdx);
+  uint key = computeMortonKey(particle.position);
+  uint dstIdx = atomicAdd(getMortonKeyCount(key), 1);
+  getReorderScratch(dstIdx) = particle;
+#else
+  storeParticle(particleIdx, getReorderScratch(particleIdx));
+#endif
+}
@@ -1,41 +1,49 @@
 #ifndef _PBFLUIDS_
 #define _PBFLUIDS_
 
-#include <Misc/Constants.glsl>
-
-
-// An SPH kernel
-float gaussianKernel(float d, float h) {
-  float d2 = d * d;
+// Position-based fluids kernels and density constraint (Macklin and Mueller,
+// "Position Based Fluids", 2013). Expects SimResources.glsl to be included
+// first. The kernel normalisations are precomputed on the CPU into
+// simUniforms.pbf, see PbfParams in ParticleSystem.h, so no pair evaluates a
+// pow. PbfSolverCpu mirrors these.
+
+// Poly6 density kernel at squared distance d2
+float poly6Kernel(float d2) {
+  float h = simUniforms.pbf.kernelRadius;
+  float f = max(h * h - d2, 0.0);
+  return simUniforms.pbf.poly6Scale * f * f * f;
+}
 
-  float h2 = h * h;
-  float h3 = h * h2;
+// Gradient of the spiky kernel with respect to p_i, at r = p_i - p_j with
+// d2 = dot(r, r). Points from p_i towards p_j, zero for coincident particles.
+vec3 spikyKernelGrad(vec3 r, float d2) {
+  float h = simUniforms.pbf.kernelRadius;
+  if (d2 <= 0.0 || d2 >= h * h)
+    return vec3(0.0);
 
-  // TODO: simplify / precompute
-  return 1.0 / pow(PI, 2.0/3.0) / h3 * exp(d2 / h2);
+  float d = sqrt(d2);
+  float f = h - d;
+  return (simUniforms.pbf.spikyGradScale * f * f / d) * r;
 }
 
-// based on the video: Coding Adventures: Simulating Fluids - Sebastian Lague
-float smoothingKernel(float r2, float d2) {
-  float r8 = r2 * r2;
-  r8 *= r8;
-  
-  float vol = 0.25 * PI * r8;
-  float v = max(0.0, r2 - d2);
-  return v * v * v / vol;
+// Artificial pressure s_corr, a small repulsion that keeps particles at the
+// free surface from clumping
+float tensileCorrection(float d2) {
+  float w = poly6Kernel(d2) * simUniforms.pbf.tensileInvKernel;
+  w *= w;
+  return -simUniforms.pbf.tensileStrength * w * w;
 }
 
-float smoothingKernelDeriv(float r2, float d2) {
-  if (d2 > r2) return 0.0;
-
-  float f = r2 - d2;
-  
-  float r8 = r2 * r2;
-  r8 *= r8;
-  
-  float scale = -24.0 / (PI * pow(r2, 4.0));  
-  return scale * f * f; 
+// The density constraint's multiplier, from a particle's density (including
+// itself), the sum of its neighbours' kernel gradients and the sum of their
+// squared lengths. Only compression is corrected, so the free surface isn't
+// pulled together.
+float computeLambda(float density, vec3 gradSum, float gradSqSum) {
+  float invRestDensity = 1.0 / simUniforms.pbf.restDensity;
+  float constraint = max(density * invRestDensity - 1.0, 0.0);
+  float gradNormSq =
+      (dot(gradSum, gradSum) + gradSqSum) * invRestDensity * invRestDensity;
+  return -constraint / (gradNormSq + simUniforms.pbf.relaxation);
 }
 
-
-#endif // _PBFLUIDS_
\ No newline at end of file
+#endif // _PBFLUIDS_
@@ -1,26 +1,106 @@
 #ifndef _PARTICLECOLLISION_
 #define _PARTICLECOLLISION_
 
+// Collision helpers shared by the constraint solver passes. Expects
+// SimSpecialization.glsl, SimResources.glsl and Misc/Input.glsl to be
+// included first.
+
+#define CAMERA_STRENGTH -0.0001
+
+// Accumulates the correction that moves this particle half way out of contact
+// with the other particle, the other particle's own update covers the other
+// half.
 void checkParticleCollision(inout vec3 deltaPos, inout uint collidingParticlesCount, vec3 particlePos, vec3 otherParticlePos)
 {
-  // TODO: Should use nextPos or prevPos?
   vec3 diff = otherParticlePos - particlePos;
   float dist = length(diff);
-  float sep = dist - 2.0 * particleRadius;
+  float sep = dist - 2.0 * simUniforms.particleRadius;
 
-  if (sep <= 0.0) {
-    // particle.debug = 1; // mark collision
+  if (sep < 0.0) {
     if (dist < 0.00001)
       diff = vec3(1.0, 0.0, 0.0);
     else 
       diff /= dist;
 
-    float bias = 0.5;
-    float k = 1.0 / float(jacobiIters);
-
-    deltaPos += k * bias * sep * diff;
+    deltaPos += 0.5 * sep * diff;
     collidingParticlesCount++;
   }
 }
 
+void checkWallCollisions(inout vec3 deltaPos, inout uint collidingParticlesCount, vec3 particlePos)
+{
+  float k = 1.0;// / float(jacobiIters);
+
+  float wallBias = 1.0;
+
+  vec3 gridLength =  vec3(60.0);
+  if (simUniforms.liveValues.checkbox1)
+    gridLength[0] = 60.0 * simUniforms.liveValues.slider1 + 20.0 * sin(0.25 * simUniforms.time);// 5.0
+  vec3 minPos = vec3(simUniforms.particleRadius);
+  vec3 maxPos = gridLength - vec3(simUniforms.particleRadius);
+  for (int i = 0; i < 3; ++i)
+  {
+    if (particlePos[i] <= minPos[i])
+    {
+      deltaPos[i] += (minPos[i] - particlePos[i]);
+      ++collidingParticlesCount;
+    }  
+
+    if (i != 1 && particlePos[i] >= maxPos[i])
+    {
+      deltaPos[i] -= (particlePos[i] - maxPos[i]);
+      ++collidingParticlesCount;
+    }
+  }
+
+  if (!simUniforms.liveValues.checkbox1 && bool(globals.inputMask & INPUT_BIT_LEFT_MOUSE))
+  {
+    // TODO: Create the projected cam position and upload in 
+    // uniforms, there is more flexibility that way and is probably
+    // more efficient
+    float camRadius = CAMERA_RADIUS;
+    float camRadiusSq = camRadius * camRadius;
+
+    vec3 cameraPos = globals.inverseView[3].xyz;
+    vec3 dir = normalize(-globals.inverseView[2].xyz);
+
+    // Solve for t to find whether and where the camera ray intersects the
+    // floor plane
+    // c.y + t * d.y = 0
+
+    float t = -1.0;
+    if (abs(dir.y) > 0.0001)
+    {
+      t = -cameraPos.y / dir.y;
+    } 
+
+    if (t < 0.0)
+    {
+      t = 10.0;
+      //return;
+    }
+
+    t = clamp(t, 0.0, 10.0);
+
+    vec3 userBallPos = cameraPos + t * dir;// + vec3(0.0, 5.0, 0.0);
+    vec3 camDiff = particlePos - userBallPos;
+    float camDistSq = dot(camDiff, camDiff) + 0.01;
+    if (camDistSq < camRadiusSq)
+    {
+      float camDist = sqrt(camDistSq);
+      if (camDistSq > 0.25 * camRadiusSq)
+      {
+        // if (bool(inputMask & INPUT_MASK_MOUSE_LEFT))
+          deltaPos += - 1.* camDiff / camDist / camDistSq;
+      }
+      else 
+      {
+        deltaPos += 5.0 * CAMERA_STRENGTH * camDistSq * camDiff / camDist;
+      }
+      // deltaPos += CAMERA_STRENGTH * camRadius * camDiff / camDist;
+      ++collidingParticlesCount;
+    }
+  }
+}
+
 #endif // _PARTICLECOLLISION_
\ No newline at end of file
@@ -0,0 +1,134 @@
+#version 450
+
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_ballot : enable
+
+#if CULL_STAGE == 0
+#define SIM_SINGLE_THREAD
+#endif
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+#include "ParticleRender.glsl"
+
+// Culls the particle instances before the GBuffer pass draws them, in two
+// dispatches selected with CULL_STAGE:
+//  0: A single thread resets the draws' instance counts, to 0 when culling
+//     and to every live particle when not
+//  1: One thread per live particle tests its rendered sphere against the
+//     view frustum and, once the previous frame's depth exists, against the
+//     max depth pyramid HiZBuild.comp.glsl built from it. The survivors are
+//     appended to the visible particle list and counted into both draws.
+// The occlusion test uses the previous frame's camera with this frame's
+// particle positions, particles uncovered since then can pop in a frame late.
+
+#ifdef PARTICLE_CULLING
+bool isInFrustum(vec3 center, float radius) {
+  // Gribb-Hartmann planes of the view projection, with Vulkan's [0, w] clip
+  // depth
+  mat4 m = transpose(globals.projection * globals.view);
+  vec4 planes[6] = vec4[](
+      m[3] + m[0],
+      m[3] - m[0],
+      m[3] + m[1],
+      m[3] - m[1],
+      m[2],
+      m[3] - m[2]);
+  for (int i = 0; i < 6; ++i) {
+    if (dot(planes[i].xyz, center) + planes[i].w <
+        -radius * length(planes[i].xyz))
+      return false;
+  }
+
+  return true;
+}
+
+bool isOccluded(vec3 center, float radius) {
+  // Screen bounds and nearest depth of the sphere's bounding box, as the
+  // previous frame saw it. The box corners are the centre plus the scaled
+  // axis columns of the view projection.
+  mat4 viewProj = simUniforms.hiZViewProjection;
+  vec4 centerClip = viewProj * vec4(center, 1.0);
+  vec4 axes[3] = vec4[](
+      radius * viewProj[0],
+      radius * viewProj[1],
+      radius * viewProj[2]);
+
+  vec2 minNdc = vec2(1.0);
+  vec2 maxNdc = vec2(-1.0);
+  float nearestDepth = 1.0;
+  for (int i = 0; i < 8; ++i) {
+    vec4 corner = centerClip +
+                  ((i & 1) != 0 ? axes[0] : -axes[0]) +
+                  ((i & 2) != 0 ? axes[1] : -axes[1]) +
+                  ((i & 4) != 0 ? axes[2] : -axes[2]);
+    // Crossing the camera plane, nothing sensible to test against
+    if (corner.w <= 0.0)
+      return false;
+
+    vec3 ndc = corner.xyz / corner.w;
+    minNdc = min(minNdc, ndc.xy);
+    maxNdc = max(maxNdc, ndc.xy);
+    nearestDepth = min(nearestDepth, ndc.z);
+  }
+
+  vec2 minUv = clamp(0.5 * minNdc + 0.5, 0.0, 1.0);
+  vec2 maxUv = clamp(0.5 * maxNdc + 0.5, 0.0, 1.0);
+
+  // The level where the bounds span at most 2x2 texels
+  vec2 level0Size = 0.5 * vec2(simUniforms.screenWidth, simUniforms.screenHeight);
+  vec2 extent = (maxUv - minUv) * level0Size;
+  uint level = uint(max(ceil(log2(max(extent.x, extent.y))), 0.0));
+  level = min(level, simUniforms.hiZLevelCount - 1);
+
+  uvec2 levelSize = getHiZLevelSize(level);
+  uint levelOffset = getHiZLevelOffset(level);
+  vec2 texelScale = level0Size / float(1u << level);
+  uvec2 minTexel = min(uvec2(minUv * texelScale), levelSize - 1);
+  uvec2 maxTexel = min(uvec2(maxUv * texelScale), levelSize - 1);
+
+  float maxDepth = max(
+      max(getHiZ(levelOffset, levelSize, minTexel),
+          getHiZ(levelOffset, levelSize, uvec2(maxTexel.x, minTexel.y))),
+      max(getHiZ(levelOffset, levelSize, uvec2(minTexel.x, maxTexel.y)),
+          getHiZ(levelOffset, levelSize, maxTexel)));
+
+  return nearestDepth > maxDepth;
+}
+#endif
+
+void main() {
+#ifdef PARTICLE_CULLING
+#if CULL_STAGE == 0
+  uint instanceCount =
+      simUniforms.cullParticles != 0 ? 0 : simCounters.particleCount;
+  simCounters.particleInstanceCount = instanceCount;
+  simCounters.particleImpostorInstanceCount = instanceCount;
+#else
+  // No early out, the whole subgroup takes part in the append
+  uint particleIdx = uint(gl_GlobalInvocationID.x);
+  bool visible = particleIdx < simCounters.particleCount;
+  if (visible) {
+    vec3 center = getParticleRenderPosition(particleIdx);
+    float radius = PARTICLE_RENDER_SCALE * simUniforms.particleRadius;
+    visible = isInFrustum(center, radius) &&
+              (simUniforms.cullOcclusion == 0 || !isOccluded(center, radius));
+  }
+
+  // One atomic per subgroup
+  uvec4 ballot = subgroupBallot(visible);
+  uint visibleCount = subgroupBallotBitCount(ballot);
+  uint firstInstance = 0;
+  if (subgroupElect() && visibleCount > 0) {
+    firstInstance =
+        atomicAdd(simCounters.particleInstanceCount, visibleCount);
+    atomicAdd(simCounters.particleImpostorInstanceCount, visibleCount);
+  }
+  firstInstance = subgroupBroadcastFirst(firstInstance);
+
+  if (visible)
+    getVisibleParticle(firstInstance + subgroupBallotExclusiveBitCount(ballot)) =
+        particleIdx;
+#endif
+#endif
+}
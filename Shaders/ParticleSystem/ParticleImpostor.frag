@@ -0,0 +1,38 @@
+#version 450
+
+#include "SimResources.glsl"
+#include "ParticleRender.glsl"
+
+layout(location=0) in vec3 cameraToQuad;
+layout(location=1) flat in vec3 cameraToCenter;
+layout(location=2) flat in vec3 color;
+
+layout(location=0) out vec4 GBuffer_Normal;
+layout(location=1) out vec4 GBuffer_Albedo;
+layout(location=2) out vec4 GBuffer_MetallicRoughnessOcclusion;
+
+// The sphere is always behind its quad, so the depth test against the quad's
+// own depth stays conservative and can still reject fragments early
+layout(depth_greater) out float gl_FragDepth;
+
+void main() {
+  float radius = PARTICLE_RENDER_SCALE * simUniforms.particleRadius;
+
+  // Intersect the view ray through this fragment with the sphere
+  vec3 dir = normalize(cameraToQuad);
+  float b = dot(dir, cameraToCenter);
+  float h = b * b - dot(cameraToCenter, cameraToCenter) + radius * radius;
+  if (h < 0.0)
+    discard;
+
+  vec3 cameraToHit = (b - sqrt(h)) * dir;
+  vec3 normal = (cameraToHit - cameraToCenter) / radius;
+
+  vec3 hitPos = globals.inverseView[3].xyz + cameraToHit;
+  vec4 clipPos = globals.projection * globals.view * vec4(hitPos, 1.0);
+  gl_FragDepth = clipPos.z / clipPos.w;
+
+  GBuffer_Normal = vec4(normal, 1.0);
+  GBuffer_Albedo = vec4(color, 1.0);
+  GBuffer_MetallicRoughnessOcclusion = vec4(0.0, 0.05, 1.0, 1.0);
+}
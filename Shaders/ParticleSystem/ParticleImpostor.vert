@@ -0,0 +1,62 @@
+#version 450
+
+#include "SimResources.glsl"
+#include "ParticleRender.glsl"
+#include "FluidSurface.glsl"
+
+// Draws each particle as one camera-facing quad instead of a sphere mesh,
+// ParticleImpostor.frag ray-casts the sphere inside it. The quad sits where
+// the view ray through the centre enters the sphere and covers the cone of
+// rays that hit it, so the sphere always lies behind it. Under the fluid
+// surface, only the particles the fluid splat leaves out are drawn.
+
+layout(location=0) out vec3 cameraToQuad;
+layout(location=1) flat out vec3 cameraToCenter;
+layout(location=2) flat out vec3 color;
+
+// Two triangles per quad, no vertex or index buffer bound
+const vec2 quadCorners[6] = vec2[](
+    vec2(-1.0, -1.0),
+    vec2(1.0, -1.0),
+    vec2(-1.0, 1.0),
+    vec2(-1.0, 1.0),
+    vec2(1.0, -1.0),
+    vec2(1.0, 1.0));
+
+void main() {
+  uint particleIdx = getRenderedParticle(gl_InstanceIndex);
+  vec3 center = getParticleRenderPosition(particleIdx);
+  float radius = PARTICLE_RENDER_SCALE * simUniforms.particleRadius;
+
+  vec3 cameraPos = globals.inverseView[3].xyz;
+  cameraToCenter = center - cameraPos;
+  color = getParticleRenderColor(particleIdx);
+
+  float dist2 = dot(cameraToCenter, cameraToCenter);
+  bool splatted = simUniforms.fluidSurface != 0 &&
+                  isFluidSplatted((globals.view * vec4(center, 1.0)).xyz, radius);
+  if (dist2 <= radius * radius || splatted) {
+    // The camera is inside the sphere, or the fluid surface draws it.
+    // Collapse the quad.
+    cameraToQuad = vec3(0.0);
+    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+
+  float dist = sqrt(dist2);
+  vec3 dir = cameraToCenter / dist;
+
+  // Radius of the silhouette cone at the front of the sphere. dir is never
+  // parallel to the camera's up axis for particles in front of the camera.
+  float quadDist = dist - radius;
+  float halfSize = quadDist * radius / sqrt(dist2 - radius * radius);
+  vec3 right = normalize(cross(dir, globals.inverseView[1].xyz));
+  vec3 up = cross(right, dir);
+
+  vec2 corner = quadCorners[gl_VertexIndex];
+  cameraToQuad =
+      quadDist * dir + halfSize * (corner.x * right + corner.y * up);
+
+  gl_Position =
+      globals.projection * globals.view * vec4(cameraPos + cameraToQuad, 1.0);
+}
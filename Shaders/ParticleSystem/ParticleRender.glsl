@@ -0,0 +1,54 @@
+#ifndef _PARTICLERENDER_
+#define _PARTICLERENDER_
+
+// Helpers shared by the particle mesh and impostor vertex shaders. Expects
+// SimResources.glsl to be included first.
+
+// The rendered spheres are a bit larger than the collision radius, same as
+// the sphere mesh created in _createGlobalResources
+#define PARTICLE_RENDER_SCALE 1.3
+
+// The particle an instance of the particle draws renders. With culling on the
+// draws only cover the visible particles.
+uint getRenderedParticle(uint instanceIdx) {
+#ifdef PARTICLE_CULLING
+  if (simUniforms.cullParticles != 0)
+    return getVisibleParticle(instanceIdx);
+#endif
+  return instanceIdx;
+}
+
+// Where to draw the particle this frame. The sim runs at a fixed rate, so
+// interpolate between where the last two sim steps' solves left the particle,
+// never extrapolating past the latest one. The particle's own position is
+// the next substep's unconstrained prediction, so the latest solved position
+// comes from its entry. Respawned particles start the step at their spawn
+// position.
+vec3 getParticleRenderPosition(uint particleIdx) {
+  // Only fetch the fields needed here, with the SoA layout this skips the
+  // position streams entirely
+  uint globalParticleIdx = getParticleGlobalIndex(particleIdx);
+  vec3 position = getPosition(globalParticleIdx, getSolvedPhase());
+  vec3 stepPosition = getParticleStepPosition(particleIdx);
+  return mix(position, stepPosition, clamp(simUniforms.renderDelay, 0.0, 1.0));
+}
+
+vec3 getParticleRenderColor(uint particleIdx) {
+  uint debug = getParticleDebug(particleIdx);
+#if 1
+  return vec3(debug >> 16, (debug >> 8) & 0xff, debug & 0xff) / 255.0;
+#elif 0
+  if (debug == 1)
+    return vec3(1.0, 0.0, 0.0);
+  else if (debug == 2)
+    return vec3(0.0, 1.0, 0.0);
+  else if (debug == 3)
+    return vec3(1.0, 1.0, 0.0);
+  else
+    return vec3(0.4, 0.1, 0.9);
+#else
+  return vec3(0.4, 0.1, 0.9);
+#endif
+}
+
+#endif // _PARTICLERENDER_
@@ -1,32 +1,100 @@
 
 #version 450
 
-layout(local_size_x = LOCAL_SIZE_X) in;
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_arithmetic : enable
+
+#include "SimSpecialization.glsl"
 
 #include <Misc/Input.glsl>
 #include "SimResources.glsl"
 #include "Hash.glsl"
 
+#ifdef PARTICLE_SLEEPING
+// Keeps the cells a moving particle can touch awake, the same 2x2x2 block of
+// cells the solvers search around it
+void markCellMotion(vec3 pos) {
+  ivec3 gridCell = computeNeighborhoodBaseCell(pos);
+  for (int i = 0; i < 8; ++i) {
+    uint hash = hashCoords(gridCell.x + (i>>2), gridCell.y + ((i>>1)&1), gridCell.z + (i&1));
+    getCellMotionEpoch(hash % simUniforms.spatialHashSize) = pushConstants.hashEpoch;
+  }
+}
+
+// Fast path for a particle that slept through the last substep. If the solver
+// barely moved it, e.g. a wall nudged it, and no moving particle has come near
+// its cell, it stays asleep. Such a particle keeps its position, skips
+// integration and only gets re-hashed, so awake particles still collide with
+// it. Only its position and globalIndex are loaded, not the whole particle.
+bool keepAsleep(uint particleIdx, float dt) {
+  uint globalParticleIdx = getParticleGlobalIndex(particleIdx);
+  if (!isEntryAsleep(globalParticleIdx))
+    return false;
+
+  // Sleeping particles aren't integrated, so the position they were inserted
+  // at is also their last solved position
+  vec3 position = getParticlePosition(particleIdx);
+  vec3 nextPos = getPosition(globalParticleIdx, getSolvedPhase());
+  if (length(nextPos - position) > simUniforms.sleepSpeed * dt)
+    return false;
+
+  vec3 gridPos = (simUniforms.worldToGrid * vec4(nextPos, 1.0)).xyz;
+  ivec3 gridCell = ivec3(floor(gridPos));
+  uint slotIdx = hashCoords(gridCell.x, gridCell.y, gridCell.z) % simUniforms.spatialHashSize;
+  if (pushConstants.hashEpoch - getCellMotionEpoch(slotIdx) <= simUniforms.sleepSubsteps)
+    return false;
+
+  if (nextPos != position) {
+    getParticlePosition(particleIdx) = nextPos;
+    getParticlePrevPosition(particleIdx) = nextPos;
+  }
+  if (pushConstants.iteration == 0)
+    getParticleStepPosition(particleIdx) = nextPos;
+
+  getParticleGlobalIndex(particleIdx) =
+      incrementCellParticleCount(gridCell.x, gridCell.y, gridCell.z) | SLEEPING_BIT;
+  return true;
+}
+#endif
+
 void main() {
   uint particleIdx = uint(gl_GlobalInvocationID.x);
-  if (particleIdx >= simUniforms.particleCount) {
+  if (particleIdx >= simCounters.particleCount) {
     return;
   }
 
-  bool newlyAdded = particleIdx >= (simUniforms.particleCount - simUniforms.addedParticles);
+  bool newlyAdded = particleIdx >= (simCounters.particleCount - simCounters.addedParticles);
 
   float dt = simUniforms.deltaTime;
 
-  Particle particle = getParticle(particleIdx);
+#ifdef PARTICLE_SLEEPING
+  if (!newlyAdded && keepAsleep(particleIdx, dt)) {
+    uint sleepingCount = subgroupAdd(1);
+    if (subgroupElect())
+      atomicAdd(simCounters.sleepingParticles, sleepingCount);
+    return;
+  }
+#endif
+
+  Particle particle = loadParticle(particleIdx);
+
+  // Slots past the live range may hold stale copies of compacted particles,
+  // so emitted particles are respawned. The CPU seeds every slot at the same
+  // position, see computeSpawnPosition.
+  if (newlyAdded) {
+    particle.position = computeSpawnPosition(simUniforms.spawnSeed, particleIdx);
+    particle.prevPosition = particle.position;
+  }
 
   // TODO: Find better function name here...
 
   vec3 velocity = vec3(0.0);
+  bool asleep = false;
   
   // if (false)
   if (!newlyAdded)
   {
-    uint phase = simUniforms.jacobiIters % 2;
+    uint phase = getSolvedPhase();
     ParticleBucketEntry particleEntry = getParticleEntry(particle.globalIndex);
     vec3 nextPos = particleEntry.positions[phase].xyz;
     vec3 stabilization = nextPos - particleEntry.positions[1-phase].xyz;
@@ -40,9 +108,39 @@ void main() {
     vec3 rejection = velocity - projection;
     // velocity -= rejection * friction * dt;
 
+#ifdef PARTICLE_SLEEPING
+    // How far the solver moved the particle over the last substep. Sleeping
+    // particles only move when something outside the sim pushes them, e.g.
+    // the walls or the camera ball.
+    bool moving = length(nextPos - particle.prevPosition) > simUniforms.sleepSpeed * dt;
+    if (moving) {
+      markCellMotion(nextPos);
+    } else {
+      vec3 cellPos = (simUniforms.worldToGrid * vec4(nextPos, 1.0)).xyz;
+      ivec3 cell = ivec3(floor(cellPos));
+      uint slotIdx = hashCoords(cell.x, cell.y, cell.z) % simUniforms.spatialHashSize;
+      asleep = pushConstants.hashEpoch - getCellMotionEpoch(slotIdx) > simUniforms.sleepSubsteps;
+    }
+#endif
+
     particle.position = nextPos;
     particle.prevPosition = nextPos;
   }
+#ifdef PARTICLE_SLEEPING
+  else
+  {
+    markCellMotion(particle.position);
+  }
+
+  uint sleepingCount = subgroupAdd(asleep ? 1 : 0);
+  if (subgroupElect() && sleepingCount > 0)
+    atomicAdd(simCounters.sleepingParticles, sleepingCount);
+#endif
+
+  // The first substep of a step starts from where the last step's solve left
+  // the particle, which the rendering interpolates away from
+  if (pushConstants.iteration == 0)
+    getParticleStepPosition(particleIdx) = particle.position;
 
   float friction = 0.;//4;//5;
   if (particle.position.y <= simUniforms.particleRadius * 1.5)
@@ -67,10 +165,16 @@ void main() {
   vec3 gridPos = (simUniforms.worldToGrid * vec4(particle.position, 1.0)).xyz;
   ivec3 gridCell = ivec3(floor(gridPos));
 
-  particle.position += velocity * dt;
+  // Sleeping particles stay where they are
+  if (!asleep)
+    particle.position += velocity * dt;
 
   // Store the particle grid cell hash
   particle.globalIndex = incrementCellParticleCount(gridCell.x, gridCell.y, gridCell.z);
+#ifdef PARTICLE_SLEEPING
+  if (asleep)
+    particle.globalIndex |= SLEEPING_BIT;
+#endif
 
   // Whether we find an entry for this grid cell, entry for a hash-colliding cell, or create a 
   // a new entry, this particle will become the new head of the particle bucket linked-list.
@@ -78,7 +182,7 @@ void main() {
   // particle.nextParticleLink = spatialHashAtomicExchange(gridCell.x, gridCell.y, gridCell.z, particleIdx);
 
 #if 1
-if (particleIdx >= (simUniforms.particleCount - simUniforms.addedParticles))
+if (particleIdx >= (simCounters.particleCount - simCounters.addedParticles))
 {
     vec3 col = vec3(1.0, 0.2, 0.1);
     uvec3 ucol = uvec3(255.0 * col.xyz);
@@ -98,5 +202,5 @@ if (bool(globals.inputMask & INPUT_BIT_SPACE))
 #endif
 
   // Write-back the modified particle data
-  getParticle(particleIdx) = particle;
+  storeParticle(particleIdx, particle);
 }
@@ -0,0 +1,93 @@
+#version 450
+
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+#include "PBFluids.glsl"
+
+// First half of a position-based fluids Jacobi iteration. Computes each
+// particle's density and constraint multiplier lambda from the current
+// iterate, the Jacobi step that follows moves every particle by the lambdas
+// around it. Neighbours come from the same 8 cells, or the neighbour lists,
+// as the Jacobi step's.
+//
+// Sleeping particles get no lambda of their own. They still add to their
+// awake neighbours' density, so they push back like a static boundary.
+//
+// The pass is always created, it only does anything with the density
+// constraint enabled.
+
+#ifdef PBF_DENSITY
+void accumulateNeighbor(
+    inout float density,
+    inout vec3 gradSum,
+    inout float gradSqSum,
+    vec3 particlePos,
+    uint otherParticleIdx) {
+  vec3 r =
+      particlePos - getPosition(otherParticleIdx, pushConstants.iteration % 2);
+  float d2 = dot(r, r);
+  float h = simUniforms.pbf.kernelRadius;
+  if (d2 >= h * h)
+    return;
+
+  density += poly6Kernel(d2);
+
+  vec3 grad = spikyKernelGrad(r, d2);
+  gradSum += grad;
+  gradSqSum += dot(grad, grad);
+}
+#endif
+
+void main() {
+#ifdef PBF_DENSITY
+  uint particleIdx = uint(gl_GlobalInvocationID.x);
+  if (particleIdx >= simCounters.particleCount) {
+    return;
+  }
+
+  uint globalParticleIdx = getParticleGlobalIndex(particleIdx);
+  if (isEntryAsleep(globalParticleIdx)) {
+    getEntryLambda(globalParticleIdx) = 0.0;
+    return;
+  }
+
+  vec3 particlePos =
+      getPosition(globalParticleIdx, pushConstants.iteration % 2);
+
+  float density = poly6Kernel(0.0);
+  vec3 gradSum = vec3(0.0);
+  float gradSqSum = 0.0;
+
+#ifdef NEIGHBOR_LISTS
+  uint neighborCount = getNeighborListEntry(particleIdx, 0);
+  for (uint i = 1; i <= neighborCount; ++i)
+    accumulateNeighbor(
+        density,
+        gradSum,
+        gradSqSum,
+        particlePos,
+        getNeighborListEntry(particleIdx, i));
+#else
+  ivec3 gridCell = computeNeighborhoodBaseCell(particlePos);
+  for (int i = 0; i < 8; ++i) {
+    uint hash = hashCoords(gridCell.x + (i>>2), gridCell.y + ((i>>1)&1), gridCell.z + (i&1));
+    uint rangeStart, rangeEnd;
+    getCellRange(hash % simUniforms.spatialHashSize, rangeStart, rangeEnd);
+
+    for (uint otherParticleIdx = rangeStart; otherParticleIdx < rangeEnd; ++otherParticleIdx) {
+      if (otherParticleIdx != globalParticleIdx)
+        accumulateNeighbor(
+            density,
+            gradSum,
+            gradSqSum,
+            particlePos,
+            otherParticleIdx);
+    }
+  }
+#endif
+
+  getEntryLambda(globalParticleIdx) =
+      computeLambda(density, gradSum, gradSqSum);
+#endif
+}
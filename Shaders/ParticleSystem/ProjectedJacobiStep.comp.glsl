@@ -3,20 +3,14 @@
 
 #define PI 3.14159265359
 
-// Need to reduce this...
-#define CAMERA_RADIUS 10.0
-#define CAMERA_STRENGTH -0.0001
-
 #extension GL_KHR_shader_subgroup_basic : enable
-#extension GL_KHR_shader_subgroup_shuffle : enable
 #extension GL_KHR_shader_subgroup_arithmetic : enable 
 
-layout(local_size_x = LOCAL_SIZE_X) in;
+#include "SimSpecialization.glsl"
 
 #include "SimResources.glsl"
 #include <Misc/Input.glsl>
 
-// shared uint[LOCAL_SIZE_X] ss
 #define getPosition(globalParticleIdx)      \
     getParticleEntry(globalParticleIdx).positions[pushConstants.iteration % 2].xyz;
 
@@ -24,30 +18,56 @@ layout(local_size_x = LOCAL_SIZE_X) in;
   {getParticleEntry(globalParticleIdx).positions[(pushConstants.iteration + 1) % 2].xyz = pos;}
 
 #include "PBFluids.glsl"
+#include "ParticleCollision.glsl"
 
-void checkPair(inout vec3 relPos, inout float partialDensity, vec3 particlePos, uint particleIdx, vec3 otherParticlePos, uint otherParticleIdx)
-{
-  vec3 diff = otherParticlePos - particlePos;// - 0.1 * deltaPos;
-  float distSq = dot(diff, diff);
+// One Jacobi iteration, every particle is updated from the previous iterate
+// of its neighbours. With PBF_DENSITY the update is the position-based fluids
+// density correction, from the lambdas PbfLambda.comp.glsl just computed off
+// the same iterate. Otherwise it is the sphere contact projection, same as
+// the Gauss-Seidel step.
 
-  partialDensity = 0.0;
+#ifdef PBF_DENSITY
+#define getLambda(globalParticleIdx) getEntryLambda(globalParticleIdx)
+#else
+#define getLambda(globalParticleIdx) 0.0
+#endif
 
-  float r = 2.0 * simUniforms.particleRadius;//0.5 * simUniforms.particleRadius;
-  float r2 = r * r;
-  if (distSq < r2) 
+void checkPair(out vec3 deltaPos, out uint contact, vec3 particlePos, float lambda, vec3 otherParticlePos, float otherLambda)
+{
+  deltaPos = vec3(0.0);
+  contact = 0;
+
+#ifdef PBF_DENSITY
+  // (lambda_i + lambda_j + s_corr) * grad W, scaled by the rest density once
+  // all neighbours are summed
+  vec3 r = particlePos - otherParticlePos;
+  float distSq = dot(r, r);
+  float h = simUniforms.pbf.kernelRadius;
+  if (distSq < h * h)
   {
-    relPos = diff * smoothingKernelDeriv(r2, distSq);
-    partialDensity = smoothingKernel(r2, distSq);
+    deltaPos = (lambda + otherLambda + tensileCorrection(distSq)) * spikyKernelGrad(r, distSq);
+    contact = 1;
   }
+#else
+  checkParticleCollision(deltaPos, contact, particlePos, otherParticlePos);
+#endif
 }
 
-// Assuming subgroup size of 32
+// The pairs of each cell are spread over the subgroup as tasks, staged in
+// shared memory. Shared memory is split per thread rather than per subgroup,
+// so the split works for any subgroup size: each subgroup owns the slices of
+// its own lanes, which are consecutive local invocations, and every thread's
+// slice holds TASKS_PER_THREAD tasks. The shared arrays only depend on
+// LOCAL_SIZE_X, which the host raises to at least the device's subgroup size
+// so no subgroup runs with idle lanes. Both come from SimSpecialization.glsl.
+
 struct ThisParticle
 {
   vec3 pos;
   uint particleIdx;
+  float lambda;
 };
-shared ThisParticle thisParticle[32];
+shared ThisParticle thisParticle[LOCAL_SIZE_X];
 
 struct TaskInput {
   uint originalThreadId;
@@ -55,15 +75,12 @@ struct TaskInput {
 };
 
 struct TaskOutput {
-  vec3 relPos;
-  float partialDensity;
+  vec3 deltaPos;
+  uint contact;
 };
 
-// TODO: Use a smaller size and refuse to process more than that many?
-// Or have a fallback??
-// 32 * 16 = 512
-shared TaskInput taskInputs[512];
-shared TaskOutput taskOutputs[512];
+shared TaskInput taskInputs[LOCAL_SIZE_X * TASKS_PER_THREAD];
+shared TaskOutput taskOutputs[LOCAL_SIZE_X * TASKS_PER_THREAD];
 
 void processTask(uint taskId)
 {
@@ -72,74 +89,89 @@ void processTask(uint taskId)
 
   vec3 otherParticlePos = getPosition(inp.otherParticleIdx);
   
-  TaskOutput outp = TaskOutput(vec3(0.0), 0);
+  TaskOutput outp = TaskOutput(vec3(0.0), 0u);
   
   if (particle.particleIdx != inp.otherParticleIdx)
     checkPair(
-        outp.relPos, 
-        outp.partialDensity, 
+        outp.deltaPos, 
+        outp.contact, 
         particle.pos, 
-        particle.particleIdx, 
+        particle.lambda, 
         otherParticlePos, 
-        inp.otherParticleIdx);
+        getLambda(inp.otherParticleIdx));
 
   taskOutputs[taskId] = outp;  
 }
 
-void checkBucket(inout vec3 deltaPos, inout float density, inout uint collidingParticlesCount, vec3 particlePos, uint thisParticleIdx, uint bucketEnd)
+void checkBucket2(inout vec3 deltaPos, inout uint contactCount, vec3 particlePos, uint thisParticleIdx, float lambda, uint bucketStart, uint bucketEnd);
+
+void checkBucket(inout vec3 deltaPos, inout uint contactCount, vec3 particlePos, uint thisParticleIdx, float lambda, uint bucketStart, uint bucketEnd)
 {
-  uint threadId = gl_SubgroupInvocationID;
-  
-  // TODO: Can move this step to main function, is not bucket-specific
-  // Make this particle position visible to other threads
+  uint threadId = gl_LocalInvocationID.x;
+
+  // The subgroup's slice of the task arrays starts at its first lane's. Lanes
+  // past the end of the workgroup don't exist, lanes past the particle count
+  // have already returned and take no tasks.
+  uint subgroupFirstThread = threadId - gl_SubgroupInvocationID;
+  uint subgroupThreads =
+      min(gl_SubgroupSize, LOCAL_SIZE_X - subgroupFirstThread);
+  uint taskCapacity = subgroupThreads * TASKS_PER_THREAD;
+  uint taskBase = subgroupFirstThread * TASKS_PER_THREAD;
 
-  uint bucketStart = bucketEnd & ~0xF;
-  uint particleCount = bucketEnd == INVALID_INDEX ? 0 : (bucketEnd & 0xF); // ??
+  uint particleCount = bucketEnd - bucketStart;
 
   // TODO: Just to be safe... try without this later...
   subgroupBarrier();
 
+  // Uniform across the subgroup
   uint taskStart = subgroupExclusiveAdd(particleCount);
   uint taskEnd = taskStart + particleCount;
-  uint taskCount = subgroupShuffle(taskEnd, gl_SubgroupSize-1);
+  uint taskCount = subgroupAdd(particleCount);
+  if (taskCount == 0)
+    return;
 
-  uint iters = (taskCount-1) / gl_SubgroupSize + 1;
+  // Cells from the prefix-sum build are not capped at PARTICLES_PER_BUCKET and
+  // buckets can overflow into the next, if the subgroup's tasks don't fit in
+  // its slice, fall back to each thread walking its own cell
+  if (taskCount > taskCapacity)
+  {
+    checkBucket2(deltaPos, contactCount, particlePos, thisParticleIdx, lambda, bucketStart, bucketEnd);
+    return;
+  }
 
   // #pragma optionNV (unroll all)
   for (uint i = 0; i < particleCount; ++i)
   {
-    uint taskId = taskStart + i;
+    uint taskId = taskBase + taskStart + i;
     uint otherParticleIdx = bucketStart + i;
     taskInputs[taskId] = TaskInput(threadId, otherParticleIdx);
   }
 
   subgroupBarrier();
 
-  // for (uint taskId = threadId; taskId < taskCount; taskId += gl_SubgroupSize)
-  uint givenTaskStart = iters * threadId;
+  // Split the tasks evenly over the active lanes
+  uint activeLanes = subgroupAdd(1);
+  uint laneRank = subgroupExclusiveAdd(1);
+  uint iters = (taskCount - 1) / activeLanes + 1;
+  uint givenTaskStart = iters * laneRank;
   // #pragma optionNV (unroll all)
   for (uint taskId = givenTaskStart; taskId < min(givenTaskStart + iters, taskCount); ++taskId)
   {    
-    processTask(taskId);
+    processTask(taskBase + taskId);
   }
 
   subgroupBarrier();
   // #pragma optionNV (unroll all)
   for (uint i = taskStart; i < taskEnd; ++i)
   {
-    TaskOutput partialResult = taskOutputs[i];
-    if (partialResult.partialDensity > 0.0)
-    {
-      density += partialResult.partialDensity;
-      deltaPos += partialResult.relPos;
-      collidingParticlesCount++;
-    }
+    TaskOutput partialResult = taskOutputs[taskBase + i];
+    deltaPos += partialResult.deltaPos;
+    contactCount += partialResult.contact;
   }
 }
 
-void checkBucket2(inout vec3 deltaPos, inout float density, inout uint collidingParticlesCount, vec3 particlePos, uint thisParticleIdx, uint bucketEnd)
+void checkBucket2(inout vec3 deltaPos, inout uint contactCount, vec3 particlePos, uint thisParticleIdx, float lambda, uint bucketStart, uint bucketEnd)
 {
-  uint bucketStart = bucketEnd & ~0xF;
   for (uint globalParticleIdx = bucketStart; globalParticleIdx < bucketEnd; ++globalParticleIdx)
   {
     // Check any valid particle pairs in the bucket
@@ -147,146 +179,87 @@ void checkBucket2(inout vec3 deltaPos, inout float density, inout uint colliding
     {
       vec3 otherParticlePos = getPosition(globalParticleIdx);
       vec3 dp;
-      float d;
+      uint contact;
 
       checkPair(
           dp, 
-          d, 
+          contact, 
           particlePos, 
-          thisParticleIdx, 
+          lambda, 
           otherParticlePos, 
-          globalParticleIdx);
-      if (d > 0.0) {
-        deltaPos += dp;
-        density += d;
-        collidingParticlesCount++;
-      }
-    }
-  }
-}
-
-void checkWallCollisions(inout vec3 deltaPos, inout uint collidingParticlesCount, vec3 particlePos)
-{
-  float k = 1.0;// / float(jacobiIters);
-
-  float wallBias = 1.0;
-
-  vec3 gridLength =  vec3(60.0);
-  if (simUniforms.liveValues.checkbox1)
-    gridLength[0] = 60.0 * simUniforms.liveValues.slider1 + 20.0 * sin(0.25 * simUniforms.time);// 5.0
-  vec3 minPos = vec3(simUniforms.particleRadius);
-  vec3 maxPos = gridLength - vec3(simUniforms.particleRadius);
-  for (int i = 0; i < 3; ++i)
-  {
-    if (particlePos[i] <= minPos[i])
-    {
-      deltaPos[i] += (minPos[i] - particlePos[i]);
-      ++collidingParticlesCount;
-    }  
-
-    if (i != 1 && particlePos[i] >= maxPos[i])
-    {
-      deltaPos[i] -= (particlePos[i] - maxPos[i]);
-      ++collidingParticlesCount;
-    }
-  }
-
-  if (!simUniforms.liveValues.checkbox1 && bool(globals.inputMask & INPUT_BIT_LEFT_MOUSE))
-  {
-    // TODO: Create the projected cam position and upload in 
-    // uniforms, there is more flexibility that way and is probably
-    // more efficient
-    float camRadius = CAMERA_RADIUS;
-    float camRadiusSq = camRadius * camRadius;
-
-    vec3 cameraPos = globals.inverseView[3].xyz;
-    vec3 dir = normalize(-globals.inverseView[2].xyz);
-
-    // Solve for t to find whether and where the camera ray intersects the
-    // floor plane
-    // c.y + t * d.y = 0
-
-    float t = -1.0;
-    if (abs(dir.y) > 0.0001)
-    {
-      t = -cameraPos.y / dir.y;
-    } 
-
-    if (t < 0.0)
-    {
-      t = 10.0;
-      //return;
-    }
-
-    t = clamp(t, 0.0, 10.0);
-
-    vec3 userBallPos = cameraPos + t * dir;// + vec3(0.0, 5.0, 0.0);
-    vec3 camDiff = particlePos - userBallPos;
-    float camDistSq = dot(camDiff, camDiff) + 0.01;
-    if (camDistSq < camRadiusSq)
-    {
-      float camDist = sqrt(camDistSq);
-      if (camDistSq > 0.25 * camRadiusSq)
-      {
-        // if (bool(inputMask & INPUT_MASK_MOUSE_LEFT))
-          deltaPos += - 1.* camDiff / camDist / camDistSq;
-      }
-      else 
-      {
-        deltaPos += 5.0 * CAMERA_STRENGTH * camDistSq * camDiff / camDist;
-      }
-      // deltaPos += CAMERA_STRENGTH * camRadius * camDiff / camDist;
-      ++collidingParticlesCount;
+          getLambda(globalParticleIdx));
+      deltaPos += dp;
+      contactCount += contact;
     }
   }
 }
 
 void main() {
   uint particleIdx = uint(gl_GlobalInvocationID.x);
-  if (particleIdx >= simUniforms.particleCount) {
+  if (particleIdx >= simCounters.particleCount) {
     return;
   }
 
-  Particle particle = getParticle(particleIdx);
-  
-  uint globalParticleIdx = particle.globalIndex;
+  uint globalParticleIdx = getParticleGlobalIndex(particleIdx);
   vec3 particlePos = getPosition(globalParticleIdx);
+  float lambda = getLambda(globalParticleIdx);
+
+  // Sleeping particles skip their contacts, they are still checked against
+  // the walls and written back every iteration
+  bool asleep = isEntryAsleep(globalParticleIdx);
   
-  thisParticle[gl_SubgroupInvocationID] = ThisParticle(particlePos, globalParticleIdx);
-
-  vec3 gridPos = (simUniforms.worldToGrid * vec4(particlePos, 1.0)).xyz;
-  vec3 gridCellF = floor(gridPos);
-  ivec3 gridCell = ivec3(gridCellF);
-  vec3 cellLocalPos = gridPos - gridCellF;
-  if (cellLocalPos.x < 0.5)
-    --gridCell.x;
-  if (cellLocalPos.y < 0.5)
-    --gridCell.y;
-  if (cellLocalPos.z < 0.5)
-    --gridCell.z;
-
-  vec3 comSum = vec3(0.0);
-  float density = 0.0; // ??
-  uint collidingParticlesCount = 0;
-  bool anyParticleCollisions = false;
+  thisParticle[gl_LocalInvocationID.x] = ThisParticle(particlePos, globalParticleIdx, lambda);
+
+  vec3 contactDisp = vec3(0.0);
+  uint contactCount = 0;
+
+#ifdef NEIGHBOR_LISTS
+  // Only the particles that were within the skin radius when the list was
+  // built at the start of the substep can be in contact now
+  uint neighborCount = asleep ? 0 : getNeighborListEntry(particleIdx, 0);
+  for (uint i = 1; i <= neighborCount; ++i) {
+    uint otherParticleIdx = getNeighborListEntry(particleIdx, i);
+    vec3 otherParticlePos = getPosition(otherParticleIdx);
+    vec3 dp;
+    uint contact;
+
+    checkPair(
+        dp,
+        contact,
+        particlePos,
+        lambda,
+        otherParticlePos,
+        getLambda(otherParticleIdx));
+    contactDisp += dp;
+    contactCount += contact;
+  }
+#else
+  ivec3 gridCell = computeNeighborhoodBaseCell(particlePos);
 
   // The grid cell size is setup so that a particle could be colliding with
   // other particles from any of the 8 cells immediately surrounding it, so
   // check each one for potential collisions.
   for (int i = 0; i < 8; ++i) {
-    uint hash = hashCoords(gridCell.x + (i>>2), gridCell.y + ((i>>1)&1), gridCell.z + (i&1));
-    uint bucketEnd = getSpatialHashSlot(hash % simUniforms.spatialHashSize);
+    // Sleeping particles still take part in the subgroup's task split, with
+    // no tasks of their own
+    uint bucketStart = 0;
+    uint bucketEnd = 0;
+    if (!asleep) {
+      uint hash = hashCoords(gridCell.x + (i>>2), gridCell.y + ((i>>1)&1), gridCell.z + (i&1));
+      getCellRange(hash % simUniforms.spatialHashSize, bucketStart, bucketEnd);
+    }
     
-    //if (bucketEnd != INVALID_INDEX) 
     {
-      checkBucket(comSum, density, collidingParticlesCount, particlePos, globalParticleIdx, bucketEnd);
+      checkBucket(contactDisp, contactCount, particlePos, globalParticleIdx, lambda, bucketStart, bucketEnd);
     }
   }
-  
-  if (collidingParticlesCount > 0)
-    anyParticleCollisions = true;
+#endif
 
-  vec3 deltaPos = vec3(0.0);
+#ifdef PBF_DENSITY
+  vec3 deltaPos = contactDisp / simUniforms.pbf.restDensity;
+#else
+  vec3 deltaPos = contactDisp;
+#endif
 
   vec3 wallDisp = vec3(0.0);
   uint hasWallCollisions = 0;
@@ -296,22 +269,5 @@ void main() {
     deltaPos += 0.5 * wallDisp;
   }
 
-  if (collidingParticlesCount > 0)
-  {
-    float targetDensity = 0.2;
-    vec3 com = comSum / float(collidingParticlesCount + 1);
-    // deltaPos += 0.5 * (targetDensity - density) * com; 
-  }
-
-  float mag = length(deltaPos);
-  if (mag > 0.001)
-  {
-    // deltaPos /= mag;// + 0.0001;
-    // mag = clamp(mag, 0.0, 1. * simUniforms.particleRadius);
-    // deltaPos *= mag;
-
-    particlePos += deltaPos;
-  }
-
-  setPosition(globalParticleIdx, particlePos);
+  setPosition(globalParticleIdx, particlePos + deltaPos);
 }
@@ -8,6 +8,15 @@
 
 #define PARTICLES_PER_BUCKET 16
 
+#define NEIGHBOR_LIST_SIZE 32
+
+#define MORTON_BITS_PER_AXIS 7
+#define MORTON_KEY_COUNT (1 << (3 * MORTON_BITS_PER_AXIS))
+
+// Per-particle storage grows a chunk of particlesPerBuffer particles at a
+// time, see SimChunk in ParticleSystem.h
+#define MAX_SIM_CHUNKS 128
+
 #define INPUT_MASK_MOUSE_LEFT 1
 #define INPUT_MASK_MOUSE_RIGHT 2
 #define INPUT_MASK_SPACEBAR 4
@@ -21,6 +30,8 @@ layout(push_constant) uniform PushConstant {
   uint globalUniformsHandle;
   uint simUniformsHandle;
   uint iteration; // TODO: This is hacky, sort out how to do multiple push constants...
+  uint hashEpoch;
+  uint simStep;
 } pushConstants;
 
 #define resources RESOURCE(globalResources, pushConstants.globalResourcesHandle)
@@ -33,14 +44,29 @@ struct LiveValues {
   bool checkbox2;
 };
 
+// Position-based fluids density constraint, mirrors PbfParams in
+// ParticleSystem.h
+struct PbfParams {
+  float kernelRadius;
+  float poly6Scale;
+  float spikyGradScale;
+  float restDensity;
+
+  float relaxation;
+  float tensileStrength;
+  float tensileInvKernel;
+  uint padding;
+};
+
 UNIFORM_BUFFER(_simUniforms, SimUniforms{
   mat4 gridToWorld;
   mat4 worldToGrid;
+  mat4 hiZViewProjection;
 
   vec3 interactionLocation;
-  uint padding;
+  float renderDelay;
   
-  uint particleCount;
+  uint particleCapacity;
   uint particlesPerBuffer;
   uint spatialHashSize;
   uint spatialHashEntriesPerBuffer;
@@ -55,15 +81,136 @@ UNIFORM_BUFFER(_simUniforms, SimUniforms{
   uint particleBucketsPerBuffer;
   uint freeListsCount;
 
-  uint particlesHeap;
-  uint spatialHashHeap;
-  uint bucketHeap;
   uint nextFreeBucket;
+  uint particleEntriesPerBuffer;
+  uint scanBlockSums;
+  uint chunkCount;
+
+  uint mortonKeyCounts;
+  uint padding0;
+  float neighborSkinRadius;
+  uint hashTelemetry;
+
+  uint simCounters;
+  uint resetParticles;
+  uint particleIndexCount;
+  uint spawnSeed;
+
+  vec3 killBoundsMin;
+  float sleepSpeed;
+  vec3 killBoundsMax;
+  uint sleepSubsteps;
+
+  PbfParams pbf;
+
+  uint screenWidth;
+  uint screenHeight;
+  uint hiZ;
+  uint hiZDepthIndex;
+
+  uint hiZLevelCount;
+  uint cullParticles;
+  uint cullOcclusion;
+  uint fluidDepth;
+
+  float fluidSmoothingRadius;
+  float fluidDepthRange;
+  uint fluidSurface;
+  uint padding;
+
+  // First heap handle of each sim chunk
+  uvec4 chunkHandles[MAX_SIM_CHUNKS / 4];
 
   LiveValues liveValues;
 });
 #define simUniforms _simUniforms[pushConstants.simUniformsHandle]
 
+// The buffers of each sim chunk take consecutive heap handles, in the order
+// ParticleSystem::_addSimChunk creates them. Each chunk's buffers are found
+// from its first handle with these offsets.
+#ifdef PARTICLE_LAYOUT_SOA
+#define CHUNK_POSITIONS_OFFSET 0
+#define CHUNK_PREV_POSITIONS_OFFSET 1
+#define CHUNK_GLOBAL_INDICES_OFFSET 2
+#define CHUNK_DEBUG_OFFSET 3
+#define CHUNK_STEP_POSITIONS_OFFSET 4
+#define CHUNK_SPATIAL_HASH_OFFSET 5
+#else
+#define CHUNK_PARTICLES_OFFSET 0
+#define CHUNK_STEP_POSITIONS_OFFSET 1
+#define CHUNK_SPATIAL_HASH_OFFSET 2
+#endif
+// Bucket build
+#define CHUNK_EPOCHS_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 1)
+#define CHUNK_BUCKETS_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 2)
+#define CHUNK_SLOT_TELEMETRY_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 3)
+// Prefix-sum build
+#define CHUNK_CELL_START_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 1)
+#define CHUNK_PARTICLE_ENTRIES_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 2)
+// Optional buffers, after either build's buffers
+#ifdef HASH_TELEMETRY
+#define _CHUNK_OPTIONAL_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 4)
+#else
+#define _CHUNK_OPTIONAL_OFFSET (CHUNK_SPATIAL_HASH_OFFSET + 3)
+#endif
+#ifdef PARTICLE_CULLING
+#define CHUNK_VISIBLE_PARTICLES_OFFSET _CHUNK_OPTIONAL_OFFSET
+#define _CHUNK_NEIGHBOR_LISTS_OFFSET (_CHUNK_OPTIONAL_OFFSET + 1)
+#else
+#define _CHUNK_NEIGHBOR_LISTS_OFFSET _CHUNK_OPTIONAL_OFFSET
+#endif
+#ifdef NEIGHBOR_LISTS
+#define CHUNK_NEIGHBOR_LISTS_OFFSET _CHUNK_NEIGHBOR_LISTS_OFFSET
+#define _CHUNK_SLEEPING_OFFSET (_CHUNK_NEIGHBOR_LISTS_OFFSET + 1)
+#else
+#define _CHUNK_SLEEPING_OFFSET _CHUNK_NEIGHBOR_LISTS_OFFSET
+#endif
+#ifdef PARTICLE_SLEEPING
+#define CHUNK_CELL_MOTION_OFFSET _CHUNK_SLEEPING_OFFSET
+#define _CHUNK_PBF_OFFSET (_CHUNK_SLEEPING_OFFSET + 1)
+#else
+#define _CHUNK_PBF_OFFSET _CHUNK_SLEEPING_OFFSET
+#endif
+#ifdef PBF_DENSITY
+#define CHUNK_ENTRY_LAMBDAS_OFFSET _CHUNK_PBF_OFFSET
+#define CHUNK_REORDER_SCRATCH_OFFSET (_CHUNK_PBF_OFFSET + 1)
+#else
+#define CHUNK_REORDER_SCRATCH_OFFSET _CHUNK_PBF_OFFSET
+#endif
+// The compaction also scatters through the reorder scratch, so it's always
+// there when the live offsets are
+#define CHUNK_LIVE_OFFSETS_OFFSET (CHUNK_REORDER_SCRATCH_OFFSET + 1)
+
+// Live particle count and the indirect arguments sized by it, written by
+// UpdateSimCounters.comp.glsl at the start of every frame and only read after
+// that. Mirrors SimCounters in ParticleSystem.h.
+BUFFER_RW(_simCounters, SIM_COUNTERS{
+  // VkDispatchIndirectCommand, one thread per particle
+  uint particleDispatchX;
+  uint particleDispatchY;
+  uint particleDispatchZ;
+  uint particleCount;
+  // VkDrawIndexedIndirectCommand, one sphere instance per particle
+  uint particleIndexCount;
+  uint particleInstanceCount;
+  uint particleFirstIndex;
+  int particleVertexOffset;
+  uint particleFirstInstance;
+  // VkDrawIndirectCommand, one impostor quad per particle
+  uint particleImpostorVertexCount;
+  uint particleImpostorInstanceCount;
+  uint particleImpostorFirstVertex;
+  uint particleImpostorFirstInstance;
+  // Emitted this frame, the last particles of the live range
+  uint addedParticles;
+  // Particles the sim pass found asleep, summed over the step's substeps
+  uint sleepingParticles;
+});
+#define simCounters _simCounters[simUniforms.simCounters]
+
+#define getChunkHandle(chunkIdx, offset)                       \
+    (simUniforms.chunkHandles[(chunkIdx) >> 2][(chunkIdx) & 3] + (offset))
+
 // TODO: Would it be useful to have the previous pos cached here as well??
 struct ParticleBucketEntry {
   vec4 positions[2]; // ping pong buffer
@@ -80,26 +227,123 @@ struct Particle {
   uint debug;
 };
 
+BUFFER_RW(_particlePositionsHeap, PARTICLE_POSITIONS_BUFFER{
+  vec4 positions[];
+});
+#define _getParticleStreamElement(heap, chunkOffset, member, particleIdx) \
+    heap[                                                                 \
+      getChunkHandle(                                                     \
+        (particleIdx) / simUniforms.particlesPerBuffer,                   \
+        chunkOffset)]                                                     \
+        .member[                                                          \
+          (particleIdx) % simUniforms.particlesPerBuffer]
+
+// The solved position each particle started the current sim step from, kept
+// in its own stream with either layout. Only the sim pass's first substep
+// writes it and only the rendering reads it, so it isn't part of Particle and
+// the reorder and compaction, which run before that substep, don't move it.
+#define getParticleStepPosition(particleIdx)               \
+    _getParticleStreamElement(                             \
+      _particlePositionsHeap,                              \
+      CHUNK_STEP_POSITIONS_OFFSET,                         \
+      positions,                                           \
+      particleIdx).xyz
+
+#ifdef PARTICLE_LAYOUT_SOA
+// Structure-of-arrays layout, each field lives in its own heap so passes only
+// fetch the fields they touch
+BUFFER_RW(_particleIndicesHeap, PARTICLE_INDICES_BUFFER{
+  uint indices[];
+});
+#define getParticlePosition(particleIdx)                   \
+    _getParticleStreamElement(                             \
+      _particlePositionsHeap,                              \
+      CHUNK_POSITIONS_OFFSET,                              \
+      positions,                                           \
+      particleIdx).xyz
+#define getParticlePrevPosition(particleIdx)               \
+    _getParticleStreamElement(                             \
+      _particlePositionsHeap,                              \
+      CHUNK_PREV_POSITIONS_OFFSET,                         \
+      positions,                                           \
+      particleIdx).xyz
+#define getParticleGlobalIndex(particleIdx)                \
+    _getParticleStreamElement(                             \
+      _particleIndicesHeap,                                \
+      CHUNK_GLOBAL_INDICES_OFFSET,                         \
+      indices,                                             \
+      particleIdx)
+#define getParticleDebug(particleIdx)                      \
+    _getParticleStreamElement(                             \
+      _particleIndicesHeap,                                \
+      CHUNK_DEBUG_OFFSET,                                  \
+      indices,                                             \
+      particleIdx)
+#else
 BUFFER_RW(_particlesHeap, PARTICLES_BUFFER{
   Particle particles[];
 });
 #define getParticle(particleIdx)                    \
     _particlesHeap[                                 \
-      simUniforms.particlesHeap +                   \
-      (particleIdx) / simUniforms.particlesPerBuffer] \
+      getChunkHandle(                               \
+        (particleIdx) / simUniforms.particlesPerBuffer, \
+        CHUNK_PARTICLES_OFFSET)]                    \
         .particles[                                 \
           (particleIdx) % simUniforms.particlesPerBuffer]
+#define getParticlePosition(particleIdx) getParticle(particleIdx).position
+#define getParticlePrevPosition(particleIdx) getParticle(particleIdx).prevPosition
+#define getParticleGlobalIndex(particleIdx) getParticle(particleIdx).globalIndex
+#define getParticleDebug(particleIdx) getParticle(particleIdx).debug
+#endif
+
+// Whole-particle access, for passes that touch every field
+Particle loadParticle(uint particleIdx) {
+#ifdef PARTICLE_LAYOUT_SOA
+  return Particle(
+      getParticlePosition(particleIdx),
+      getParticleGlobalIndex(particleIdx),
+      getParticlePrevPosition(particleIdx),
+      getParticleDebug(particleIdx));
+#else
+  return getParticle(particleIdx);
+#endif
+}
+
+void storeParticle(uint particleIdx, Particle particle) {
+#ifdef PARTICLE_LAYOUT_SOA
+  getParticlePosition(particleIdx) = particle.position;
+  getParticleGlobalIndex(particleIdx) = particle.globalIndex;
+  getParticlePrevPosition(particleIdx) = particle.prevPosition;
+  getParticleDebug(particleIdx) = particle.debug;
+#else
+  getParticle(particleIdx) = particle;
+#endif
+}
 
 BUFFER_RW(_spatialHashHeap, SPATIAL_HASH_HEAP{
   uint spatialHash[];
 });
 #define getSpatialHashSlot(slotIdx)                    \
     _spatialHashHeap[                                       \
-      simUniforms.spatialHashHeap +                         \
-      (slotIdx) / simUniforms.spatialHashEntriesPerBuffer]    \
+      getChunkHandle(                                       \
+        (slotIdx) / simUniforms.spatialHashEntriesPerBuffer,  \
+        CHUNK_SPATIAL_HASH_OFFSET)]                         \
         .spatialHash[                                       \
           (slotIdx) % simUniforms.spatialHashEntriesPerBuffer]
 
+// Bucket build only: the substep each slot was last touched in. Slots tagged
+// with an older epoch read as empty, so the hash never needs to be cleared.
+BUFFER_RW(_spatialHashEpochHeap, SPATIAL_HASH_EPOCH_HEAP{
+  uint epochs[];
+});
+#define getSpatialHashEpoch(slotIdx)                          \
+    _spatialHashEpochHeap[                                    \
+      getChunkHandle(                                         \
+        (slotIdx) / simUniforms.spatialHashEntriesPerBuffer,  \
+        CHUNK_EPOCHS_OFFSET)]                                 \
+        .epochs[                                              \
+          (slotIdx) % simUniforms.spatialHashEntriesPerBuffer]
+
 // TODO: These should probably be heaps as well??
 BUFFER_RW(_nextFreeBucket, NEXT_FREE_BUCKET{
   uint freeList[];
@@ -112,15 +356,287 @@ BUFFER_RW(_bucketHeap, PARTICLE_BUCKETS{
 });
 #define getBucket(bucketIdx)                            \
     _bucketHeap[                                        \
-      simUniforms.bucketHeap +                 \
-      (bucketIdx) / simUniforms.particleBucketsPerBuffer] \
+      getChunkHandle(                                   \
+        (bucketIdx) / simUniforms.particleBucketsPerBuffer, \
+        CHUNK_BUCKETS_OFFSET)]                          \
         .buckets[                                       \
           (bucketIdx) % simUniforms.particleBucketsPerBuffer]
 
+#ifdef HASH_TELEMETRY
+// Bucket build telemetry, summed over a frame's substeps by the bucket alloc
+// and insert passes. Mirrors HashTelemetry in ParticleSystem.h.
+BUFFER_RW(_hashTelemetry, HASH_TELEMETRY_STATS{
+  uint occupiedSlots;
+  uint collidingSlots;
+  uint collidedParticles;
+  uint overfullSlots;
+  uint overflowedParticles;
+  uint maxSlotParticles;
+  uint padding[2];
+  uint freeListAllocs[];
+});
+#define hashTelemetry _hashTelemetry[simUniforms.hashTelemetry]
+
+// Per-slot scratch for the insert pass, reset by the bucket alloc pass for
+// every occupied slot. x holds a key for the first cell inserted into the
+// slot, with the top bit set once another cell shows up. y counts the
+// particles inserted.
+BUFFER_RW(_slotTelemetryHeap, SLOT_TELEMETRY_HEAP{
+  uvec2 slots[];
+});
+#define getSlotTelemetry(slotIdx)                             \
+    _slotTelemetryHeap[                                       \
+      getChunkHandle(                                         \
+        (slotIdx) / simUniforms.spatialHashEntriesPerBuffer,  \
+        CHUNK_SLOT_TELEMETRY_OFFSET)]                         \
+        .slots[                                               \
+          (slotIdx) % simUniforms.spatialHashEntriesPerBuffer]
+#endif
+
+// Prefix-sum build only: after the scan and scatter passes, slot i holds the
+// index of the first particle entry of cell i, and slot i+1 holds the end of
+// its range. Each chunk holds one extra entry, only the last chunk's is used
+// for the end of the last range.
+BUFFER_RW(_cellStartHeap, CELL_START_HEAP{
+  uint cellStart[];
+});
+#define _getCellStartChunk(slotIdx)                           \
+    min(                                                      \
+      (slotIdx) / simUniforms.spatialHashEntriesPerBuffer,    \
+      simUniforms.chunkCount - 1)
+#define getCellStart(slotIdx)                                 \
+    _cellStartHeap[                                           \
+      getChunkHandle(                                         \
+        _getCellStartChunk(slotIdx),                          \
+        CHUNK_CELL_START_OFFSET)]                             \
+        .cellStart[                                           \
+          (slotIdx) -                                         \
+          _getCellStartChunk(slotIdx) *                       \
+            simUniforms.spatialHashEntriesPerBuffer]
+
+BUFFER_RW(_scanBlockSums, SCAN_BLOCK_SUMS{
+  uint blockSums[];
+});
+#define getScanBlockSum(blockIdx)  \
+    _scanBlockSums[simUniforms.scanBlockSums].blockSums[blockIdx]
+
+// Morton reorder only: particle counts per Morton key, scanned in place into
+// the start of each key's range. The key space is fixed, so these don't grow
+// with the particle count.
+BUFFER_RW(_mortonKeyCounts, MORTON_KEY_COUNTS{
+  uint keyCounts[];
+});
+#define getMortonKeyCount(key)  \
+    _mortonKeyCounts[simUniforms.mortonKeyCounts].keyCounts[key]
+
+// The reordered or compacted particles are staged here in AoS layout,
+// whatever the particle layout is
+BUFFER_RW(_reorderScratchHeap, REORDER_SCRATCH_HEAP{
+  Particle particles[];
+});
+#define getReorderScratch(particleIdx)                        \
+    _reorderScratchHeap[                                      \
+      getChunkHandle(                                         \
+        (particleIdx) / simUniforms.particlesPerBuffer,       \
+        CHUNK_REORDER_SCRATCH_OFFSET)]                        \
+        .particles[                                           \
+          (particleIdx) % simUniforms.particlesPerBuffer]
+
+// Compaction only: 1 for each live particle, scanned in place into the number
+// of live particles up to and including each one
+BUFFER_RW(_liveOffsetsHeap, LIVE_OFFSETS_HEAP{
+  uint offsets[];
+});
+#define getLiveOffset(particleIdx)                            \
+    _liveOffsetsHeap[                                         \
+      getChunkHandle(                                         \
+        (particleIdx) / simUniforms.particlesPerBuffer,       \
+        CHUNK_LIVE_OFFSETS_OFFSET)]                           \
+        .offsets[                                             \
+          (particleIdx) % simUniforms.particlesPerBuffer]
+
+// Particles that left the kill bounds are removed by the next compaction. NaN
+// positions fail both tests. Same test as isParticleDead in
+// ParticleCompaction.h.
+bool isParticleDead(vec3 position) {
+  return !all(greaterThanEqual(position, simUniforms.killBoundsMin)) ||
+         !all(lessThanEqual(position, simUniforms.killBoundsMax));
+}
+
+#ifdef PARTICLE_SLEEPING
+// The last substep, by hash epoch, a moving particle was near each spatial
+// hash slot. Particles in slots that haven't seen motion for sleepSubsteps
+// substeps, and that aren't moving themselves, fall asleep. Like the hash
+// epochs these are never cleared, only on epoch wrap-around.
+BUFFER_RW(_cellMotionHeap, CELL_MOTION_HEAP{
+  uint epochs[];
+});
+#define getCellMotionEpoch(slotIdx)                           \
+    _cellMotionHeap[                                          \
+      getChunkHandle(                                         \
+        (slotIdx) / simUniforms.spatialHashEntriesPerBuffer,  \
+        CHUNK_CELL_MOTION_OFFSET)]                            \
+        .epochs[                                              \
+          (slotIdx) % simUniforms.spatialHashEntriesPerBuffer]
+
+// The sim pass flags sleeping particles in the top bit of the cell hash it
+// hands to the insert pass, which moves the flag to w of the entry's phase 0
+// position. The solvers skip the contacts of sleeping entries.
+#define SLEEPING_BIT 0x80000000
+#define isEntryAsleep(globalParticleIdx) \
+    (getParticleEntry(globalParticleIdx).positions[0].w != 0.0)
+#else
+#define isEntryAsleep(globalParticleIdx) false
+#endif
+
+#ifdef NEIGHBOR_LISTS
+// The bucket-entry indices of the particles near each particle, rebuilt once
+// per substep. Entry 0 of each list holds the neighbour count.
+BUFFER_RW(_neighborListHeap, NEIGHBOR_LIST_HEAP{
+  uint entries[];
+});
+#define getNeighborListEntry(particleIdx, entryIdx)           \
+    _neighborListHeap[                                        \
+      getChunkHandle(                                         \
+        (particleIdx) / simUniforms.particlesPerBuffer,       \
+        CHUNK_NEIGHBOR_LISTS_OFFSET)]                         \
+        .entries[                                             \
+          ((particleIdx) % simUniforms.particlesPerBuffer) *  \
+            NEIGHBOR_LIST_SIZE +                              \
+          (entryIdx)]
+#endif
+
+#ifdef PARTICLE_CULLING
+// The particles that survived culling, compacted in no particular order. The
+// particle draws index it by instance, see ParticleCull.comp.glsl.
+BUFFER_RW(_visibleParticlesHeap, VISIBLE_PARTICLES_HEAP{
+  uint particles[];
+});
+#define getVisibleParticle(instanceIdx)                       \
+    _visibleParticlesHeap[                                    \
+      getChunkHandle(                                         \
+        (instanceIdx) / simUniforms.particlesPerBuffer,       \
+        CHUNK_VISIBLE_PARTICLES_OFFSET)]                      \
+        .particles[                                           \
+          (instanceIdx) % simUniforms.particlesPerBuffer]
+
+// Max depth pyramid of the previous frame's GBuffer depth, every level
+// packed row by row after the previous one. Level 0 is half the depth's
+// resolution, each texel covers 2x2 texels of the level below.
+BUFFER_RW(_hiZHeap, HI_Z_HEAP{
+  float depths[];
+});
+
+uvec2 getHiZLevelSize(uint level) {
+  uvec2 depthSize = uvec2(simUniforms.screenWidth, simUniforms.screenHeight);
+  return (depthSize + (2u << level) - 1) >> (level + 1);
+}
+
+uint getHiZLevelOffset(uint level) {
+  uint offset = 0;
+  for (uint i = 0; i < level; ++i) {
+    uvec2 size = getHiZLevelSize(i);
+    offset += size.x * size.y;
+  }
+  return offset;
+}
+
+#define getHiZ(levelOffset, levelSize, texel)                 \
+    _hiZHeap[simUniforms.hiZ]                                 \
+        .depths[(levelOffset) + (texel).y * (levelSize).x + (texel).x]
+#endif
+
+#ifdef PBF_DENSITY
+// The position-based fluids multiplier of each particle entry, indexed like
+// the entries and rewritten every Jacobi iteration by PbfLambda.comp.glsl
+BUFFER_RW(_entryLambdaHeap, ENTRY_LAMBDA_HEAP{
+  float lambdas[];
+});
+#ifdef SPATIAL_HASH_PREFIX_SUM
+#define _ENTRIES_PER_CHUNK simUniforms.particleEntriesPerBuffer
+#else
+#define _ENTRIES_PER_CHUNK \
+    (simUniforms.particleBucketsPerBuffer * PARTICLES_PER_BUCKET)
+#endif
+#define getEntryLambda(globalParticleIdx)                     \
+    _entryLambdaHeap[                                         \
+      getChunkHandle(                                         \
+        (globalParticleIdx) / _ENTRIES_PER_CHUNK,             \
+        CHUNK_ENTRY_LAMBDAS_OFFSET)]                          \
+        .lambdas[                                             \
+          (globalParticleIdx) % _ENTRIES_PER_CHUNK]
+#endif
+
+// Cells are one particle diameter wide, so every particle a particle can touch
+// lies in the 2x2x2 block of cells around the cell corner nearest to it.
+// Returns the min corner cell of that block.
+ivec3 computeNeighborhoodBaseCell(vec3 pos) {
+  vec3 gridPos = (simUniforms.worldToGrid * vec4(pos, 1.0)).xyz;
+  vec3 gridCellF = floor(gridPos);
+  ivec3 gridCell = ivec3(gridCellF);
+  vec3 cellLocalPos = gridPos - gridCellF;
+  if (cellLocalPos.x < 0.5)
+    --gridCell.x;
+  if (cellLocalPos.y < 0.5)
+    --gridCell.y;
+  if (cellLocalPos.z < 0.5)
+    --gridCell.z;
+
+  return gridCell;
+}
+
+// 8-colouring of the grid by cell coordinate parity. Cells of the same colour
+// are at least a cell apart, so particles hashed into different cells of the
+// same colour can't be in contact.
+#define CELL_COLOR_COUNT 8
+uint computeCellColor(vec3 pos) {
+  vec3 gridPos = (simUniforms.worldToGrid * vec4(pos, 1.0)).xyz;
+  uvec3 parity = uvec3(ivec3(floor(gridPos))) & 1;
+  return parity.x | (parity.y << 1) | (parity.z << 2);
+}
+
+// Spreads the low 10 bits of v out to every third bit
+uint expandMortonBits(uint v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// Z-order key of the block containing pos. The kill bounds, the only space
+// particles live in, are split into 2^MORTON_BITS_PER_AXIS blocks along each
+// axis so no two distant blocks share a key. Positions outside are clamped to
+// the edge blocks, the next compaction removes them anyway.
+uint computeMortonKey(vec3 pos) {
+  float blocksPerAxis = float(1 << MORTON_BITS_PER_AXIS);
+  vec3 boundsPos = (pos - simUniforms.killBoundsMin) /
+                   (simUniforms.killBoundsMax - simUniforms.killBoundsMin);
+  uvec3 block =
+      uvec3(clamp(boundsPos * blocksPerAxis, 0.0, blocksPerAxis - 1.0));
+  return expandMortonBits(block.x) |
+         (expandMortonBits(block.y) << 1) |
+         (expandMortonBits(block.z) << 2);
+}
+
+#ifdef SPATIAL_HASH_PREFIX_SUM
+// Particle entries are densely packed, sorted by spatial hash slot
+BUFFER_RW(_particleEntryHeap, PARTICLE_ENTRIES{
+  ParticleBucketEntry entries[];
+});
+#define getParticleEntry(globalParticleIdx)                     \
+    _particleEntryHeap[                                         \
+      getChunkHandle(                                           \
+        (globalParticleIdx) / simUniforms.particleEntriesPerBuffer, \
+        CHUNK_PARTICLE_ENTRIES_OFFSET)]                         \
+        .entries[                                               \
+          (globalParticleIdx) % simUniforms.particleEntriesPerBuffer]
+#else
 // A "u32 globalParticleIdx" has a bottom 4-bits representing a bucket-local
 // index (0-15), the rest of the bits are the index of the bucket itself
 #define getParticleEntry(globalParticleIdx)        \
     getBucket((globalParticleIdx) >> 4).particles[(globalParticleIdx) & 0xF]
+#endif
 
 // #define getPosition(globalParticleIdx, phase)      \\
 //     getParticleEntry(globalParticleIdx).positions[phase].xyz;
@@ -136,13 +652,30 @@ void setPosition(uint globalParticleIdx, vec3 pos, uint phase) {
   getParticleEntry(globalParticleIdx).positions[phase].xyz = pos;
 }
 
+// The phase of each particle entry holding the solver's final position once
+// the substep's iterations are done. The Gauss-Seidel sweeps leave it in phase
+// 1 and the position before the last update in phase 0.
+uint getSolvedPhase() {
+#ifdef SOLVER_GAUSS_SEIDEL
+  return 1;
+#else
+  return simUniforms.jacobiIters % 2;
+#endif
+}
+
 // Increment the particle count of a cell, called during the 
 // pre-sizing pass. Returns the slot idx of the grid cell
 uint incrementCellParticleCount(int i, int j, int k) {
   uint gridCellHash = hashCoords(i, j, k);
   uint slotIdx = gridCellHash % simUniforms.spatialHashSize;
   
+#ifdef SPATIAL_HASH_PREFIX_SUM
   atomicAdd(getSpatialHashSlot(slotIdx), 1);
+#else
+  // The bucket build only cares whether a cell is occupied, tag the slot as
+  // live for this substep
+  getSpatialHashEpoch(slotIdx) = pushConstants.hashEpoch;
+#endif
 
   return slotIdx;
 }
@@ -150,23 +683,34 @@ uint incrementCellParticleCount(int i, int j, int k) {
 // This should get called after the sizing-pass, each cell with a non-zero
 // amount of particles gets dynamically allocated a fixed-size particle bucket
 void allocateBucketForCell(uint slotIdx) {
-  uint particleCount = getSpatialHashSlot(slotIdx);
-
-  if (particleCount != INVALID_INDEX) {
+  if (getSpatialHashEpoch(slotIdx) == pushConstants.hashEpoch) {
     uint freeListIdx = slotIdx % simUniforms.freeListsCount;
-    // // TODO: Measure how much contention is seen here...
+    // HASH_TELEMETRY counts the allocations from each free list, to see how
+    // evenly they are spread
     uint freeListCounter = atomicAdd(getBucketFreeList(freeListIdx), 1);
     uint bucketIdx = (freeListCounter * simUniforms.freeListsCount + freeListIdx) % simUniforms.particleBucketCount;
     uint globalIdx = bucketIdx << 4;
 
     getSpatialHashSlot(slotIdx) = globalIdx;
+
+#ifdef HASH_TELEMETRY
+    atomicAdd(hashTelemetry.occupiedSlots, 1);
+    atomicAdd(hashTelemetry.freeListAllocs[freeListIdx], 1);
+    getSlotTelemetry(slotIdx) = uvec2(0);
+#endif
   }
 }
 
 uint hashInsertPosition(uint slotIdx, vec3 position) {
+#ifdef SPATIAL_HASH_PREFIX_SUM
+  // After the scan each slot holds the end of its cell's range, fill the range
+  // back to front so the slot is left holding the start of the range
+  uint particleGlobalIdx = atomicAdd(getCellStart(slotIdx), INVALID_INDEX) - 1;
+#else
   // Bump-allocates a particle entry within the bucket that 
   // exists in this hash slot
   uint particleGlobalIdx = atomicAdd(getSpatialHashSlot(slotIdx), 1);
+#endif
 
   // TODO: Understand this 0-phase?
   setPosition(particleGlobalIdx, position, 0);
@@ -174,6 +718,60 @@ uint hashInsertPosition(uint slotIdx, vec3 position) {
   return particleGlobalIdx;
 }
 
+#ifdef HASH_TELEMETRY
+// Records one insert into slotIdx, cellPos being the position the sim pass
+// hashed. Cells are told apart by their full hash before it is wrapped to the
+// hash size, distinct cells with the same full hash aren't counted.
+void recordHashInsert(uint slotIdx, vec3 cellPos) {
+  vec3 gridPos = (simUniforms.worldToGrid * vec4(cellPos, 1.0)).xyz;
+  ivec3 gridCell = ivec3(floor(gridPos));
+  // Never 0 and never uses the top bit
+  uint cellKey = hashCoords(gridCell.x, gridCell.y, gridCell.z) % 0x7FFFFFFF + 1;
+
+  uint firstKey = atomicCompSwap(getSlotTelemetry(slotIdx).x, 0, cellKey);
+  if (firstKey != 0 && (firstKey & 0x7FFFFFFF) != cellKey) {
+    atomicAdd(hashTelemetry.collidedParticles, 1);
+    // The first particle from another cell flags the slot
+    uint flags = atomicOr(getSlotTelemetry(slotIdx).x, 0x80000000);
+    if ((flags & 0x80000000) == 0)
+      atomicAdd(hashTelemetry.collidingSlots, 1);
+  }
+
+  uint slotParticles = atomicAdd(getSlotTelemetry(slotIdx).y, 1) + 1;
+  if (slotParticles > PARTICLES_PER_BUCKET) {
+    atomicAdd(hashTelemetry.overflowedParticles, 1);
+    if (slotParticles == PARTICLES_PER_BUCKET + 1)
+      atomicAdd(hashTelemetry.overfullSlots, 1);
+  }
+
+  // Check before the atomic, the max rarely changes once a few slots are in
+  if (slotParticles > hashTelemetry.maxSlotParticles)
+    atomicMax(hashTelemetry.maxSlotParticles, slotParticles);
+}
+#endif
+
+// The range of particle entries inserted into a spatial hash slot during this
+// substep. A live bucket slot holds at least one entry, so the end of a full
+// bucket, which is the next bucket's start, still maps back to its own bucket.
+// Past PARTICLES_PER_BUCKET the count can't be told apart from the bucket
+// index, so an overflowing cell only finds its entries from the last bucket
+// boundary it crossed on.
+void getCellRange(uint slotIdx, out uint rangeStart, out uint rangeEnd) {
+#ifdef SPATIAL_HASH_PREFIX_SUM
+  rangeStart = getCellStart(slotIdx);
+  rangeEnd = getCellStart(slotIdx + 1);
+#else
+  if (getSpatialHashEpoch(slotIdx) != pushConstants.hashEpoch) {
+    rangeStart = 0;
+    rangeEnd = 0;
+  } else {
+    uint bucketEnd = getSpatialHashSlot(slotIdx);
+    rangeStart = (bucketEnd - 1) & ~0xF;
+    rangeEnd = bucketEnd;
+  }
+#endif
+}
+
 uint spatialHashAtomicExchange(int i, int j, int k, uint newValue) {
   uint gridCellHash = hashCoords(i, j, k);
   uint slotIdx = gridCellHash % simUniforms.spatialHashSize;
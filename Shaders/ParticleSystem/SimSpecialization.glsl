@@ -0,0 +1,27 @@
+#ifndef _SIMSPECIALIZATION_
+#define _SIMSPECIALIZATION_
+
+// Tunables of the sim passes, see SimSpecialization in ParticleSystem.h. The
+// host passes its values as the SIM_* defines, so each variant is compiled to
+// its own SPIR-V.
+//
+// Include before anything else, it declares the workgroup size. The one
+// single-threaded pass defines SIM_SINGLE_THREAD first, it still sees the
+// other passes' LOCAL_SIZE_X to size their indirect dispatches.
+
+#define LOCAL_SIZE_X SIM_LOCAL_SIZE_X
+
+#ifdef SIM_SINGLE_THREAD
+layout(local_size_x = 1) in;
+#else
+layout(local_size_x = LOCAL_SIZE_X) in;
+#endif
+
+// Neighbour tasks each thread of the Jacobi step holds in shared memory
+#define TASKS_PER_THREAD SIM_TASKS_PER_THREAD
+
+// Radius of the camera ray that pushes particles away while the left mouse
+// button is held
+#define CAMERA_RADIUS SIM_CAMERA_RADIUS
+
+#endif // _SIMSPECIALIZATION_
@@ -0,0 +1,50 @@
+
+#version 450
+
+#define SIM_SINGLE_THREAD
+#include "SimSpecialization.glsl"
+
+#include "SimResources.glsl"
+
+// Emits this frame's particles and sizes the indirect dispatches and draw for
+// the new particle count, so the CPU never needs to know it. A single thread,
+// dispatched before every other pass of each sim step. With AFTER_COMPACTION
+// it runs right after the compaction instead, and only the live particles are
+// kept. Only the frame's first sim step emits and resets.
+
+void main() {
+  uint particleCount = simCounters.particleCount;
+#ifdef AFTER_COMPACTION
+  if (particleCount > 0)
+    particleCount = getLiveOffset(particleCount - 1);
+#endif
+  bool firstStep = pushConstants.simStep == 0;
+  if (firstStep && bool(simUniforms.resetParticles))
+    particleCount = 0;
+
+  // Emission can't outgrow the chunks allocated so far
+  uint capacity = simUniforms.particleCapacity;
+  uint requestedParticles = firstStep ? simUniforms.addedParticles : 0;
+  uint addedParticles =
+      min(requestedParticles, capacity - min(particleCount, capacity));
+  particleCount += addedParticles;
+
+  simCounters.particleCount = particleCount;
+  simCounters.addedParticles = addedParticles;
+  simCounters.sleepingParticles = 0;
+
+  simCounters.particleDispatchX = (particleCount + LOCAL_SIZE_X - 1) / LOCAL_SIZE_X;
+  simCounters.particleDispatchY = 1;
+  simCounters.particleDispatchZ = 1;
+
+  simCounters.particleIndexCount = simUniforms.particleIndexCount;
+  simCounters.particleInstanceCount = particleCount;
+  simCounters.particleFirstIndex = 0;
+  simCounters.particleVertexOffset = 0;
+  simCounters.particleFirstInstance = 0;
+
+  simCounters.particleImpostorVertexCount = 6;
+  simCounters.particleImpostorInstanceCount = particleCount;
+  simCounters.particleImpostorFirstVertex = 0;
+  simCounters.particleImpostorFirstInstance = 0;
+}
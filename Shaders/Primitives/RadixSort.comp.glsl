@@ -0,0 +1,78 @@
+#version 460 core
+
+#include <Bindless/GlobalHeap.glsl>
+
+layout(local_size_x = LOCAL_SIZE_X) in;
+
+// One pass of a stable LSD radix sort of uint key-value pairs, see
+// GpuPrimitives.h. Each thread owns a tile of RADIX_ITEMS_PER_THREAD
+// consecutive pairs and the digit counts are laid out digit-major, i.e.
+// histogram[digit * tileCount + tileIdx]. An exclusive scan of the histogram
+// (Scan.comp.glsl) then gives each tile the destination of its first pair of
+// each digit, in tile order, which is what keeps the sort stable without any
+// ranking within a workgroup. Selected with SORT_STAGE:
+//  0: Count the digits of each tile
+//  1: Scatter each tile's pairs to the scanned offsets, in order
+
+#define RADIX_DIGIT_COUNT (1 << RADIX_BITS)
+
+layout(push_constant) uniform PushConstants {
+  uint keysIn;
+  uint valuesIn;
+  uint keysOut;
+  uint valuesOut;
+  uint histogram;
+  uint count;
+  uint digitShift;
+} pushConstants;
+
+BUFFER_RW(_sortBuffers, SORT_BUFFERS{
+  uint arr[];
+});
+
+#define getKeyIn(idx) RESOURCE(_sortBuffers, pushConstants.keysIn).arr[idx]
+#define getValueIn(idx) RESOURCE(_sortBuffers, pushConstants.valuesIn).arr[idx]
+#define getKeyOut(idx) RESOURCE(_sortBuffers, pushConstants.keysOut).arr[idx]
+#define getValueOut(idx)                                                       \
+  RESOURCE(_sortBuffers, pushConstants.valuesOut).arr[idx]
+#define getHistogram(idx)                                                      \
+  RESOURCE(_sortBuffers, pushConstants.histogram).arr[idx]
+
+uint getDigit(uint key) {
+  return (key >> pushConstants.digitShift) & (RADIX_DIGIT_COUNT - 1);
+}
+
+void main() {
+  uint count = pushConstants.count;
+  uint tileCount = (count - 1) / RADIX_ITEMS_PER_THREAD + 1;
+  uint tileIdx = uint(gl_GlobalInvocationID.x);
+  if (tileIdx >= tileCount) {
+    return;
+  }
+
+  uint firstIdx = tileIdx * RADIX_ITEMS_PER_THREAD;
+  uint lastIdx = min(firstIdx + RADIX_ITEMS_PER_THREAD, count);
+
+#if SORT_STAGE == 0
+  uint digitCounts[RADIX_DIGIT_COUNT];
+  for (uint digit = 0; digit < RADIX_DIGIT_COUNT; ++digit)
+    digitCounts[digit] = 0;
+
+  for (uint idx = firstIdx; idx < lastIdx; ++idx)
+    ++digitCounts[getDigit(getKeyIn(idx))];
+
+  for (uint digit = 0; digit < RADIX_DIGIT_COUNT; ++digit)
+    getHistogram(digit * tileCount + tileIdx) = digitCounts[digit];
+#else
+  uint digitOffsets[RADIX_DIGIT_COUNT];
+  for (uint digit = 0; digit < RADIX_DIGIT_COUNT; ++digit)
+    digitOffsets[digit] = getHistogram(digit * tileCount + tileIdx);
+
+  for (uint idx = firstIdx; idx < lastIdx; ++idx) {
+    uint key = getKeyIn(idx);
+    uint dstIdx = digitOffsets[getDigit(key)]++;
+    getKeyOut(dstIdx) = key;
+    getValueOut(dstIdx) = getValueIn(idx);
+  }
+#endif
+}
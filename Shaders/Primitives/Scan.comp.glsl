@@ -0,0 +1,94 @@
+#version 460 core
+
+#include <Bindless/GlobalHeap.glsl>
+
+layout(local_size_x = LOCAL_SIZE_X) in;
+
+#include "Workgroup.glsl"
+
+// In-place exclusive prefix sum of a uint buffer, see GpuPrimitives.h. Same
+// three dispatches as the particle sim's CellScan.comp.glsl, selected with
+// SCAN_STAGE:
+//  0: Scan each block of SCAN_BLOCK_SIZE values locally, write the block
+//     totals
+//  1: A single workgroup turns the block totals into block offsets
+//  2: Add the block offsets back into each value, a workgroup per block
+
+layout(push_constant) uniform PushConstants {
+  uint values;
+  uint blockSums;
+  uint count;
+} pushConstants;
+
+BUFFER_RW(_scanValues, SCAN_VALUES{
+  uint arr[];
+});
+
+#define SCAN_BLOCK_SIZE (LOCAL_SIZE_X * SCAN_ITEMS_PER_THREAD)
+
+#define getValue(idx) RESOURCE(_scanValues, pushConstants.values).arr[idx]
+#define getBlockSum(idx) RESOURCE(_scanValues, pushConstants.blockSums).arr[idx]
+
+void main() {
+  uint threadId = gl_LocalInvocationID.x;
+  uint count = pushConstants.count;
+
+  // Note: No early-outs before workgroupExclusiveAdd, every thread needs to
+  // reach the barriers
+#if SCAN_STAGE == 0
+  uint blockIdx = gl_WorkGroupID.x;
+  uint firstIdx =
+      blockIdx * SCAN_BLOCK_SIZE + threadId * SCAN_ITEMS_PER_THREAD;
+
+  uint values[SCAN_ITEMS_PER_THREAD];
+  uint threadSum = 0;
+  for (uint i = 0; i < SCAN_ITEMS_PER_THREAD; ++i) {
+    uint idx = firstIdx + i;
+    values[i] = idx < count ? getValue(idx) : 0;
+    threadSum += values[i];
+  }
+
+  uint offset = workgroupExclusiveAdd(threadSum);
+  uint blockSum = offset + threadSum;
+
+  for (uint i = 0; i < SCAN_ITEMS_PER_THREAD; ++i) {
+    uint idx = firstIdx + i;
+    if (idx < count)
+      getValue(idx) = offset;
+    offset += values[i];
+  }
+
+  if (threadId == LOCAL_SIZE_X - 1)
+    getBlockSum(blockIdx) = blockSum;
+#elif SCAN_STAGE == 1
+  uint blockCount = (count - 1) / SCAN_BLOCK_SIZE + 1;
+  uint blocksPerThread = (blockCount - 1) / LOCAL_SIZE_X + 1;
+  uint firstBlock = threadId * blocksPerThread;
+
+  uint threadSum = 0;
+  for (uint i = 0; i < blocksPerThread; ++i) {
+    uint blockIdx = firstBlock + i;
+    if (blockIdx < blockCount)
+      threadSum += getBlockSum(blockIdx);
+  }
+
+  uint blockOffset = workgroupExclusiveAdd(threadSum);
+
+  for (uint i = 0; i < blocksPerThread; ++i) {
+    uint blockIdx = firstBlock + i;
+    if (blockIdx < blockCount) {
+      uint blockSum = getBlockSum(blockIdx);
+      getBlockSum(blockIdx) = blockOffset;
+      blockOffset += blockSum;
+    }
+  }
+#else
+  uint blockIdx = gl_WorkGroupID.x;
+  uint blockOffset = getBlockSum(blockIdx);
+  for (uint i = 0; i < SCAN_ITEMS_PER_THREAD; ++i) {
+    uint idx = blockIdx * SCAN_BLOCK_SIZE + i * LOCAL_SIZE_X + threadId;
+    if (idx < count)
+      getValue(idx) += blockOffset;
+  }
+#endif
+}
@@ -0,0 +1,53 @@
+#version 460 core
+
+#include <Bindless/GlobalHeap.glsl>
+
+layout(local_size_x = LOCAL_SIZE_X) in;
+
+#include "Workgroup.glsl"
+
+// Sums each segment of a float buffer, see GpuPrimitives.h. Segment i covers
+// values [segmentOffsets[i], segmentOffsets[i + 1]). One workgroup per
+// segment, striding over the segments if there are more than workgroups.
+
+layout(push_constant) uniform PushConstants {
+  uint values;
+  uint segmentOffsets;
+  uint sums;
+  uint segmentCount;
+} pushConstants;
+
+BUFFER_RW(_reduceFloats, REDUCE_FLOATS{
+  float arr[];
+});
+
+BUFFER_RW(_reduceOffsets, REDUCE_OFFSETS{
+  uint arr[];
+});
+
+#define getValue(idx) RESOURCE(_reduceFloats, pushConstants.values).arr[idx]
+#define getSum(idx) RESOURCE(_reduceFloats, pushConstants.sums).arr[idx]
+#define getSegmentOffset(idx)                                                  \
+  RESOURCE(_reduceOffsets, pushConstants.segmentOffsets).arr[idx]
+
+void main() {
+  uint threadId = gl_LocalInvocationID.x;
+
+  // The segment is uniform across the workgroup, so every thread reaches the
+  // barriers in workgroupAdd
+  for (uint segmentIdx = gl_WorkGroupID.x;
+       segmentIdx < pushConstants.segmentCount;
+       segmentIdx += gl_NumWorkGroups.x) {
+    uint segmentStart = getSegmentOffset(segmentIdx);
+    uint segmentEnd = getSegmentOffset(segmentIdx + 1);
+
+    float threadSum = 0.0;
+    for (uint idx = segmentStart + threadId; idx < segmentEnd;
+         idx += LOCAL_SIZE_X)
+      threadSum += getValue(idx);
+
+    float sum = workgroupAdd(threadSum);
+    if (threadId == 0)
+      getSum(segmentIdx) = sum;
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef _WORKGROUP_
+#define _WORKGROUP_
+
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_arithmetic : enable
+
+// Workgroup-wide scans and reductions, for 1D workgroups of LOCAL_SIZE_X
+// threads. Each subgroup scans its values with subgroup arithmetic, then the
+// first subgroup scans the subgroup totals. Makes no assumption on the
+// subgroup size, including subgroups smaller than the ones the totals fit in.
+// Every thread of the workgroup needs to call these, they contain barriers.
+
+// Worst case of one thread per subgroup
+shared uint _subgroupTotals[LOCAL_SIZE_X];
+shared float _subgroupFloatTotals[LOCAL_SIZE_X];
+
+// Turns _subgroupTotals[0, gl_NumSubgroups) into exclusive offsets, in rounds
+// of one subgroup
+void _scanSubgroupTotals() {
+  if (gl_SubgroupID == 0) {
+    uint total = 0;
+    for (uint first = 0; first < gl_NumSubgroups; first += gl_SubgroupSize) {
+      uint idx = first + gl_SubgroupInvocationID;
+      uint subgroupTotal = idx < gl_NumSubgroups ? _subgroupTotals[idx] : 0;
+      uint offset = total + subgroupExclusiveAdd(subgroupTotal);
+      if (idx < gl_NumSubgroups)
+        _subgroupTotals[idx] = offset;
+      total += subgroupAdd(subgroupTotal);
+    }
+  }
+}
+
+// Inclusive sum of one value per thread across the workgroup
+uint workgroupInclusiveAdd(uint value) {
+  uint subgroupSum = subgroupInclusiveAdd(value);
+  // The last active thread holds the subgroup total, the last subgroup may
+  // be partial
+  if (gl_SubgroupInvocationID == subgroupMax(gl_SubgroupInvocationID))
+    _subgroupTotals[gl_SubgroupID] = subgroupSum;
+  barrier();
+
+  _scanSubgroupTotals();
+  barrier();
+
+  uint result = _subgroupTotals[gl_SubgroupID] + subgroupSum;
+  // The totals can be overwritten by the next call once everyone has read
+  // them
+  barrier();
+  return result;
+}
+
+uint workgroupExclusiveAdd(uint value) {
+  return workgroupInclusiveAdd(value) - value;
+}
+
+// Sum of one value per thread across the workgroup, returned to every thread
+float workgroupAdd(float value) {
+  float subgroupSum = subgroupAdd(value);
+  if (subgroupElect())
+    _subgroupFloatTotals[gl_SubgroupID] = subgroupSum;
+  barrier();
+
+  if (gl_SubgroupID == 0) {
+    float total = 0.0;
+    for (uint first = 0; first < gl_NumSubgroups; first += gl_SubgroupSize) {
+      uint idx = first + gl_SubgroupInvocationID;
+      total += subgroupAdd(
+          idx < gl_NumSubgroups ? _subgroupFloatTotals[idx] : 0.0);
+    }
+    if (subgroupElect())
+      _subgroupFloatTotals[0] = total;
+  }
+  barrier();
+
+  float result = _subgroupFloatTotals[0];
+  barrier();
+  return result;
+}
+
+#endif // _WORKGROUP_
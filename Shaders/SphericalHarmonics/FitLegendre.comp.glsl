@@ -10,9 +10,20 @@ layout(push_constant) uniform PushConstants {
 #include <Misc/Constants.glsl>
 
 #define locals RESOURCE(legendreUniforms, pushConstants.legendreUniformsHandle)
-#define coeffs legendreCoeffs(locals.coeffBuffer)
 
-layout(local_size_x=16) in;
+// Needs to match SphericalHarmonics.cpp
+#define LEGENDRE_FIT_STEPS 100
+
+BUFFER_RW(_legendreTerms, LEGENDRE_TERMS{
+  float arr[];
+});
+
+#define terms RESOURCE(_legendreTerms, locals.termsBuffer).arr
+
+// A workgroup per coefficient and a thread per integration step. Each thread
+// writes its step's term, GpuPrimitives::segmentedReduce then sums each
+// coefficient's terms into the coefficient buffer.
+layout(local_size_x=LEGENDRE_FIT_STEPS) in;
 
 float f(float x, float mean) {
   if (abs(x - mean) < 0.15)
@@ -25,30 +36,23 @@ void main() {
   // if (locals.sampleCount == 0)
   //   return;
   
-  uint coeffIdx = uint(gl_GlobalInvocationID.x);
+  uint coeffIdx = uint(gl_WorkGroupID.x);
+  uint stepIdx = uint(gl_LocalInvocationID.x);
   
-  float c = 0.0;
-  
-  float x = -1.0;
-  int steps = 100;
-  float stepSize = 2.0 / 100;
-  for (int i = 0; i < 100; ++i)
-  {
-    float f_x = 0.0;
-    for (uint sampleIdx = 0; sampleIdx < locals.sampleCount; ++sampleIdx) { 
-      vec2 fSample = locals.samples[sampleIdx];
-      fSample.x = 2.0 * fSample.x - 1.0;
-      fSample.y = 1.0 - 2.0 * fSample.y;
-
-      // f_x += f(x, fSample.x) * fSample.y / locals.sampleCount;
-      f_x += f(x, fSample.x) * fSample.y;// / locals.sampleCount;
-    }
-
-    f_x = clamp(f_x, -1.0, 1.0);
-    float p = P(x, coeffIdx);
-    c += f_x * p * stepSize;
-    x += stepSize;
+  float stepSize = 2.0 / LEGENDRE_FIT_STEPS;
+  float x = -1.0 + stepIdx * stepSize;
+
+  float f_x = 0.0;
+  for (uint sampleIdx = 0; sampleIdx < locals.sampleCount; ++sampleIdx) { 
+    vec2 fSample = locals.samples[sampleIdx];
+    fSample.x = 2.0 * fSample.x - 1.0;
+    fSample.y = 1.0 - 2.0 * fSample.y;
+
+    // f_x += f(x, fSample.x) * fSample.y / locals.sampleCount;
+    f_x += f(x, fSample.x) * fSample.y;// / locals.sampleCount;
   }
 
-  coeffs[coeffIdx] = c;
+  f_x = clamp(f_x, -1.0, 1.0);
+  float p = P(x, coeffIdx);
+  terms[coeffIdx * LEGENDRE_FIT_STEPS + stepIdx] = f_x * p * stepSize;
 }
\ No newline at end of file
@@ -36,6 +36,7 @@ UNIFORM_BUFFER(legendreUniforms, LegendreUniforms{
   vec2 samples[10];
   uint sampleCount;
   uint coeffBuffer;
+  uint termsBuffer;
 });
 
 UNIFORM_BUFFER(shUniforms, SHUniforms{
@@ -0,0 +1,199 @@
+#include "AsyncReadback.h"
+
+#include <Althea/Application.h>
+#include <Althea/BufferUtilities.h>
+
+#include <chrono>
+#include <stdexcept>
+
+using namespace AltheaEngine;
+
+namespace AltheaDemo {
+
+AsyncReadback::AsyncReadback(Application& app, uint32_t maxRequestsInFlight)
+    : m_app(app), m_device(app.getDevice()), m_slots(maxRequestsInFlight) {
+  for (uint32_t slotIdx = 0; slotIdx < maxRequestsInFlight; ++slotIdx) {
+    // The host polls the events, so they can't be device-only
+    VkEventCreateInfo createInfo{VK_STRUCTURE_TYPE_EVENT_CREATE_INFO};
+    if (vkCreateEvent(
+            m_device,
+            &createInfo,
+            nullptr,
+            &m_slots[slotIdx].event) != VK_SUCCESS)
+      throw std::runtime_error("Failed to create readback event!");
+
+    m_freeSlots.push_back(slotIdx);
+  }
+
+  m_worker = std::thread([this]() { _workerLoop(); });
+}
+
+AsyncReadback::~AsyncReadback() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopWorker = true;
+  }
+  m_wakeWorker.notify_one();
+  m_worker.join();
+
+  for (Slot& slot : m_slots)
+    vkDestroyEvent(m_device, slot.event, nullptr);
+}
+
+bool AsyncReadback::request(
+    VkCommandBuffer commandBuffer,
+    const std::vector<ReadbackRegion>& regions,
+    ReadbackCallback&& callback) {
+  VkDeviceSize totalSize = 0;
+  for (const ReadbackRegion& region : regions)
+    totalSize += region.size;
+  if (totalSize == 0)
+    return false;
+
+  uint32_t slotIdx;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_freeSlots.empty())
+      return false;
+
+    slotIdx = m_freeSlots.back();
+    m_freeSlots.pop_back();
+  }
+
+  // Free slots aren't touched by the GPU or the worker
+  Slot& slot = m_slots[slotIdx];
+  if (totalSize > slot.capacity) {
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+    allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    slot.staging = BufferUtilities::createBuffer(
+        m_app,
+        totalSize,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        allocInfo);
+    slot.capacity = totalSize;
+  }
+
+  vkResetEvent(m_device, slot.event);
+
+  auto barrier = [commandBuffer](
+                     VkPipelineStageFlags srcStage,
+                     VkAccessFlags srcAccess,
+                     VkPipelineStageFlags dstStage,
+                     VkAccessFlags dstAccess) {
+    VkMemoryBarrier memoryBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    memoryBarrier.srcAccessMask = srcAccess;
+    memoryBarrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        srcStage,
+        dstStage,
+        0,
+        1,
+        &memoryBarrier,
+        0,
+        nullptr,
+        0,
+        nullptr);
+  };
+
+  barrier(
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+
+  slot.regionSizes.clear();
+  VkDeviceSize stagingOffset = 0;
+  for (const ReadbackRegion& region : regions) {
+    VkBufferCopy copy{};
+    copy.srcOffset = region.offset;
+    copy.dstOffset = stagingOffset;
+    copy.size = region.size;
+    vkCmdCopyBuffer(
+        commandBuffer,
+        region.buffer,
+        slot.staging.getBuffer(),
+        1,
+        &copy);
+
+    slot.regionSizes.push_back(region.size);
+    stagingOffset += region.size;
+  }
+
+  barrier(
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,
+      VK_ACCESS_HOST_READ_BIT);
+  vkCmdSetEvent(commandBuffer, slot.event, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  slot.callback = std::move(callback);
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pendingSlots.push_back(slotIdx);
+  }
+  m_wakeWorker.notify_one();
+
+  return true;
+}
+
+void AsyncReadback::flush() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_requestDelivered.wait(lock, [this]() {
+    return m_pendingSlots.empty() && !m_delivering;
+  });
+}
+
+void AsyncReadback::_workerLoop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_wakeWorker.wait(lock, [this]() {
+      return m_stopWorker || !m_pendingSlots.empty();
+    });
+    if (m_stopWorker)
+      return;
+
+    // Requests are submitted in the order they are recorded, so only the
+    // oldest one needs to be polled
+    uint32_t slotIdx = m_pendingSlots.front();
+    Slot& slot = m_slots[slotIdx];
+    if (vkGetEventStatus(m_device, slot.event) != VK_EVENT_SET) {
+      lock.unlock();
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+      lock.lock();
+      continue;
+    }
+
+    m_pendingSlots.pop_front();
+    m_delivering = true;
+    lock.unlock();
+
+    ReadbackData data;
+    data.reserve(slot.regionSizes.size());
+    const std::byte* pStaging =
+        static_cast<const std::byte*>(slot.staging.mapMemory());
+    VkDeviceSize stagingOffset = 0;
+    for (VkDeviceSize size : slot.regionSizes) {
+      data.emplace_back(
+          pStaging + stagingOffset,
+          pStaging + stagingOffset + size);
+      stagingOffset += size;
+    }
+    slot.staging.unmapMemory();
+
+    ReadbackCallback callback = std::move(slot.callback);
+    slot.callback = nullptr;
+    callback(std::move(data));
+
+    lock.lock();
+    m_delivering = false;
+    m_freeSlots.push_back(slotIdx);
+    m_requestDelivered.notify_all();
+  }
+}
+
+} // namespace AltheaDemo
@@ -0,0 +1,104 @@
+#include "BarrierBatcher.h"
+
+namespace AltheaDemo {
+
+BarrierBatcher::BarrierBatcher(uint32_t resourceCount)
+    : m_states(resourceCount) {}
+
+void BarrierBatcher::read(
+    uint32_t resource,
+    VkPipelineStageFlags stages,
+    VkAccessFlags access) {
+  m_pendingAccesses.push_back({resource, stages, access, false});
+}
+
+void BarrierBatcher::write(
+    uint32_t resource,
+    VkPipelineStageFlags stages,
+    VkAccessFlags access) {
+  m_pendingAccesses.push_back({resource, stages, access, true});
+}
+
+void BarrierBatcher::readWrite(
+    uint32_t resource,
+    VkPipelineStageFlags stages) {
+  read(resource, stages, VK_ACCESS_SHADER_READ_BIT);
+  write(resource, stages, VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+void BarrierBatcher::flush(VkCommandBuffer commandBuffer) {
+  VkPipelineStageFlags srcStages = 0;
+  VkPipelineStageFlags dstStages = 0;
+  VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+
+  for (const Access& access : m_pendingAccesses) {
+    const ResourceState& state = m_states[access.resource];
+
+    // Read or write after write, unless this read's stages already waited
+    if (state.writeStages != 0 &&
+        (access.write || (access.stages & ~state.visibleStages) != 0)) {
+      srcStages |= state.writeStages;
+      dstStages |= access.stages;
+      barrier.srcAccessMask |= state.writeAccess;
+      barrier.dstAccessMask |= access.access;
+    }
+
+    // Write after read only needs the reads to be done
+    if (access.write && state.readStages != 0) {
+      srcStages |= state.readStages;
+      dstStages |= access.stages;
+    }
+  }
+
+  ++m_flushIdx;
+  ++m_flushCount;
+
+  if (srcStages != 0) {
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        srcStages,
+        dstStages,
+        0,
+        1,
+        &barrier,
+        0,
+        nullptr,
+        0,
+        nullptr);
+    ++m_barrierCount;
+  }
+
+  // Reads first, a write in the same pass supersedes them
+  for (const Access& access : m_pendingAccesses) {
+    if (access.write)
+      continue;
+
+    ResourceState& state = m_states[access.resource];
+    state.readStages |= access.stages;
+    state.visibleStages |= access.stages;
+  }
+
+  for (const Access& access : m_pendingAccesses) {
+    if (!access.write)
+      continue;
+
+    ResourceState& state = m_states[access.resource];
+    if (state.writeFlush != m_flushIdx) {
+      state = {};
+      state.writeFlush = m_flushIdx;
+    }
+
+    state.writeStages |= access.stages;
+    state.writeAccess |= access.access;
+  }
+
+  m_pendingAccesses.clear();
+}
+
+void BarrierBatcher::reset() {
+  m_pendingAccesses.clear();
+  for (ResourceState& state : m_states)
+    state = {};
+}
+
+} // namespace AltheaDemo
@@ -0,0 +1,964 @@
+#include "Benchmarks.h"
+
+#include "ContactSolverCpu.h"
+#include "MortonOrder.h"
+#include "NeighborListCpu.h"
+#include "ParallelFor.h"
+#include "ParticleSeeding.h"
+#include "ParticleSystem.h"
+#include "PbfSolverCpu.h"
+#include "PrimitivesCpu.h"
+#include "SpatialHashCpu.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace AltheaDemo {
+namespace Benchmarks {
+namespace {
+struct Stopwatch {
+  std::chrono::high_resolution_clock::time_point start =
+      std::chrono::high_resolution_clock::now();
+
+  double elapsedMs() const {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::high_resolution_clock::now() - start)
+        .count();
+  }
+};
+
+uint32_t getArg(
+    const std::vector<std::string>& args,
+    size_t idx,
+    uint32_t defaultValue) {
+  return idx < args.size() ? static_cast<uint32_t>(std::stoul(args[idx]))
+                           : defaultValue;
+}
+
+// Same distribution ParticleSystem::_resetParticles spawns particles with
+void generateParticlePositions(
+    uint32_t particleCount,
+    std::vector<glm::vec3>& positions) {
+  positions.resize(particleCount);
+  ParticleSystem::seedParticles(
+      0,
+      0,
+      particleCount,
+      [&](uint32_t particleIdx, const glm::vec3& position) {
+        positions[particleIdx] = position;
+      });
+}
+
+// Packs the particles into a cube-shaped lattice with the given spacing, each
+// particle jittered by up to jitter along each axis. The default spawn
+// distribution is too sparse for contact benchmarks.
+void generateParticleLattice(
+    uint32_t particleCount,
+    float spacing,
+    float jitter,
+    std::vector<glm::vec3>& positions) {
+  uint32_t side = static_cast<uint32_t>(std::cbrt(double(particleCount))) + 1;
+
+  positions.resize(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
+    uint32_t hash = ParticleSystem::pcgHash(particleIdx);
+    glm::vec3 lattice(
+        particleIdx % side,
+        (particleIdx / side) % side,
+        particleIdx / (side * side));
+    glm::vec3 offset(
+        float(hash & 0xff) - 127.5f,
+        float((hash >> 8) & 0xff) - 127.5f,
+        float((hash >> 16) & 0xff) - 127.5f);
+    positions[particleIdx] = glm::vec3(35.0f) + spacing * lattice +
+                             (jitter / 127.5f) * offset;
+  }
+}
+
+// Args: [particleCount = 5M] [iterations = 5] [bucketCount = particleCount]
+int spatialHashBuild(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 5000000);
+  uint32_t iterations = getArg(args, 1, 5);
+  uint32_t bucketCount = getArg(args, 2, particleCount);
+  uint32_t spatialHashSize = 3 * particleCount;
+
+  // Same grid setup as ParticleSystem::tick
+  glm::mat4 gridToWorld = glm::scale(glm::mat4(1.0f), glm::vec3(0.2f));
+  glm::mat4 worldToGrid = glm::inverse(gridToWorld);
+
+  std::vector<glm::vec3> positions;
+  generateParticlePositions(particleCount, positions);
+
+  SpatialHashCpu spatialHash(spatialHashSize, bucketCount, 32);
+  std::vector<uint32_t> slotIndices;
+  std::vector<uint32_t> globalIndices;
+
+  std::cout << "spatial-hash-build: " << particleCount << " particles, "
+            << spatialHashSize << " slots, " << bucketCount << " buckets ("
+            << (uint64_t(bucketCount) * sizeof(ParticleBucket) >> 20)
+            << " MB), " << getWorkerCount() << " threads\n";
+
+  double clearMs = 0.0;
+  double countMs = 0.0;
+  double allocMs = 0.0;
+  double insertMs = 0.0;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    Stopwatch clear;
+    spatialHash.clear();
+    clearMs += clear.elapsedMs();
+
+    Stopwatch count;
+    spatialHash.countParticles(worldToGrid, positions, slotIndices);
+    countMs += count.elapsedMs();
+
+    Stopwatch alloc;
+    spatialHash.allocateBuckets();
+    allocMs += alloc.elapsedMs();
+
+    Stopwatch insert;
+    spatialHash.insertParticles(positions, slotIndices, globalIndices);
+    insertMs += insert.elapsedMs();
+  }
+
+  double totalMs = (clearMs + countMs + allocMs + insertMs) / iterations;
+  std::cout << "  clear:  " << clearMs / iterations << " ms\n"
+            << "  count:  " << countMs / iterations << " ms\n"
+            << "  alloc:  " << allocMs / iterations << " ms\n"
+            << "  insert: " << insertMs / iterations << " ms\n"
+            << "  total:  " << totalMs << " ms, "
+            << particleCount / totalMs * 1.0e-3 << " M particles/s"
+            << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+// Args: [particleCount = 5M] [iterations = 5]
+int spatialHashPrefixSum(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 5000000);
+  uint32_t iterations = getArg(args, 1, 5);
+  uint32_t spatialHashSize = 3 * particleCount;
+
+  glm::mat4 gridToWorld = glm::scale(glm::mat4(1.0f), glm::vec3(0.2f));
+  glm::mat4 worldToGrid = glm::inverse(gridToWorld);
+
+  std::vector<glm::vec3> positions;
+  generateParticlePositions(particleCount, positions);
+
+  SortedSpatialHashCpu spatialHash(spatialHashSize, particleCount);
+  std::vector<uint32_t> slotIndices;
+  std::vector<uint32_t> globalIndices;
+
+  std::cout << "spatial-hash-prefix-sum: " << particleCount << " particles, "
+            << spatialHashSize << " slots, packed entries ("
+            << (uint64_t(particleCount) * sizeof(ParticleEntry) >> 20)
+            << " MB), " << getWorkerCount() << " threads\n";
+
+  // No clear between iterations, the scan zeroes the counts it consumes
+  double countMs = 0.0;
+  double scanMs = 0.0;
+  double scatterMs = 0.0;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    Stopwatch count;
+    spatialHash.countParticles(worldToGrid, positions, slotIndices);
+    countMs += count.elapsedMs();
+
+    Stopwatch scan;
+    spatialHash.scanCellCounts();
+    scanMs += scan.elapsedMs();
+
+    Stopwatch scatter;
+    spatialHash.scatterParticles(positions, slotIndices, globalIndices);
+    scatterMs += scatter.elapsedMs();
+  }
+
+  double totalMs = (countMs + scanMs + scatterMs) / iterations;
+  std::cout << "  count:   " << countMs / iterations << " ms\n"
+            << "  scan:    " << scanMs / iterations << " ms\n"
+            << "  scatter: " << scatterMs / iterations << " ms\n"
+            << "  total:   " << totalMs << " ms, "
+            << particleCount / totalMs * 1.0e-3 << " M particles/s"
+            << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+// Runs fn over every particle, returns the average ms per iteration. The
+// values fn returns are summed so the loads can't be optimized out.
+template <typename TFunc>
+double
+timeParticlePass(uint32_t particleCount, uint32_t iterations, TFunc&& fn) {
+  static std::atomic<uint32_t> s_sink;
+
+  Stopwatch stopwatch;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+      float sum = 0.0f;
+      for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx)
+        sum += fn(particleIdx);
+      s_sink.fetch_add(static_cast<uint32_t>(sum), std::memory_order_relaxed);
+    });
+  }
+
+  return stopwatch.elapsedMs() / iterations;
+}
+
+// Args: [particleCount = 5M] [iterations = 5]
+// CPU stand-in for the particle fetches each GPU pass does, comparing the
+// interleaved Particle struct (PARTICLE_LAYOUT_AOS) against separate streams
+// (PARTICLE_LAYOUT_SOA).
+int particleLayout(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 5000000);
+  uint32_t iterations = getArg(args, 1, 5);
+
+  std::vector<glm::vec3> initialPositions;
+  generateParticlePositions(particleCount, initialPositions);
+
+  std::vector<Particle> particles(particleCount);
+  std::vector<glm::vec4> positions(particleCount);
+  std::vector<glm::vec4> prevPositions(particleCount);
+  std::vector<uint32_t> globalIndices(particleCount);
+  std::vector<uint32_t> debug(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
+    const glm::vec3& position = initialPositions[particleIdx];
+    particles[particleIdx] = Particle{position, particleIdx, position, 0};
+    positions[particleIdx] = glm::vec4(position, 1.0f);
+    prevPositions[particleIdx] = glm::vec4(position, 1.0f);
+    globalIndices[particleIdx] = particleIdx;
+    debug[particleIdx] = 0;
+  }
+
+  std::cout << "particle-layout: " << particleCount << " particles, "
+            << getWorkerCount() << " threads\n";
+
+  auto report = [&](const char* pass,
+                    uint32_t soaBytes,
+                    double aosMs,
+                    double soaMs) {
+    std::cout << "  " << pass << ": AoS " << aosMs << " ms ("
+              << sizeof(Particle) << " B/particle), SoA " << soaMs << " ms ("
+              << soaBytes << " B/particle), " << aosMs / soaMs << "x\n";
+  };
+
+  // Particles.vert: position and color
+  report(
+      "render",
+      sizeof(glm::vec4) + sizeof(uint32_t),
+      timeParticlePass(
+          particleCount,
+          iterations,
+          [&](uint32_t i) {
+            return particles[i].position.x + float(particles[i].debug);
+          }),
+      timeParticlePass(particleCount, iterations, [&](uint32_t i) {
+        return positions[i].x + float(debug[i]);
+      }));
+
+  // ProjectedJacobiStep: global index only, the position comes from the
+  // particle entries
+  report(
+      "jacobi",
+      sizeof(uint32_t),
+      timeParticlePass(
+          particleCount,
+          iterations,
+          [&](uint32_t i) { return float(particles[i].globalIndex); }),
+      timeParticlePass(particleCount, iterations, [&](uint32_t i) {
+        return float(globalIndices[i]);
+      }));
+
+  // CopyToBucket: reads the position and cell, rewrites the global index
+  report(
+      "insert",
+      sizeof(glm::vec4) + sizeof(uint32_t),
+      timeParticlePass(
+          particleCount,
+          iterations,
+          [&](uint32_t i) {
+            Particle& particle = particles[i];
+            particle.globalIndex += 1;
+            return particle.position.y;
+          }),
+      timeParticlePass(particleCount, iterations, [&](uint32_t i) {
+        globalIndices[i] += 1;
+        return positions[i].y;
+      }));
+
+  // Sim pass: reads and writes every field
+  report(
+      "sim",
+      2 * sizeof(glm::vec4) + 2 * sizeof(uint32_t),
+      timeParticlePass(
+          particleCount,
+          iterations,
+          [&](uint32_t i) {
+            Particle& particle = particles[i];
+            particle.prevPosition = particle.position;
+            particle.position.y -= 0.01f;
+            particle.debug = particle.globalIndex;
+            return particle.position.y;
+          }),
+      timeParticlePass(particleCount, iterations, [&](uint32_t i) {
+        prevPositions[i] = positions[i];
+        positions[i].y -= 0.01f;
+        debug[i] = globalIndices[i];
+        return positions[i].y;
+      }));
+
+  std::cout << std::flush;
+
+  return EXIT_SUCCESS;
+}
+
+// Set-associative LRU cache, roughly shaped like a GPU L2
+class CacheModel {
+public:
+  CacheModel(uint32_t sizeBytes, uint32_t ways, uint32_t lineSizeLog2)
+      : m_ways(ways),
+        m_lineSizeLog2(lineSizeLog2),
+        m_setCount((sizeBytes >> lineSizeLog2) / ways),
+        m_tags(m_setCount * ways, ~0ull),
+        m_lastUse(m_setCount * ways, 0) {}
+
+  void access(uint64_t address) {
+    uint64_t line = address >> m_lineSizeLog2;
+    size_t firstWay = (line % m_setCount) * m_ways;
+    ++m_time;
+
+    size_t lruWay = firstWay;
+    for (size_t way = firstWay; way < firstWay + m_ways; ++way) {
+      if (m_tags[way] == line) {
+        m_lastUse[way] = m_time;
+        ++m_hits;
+        return;
+      }
+
+      if (m_lastUse[way] < m_lastUse[lruWay])
+        lruWay = way;
+    }
+
+    m_tags[lruWay] = line;
+    m_lastUse[lruWay] = m_time;
+    ++m_misses;
+  }
+
+  double getHitRate() const {
+    return double(m_hits) / double(std::max<uint64_t>(m_hits + m_misses, 1));
+  }
+
+private:
+  uint32_t m_ways;
+  uint32_t m_lineSizeLog2;
+  uint32_t m_setCount;
+  std::vector<uint64_t> m_tags;
+  std::vector<uint64_t> m_lastUse;
+  uint64_t m_time = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+};
+
+// Replays the memory accesses of ProjectedJacobiStep.comp.glsl in particle
+// order through a 4MB, 16-way cache with 128B lines. Each particle reads its
+// own record and entry, then every entry in the 8 cells around it. Returns
+// the hit rate.
+double simulateJacobiHitRate(
+    const ParticleSystem::SpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& positions,
+    const std::vector<uint32_t>& globalIndices) {
+  using namespace ParticleSystem;
+
+  // Keep the particle and bucket heaps apart in the address space
+  const uint64_t particlesBase = 0;
+  const uint64_t entriesBase = 1ull << 40;
+
+  CacheModel cache(4 << 20, 16, 7);
+  for (uint32_t particleIdx = 0; particleIdx < positions.size();
+       ++particleIdx) {
+    cache.access(particlesBase + uint64_t(particleIdx) * sizeof(Particle));
+
+    uint32_t globalIdx = globalIndices[particleIdx];
+    cache.access(entriesBase + uint64_t(globalIdx) * sizeof(ParticleEntry));
+
+    glm::ivec3 gridCell =
+        computeNeighborhoodBaseCell(worldToGrid, positions[particleIdx]);
+    for (int i = 0; i < 8; ++i) {
+      uint32_t slotIdx = hashCoords(
+                             gridCell.x + (i >> 2),
+                             gridCell.y + ((i >> 1) & 1),
+                             gridCell.z + (i & 1)) %
+                         spatialHash.getSpatialHashSize();
+      uint32_t rangeStart, rangeEnd;
+      spatialHash.getCellRange(slotIdx, rangeStart, rangeEnd);
+      for (uint32_t entryIdx = rangeStart; entryIdx < rangeEnd; ++entryIdx)
+        cache.access(entriesBase + uint64_t(entryIdx) * sizeof(ParticleEntry));
+    }
+  }
+
+  return cache.getHitRate();
+}
+
+// Args: [particleCount = 1M] [iterations = 5]
+// Times the CPU reference Morton sort and compares the cache hit rate of the
+// Jacobi step's accesses before and after reordering.
+int mortonReorder(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 1000000);
+  uint32_t iterations = getArg(args, 1, 5);
+
+  glm::mat4 gridToWorld = glm::scale(glm::mat4(1.0f), glm::vec3(0.2f));
+  glm::mat4 worldToGrid = glm::inverse(gridToWorld);
+
+  std::vector<glm::vec3> positions;
+  generateParticlePositions(particleCount, positions);
+
+  // The sim keys over its kill bounds, the spawn bounds stand in for them
+  glm::vec3 boundsMin(std::numeric_limits<float>::max());
+  glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+  for (const glm::vec3& position : positions) {
+    boundsMin = glm::min(boundsMin, position);
+    boundsMax = glm::max(boundsMax, position);
+  }
+
+  std::cout << "morton-reorder: " << particleCount << " particles, "
+            << getWorkerCount() << " threads\n";
+
+  std::vector<uint32_t> order;
+  Stopwatch sort;
+  for (uint32_t iter = 0; iter < iterations; ++iter)
+    computeMortonOrder(boundsMin, boundsMax, positions, order);
+  double sortMs = sort.elapsedMs() / iterations;
+
+  std::vector<glm::vec3> sortedPositions(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx)
+    sortedPositions[particleIdx] = positions[order[particleIdx]];
+
+  SpatialHashCpu spatialHash(3 * particleCount, particleCount, 32);
+  std::vector<uint32_t> globalIndices;
+
+  spatialHash.build(worldToGrid, positions, positions, globalIndices);
+  double spawnOrderHitRate = simulateJacobiHitRate(
+      spatialHash,
+      worldToGrid,
+      positions,
+      globalIndices);
+
+  spatialHash.build(
+      worldToGrid,
+      sortedPositions,
+      sortedPositions,
+      globalIndices);
+  double mortonOrderHitRate = simulateJacobiHitRate(
+      spatialHash,
+      worldToGrid,
+      sortedPositions,
+      globalIndices);
+
+  std::cout << "  sort: " << sortMs << " ms, "
+            << countMortonOrderInversions(
+                   boundsMin,
+                   boundsMax,
+                   sortedPositions)
+            << " inversions\n"
+            << "  jacobi cache hit rate, spawn order:  "
+            << 100.0 * spawnOrderHitRate << "%\n"
+            << "  jacobi cache hit rate, Morton order: "
+            << 100.0 * mortonOrderHitRate << "%" << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+// Compares the old single-threaded rand() reset against the parallel PCG
+// reset, both filling the CPU-side particle copies that get uploaded.
+// Args: [particleCount = 5M] [iterations = 5]
+int particleReset(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 5000000);
+  uint32_t iterations = getArg(args, 1, 5);
+
+  std::vector<Particle> particles(particleCount);
+  std::vector<glm::vec4> positions(particleCount);
+  std::vector<glm::vec4> prevPositions(particleCount);
+  std::vector<uint32_t> globalIndices(particleCount);
+  std::vector<uint32_t> debug(particleCount);
+
+  std::cout << "particle-reset: " << particleCount << " particles, "
+            << getWorkerCount() << " threads\n";
+
+  Stopwatch serial;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    for (uint32_t particleIdx = 0; particleIdx < particleCount;
+         ++particleIdx) {
+      glm::vec3 position(rand() % 300, rand() % 3000, rand() % 300);
+      position *= 0.1f;
+      position += glm::vec3(35.0);
+      particles[particleIdx] = Particle{position, 0, position, 0xfc3311};
+    }
+  }
+  double serialMs = serial.elapsedMs() / iterations;
+
+  Stopwatch parallelAos;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    seedParticles(
+        iter,
+        0,
+        particleCount,
+        [&](uint32_t particleIdx, const glm::vec3& position) {
+          particles[particleIdx] = Particle{position, 0, position, 0xfc3311};
+        });
+  }
+  double parallelAosMs = parallelAos.elapsedMs() / iterations;
+
+  Stopwatch parallelSoa;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    seedParticles(
+        iter,
+        0,
+        particleCount,
+        [&](uint32_t particleIdx, const glm::vec3& position) {
+          positions[particleIdx] = glm::vec4(position, 1.0f);
+          prevPositions[particleIdx] = glm::vec4(position, 1.0f);
+          globalIndices[particleIdx] = 0;
+          debug[particleIdx] = 0xfc3311;
+        });
+  }
+  double parallelSoaMs = parallelSoa.elapsedMs() / iterations;
+
+  std::cout << "  serial rand(), AoS: " << serialMs << " ms\n"
+            << "  parallel PCG, AoS:  " << parallelAosMs << " ms ("
+            << serialMs / parallelAosMs << "x)\n"
+            << "  parallel PCG, SoA:  " << parallelSoaMs << " ms ("
+            << serialMs / parallelSoaMs << "x)" << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+// Args: [particleCount = 1M] [iterations = 5]
+// Compares the Jacobi step walking the 8 hash cells around each particle
+// against reading a prebuilt neighbour list, for a few skin radii. The
+// particles are packed slightly tighter than a particle diameter, so most of
+// them are in contact like in a settled pile.
+int neighborList(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 1000000);
+  uint32_t iterations = getArg(args, 1, 5);
+
+  const float particleRadius = 0.1f;
+  glm::mat4 gridToWorld =
+      glm::scale(glm::mat4(1.0f), glm::vec3(2.0f * particleRadius));
+  glm::mat4 worldToGrid = glm::inverse(gridToWorld);
+
+  std::vector<glm::vec3> positions;
+  generateParticleLattice(
+      particleCount,
+      1.8f * particleRadius,
+      0.1f * particleRadius,
+      positions);
+
+  SpatialHashCpu spatialHash(3 * particleCount, particleCount, 32);
+  std::vector<uint32_t> globalIndices;
+  spatialHash.build(worldToGrid, positions, positions, globalIndices);
+
+  float contactDistSq = 4.0f * particleRadius * particleRadius;
+  auto countContact = [&](const glm::vec3& particlePos, uint32_t otherIdx) {
+    glm::vec3 diff = spatialHash.getPosition(otherIdx) - particlePos;
+    return glm::dot(diff, diff) < contactDistSq ? 1.0f : 0.0f;
+  };
+
+  auto walkCells = [&](uint32_t particleIdx) {
+    uint32_t globalIdx = globalIndices[particleIdx];
+    glm::vec3 particlePos = spatialHash.getPosition(globalIdx);
+    glm::ivec3 gridCell = computeNeighborhoodBaseCell(worldToGrid, particlePos);
+
+    float contacts = 0.0f;
+    for (int i = 0; i < 8; ++i) {
+      uint32_t slotIdx = hashCoords(
+                             gridCell.x + (i >> 2),
+                             gridCell.y + ((i >> 1) & 1),
+                             gridCell.z + (i & 1)) %
+                         spatialHash.getSpatialHashSize();
+      uint32_t rangeStart, rangeEnd;
+      spatialHash.getCellRange(slotIdx, rangeStart, rangeEnd);
+      for (uint32_t otherIdx = rangeStart; otherIdx < rangeEnd; ++otherIdx) {
+        if (otherIdx != globalIdx)
+          contacts += countContact(particlePos, otherIdx);
+      }
+    }
+
+    return contacts;
+  };
+
+  double expectedContacts = 0.0;
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx)
+    expectedContacts += walkCells(particleIdx);
+
+  std::cout << "neighbor-list: " << particleCount << " particles, "
+            << getWorkerCount() << " threads\n"
+            << "  hash walk: " << timeParticlePass(
+                                      particleCount,
+                                      iterations,
+                                      walkCells)
+            << " ms/iteration, "
+            << expectedContacts / particleCount << " contacts/particle\n";
+
+  NeighborListCpu neighborLists;
+  for (float skinScale : {0.0f, 0.25f, 0.5f, 1.0f}) {
+    float searchRadius = 2.0f * particleRadius + skinScale * particleRadius;
+
+    Stopwatch build;
+    for (uint32_t iter = 0; iter < iterations; ++iter)
+      neighborLists.build(
+          spatialHash,
+          worldToGrid,
+          globalIndices,
+          searchRadius);
+    double buildMs = build.elapsedMs() / iterations;
+
+    auto walkList = [&](uint32_t particleIdx) {
+      glm::vec3 particlePos =
+          spatialHash.getPosition(globalIndices[particleIdx]);
+
+      float contacts = 0.0f;
+      uint32_t neighborCount = neighborLists.getNeighborCount(particleIdx);
+      for (uint32_t i = 0; i < neighborCount; ++i) {
+        uint32_t otherIdx = neighborLists.getNeighbor(particleIdx, i);
+        contacts += countContact(particlePos, otherIdx);
+      }
+
+      return contacts;
+    };
+
+    double listContacts = 0.0;
+    double neighbors = 0.0;
+    for (uint32_t particleIdx = 0; particleIdx < particleCount;
+         ++particleIdx) {
+      listContacts += walkList(particleIdx);
+      neighbors += neighborLists.getNeighborCount(particleIdx);
+    }
+
+    std::cout << "  skin " << skinScale << "r: build " << buildMs
+              << " ms, list walk "
+              << timeParticlePass(particleCount, iterations, walkList)
+              << " ms/iteration, "
+              << neighborLists.getMemoryBytes() / (1024.0 * 1024.0)
+              << " MB, " << neighbors / particleCount
+              << " neighbors/particle, "
+              << neighborLists.getOverflowCount() << " overflowed, "
+              << (listContacts == expectedContacts ? "contacts match"
+                                                   : "contacts MISMATCH")
+              << "\n";
+  }
+
+  std::cout << std::flush;
+
+  return EXIT_SUCCESS;
+}
+
+// Args: [particleCount = 1M] [iterations = 8]
+// Convergence of the contact projection against time, for the Jacobi and the
+// graph-coloured Gauss-Seidel iteration orders. Starts from particles resting
+// on a lattice one diameter apart, jittered enough that neighbours overlap.
+// The penetration is the total overlap over all contact pairs, in particle
+// radii.
+int solverConvergence(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 1000000);
+  uint32_t iterations = getArg(args, 1, 8);
+
+  const float particleRadius = 0.1f;
+  glm::mat4 gridToWorld =
+      glm::scale(glm::mat4(1.0f), glm::vec3(2.0f * particleRadius));
+  glm::mat4 worldToGrid = glm::inverse(gridToWorld);
+
+  std::vector<glm::vec3> positions;
+  generateParticleLattice(
+      particleCount,
+      2.0f * particleRadius,
+      0.3f * particleRadius,
+      positions);
+
+  SpatialHashCpu spatialHash(3 * particleCount, particleCount, 32);
+  std::vector<uint32_t> globalIndices;
+  spatialHash.build(worldToGrid, positions, positions, globalIndices);
+
+  ContactSolverCpu jacobi;
+  jacobi.init(
+      spatialHash,
+      worldToGrid,
+      positions,
+      globalIndices,
+      particleRadius);
+  ContactSolverCpu gaussSeidel;
+  gaussSeidel.init(
+      spatialHash,
+      worldToGrid,
+      positions,
+      globalIndices,
+      particleRadius);
+
+  double initialPenetration = jacobi.computePenetration() / particleRadius;
+  std::cout << "solver-convergence: " << particleCount << " particles, "
+            << getWorkerCount() << " threads\n"
+            << "  initial penetration: " << initialPenetration << "r\n"
+            << "  iter | jacobi penetration, ms"
+            << " | gauss-seidel penetration, ms\n";
+
+  double jacobiMs = 0.0;
+  double gaussSeidelMs = 0.0;
+  for (uint32_t iter = 1; iter <= iterations; ++iter) {
+    Stopwatch jacobiIteration;
+    jacobi.jacobiIteration();
+    jacobiMs += jacobiIteration.elapsedMs();
+
+    Stopwatch gaussSeidelIteration;
+    gaussSeidel.gaussSeidelIteration();
+    gaussSeidelMs += gaussSeidelIteration.elapsedMs();
+
+    std::cout << "  " << iter << " | "
+              << jacobi.computePenetration() / particleRadius << "r, "
+              << jacobiMs << " | "
+              << gaussSeidel.computePenetration() / particleRadius << "r, "
+              << gaussSeidelMs << "\n";
+  }
+
+  std::cout << std::flush;
+
+  return EXIT_SUCCESS;
+}
+
+// Args: [particleCount = 1M] [iterations = 8]
+// Convergence of the position-based fluids density constraint against time.
+// Starts from particles on a lattice packed a fifth closer than the rest
+// spacing, so every interior particle is compressed. The compression is the
+// mean density over the rest density past 1, the part the solve corrects.
+int pbfConvergence(const std::vector<std::string>& args) {
+  using namespace ParticleSystem;
+
+  uint32_t particleCount = getArg(args, 0, 1000000);
+  uint32_t iterations = getArg(args, 1, 8);
+
+  // Same constants as the sim, see ParticleSystem.cpp
+  const float particleRadius = 0.1f;
+  const float kernelRadius = 2.0f * particleRadius;
+  const float restSpacing = 0.55f * kernelRadius;
+  PbfParams params = computePbfParams(
+      kernelRadius,
+      restSpacing,
+      1.0f,
+      0.1f,
+      0.2f * kernelRadius);
+
+  glm::mat4 gridToWorld =
+      glm::scale(glm::mat4(1.0f), glm::vec3(2.0f * particleRadius));
+  glm::mat4 worldToGrid = glm::inverse(gridToWorld);
+
+  std::vector<glm::vec3> positions;
+  generateParticleLattice(
+      particleCount,
+      0.8f * restSpacing,
+      0.1f * restSpacing,
+      positions);
+
+  // Cells hold more particles than a bucket at this packing, the sim also
+  // uses the prefix-sum build with the density constraint
+  SortedSpatialHashCpu spatialHash(3 * particleCount, particleCount);
+  std::vector<uint32_t> globalIndices;
+  spatialHash.build(worldToGrid, positions, positions, globalIndices);
+
+  PbfSolverCpu solver;
+  solver.init(spatialHash, worldToGrid, globalIndices, params);
+
+  std::cout << "pbf-convergence: " << particleCount << " particles, "
+            << getWorkerCount() << " threads\n"
+            << "  rest density: " << params.restDensity << "\n"
+            << "  initial compression: " << solver.computeCompression()
+            << "\n"
+            << "  iter | compression, ms\n";
+
+  double solverMs = 0.0;
+  for (uint32_t iter = 1; iter <= iterations; ++iter) {
+    Stopwatch iteration;
+    solver.jacobiIteration();
+    solverMs += iteration.elapsedMs();
+
+    std::cout << "  " << iter << " | " << solver.computeCompression() << ", "
+              << solverMs << "\n";
+  }
+
+  std::cout << std::flush;
+
+  return EXIT_SUCCESS;
+}
+
+// Args: [count = 16M] [iterations = 5] [segmentSize = 1024]
+// Throughput of the CPU twins of the GpuPrimitives against single-threaded
+// standard library baselines, checking they agree on the way.
+int primitives(const std::vector<std::string>& args) {
+  uint32_t count = std::max(getArg(args, 0, 16000000), 1u);
+  uint32_t iterations = getArg(args, 1, 5);
+  uint32_t segmentSize = std::max(getArg(args, 2, 1024), 1u);
+
+  std::vector<uint32_t> inputKeys(count);
+  std::vector<uint32_t> inputValues(count);
+  std::vector<float> inputFloats(count);
+  parallelFor(count, [&](uint32_t start, uint32_t end) {
+    for (uint32_t idx = start; idx < end; ++idx) {
+      uint32_t hash = ParticleSystem::pcgHash(idx);
+      inputKeys[idx] = hash;
+      inputValues[idx] = idx;
+      inputFloats[idx] = float(hash & 0xffff) / 65535.0f - 0.5f;
+    }
+  });
+
+  std::vector<uint32_t> segmentOffsets;
+  for (uint32_t offset = 0; offset < count; offset += segmentSize)
+    segmentOffsets.push_back(offset);
+  segmentOffsets.push_back(count);
+
+  std::cout << "primitives: " << count << " elements, " << getWorkerCount()
+            << " threads\n";
+
+  auto printThroughput = [&](const char* name, double ms, double baselineMs) {
+    std::cout << "  " << name << ": " << ms << " ms, "
+              << count / ms * 1.0e-3 << " M elements/s ("
+              << baselineMs / ms << "x over std)\n";
+  };
+
+  // Scan, small values so the sums don't wrap
+  std::vector<uint32_t> counts(count);
+  for (uint32_t idx = 0; idx < count; ++idx)
+    counts[idx] = inputKeys[idx] & 0xf;
+
+  std::vector<uint32_t> scanned;
+  Stopwatch scan;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    scanned = counts;
+    exclusiveScanCpu(scanned);
+  }
+  double scanMs = scan.elapsedMs() / iterations;
+
+  std::vector<uint32_t> expectedScan(count);
+  Stopwatch stdScan;
+  for (uint32_t iter = 0; iter < iterations; ++iter)
+    std::exclusive_scan(counts.begin(), counts.end(), expectedScan.begin(), 0u);
+  double stdScanMs = stdScan.elapsedMs() / iterations;
+
+  printThroughput("exclusive scan", scanMs, stdScanMs);
+  if (scanned != expectedScan)
+    std::cout << "  exclusive scan mismatch!\n";
+
+  // Key-value sort
+  std::vector<uint32_t> keys;
+  std::vector<uint32_t> values;
+  Stopwatch sort;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    keys = inputKeys;
+    values = inputValues;
+    sortKeyValuesCpu(keys, values);
+  }
+  double sortMs = sort.elapsedMs() / iterations;
+
+  std::vector<std::pair<uint32_t, uint32_t>> pairs(count);
+  Stopwatch stdSort;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    for (uint32_t idx = 0; idx < count; ++idx)
+      pairs[idx] = {inputKeys[idx], inputValues[idx]};
+    std::stable_sort(pairs.begin(), pairs.end(), [](auto& a, auto& b) {
+      return a.first < b.first;
+    });
+  }
+  double stdSortMs = stdSort.elapsedMs() / iterations;
+
+  printThroughput("key-value sort", sortMs, stdSortMs);
+  uint32_t sortMismatches = 0;
+  for (uint32_t idx = 0; idx < count; ++idx)
+    if (keys[idx] != pairs[idx].first || values[idx] != pairs[idx].second)
+      ++sortMismatches;
+  if (sortMismatches != 0)
+    std::cout << "  key-value sort mismatches: " << sortMismatches << "\n";
+
+  // Segmented reduction
+  std::vector<float> sums;
+  Stopwatch reduce;
+  for (uint32_t iter = 0; iter < iterations; ++iter)
+    segmentedReduceCpu(inputFloats, segmentOffsets, sums);
+  double reduceMs = reduce.elapsedMs() / iterations;
+
+  std::vector<float> expectedSums(segmentOffsets.size() - 1);
+  Stopwatch stdReduce;
+  for (uint32_t iter = 0; iter < iterations; ++iter) {
+    for (size_t segmentIdx = 0; segmentIdx < expectedSums.size();
+         ++segmentIdx)
+      expectedSums[segmentIdx] = std::accumulate(
+          inputFloats.begin() + segmentOffsets[segmentIdx],
+          inputFloats.begin() + segmentOffsets[segmentIdx + 1],
+          0.0f);
+  }
+  double stdReduceMs = stdReduce.elapsedMs() / iterations;
+
+  printThroughput("segmented reduce", reduceMs, stdReduceMs);
+  float maxError = 0.0f;
+  for (size_t segmentIdx = 0; segmentIdx < sums.size(); ++segmentIdx)
+    maxError = std::max(
+        maxError,
+        std::abs(sums[segmentIdx] - expectedSums[segmentIdx]));
+  std::cout << "  segmented reduce max error: " << maxError << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+struct Benchmark {
+  const char* name;
+  std::function<int(const std::vector<std::string>&)> run;
+};
+
+const Benchmark s_benchmarks[] = {
+    {"spatial-hash-build", spatialHashBuild},
+    {"spatial-hash-prefix-sum", spatialHashPrefixSum},
+    {"particle-layout", particleLayout},
+    {"morton-reorder", mortonReorder},
+    {"particle-reset", particleReset},
+    {"neighbor-list", neighborList},
+    {"solver-convergence", solverConvergence},
+    {"pbf-convergence", pbfConvergence},
+    {"primitives", primitives}};
+} // namespace
+
+int run(const std::string& name, const std::vector<std::string>& args) {
+  for (const Benchmark& benchmark : s_benchmarks) {
+    if (name == benchmark.name)
+      return benchmark.run(args);
+  }
+
+  std::cerr << "Unknown benchmark \"" << name << "\", available benchmarks:\n";
+  for (const Benchmark& benchmark : s_benchmarks)
+    std::cerr << "  " << benchmark.name << "\n";
+
+  return EXIT_FAILURE;
+}
+
+} // namespace Benchmarks
+} // namespace AltheaDemo
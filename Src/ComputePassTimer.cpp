@@ -0,0 +1,105 @@
+#include "ComputePassTimer.h"
+
+#include <Althea/Application.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace AltheaDemo {
+
+ComputePassTimer::ComputePassTimer(
+    Application& app,
+    uint32_t passCount,
+    uint32_t maxDispatches)
+    : m_device(app.getDevice()),
+      m_maxDispatches(maxDispatches),
+      m_passMs(passCount),
+      m_passDispatches(passCount) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(app.getPhysicalDevice(), &properties);
+  if (properties.limits.timestampPeriod == 0.0f)
+    throw std::runtime_error("Timestamp queries are not supported!");
+
+  m_msPerTick = properties.limits.timestampPeriod * 1.0e-6;
+
+  VkQueryPoolCreateInfo createInfo{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+  createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  createInfo.queryCount = 2 * maxDispatches;
+  if (vkCreateQueryPool(m_device, &createInfo, nullptr, &m_queryPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("Failed to create timestamp query pool!");
+
+  m_dispatchPasses.reserve(maxDispatches);
+}
+
+ComputePassTimer::~ComputePassTimer() {
+  vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+}
+
+void ComputePassTimer::reset(VkCommandBuffer commandBuffer) {
+  vkCmdResetQueryPool(commandBuffer, m_queryPool, 0, 2 * m_maxDispatches);
+  m_dispatchPasses.clear();
+}
+
+void ComputePassTimer::beginDispatch(
+    VkCommandBuffer commandBuffer,
+    uint32_t passIdx) {
+  m_timingDispatch = m_dispatchPasses.size() < m_maxDispatches;
+  if (!m_timingDispatch)
+    return;
+
+  uint32_t queryIdx = 2 * static_cast<uint32_t>(m_dispatchPasses.size());
+  m_dispatchPasses.push_back(passIdx);
+  // Written once the work before the dispatch is done with the compute
+  // stage, so barrier stalls aren't charged to the dispatch
+  vkCmdWriteTimestamp(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      m_queryPool,
+      queryIdx);
+}
+
+void ComputePassTimer::endDispatch(VkCommandBuffer commandBuffer) {
+  if (!m_timingDispatch)
+    return;
+
+  m_timingDispatch = false;
+  uint32_t queryIdx = 2 * static_cast<uint32_t>(m_dispatchPasses.size()) - 1;
+  vkCmdWriteTimestamp(
+      commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      m_queryPool,
+      queryIdx);
+}
+
+void ComputePassTimer::collect() {
+  uint32_t dispatchCount = static_cast<uint32_t>(m_dispatchPasses.size());
+  if (dispatchCount == 0)
+    return;
+
+  std::vector<uint64_t> timestamps(2 * dispatchCount);
+  vkGetQueryPoolResults(
+      m_device,
+      m_queryPool,
+      0,
+      2 * dispatchCount,
+      timestamps.size() * sizeof(uint64_t),
+      timestamps.data(),
+      sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+  for (uint32_t dispatchIdx = 0; dispatchIdx < dispatchCount; ++dispatchIdx) {
+    uint64_t ticks =
+        timestamps[2 * dispatchIdx + 1] - timestamps[2 * dispatchIdx];
+    uint32_t passIdx = m_dispatchPasses[dispatchIdx];
+    m_passMs[passIdx] += ticks * m_msPerTick;
+    ++m_passDispatches[passIdx];
+  }
+
+  m_dispatchPasses.clear();
+}
+
+} // namespace AltheaDemo
@@ -0,0 +1,217 @@
+#include "ContactSolverCpu.h"
+
+#include "ParallelFor.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+uint32_t computeCellColor(const glm::mat4& worldToGrid, const glm::vec3& pos) {
+  glm::ivec3 gridCell = computeGridCell(worldToGrid, pos);
+  return (gridCell.x & 1) | ((gridCell.y & 1) << 1) | ((gridCell.z & 1) << 2);
+}
+
+namespace {
+// Same as checkParticleCollision in ParticleCollision.glsl
+void checkParticleCollision(
+    glm::vec3& deltaPos,
+    uint32_t& collidingParticlesCount,
+    const glm::vec3& particlePos,
+    const glm::vec3& otherParticlePos,
+    float particleRadius) {
+  glm::vec3 diff = otherParticlePos - particlePos;
+  float dist = glm::length(diff);
+  float sep = dist - 2.0f * particleRadius;
+
+  if (sep < 0.0f) {
+    if (dist < 0.00001f)
+      diff = glm::vec3(1.0f, 0.0f, 0.0f);
+    else
+      diff /= dist;
+
+    deltaPos += 0.5f * sep * diff;
+    ++collidingParticlesCount;
+  }
+}
+} // namespace
+
+void ContactSolverCpu::init(
+    const SpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    const std::vector<uint32_t>& globalIndices,
+    float particleRadius) {
+  _init(spatialHash, worldToGrid, cellPositions, globalIndices, particleRadius);
+}
+
+void ContactSolverCpu::init(
+    const SortedSpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    const std::vector<uint32_t>& globalIndices,
+    float particleRadius) {
+  _init(spatialHash, worldToGrid, cellPositions, globalIndices, particleRadius);
+}
+
+template <typename TSpatialHash>
+void ContactSolverCpu::_init(
+    const TSpatialHash& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    const std::vector<uint32_t>& globalIndices,
+    float particleRadius) {
+  m_worldToGrid = worldToGrid;
+  m_particleRadius = particleRadius;
+
+  uint32_t spatialHashSize = spatialHash.getSpatialHashSize();
+  m_rangeStarts.resize(spatialHashSize);
+  m_rangeEnds.resize(spatialHashSize);
+  parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+    for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx)
+      spatialHash.getCellRange(
+          slotIdx,
+          m_rangeStarts[slotIdx],
+          m_rangeEnds[slotIdx]);
+  });
+
+  uint32_t entryCount = 0;
+  for (uint32_t globalIdx : globalIndices)
+    entryCount = std::max(entryCount, globalIdx + 1);
+
+  m_positions.resize(entryCount);
+  m_colors.resize(entryCount);
+  uint32_t particleCount = static_cast<uint32_t>(globalIndices.size());
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      uint32_t globalIdx = globalIndices[particleIdx];
+      m_positions[globalIdx] = spatialHash.getPosition(globalIdx);
+      m_colors[globalIdx] = static_cast<uint8_t>(
+          computeCellColor(worldToGrid, cellPositions[particleIdx]));
+    }
+  });
+}
+
+template <typename TFunc>
+void ContactSolverCpu::_forEachNeighbor(
+    uint32_t globalParticleIdx,
+    const glm::vec3& particlePos,
+    TFunc&& fn) const {
+  glm::ivec3 gridCell = computeNeighborhoodBaseCell(m_worldToGrid, particlePos);
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  for (int i = 0; i < 8; ++i) {
+    uint32_t slotIdx = hashCoords(
+                           gridCell.x + (i >> 2),
+                           gridCell.y + ((i >> 1) & 1),
+                           gridCell.z + (i & 1)) %
+                       spatialHashSize;
+    for (uint32_t otherIdx = m_rangeStarts[slotIdx];
+         otherIdx < m_rangeEnds[slotIdx];
+         ++otherIdx) {
+      if (otherIdx != globalParticleIdx)
+        fn(otherIdx);
+    }
+  }
+}
+
+void ContactSolverCpu::jacobiIteration() {
+  m_prevIterate = m_positions;
+
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+    for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx) {
+      for (uint32_t globalIdx = m_rangeStarts[slotIdx];
+           globalIdx < m_rangeEnds[slotIdx];
+           ++globalIdx) {
+        glm::vec3 particlePos = m_prevIterate[globalIdx];
+
+        glm::vec3 contactDisp(0.0f);
+        uint32_t contactCount = 0;
+        _forEachNeighbor(globalIdx, particlePos, [&](uint32_t otherIdx) {
+          checkParticleCollision(
+              contactDisp,
+              contactCount,
+              particlePos,
+              m_prevIterate[otherIdx],
+              m_particleRadius);
+        });
+
+        m_positions[globalIdx] = particlePos + contactDisp;
+      }
+    }
+  });
+}
+
+void ContactSolverCpu::gaussSeidelIteration() {
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  for (uint32_t color = 0; color < CELL_COLOR_COUNT; ++color) {
+    parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+      for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx) {
+        uint32_t slotStart = m_rangeStarts[slotIdx];
+        uint32_t slotEnd = m_rangeEnds[slotIdx];
+        for (uint32_t globalIdx = slotStart; globalIdx < slotEnd;
+             ++globalIdx) {
+          if (m_colors[globalIdx] != color)
+            continue;
+
+          glm::vec3 particlePos = m_positions[globalIdx];
+
+          glm::vec3 contactDisp(0.0f);
+          uint32_t contactCount = 0;
+          _forEachNeighbor(globalIdx, particlePos, [&](uint32_t otherIdx) {
+            // Particles of this colour in other slots may be getting updated
+            // by another thread, they started out at least a cell away
+            bool inThisSlot = otherIdx >= slotStart && otherIdx < slotEnd;
+            if (!inThisSlot && m_colors[otherIdx] == color)
+              return;
+
+            checkParticleCollision(
+                contactDisp,
+                contactCount,
+                particlePos,
+                m_positions[otherIdx],
+                m_particleRadius);
+          });
+
+          m_positions[globalIdx] = particlePos + contactDisp;
+        }
+      }
+    });
+  }
+}
+
+double ContactSolverCpu::computePenetration() const {
+  std::atomic<uint64_t> penetration{0};
+
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+    double localPenetration = 0.0;
+    for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx) {
+      for (uint32_t globalIdx = m_rangeStarts[slotIdx];
+           globalIdx < m_rangeEnds[slotIdx];
+           ++globalIdx) {
+        glm::vec3 particlePos = m_positions[globalIdx];
+        _forEachNeighbor(globalIdx, particlePos, [&](uint32_t otherIdx) {
+          float dist = glm::length(m_positions[otherIdx] - particlePos);
+          localPenetration += std::max(2.0f * m_particleRadius - dist, 0.0f);
+        });
+      }
+    }
+
+    // Summed in micrometers, atomic doubles can't be added to before C++20
+    penetration.fetch_add(
+        static_cast<uint64_t>(localPenetration * 1.0e6),
+        std::memory_order_relaxed);
+  });
+
+  // Every pair was counted from both sides
+  return 0.5e-6 * static_cast<double>(penetration.load());
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
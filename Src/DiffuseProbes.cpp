@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,11 @@ namespace AltheaDemo {
 namespace DiffuseProbes {
 
 namespace {
+uint32_t getReservoirBufferCount(const VkExtent2D& extent) {
+  uint32_t reservoirCount = 2 * extent.width * extent.height;
+  return (reservoirCount - 1) / RESERVOIR_COUNT_PER_BUFFER + 1;
+}
+
 struct GBufferPush {
   uint32_t matrixBufferHandle;
   uint32_t primConstantsBuffer;
@@ -109,10 +115,47 @@ void DiffuseProbes::initGame(Application& app) {
           exposure = static_cast<float>(y);
         }
       });
+
+  // The scene, its acceleration structure and the probes outlive swapchain
+  // re-creation
+  SingleTimeCommandBuffer commandBuffer(app);
+  createGlobalResources(app, commandBuffer);
+  createSamplingPasses(app, commandBuffer);
+  createProbeResources(app, commandBuffer);
+
+  // The heap can't release handles, so the screen-sized resources get theirs
+  // once and createScreenResources rewrites them on every resize
+  m_rtTarget.targetImageHandle = m_heap.registerImage();
+  m_rtTarget.targetTextureHandle = m_heap.registerTexture();
+  registerReservoirHandles(getReservoirBufferCount(windowDims));
 }
 
 void DiffuseProbes::shutdownGame(Application& app) {
   m_pCameraController.reset();
+
+  m_models.clear();
+
+  m_accelerationStructure = {};
+  m_giUniforms = {};
+
+  m_directSamplingPass = {};
+  m_spatialResamplingPass = {};
+
+  m_probeController = {};
+  m_probes = {};
+
+  m_sphere = {};
+  m_probePlacementPass = {};
+
+  m_globalUniforms = {};
+
+  m_rtTarget = {};
+  m_reservoirHandles.clear();
+
+  m_globalResources = {};
+  m_globalResourcesExtent = {};
+
+  m_heap = {};
 }
 
 void DiffuseProbes::createRenderState(Application& app) {
@@ -123,44 +166,31 @@ void DiffuseProbes::createRenderState(Application& app) {
   Gui::createRenderState(app);
 
   SingleTimeCommandBuffer commandBuffer(app);
-  createGlobalResources(app, commandBuffer);
+  createScreenResources(app, commandBuffer);
   createGBufferPass(app, commandBuffer);
-  createSamplingPasses(app, commandBuffer);
-  createProbeResources(app, commandBuffer);
+  createDisplayPass(app);
+  createCompositingPass(app);
+
+  // The reservoirs start over
+  m_frameNumber = 0;
 }
 
 void DiffuseProbes::destroyRenderState(Application& app) {
-  m_models.clear();
-
   Gui::destroyRenderState(app);
 
-  m_accelerationStructure = {};
-  m_rtTarget = {};
-  m_giUniforms = {};
+  m_rtTarget.target = {};
 
   m_gBufferPass = {};
   m_gBufferFrameBufferA = {};
   m_gBufferFrameBufferB = {};
-  m_directSamplingPass = {};
-  m_spatialResamplingPass = {};
   m_displayPass = {};
   m_displayPassSwapChainFrameBuffers = {};
 
-  m_probeController = {};
-  m_probes = {};
-
-  m_sphere = {};
-  m_probePlacementPass = {};
   m_compositingPass = {};
   m_compositingFrameBufferA = {};
   m_compositingFrameBufferB = {};
 
-  m_globalResources = {};
-  m_globalUniforms = {};
-
-  m_reservoirHeap = {};
-
-  m_heap = {};
+  m_reservoirHeap.clear();
 }
 
 static GlobalIllumination::LiveEditValues s_liveValues{};
@@ -277,7 +307,7 @@ void DiffuseProbes::tick(Application& app, const FrameContext& frame) {
 
   giUniforms.writeIndex = m_targetIndex;
 
-  giUniforms.reservoirHeap = m_reservoirHeap.getFirstBufferHandle().index;
+  giUniforms.reservoirHeap = m_reservoirHandles[0].index;
   giUniforms.reservoirsPerBuffer = RESERVOIR_COUNT_PER_BUFFER;
 
   giUniforms.frameNumber = m_frameNumber;
@@ -344,24 +374,95 @@ void DiffuseProbes::createGlobalResources(
   m_accelerationStructure = AccelerationStructure(app, commandBuffer, m_models);
   m_accelerationStructure.registerToHeap(m_heap);
 
-  GlobalResourcesBuilder resourcesBuilder{};
-  m_globalResources =
-      GlobalResources(app, commandBuffer, m_heap, resourcesBuilder);
   m_globalUniforms = GlobalUniformsResource(app, m_heap);
+}
 
+void DiffuseProbes::createScreenResources(
+    Application& app,
+    SingleTimeCommandBuffer& commandBuffer) {
   // TODO: Make this buffer smaller...
   VkExtent2D extent = app.getSwapChainExtent();
 
+  // GlobalResources registers its own heap handles, the engine can't point
+  // them at a new GBuffer. Only an actual resize rebuilds it.
+  if (extent.width != m_globalResourcesExtent.width ||
+      extent.height != m_globalResourcesExtent.height) {
+    GlobalResourcesBuilder resourcesBuilder{};
+    m_globalResources =
+        GlobalResources(app, commandBuffer, m_heap, resourcesBuilder);
+    m_globalResourcesExtent = extent;
+  }
+
   {
-    uint32_t reservoirCount = 2 * extent.width * extent.height;
-    uint32_t bufferCount =
-        (reservoirCount - 1) / RESERVOIR_COUNT_PER_BUFFER + 1;
-    m_reservoirHeap = StructuredBufferHeap<GlobalIllumination::Reservoir>(
-        app,
-        bufferCount,
-        RESERVOIR_COUNT_PER_BUFFER);
-    m_reservoirHeap.zeroBuffer(commandBuffer);
-    m_reservoirHeap.registerToHeap(m_heap);
+    uint32_t bufferCount = getReservoirBufferCount(extent);
+
+    // Only a window larger than any before it needs a longer range
+    if (bufferCount > m_reservoirHandles.size())
+      registerReservoirHandles(bufferCount);
+
+    m_reservoirHeap.reserve(bufferCount);
+    m_reservoirBarriers = BarrierBatcher(1);
+
+    for (uint32_t bufferIdx = 0; bufferIdx < bufferCount; ++bufferIdx) {
+      auto& buffer =
+          m_reservoirHeap.emplace_back(app, RESERVOIR_COUNT_PER_BUFFER);
+      buffer.zeroBuffer(commandBuffer);
+      m_heap.updateStorageBuffer(
+          m_reservoirHandles[bufferIdx],
+          buffer.getAllocation().getBuffer(),
+          0,
+          buffer.getSize());
+    }
+
+    m_reservoirBarriers.write(
+        0,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT);
+    m_reservoirBarriers.flush(commandBuffer);
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    ImageOptions imageOptions{};
+    imageOptions.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    imageOptions.width = app.getSwapChainExtent().width;
+    imageOptions.height = app.getSwapChainExtent().height;
+    imageOptions.usage = VK_IMAGE_USAGE_STORAGE_BIT |
+                         VK_IMAGE_USAGE_SAMPLED_BIT |
+                         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+    ImageViewOptions viewOptions{};
+    viewOptions.format = imageOptions.format;
+
+    SamplerOptions samplerOptions{};
+    samplerOptions.minFilter = VK_FILTER_NEAREST;
+    samplerOptions.magFilter = VK_FILTER_NEAREST;
+
+    m_rtTarget.target.image = Image(app, imageOptions);
+    m_rtTarget.target.view =
+        ImageView(app, m_rtTarget.target.image, viewOptions);
+    m_rtTarget.target.sampler = Sampler(app, samplerOptions);
+
+    m_heap.updateStorageImage(
+        m_rtTarget.targetImageHandle,
+        m_rtTarget.target.view,
+        m_rtTarget.target.sampler);
+
+    m_heap.updateTexture(
+        m_rtTarget.targetTextureHandle,
+        m_rtTarget.target.view,
+        m_rtTarget.target.sampler);
+  }
+}
+
+void DiffuseProbes::registerReservoirHandles(uint32_t bufferCount) {
+  m_reservoirHandles.clear();
+  m_reservoirHandles.reserve(bufferCount);
+  for (uint32_t bufferIdx = 0; bufferIdx < bufferCount; ++bufferIdx) {
+    BufferHandle handle = m_heap.registerBuffer();
+    if (bufferIdx != 0 &&
+        handle.index != m_reservoirHandles[0].index + bufferIdx)
+      throw std::runtime_error("Reservoir handles aren't contiguous!");
+    m_reservoirHandles.push_back(handle);
   }
 }
 
@@ -418,40 +519,6 @@ void DiffuseProbes::createSamplingPasses(
   m_giUniforms = TransientUniforms<GlobalIllumination::Uniforms>(app);
   m_giUniforms.registerToHeap(m_heap);
 
-  for (int i = 0; i < 2; ++i) {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    imageOptions.width = app.getSwapChainExtent().width;
-    imageOptions.height = app.getSwapChainExtent().height;
-    imageOptions.usage = VK_IMAGE_USAGE_STORAGE_BIT |
-                         VK_IMAGE_USAGE_SAMPLED_BIT |
-                         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-    ImageViewOptions viewOptions{};
-    viewOptions.format = imageOptions.format;
-
-    SamplerOptions samplerOptions{};
-    samplerOptions.minFilter = VK_FILTER_NEAREST;
-    samplerOptions.magFilter = VK_FILTER_NEAREST;
-
-    m_rtTarget.target.image = Image(app, imageOptions);
-    m_rtTarget.target.view =
-        ImageView(app, m_rtTarget.target.image, viewOptions);
-    m_rtTarget.target.sampler = Sampler(app, samplerOptions);
-
-    m_rtTarget.targetImageHandle = m_heap.registerImage();
-    m_heap.updateStorageImage(
-        m_rtTarget.targetImageHandle,
-        m_rtTarget.target.view,
-        m_rtTarget.target.sampler);
-
-    m_rtTarget.targetTextureHandle = m_heap.registerTexture();
-    m_heap.updateTexture(
-        m_rtTarget.targetTextureHandle,
-        m_rtTarget.target.view,
-        m_rtTarget.target.sampler);
-  }
-
   ShaderDefines defs;
   RayTracingPipelineBuilder builder{};
   builder.setRayGenShader(
@@ -479,8 +546,9 @@ void DiffuseProbes::createSamplingPasses(
 
   m_spatialResamplingPass =
       RayTracingPipeline(app, RayTracingPipelineBuilder(builder));
+}
 
-  // Display Pass
+void DiffuseProbes::createDisplayPass(Application& app) {
   VkClearValue colorClear;
   colorClear.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
   VkClearValue depthClear;
@@ -570,6 +638,9 @@ void DiffuseProbes::createProbeResources(
 
     m_probePlacementPass = ComputePipeline(app, std::move(builder));
   }
+}
+
+void DiffuseProbes::createCompositingPass(Application& app) {
   const ImageOptions& targetOptions = m_rtTarget.target.image.getOptions();
 
   VkClearValue colorClear;
@@ -720,6 +791,10 @@ void DiffuseProbes::draw(
           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
   // Direct Sampling
+  m_reservoirBarriers.readWrite(
+      0,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+  m_reservoirBarriers.flush(commandBuffer);
   {
     m_directSamplingPass.bindPipeline(commandBuffer);
     m_directSamplingPass.bindDescriptorSet(commandBuffer, heapSet);
@@ -727,9 +802,11 @@ void DiffuseProbes::draw(
     m_directSamplingPass.traceRays(app.getSwapChainExtent(), commandBuffer);
   }
 
-  m_reservoirHeap.rwBarrier(commandBuffer);
-
   // Spatial Resampling
+  m_reservoirBarriers.readWrite(
+      0,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+  m_reservoirBarriers.flush(commandBuffer);
   {
     m_spatialResamplingPass.bindPipeline(commandBuffer);
     m_spatialResamplingPass.bindDescriptorSet(commandBuffer, heapSet);
@@ -737,12 +814,11 @@ void DiffuseProbes::draw(
     m_spatialResamplingPass.traceRays(app.getSwapChainExtent(), commandBuffer);
   }
 
-  m_reservoirHeap.barrier(
-      commandBuffer,
-      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
-      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-      VK_ACCESS_SHADER_READ_BIT,
-      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  m_reservoirBarriers.read(
+      0,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT);
+  m_reservoirBarriers.flush(commandBuffer);
   m_rtTarget.target.image.transitionLayout(
       commandBuffer,
       VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
@@ -0,0 +1,277 @@
+#include "GpuPrimitives.h"
+
+#include "ComputePassTimer.h"
+
+#include <Althea/Application.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace AltheaEngine;
+
+#define PRIMITIVES_LOCAL_SIZE_X 128
+
+#define SCAN_ITEMS_PER_THREAD 8
+#define SCAN_BLOCK_SIZE (PRIMITIVES_LOCAL_SIZE_X * SCAN_ITEMS_PER_THREAD)
+
+// 4-bit digits keep the per-thread digit counts in registers
+#define RADIX_BITS 4
+#define RADIX_DIGIT_COUNT (1 << RADIX_BITS)
+#define RADIX_ITEMS_PER_THREAD 16
+
+// Upper bound on the workgroups of one dispatch in x
+#define MAX_GROUP_COUNT 65535
+
+namespace AltheaDemo {
+namespace {
+struct ScanPushConstants {
+  uint32_t values;
+  uint32_t blockSums;
+  uint32_t count;
+};
+
+struct SortPushConstants {
+  uint32_t keysIn;
+  uint32_t valuesIn;
+  uint32_t keysOut;
+  uint32_t valuesOut;
+  uint32_t histogram;
+  uint32_t count;
+  uint32_t digitShift;
+};
+
+struct ReducePushConstants {
+  uint32_t values;
+  uint32_t segmentOffsets;
+  uint32_t sums;
+  uint32_t segmentCount;
+};
+
+uint32_t getSortTileCount(uint32_t count) {
+  return (count - 1) / RADIX_ITEMS_PER_THREAD + 1;
+}
+
+// Sorts scan their histograms, which can be a bit longer than the keys
+uint32_t getMaxScanCount(uint32_t maxCount) {
+  if (maxCount == 0)
+    return 0;
+
+  return std::max(maxCount, RADIX_DIGIT_COUNT * getSortTileCount(maxCount));
+}
+
+template <typename TPushConstants>
+void addComputePass(
+    Application& app,
+    GlobalHeap& heap,
+    const std::string& shaderPath,
+    const ShaderDefines& defs,
+    std::vector<ComputePipeline>& passes) {
+  ComputePipelineBuilder builder;
+  builder.setComputeShader(GProjectDirectory + shaderPath, defs);
+  builder.layoutBuilder.addDescriptorSet(heap.getDescriptorSetLayout())
+      .addPushConstants<TPushConstants>();
+
+  passes.emplace_back(app, std::move(builder));
+}
+} // namespace
+
+GpuPrimitives::GpuPrimitives(
+    Application& app,
+    GlobalHeap& heap,
+    uint32_t maxCount)
+    : m_pHeap(&heap), m_maxCount(maxCount), m_barriers(1) {
+  if (maxCount > 0) {
+    m_scanBlockSums = StructuredBuffer<uint32_t>(
+        app,
+        (getMaxScanCount(maxCount) - 1) / SCAN_BLOCK_SIZE + 1);
+    m_scanBlockSums.registerToHeap(heap);
+
+    m_sortHistogram = StructuredBuffer<uint32_t>(
+        app,
+        RADIX_DIGIT_COUNT * getSortTileCount(maxCount));
+    m_sortHistogram.registerToHeap(heap);
+
+    m_sortKeys = StructuredBuffer<uint32_t>(app, maxCount);
+    m_sortKeys.registerToHeap(heap);
+    m_sortValues = StructuredBuffer<uint32_t>(app, maxCount);
+    m_sortValues.registerToHeap(heap);
+  }
+
+  ShaderDefines shaderDefs{};
+  shaderDefs.emplace("LOCAL_SIZE_X", std::to_string(PRIMITIVES_LOCAL_SIZE_X));
+
+  // Order needs to match the PRIMITIVE_*_PASS indices
+  for (uint32_t scanStage = 0; scanStage < 3; ++scanStage) {
+    ShaderDefines scanDefs = shaderDefs;
+    scanDefs.emplace("SCAN_STAGE", std::to_string(scanStage));
+    scanDefs.emplace(
+        "SCAN_ITEMS_PER_THREAD",
+        std::to_string(SCAN_ITEMS_PER_THREAD));
+    addComputePass<ScanPushConstants>(
+        app,
+        heap,
+        "/Shaders/Primitives/Scan.comp.glsl",
+        scanDefs,
+        m_passes);
+  }
+
+  for (uint32_t sortStage = 0; sortStage < 2; ++sortStage) {
+    ShaderDefines sortDefs = shaderDefs;
+    sortDefs.emplace("SORT_STAGE", std::to_string(sortStage));
+    sortDefs.emplace("RADIX_BITS", std::to_string(RADIX_BITS));
+    sortDefs.emplace(
+        "RADIX_ITEMS_PER_THREAD",
+        std::to_string(RADIX_ITEMS_PER_THREAD));
+    addComputePass<SortPushConstants>(
+        app,
+        heap,
+        "/Shaders/Primitives/RadixSort.comp.glsl",
+        sortDefs,
+        m_passes);
+  }
+
+  addComputePass<ReducePushConstants>(
+      app,
+      heap,
+      "/Shaders/Primitives/SegmentedReduce.comp.glsl",
+      shaderDefs,
+      m_passes);
+}
+
+void GpuPrimitives::exclusiveScan(
+    VkCommandBuffer commandBuffer,
+    uint32_t valuesHandle,
+    uint32_t count) {
+  if (count == 0)
+    return;
+
+  if (count > getMaxScanCount(m_maxCount))
+    throw std::runtime_error("Scan is larger than the primitives' maxCount!");
+
+  ScanPushConstants push{};
+  push.values = valuesHandle;
+  push.blockSums = m_scanBlockSums.getHandle().index;
+  push.count = count;
+
+  // Scan each block locally and write out the block totals
+  uint32_t blockCount = (count - 1) / SCAN_BLOCK_SIZE + 1;
+  _dispatch(commandBuffer, PRIMITIVE_SCAN_BLOCKS_PASS, push, blockCount);
+
+  // Turn the block totals into block offsets
+  _dispatch(commandBuffer, PRIMITIVE_SCAN_BLOCK_SUMS_PASS, push, 1);
+
+  // Add the block offsets back in
+  _dispatch(commandBuffer, PRIMITIVE_SCAN_APPLY_PASS, push, blockCount);
+}
+
+void GpuPrimitives::sortKeyValues(
+    VkCommandBuffer commandBuffer,
+    uint32_t keysHandle,
+    uint32_t valuesHandle,
+    uint32_t count,
+    uint32_t keyBits) {
+  if (count <= 1 || keyBits == 0)
+    return;
+
+  if (count > m_maxCount)
+    throw std::runtime_error("Sort is larger than the primitives' maxCount!");
+
+  // An even number of passes leaves the sorted pairs back in the caller's
+  // buffers, an extra pass over zero bits is cheaper than a copy
+  uint32_t passCount = (std::min(keyBits, 32u) - 1) / RADIX_BITS + 1;
+  passCount += passCount & 1;
+
+  uint32_t tileCount = getSortTileCount(count);
+  uint32_t groupCount = (tileCount - 1) / PRIMITIVES_LOCAL_SIZE_X + 1;
+
+  SortPushConstants push{};
+  push.keysIn = keysHandle;
+  push.valuesIn = valuesHandle;
+  push.keysOut = m_sortKeys.getHandle().index;
+  push.valuesOut = m_sortValues.getHandle().index;
+  push.histogram = m_sortHistogram.getHandle().index;
+  push.count = count;
+
+  for (uint32_t passIdx = 0; passIdx < passCount; ++passIdx) {
+    push.digitShift = passIdx * RADIX_BITS;
+
+    // Count the digits of each tile
+    _dispatch(commandBuffer, PRIMITIVE_SORT_COUNT_PASS, push, groupCount);
+
+    // Turn the counts into each tile's first destination per digit
+    exclusiveScan(
+        commandBuffer,
+        push.histogram,
+        RADIX_DIGIT_COUNT * tileCount);
+
+    // Scatter the pairs, in order within each tile
+    _dispatch(commandBuffer, PRIMITIVE_SORT_SCATTER_PASS, push, groupCount);
+
+    std::swap(push.keysIn, push.keysOut);
+    std::swap(push.valuesIn, push.valuesOut);
+  }
+}
+
+void GpuPrimitives::segmentedReduce(
+    VkCommandBuffer commandBuffer,
+    uint32_t valuesHandle,
+    uint32_t segmentOffsetsHandle,
+    uint32_t sumsHandle,
+    uint32_t segmentCount) {
+  if (segmentCount == 0)
+    return;
+
+  ReducePushConstants push{};
+  push.values = valuesHandle;
+  push.segmentOffsets = segmentOffsetsHandle;
+  push.sums = sumsHandle;
+  push.segmentCount = segmentCount;
+
+  _dispatch(
+      commandBuffer,
+      PRIMITIVE_SEGMENTED_REDUCE_PASS,
+      push,
+      std::min(segmentCount, static_cast<uint32_t>(MAX_GROUP_COUNT)));
+}
+
+template <typename TPushConstants>
+void GpuPrimitives::_dispatch(
+    VkCommandBuffer commandBuffer,
+    uint32_t passIdx,
+    const TPushConstants& push,
+    uint32_t groupCount) {
+  m_barriers.readWrite(0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  m_barriers.flush(commandBuffer);
+
+  VkDescriptorSet set = m_pHeap->getDescriptorSet();
+  m_passes[passIdx].bindPipeline(commandBuffer);
+  vkCmdBindDescriptorSets(
+      commandBuffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      m_passes[passIdx].getLayout(),
+      0,
+      1,
+      &set,
+      0,
+      nullptr);
+
+  vkCmdPushConstants(
+      commandBuffer,
+      m_passes[passIdx].getLayout(),
+      VK_SHADER_STAGE_ALL,
+      0,
+      sizeof(TPushConstants),
+      &push);
+
+  if (m_pPassTimer)
+    m_pPassTimer->beginDispatch(commandBuffer, passIdx);
+
+  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+  if (m_pPassTimer)
+    m_pPassTimer->endDispatch(commandBuffer);
+}
+
+} // namespace AltheaDemo
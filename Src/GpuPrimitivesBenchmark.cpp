@@ -0,0 +1,224 @@
+#include "GpuPrimitivesBenchmark.h"
+
+#include "BarrierBatcher.h"
+#include "ComputePassTimer.h"
+#include "GpuPrimitives.h"
+#include "ParticleSeeding.h"
+#include "PrimitivesCpu.h"
+
+#include <Althea/Application.h>
+#include <Althea/GlobalHeap.h>
+#include <Althea/SingleTimeCommandBuffer.h>
+#include <Althea/StructuredBuffer.h>
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace AltheaDemo {
+namespace {
+// Upper bound on the dispatches recorded in one iteration, a 32-bit sort
+// takes 40
+#define MAX_DISPATCHES_PER_ITERATION 64
+
+uint32_t getArg(
+    const std::vector<std::string>& args,
+    size_t idx,
+    uint32_t defaultValue) {
+  return idx < args.size() ? static_cast<uint32_t>(std::stoul(args[idx]))
+                           : defaultValue;
+}
+
+template <typename T>
+StructuredBuffer<T> createBuffer(
+    Application& app,
+    GlobalHeap& heap,
+    const std::vector<T>& elements) {
+  StructuredBuffer<T> buffer(app, static_cast<uint32_t>(elements.size()));
+  buffer.registerToHeap(heap);
+  for (uint32_t idx = 0; idx < elements.size(); ++idx)
+    buffer.setElement(elements[idx], idx);
+  return buffer;
+}
+} // namespace
+
+/*static*/
+int GpuPrimitivesBenchmark::run(
+    Application& app,
+    const std::vector<std::string>& args) {
+  uint32_t count = std::max(getArg(args, 0, 4000000), 1u);
+  uint32_t iterations = std::max(getArg(args, 1, 10), 1u);
+  uint32_t segmentSize = std::max(getArg(args, 2, 1024), 1u);
+
+  // Same inputs as the CPU primitives benchmark
+  std::vector<uint32_t> counts(count);
+  std::vector<uint32_t> keys(count);
+  std::vector<uint32_t> values(count);
+  std::vector<float> floats(count);
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    uint32_t hash = ParticleSystem::pcgHash(idx);
+    counts[idx] = hash & 0xf;
+    keys[idx] = hash;
+    values[idx] = idx;
+    floats[idx] = float(hash & 0xffff) / 65535.0f - 0.5f;
+  }
+
+  std::vector<uint32_t> segmentOffsets;
+  for (uint32_t offset = 0; offset < count; offset += segmentSize)
+    segmentOffsets.push_back(offset);
+  segmentOffsets.push_back(count);
+  uint32_t segmentCount = static_cast<uint32_t>(segmentOffsets.size()) - 1;
+
+  GlobalHeap heap(app);
+  GpuPrimitives primitives(app, heap, count);
+
+  StructuredBuffer<uint32_t> countsBuffer = createBuffer(app, heap, counts);
+  StructuredBuffer<uint32_t> keysBuffer = createBuffer(app, heap, keys);
+  StructuredBuffer<uint32_t> valuesBuffer = createBuffer(app, heap, values);
+  StructuredBuffer<float> floatsBuffer = createBuffer(app, heap, floats);
+  StructuredBuffer<uint32_t> segmentOffsetsBuffer =
+      createBuffer(app, heap, segmentOffsets);
+  StructuredBuffer<float> sumsBuffer(app, segmentCount);
+  sumsBuffer.registerToHeap(heap);
+
+  ComputePassTimer timer(
+      app,
+      PRIMITIVE_PASS_COUNT,
+      MAX_DISPATCHES_PER_ITERATION);
+  primitives.setPassTimer(&timer);
+
+  // The inputs are uploaded again before every iteration, the primitives
+  // work in place
+  BarrierBatcher barriers(1);
+  auto timeIterations = [&](auto&& upload, auto&& record) {
+    auto getTotalMs = [&]() {
+      double totalMs = 0.0;
+      for (uint32_t passIdx = 0; passIdx < PRIMITIVE_PASS_COUNT; ++passIdx)
+        totalMs += timer.getPassMs(passIdx);
+      return totalMs;
+    };
+
+    double startMs = getTotalMs();
+    for (uint32_t iter = 0; iter < iterations; ++iter) {
+      {
+        SingleTimeCommandBuffer commandBuffer(app);
+        timer.reset(commandBuffer);
+
+        barriers.write(
+            0,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT);
+        barriers.flush(commandBuffer);
+        upload(commandBuffer);
+
+        barriers.write(
+            0,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT);
+        barriers.flush(commandBuffer);
+        record(commandBuffer);
+      }
+      timer.collect();
+    }
+
+    return (getTotalMs() - startMs) / iterations;
+  };
+
+  double scanMs = timeIterations(
+      [&](VkCommandBuffer commandBuffer) {
+        countsBuffer.upload(app, commandBuffer);
+      },
+      [&](VkCommandBuffer commandBuffer) {
+        primitives.exclusiveScan(
+            commandBuffer,
+            countsBuffer.getHandle().index,
+            count);
+      });
+
+  double sortMs = timeIterations(
+      [&](VkCommandBuffer commandBuffer) {
+        keysBuffer.upload(app, commandBuffer);
+        valuesBuffer.upload(app, commandBuffer);
+      },
+      [&](VkCommandBuffer commandBuffer) {
+        primitives.sortKeyValues(
+            commandBuffer,
+            keysBuffer.getHandle().index,
+            valuesBuffer.getHandle().index,
+            count);
+      });
+
+  double reduceMs = timeIterations(
+      [&](VkCommandBuffer /*commandBuffer*/) {},
+      [&](VkCommandBuffer commandBuffer) {
+        primitives.segmentedReduce(
+            commandBuffer,
+            floatsBuffer.getHandle().index,
+            segmentOffsetsBuffer.getHandle().index,
+            sumsBuffer.getHandle().index,
+            segmentCount);
+      });
+
+  vkDeviceWaitIdle(app.getDevice());
+
+  // Check the last iteration of each against the CPU twins
+  std::vector<uint32_t> gpuScan;
+  std::vector<uint32_t> gpuKeys;
+  std::vector<uint32_t> gpuValues;
+  std::vector<float> gpuSums;
+  countsBuffer.download(gpuScan);
+  keysBuffer.download(gpuKeys);
+  valuesBuffer.download(gpuValues);
+  sumsBuffer.download(gpuSums);
+
+  exclusiveScanCpu(counts);
+  sortKeyValuesCpu(keys, values);
+  std::vector<float> sums;
+  segmentedReduceCpu(floats, segmentOffsets, sums);
+
+  uint32_t scanMismatches = 0;
+  uint32_t sortMismatches = 0;
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    if (gpuScan[idx] != counts[idx])
+      ++scanMismatches;
+    if (gpuKeys[idx] != keys[idx] || gpuValues[idx] != values[idx])
+      ++sortMismatches;
+  }
+
+  // Segments of uniform values in [-0.5, 0.5] sum to a few units at most,
+  // the tolerance covers the different summation orders
+  uint32_t reduceMismatches = 0;
+  for (uint32_t segmentIdx = 0; segmentIdx < segmentCount; ++segmentIdx)
+    if (std::abs(gpuSums[segmentIdx] - sums[segmentIdx]) >
+        1.0e-5f * float(segmentSize))
+      ++reduceMismatches;
+
+  auto printResult =
+      [&](const char* name, double ms, uint32_t mismatches) {
+        std::cout << "  " << name << ": " << ms << " ms, "
+                  << count / ms * 1.0e-3 << " M elements/s, " << mismatches
+                  << " mismatches\n";
+      };
+
+  std::cout << "primitives-bench: " << count << " elements, " << iterations
+            << " iterations\n";
+  printResult("exclusive scan", scanMs, scanMismatches);
+  printResult("key-value sort", sortMs, sortMismatches);
+  printResult("segmented reduce", reduceMs, reduceMismatches);
+  std::cout << std::flush;
+
+  primitives.setPassTimer(nullptr);
+
+  return scanMismatches == 0 && sortMismatches == 0 && reduceMismatches == 0
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
+
+} // namespace AltheaDemo
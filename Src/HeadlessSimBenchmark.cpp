@@ -0,0 +1,406 @@
+#include "HeadlessSimBenchmark.h"
+
+#include "ComputePassTimer.h"
+#include "ParticleSystem.h"
+#include "SpatialHashCpu.h"
+
+#include <Althea/Application.h>
+#include <Althea/SingleTimeCommandBuffer.h>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace AltheaEngine;
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+namespace {
+// Indexed by the *_PASS defines
+const char* s_passNames[] = {
+    "sim",
+    "bucket-alloc",
+    "bucket-insert",
+    "jacobi-step",
+    "cell-scan-blocks",
+    "cell-scan-block-sums",
+    "cell-scan-apply",
+    "morton-keys",
+    "morton-scatter",
+    "morton-copy-back",
+    "neighbor-list",
+    "gauss-seidel-step",
+    "sim-counters",
+    "compact-flags",
+    "live-scan-blocks",
+    "live-scan-block-sums",
+    "live-scan-apply",
+    "compact-scatter",
+    "compact-copy-back",
+    "sim-counters-compacted",
+    "pbf-lambda",
+    "hi-z",
+    "cull-reset",
+    "cull",
+    "fluid-clear",
+    "fluid-splat",
+    "fluid-smooth"};
+
+// Indexed by the PRIMITIVE_*_PASS defines, the sim only runs the primitives'
+// scan for the Morton reorder
+const char* s_primitivePassNames[] = {
+    "morton-scan-blocks",
+    "morton-scan-block-sums",
+    "morton-scan-apply",
+    "primitive-sort-count",
+    "primitive-sort-scatter",
+    "primitive-segmented-reduce"};
+
+// Upper bound on the dispatches recorded in one frame
+#define MAX_DISPATCHES_PER_FRAME 1024
+
+double getGpuMs(
+    const ComputePassTimer& timer,
+    const ComputePassTimer& primitivesTimer,
+    uint32_t passCount) {
+  double gpuMs = 0.0;
+  for (uint32_t passIdx = 0; passIdx < passCount; ++passIdx)
+    gpuMs += timer.getPassMs(passIdx);
+  for (uint32_t passIdx = 0; passIdx < PRIMITIVE_PASS_COUNT; ++passIdx)
+    gpuMs += primitivesTimer.getPassMs(passIdx);
+  return gpuMs;
+}
+
+uint32_t getArg(
+    const std::vector<std::string>& args,
+    size_t idx,
+    uint32_t defaultValue) {
+  return idx < args.size() ? static_cast<uint32_t>(std::stoul(args[idx]))
+                           : defaultValue;
+}
+} // namespace
+
+/*static*/
+int HeadlessSimBenchmark::run(
+    Application& app,
+    const std::vector<std::string>& args) {
+  uint32_t substeps = getArg(args, 0, 600);
+  uint32_t particleCount = getArg(args, 1, 100000);
+  std::string outputPath = args.size() > 2 ? args[2] : "sim-benchmark.json";
+  uint32_t localSizeX = getArg(args, 3, 0);
+  uint32_t tasksPerThread = getArg(args, 4, 0);
+
+  ParticleSystem sim;
+  _createSim(app, sim, particleCount, localSizeX, tasksPerThread);
+  particleCount = sim.m_activeParticleCount;
+  const SimSpecialization& specialization = sim.m_simSpecialization;
+
+  ComputePassTimer timer(
+      app,
+      static_cast<uint32_t>(sim.m_computePasses.size()),
+      MAX_DISPATCHES_PER_FRAME);
+  ComputePassTimer primitivesTimer(
+      app,
+      PRIMITIVE_PASS_COUNT,
+      MAX_DISPATCHES_PER_FRAME);
+
+  uint32_t substepsPerFrame = sim._getSubstepsPerFrame();
+  uint32_t frameCount = (substeps - 1) / substepsPerFrame + 1;
+  substeps = frameCount * substepsPerFrame;
+
+  sim.m_barriers.resetCounts();
+  double recordMs = 0.0;
+  double wallMs =
+      _runFrames(app, sim, timer, primitivesTimer, frameCount, recordMs);
+
+  vkDeviceWaitIdle(app.getDevice());
+
+  // Every frame's commands were waited on, only the readback worker might
+  // still be catching up
+  if (sim.m_useHashTelemetry || sim.m_useSleeping)
+    sim.m_pReadback->flush();
+  if (sim.m_useHashTelemetry)
+    sim._collectHashTelemetry();
+  if (sim.m_useSleeping)
+    sim._collectSleepStats();
+
+  // Compaction may have dropped particles that left the kill bounds
+  std::vector<SimCounters> simCounters;
+  sim.m_simCounters.download(simCounters);
+  uint32_t liveParticleCount = simCounters[0].particleCount;
+
+  // Hash the last substep's cell positions again on the CPU, the sim pass
+  // hashes the position each particle started the substep at
+  std::vector<glm::vec3> cellPositions;
+  cellPositions.reserve(particleCount);
+  for (SimChunk& chunk : sim.m_chunks) {
+    if (sim.m_particleLayout == PARTICLE_LAYOUT_SOA) {
+      std::vector<glm::vec4> prevPositions;
+      chunk.prevPositions.download(prevPositions);
+      for (const glm::vec4& position : prevPositions)
+        cellPositions.push_back(glm::vec3(position));
+    } else {
+      std::vector<Particle> particles;
+      chunk.particles.download(particles);
+      for (const Particle& particle : particles)
+        cellPositions.push_back(particle.prevPosition);
+    }
+  }
+  cellPositions.resize(liveParticleCount);
+
+  const SimUniforms& simUniforms = sim.m_lastSimUniforms;
+  uint32_t spatialHashSize = simUniforms.spatialHashSize;
+  SpatialHashStats hashStats = computeSpatialHashStats(
+      simUniforms.worldToGrid,
+      cellPositions,
+      spatialHashSize);
+
+  uint32_t passCount = static_cast<uint32_t>(sim.m_computePasses.size());
+  double gpuMs = getGpuMs(timer, primitivesTimer, passCount);
+
+  // Time the same run again with sleeping off, so the time sleeping saves is
+  // measured rather than extrapolated from the sleeping fraction
+  double awakeGpuMs = 0.0;
+  if (sim.m_useSleeping) {
+    ParticleSystem awakeSim;
+    awakeSim.m_useSleeping = false;
+    _createSim(app, awakeSim, particleCount, localSizeX, tasksPerThread);
+
+    ComputePassTimer awakeTimer(app, passCount, MAX_DISPATCHES_PER_FRAME);
+    ComputePassTimer awakePrimitivesTimer(
+        app,
+        PRIMITIVE_PASS_COUNT,
+        MAX_DISPATCHES_PER_FRAME);
+    double awakeRecordMs = 0.0;
+    _runFrames(
+        app,
+        awakeSim,
+        awakeTimer,
+        awakePrimitivesTimer,
+        frameCount,
+        awakeRecordMs);
+    vkDeviceWaitIdle(app.getDevice());
+
+    awakeGpuMs = getGpuMs(awakeTimer, awakePrimitivesTimer, passCount);
+  }
+
+  double particleSubsteps = double(particleCount) * substeps;
+
+  std::ofstream output(outputPath);
+  if (!output) {
+    std::cerr << "Failed to open " << outputPath << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  output << "{\n"
+         << "  \"particleCount\": " << particleCount << ",\n"
+         << "  \"liveParticleCount\": " << liveParticleCount << ",\n"
+         << "  \"substeps\": " << substeps << ",\n"
+         << "  \"hashBuildMode\": "
+         << (sim.m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM
+                 ? "\"prefix-sum\""
+                 : "\"buckets\"")
+         << ",\n"
+         << "  \"particleLayout\": "
+         << (sim.m_particleLayout == PARTICLE_LAYOUT_SOA ? "\"soa\""
+                                                         : "\"aos\"")
+         << ",\n"
+         << "  \"solver\": "
+         << (sim.m_solverMode == PARTICLE_SOLVER_GAUSS_SEIDEL
+                 ? "\"gauss-seidel\""
+                 : "\"jacobi\"")
+         << ",\n"
+         << "  \"localSizeX\": " << specialization.localSizeX << ",\n"
+         << "  \"tasksPerThread\": " << specialization.tasksPerThread << ",\n"
+         << "  \"wallMs\": " << wallMs << ",\n"
+         << "  \"gpuMs\": " << gpuMs << ",\n"
+         << "  \"particlesPerSecond\": " << particleSubsteps / gpuMs * 1.0e3
+         << ",\n"
+         << "  \"passes\": [";
+
+  bool firstPass = true;
+  for (uint32_t passIdx = 0; passIdx < sim.m_computePasses.size(); ++passIdx) {
+    uint32_t dispatches = timer.getPassDispatches(passIdx);
+    if (dispatches == 0)
+      continue;
+
+    output << (firstPass ? "\n" : ",\n") << "    {\"name\": \""
+           << s_passNames[passIdx] << "\", \"dispatches\": " << dispatches
+           << ", \"totalMs\": " << timer.getPassMs(passIdx)
+           << ", \"msPerSubstep\": " << timer.getPassMs(passIdx) / substeps
+           << "}";
+    firstPass = false;
+  }
+
+  for (uint32_t passIdx = 0; passIdx < PRIMITIVE_PASS_COUNT; ++passIdx) {
+    uint32_t dispatches = primitivesTimer.getPassDispatches(passIdx);
+    if (dispatches == 0)
+      continue;
+
+    output << (firstPass ? "\n" : ",\n") << "    {\"name\": \""
+           << s_primitivePassNames[passIdx]
+           << "\", \"dispatches\": " << dispatches
+           << ", \"totalMs\": " << primitivesTimer.getPassMs(passIdx)
+           << ", \"msPerSubstep\": "
+           << primitivesTimer.getPassMs(passIdx) / substeps << "}";
+    firstPass = false;
+  }
+
+  output << "\n  ],\n"
+         << "  \"hash\": {\n"
+         << "    \"size\": " << spatialHashSize << ",\n"
+         << "    \"occupiedSlots\": " << hashStats.occupiedSlots << ",\n"
+         << "    \"loadFactor\": "
+         << double(hashStats.occupiedSlots) / spatialHashSize << ",\n"
+         << "    \"collidingSlots\": " << hashStats.collidingSlots << ",\n"
+         << "    \"maxSlotParticles\": " << hashStats.maxSlotParticles << ",\n"
+         << "    \"overfullSlots\": " << hashStats.overfullSlots << "\n"
+         << "  },\n"
+         << "  \"recording\": {\n"
+         << "    \"msPerFrame\": " << recordMs / frameCount << ",\n"
+         << "    \"flushesPerFrame\": "
+         << double(sim.m_barriers.getFlushCount()) / frameCount << ",\n"
+         << "    \"barriersPerFrame\": "
+         << double(sim.m_barriers.getBarrierCount()) / frameCount << "\n"
+         << "  },\n"
+         << "  \"chunks\": {\n"
+         << "    \"count\": " << sim.m_stats.chunkCount << ",\n"
+         << "    \"bytesPerChunk\": " << sim.m_stats.chunkBytes << "\n"
+         << "  }";
+
+  // GPU counts from the last frame, averaged over its substeps
+  const SimStats& stats = sim.m_stats;
+  if (stats.hashTelemetrySubsteps > 0) {
+    const HashTelemetry& telemetry = stats.hashTelemetry;
+    double telemetrySubsteps = stats.hashTelemetrySubsteps;
+    output << ",\n"
+           << "  \"telemetry\": {\n"
+           << "    \"occupiedSlots\": "
+           << telemetry.occupiedSlots / telemetrySubsteps << ",\n"
+           << "    \"collidingSlots\": "
+           << telemetry.collidingSlots / telemetrySubsteps << ",\n"
+           << "    \"collidedParticles\": "
+           << telemetry.collidedParticles / telemetrySubsteps << ",\n"
+           << "    \"overfullSlots\": "
+           << telemetry.overfullSlots / telemetrySubsteps << ",\n"
+           << "    \"overflowedParticles\": "
+           << telemetry.overflowedParticles / telemetrySubsteps << ",\n"
+           << "    \"maxSlotParticles\": " << telemetry.maxSlotParticles
+           << ",\n"
+           << "    \"freeListSkew\": " << stats.freeListSkew << "\n"
+           << "  }";
+  }
+
+  if (sim.m_useSleeping) {
+    double sleepingFraction =
+        stats.particleSubsteps == 0
+            ? 0.0
+            : double(stats.sleepingParticleSubsteps) / stats.particleSubsteps;
+    output << ",\n"
+           << "  \"sleeping\": {\n"
+           << "    \"sleepingFraction\": " << sleepingFraction << ",\n"
+           << "    \"awakeGpuMs\": " << awakeGpuMs << ",\n"
+           << "    \"msSavedPerSubstep\": " << (awakeGpuMs - gpuMs) / substeps
+           << "\n"
+           << "  }";
+  }
+
+  output << "\n}\n";
+
+  std::cout << "sim-bench: " << particleCount << " particles, " << substeps
+            << " substeps\n"
+            << "  GPU: " << gpuMs << " ms, "
+            << particleSubsteps / gpuMs * 1.0e-3 << " M particles/s\n"
+            << "  wall: " << wallMs << " ms\n"
+            << "  recording: " << recordMs / frameCount << " ms/frame, "
+            << double(sim.m_barriers.getBarrierCount()) / frameCount
+            << " barriers/frame\n"
+            << "  results written to " << outputPath << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+
+/*static*/
+void HeadlessSimBenchmark::_createSim(
+    Application& app,
+    ParticleSystem& sim,
+    uint32_t particleCount,
+    uint32_t localSizeX,
+    uint32_t tasksPerThread) {
+  {
+    SingleTimeCommandBuffer commandBuffer(app);
+    sim._createHeadlessResources(app, commandBuffer, particleCount);
+  }
+
+  if (localSizeX != 0 || tasksPerThread != 0) {
+    if (localSizeX != 0)
+      sim.m_simSpecialization.localSizeX = localSizeX;
+    if (tasksPerThread != 0)
+      sim.m_simSpecialization.tasksPerThread = tasksPerThread;
+    sim._createSimPasses(app);
+  }
+}
+
+/*static*/
+double HeadlessSimBenchmark::_runFrames(
+    Application& app,
+    ParticleSystem& sim,
+    ComputePassTimer& timer,
+    ComputePassTimer& primitivesTimer,
+    uint32_t frameCount,
+    double& recordMs) {
+  // One sim step per frame
+  float frameTime = sim._getSimStepTime();
+
+  sim.m_pPassTimer = &timer;
+  sim.m_primitives.setPassTimer(&primitivesTimer);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (uint32_t frameIdx = 0; frameIdx < frameCount; ++frameIdx) {
+    // Every frame waits on its command buffer, so the first ring buffer slot
+    // of the transient uniforms is always free
+    FrameContext frame{};
+    frame.currentTime = frameIdx * frameTime;
+    frame.deltaTime = frameTime;
+
+    GlobalUniforms globalUniforms{};
+    globalUniforms.view = glm::mat4(1.0f);
+    globalUniforms.inverseView = glm::mat4(1.0f);
+    globalUniforms.time = static_cast<float>(frame.currentTime);
+    sim.m_globalUniforms.getCurrentUniformBuffer(frame).updateUniforms(
+        globalUniforms);
+
+    sim._updateSimUniforms(app, frame, 0);
+
+    {
+      SingleTimeCommandBuffer commandBuffer(app);
+      timer.reset(commandBuffer);
+      primitivesTimer.reset(commandBuffer);
+
+      // CPU cost of recording the frame's passes and barriers
+      auto recordStart = std::chrono::high_resolution_clock::now();
+      sim._stepSim(commandBuffer);
+      recordMs += std::chrono::duration<double, std::milli>(
+                      std::chrono::high_resolution_clock::now() - recordStart)
+                      .count();
+    }
+
+    timer.collect();
+    primitivesTimer.collect();
+  }
+  double wallMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::high_resolution_clock::now() - start)
+                      .count();
+  sim.m_pPassTimer = nullptr;
+  sim.m_primitives.setPassTimer(nullptr);
+
+  return wallMs;
+}
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,92 @@
+#include "MortonOrder.h"
+
+#include "ParallelFor.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+namespace {
+// Spreads the low 10 bits of v out to every third bit
+uint32_t expandMortonBits(uint32_t v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+} // namespace
+
+uint32_t computeMortonKey(
+    const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax,
+    const glm::vec3& pos) {
+  float blocksPerAxis = float(1u << MORTON_BITS_PER_AXIS);
+  glm::vec3 boundsPos = (pos - boundsMin) / (boundsMax - boundsMin);
+  glm::uvec3 block = glm::uvec3(
+      glm::clamp(boundsPos * blocksPerAxis, 0.0f, blocksPerAxis - 1.0f));
+
+  return expandMortonBits(block.x) | (expandMortonBits(block.y) << 1) |
+         (expandMortonBits(block.z) << 2);
+}
+
+void computeMortonOrder(
+    const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax,
+    const std::vector<glm::vec3>& positions,
+    std::vector<uint32_t>& order) {
+  uint32_t particleCount = static_cast<uint32_t>(positions.size());
+
+  std::vector<uint32_t> keys(particleCount);
+  std::vector<std::atomic<uint32_t>> keyCounts(MORTON_KEY_COUNT);
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      uint32_t key =
+          computeMortonKey(boundsMin, boundsMax, positions[particleIdx]);
+      keys[particleIdx] = key;
+      keyCounts[key].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  // Exclusive scan of the counts into the start of each key's range
+  std::vector<uint32_t> keyStarts(MORTON_KEY_COUNT);
+  uint32_t sum = 0;
+  for (uint32_t key = 0; key < MORTON_KEY_COUNT; ++key) {
+    keyStarts[key] = sum;
+    sum += keyCounts[key].load(std::memory_order_relaxed);
+  }
+
+  // A serial scatter keeps the sort stable
+  order.resize(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx)
+    order[keyStarts[keys[particleIdx]]++] = particleIdx;
+}
+
+uint32_t countMortonOrderInversions(
+    const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax,
+    const std::vector<glm::vec3>& positions) {
+  uint32_t particleCount = static_cast<uint32_t>(positions.size());
+
+  std::atomic<uint32_t> inversions{0};
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    uint32_t localInversions = 0;
+    for (uint32_t particleIdx = std::max(start, 1u); particleIdx < end;
+         ++particleIdx) {
+      if (computeMortonKey(boundsMin, boundsMax, positions[particleIdx - 1]) >
+          computeMortonKey(boundsMin, boundsMax, positions[particleIdx]))
+        ++localInversions;
+    }
+    inversions.fetch_add(localInversions, std::memory_order_relaxed);
+  });
+
+  return inversions.load();
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
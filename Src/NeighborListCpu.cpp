@@ -0,0 +1,89 @@
+#include "NeighborListCpu.h"
+
+#include "ParallelFor.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+void NeighborListCpu::build(
+    const SpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<uint32_t>& globalIndices,
+    float searchRadius) {
+  _build(spatialHash, worldToGrid, globalIndices, searchRadius);
+}
+
+void NeighborListCpu::build(
+    const SortedSpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<uint32_t>& globalIndices,
+    float searchRadius) {
+  _build(spatialHash, worldToGrid, globalIndices, searchRadius);
+}
+
+template <typename TSpatialHash>
+void NeighborListCpu::_build(
+    const TSpatialHash& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<uint32_t>& globalIndices,
+    float searchRadius) {
+  uint32_t particleCount = static_cast<uint32_t>(globalIndices.size());
+  m_lists.resize(size_t(particleCount) * NEIGHBOR_LIST_SIZE);
+
+  float searchRadiusSq = searchRadius * searchRadius;
+
+  std::atomic<uint32_t> overflowCount{0};
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    uint32_t localOverflowCount = 0;
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      uint32_t globalIdx = globalIndices[particleIdx];
+      glm::vec3 particlePos = spatialHash.getPosition(globalIdx);
+      glm::ivec3 gridCell =
+          computeNeighborhoodBaseCell(worldToGrid, particlePos);
+
+      uint32_t* list = &m_lists[size_t(particleIdx) * NEIGHBOR_LIST_SIZE];
+      uint32_t neighborCount = 0;
+      bool overflowed = false;
+      for (int i = 0; i < 8; ++i) {
+        uint32_t slotIdx = hashCoords(
+                               gridCell.x + (i >> 2),
+                               gridCell.y + ((i >> 1) & 1),
+                               gridCell.z + (i & 1)) %
+                           spatialHash.getSpatialHashSize();
+        uint32_t rangeStart, rangeEnd;
+        spatialHash.getCellRange(slotIdx, rangeStart, rangeEnd);
+
+        for (uint32_t otherIdx = rangeStart; otherIdx < rangeEnd; ++otherIdx) {
+          if (otherIdx == globalIdx)
+            continue;
+
+          glm::vec3 diff = spatialHash.getPosition(otherIdx) - particlePos;
+          if (glm::dot(diff, diff) >= searchRadiusSq)
+            continue;
+
+          if (neighborCount < NEIGHBOR_LIST_SIZE - 1)
+            list[++neighborCount] = otherIdx;
+          else
+            overflowed = true;
+        }
+      }
+
+      list[0] = neighborCount;
+      if (overflowed)
+        ++localOverflowCount;
+    }
+
+    overflowCount.fetch_add(localOverflowCount, std::memory_order_relaxed);
+  });
+
+  m_overflowCount = overflowCount.load();
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
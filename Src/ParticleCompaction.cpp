@@ -0,0 +1,33 @@
+#include "ParticleCompaction.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+bool isParticleDead(
+    const glm::vec3& killBoundsMin,
+    const glm::vec3& killBoundsMax,
+    const glm::vec3& position) {
+  // Written so NaN fails the comparisons, same as on the GPU
+  for (int i = 0; i < 3; ++i)
+    if (!(position[i] >= killBoundsMin[i] && position[i] <= killBoundsMax[i]))
+      return true;
+
+  return false;
+}
+
+void compactParticles(
+    const glm::vec3& killBoundsMin,
+    const glm::vec3& killBoundsMax,
+    const std::vector<Particle>& particles,
+    std::vector<Particle>& out) {
+  for (const Particle& particle : particles)
+    if (!isParticleDead(killBoundsMin, killBoundsMax, particle.position))
+      out.push_back(particle);
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,25 @@
+#include "ParticleSeeding.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+glm::vec3 computeSpawnPosition(uint32_t seed, uint32_t particleIdx) {
+  // Chain the hash for each axis, mixing the seed in first so consecutive
+  // seeds don't just shift the sequence by one particle
+  uint32_t x = pcgHash(particleIdx ^ pcgHash(seed));
+  uint32_t y = pcgHash(x);
+  uint32_t z = pcgHash(y);
+
+  glm::vec3 position(x % 300, y % 3000, z % 300);
+  position *= 0.1f;
+  position += glm::vec3(35.0f);
+
+  return position;
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
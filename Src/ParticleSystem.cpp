@@ -1,5 +1,8 @@
 #include "ParticleSystem.h"
 
+#include "ComputePassTimer.h"
+#include "ParticleSeeding.h"
+#include "PbfSolverCpu.h"
 #include "SpatialHashUnitTests.h"
 
 #include <Althea/Application.h>
@@ -21,30 +24,137 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 using namespace AltheaEngine;
 
-#define PARTICLE_COUNT 5000000     // 500000 // 200000
-#define PARTICLES_PER_BUFFER 50000 // 100000 // 50000
+// Sim storage is allocated a chunk of this many particles at a time, see
+// SimChunk
+#define PARTICLES_PER_CHUNK 50000 // 100000 // 50000
 
-#define SPATIAL_HASH_SIZE (3 * PARTICLE_COUNT)
-#define SPATIAL_HASH_ENTRIES_PER_BUFFER (PARTICLE_COUNT / 4)
+#define SPATIAL_HASH_SLOTS_PER_PARTICLE 3
+#define SPATIAL_HASH_SLOTS_PER_CHUNK                                           \
+  (SPATIAL_HASH_SLOTS_PER_PARTICLE * PARTICLES_PER_CHUNK)
+#define MAX_SPATIAL_HASH_SIZE (MAX_SIM_CHUNKS * SPATIAL_HASH_SLOTS_PER_CHUNK)
 
-// TODO: Probably waaay too many
-#define PARTICLE_BUCKET_COUNT 5000000      //(PARTICLE_COUNT / 4)
-#define PARTICLE_BUCKETS_PER_BUFFFER 10000 //(PARTICLE_BUCKET_COUNT)
+// The particle budget is a runtime setting, this is only its starting value
+#define DEFAULT_PARTICLE_BUDGET 5000000
+#define MAX_PARTICLE_BUDGET (MAX_SIM_CHUNKS * PARTICLES_PER_CHUNK)
+#define INITIAL_PARTICLE_COUNT 100000
+#define EMITTED_PARTICLES_PER_FRAME 1000
 
+// The sim runs at a fixed rate independent of the frame rate, rendered
+// frames interpolate between the last two sim steps
+#define SIM_STEP_TIME (1.0f / 30.0f)
 #define TIME_SUBSTEPS 2
+// Sim steps a frame can catch up on, the rest of a long frame is dropped so a
+// slow frame doesn't lead to even slower ones
+#define MAX_SIM_STEPS_PER_FRAME 4
+// Solver iterations per substep, for either solver
 #define JACOBI_ITERS 2
 #define PARTICLE_RADIUS 0.1f
 
-#define LOCAL_SIZE_X 32
+// Workgroup size of the sim passes, raised to the device's subgroup size if
+// that's wider so no subgroup runs with idle lanes
+#define MIN_LOCAL_SIZE_X 32
+// Shared memory of the Jacobi step fits a full bucket of tasks per thread,
+// subgroups with more tasks walk their cells per thread instead
+#define JACOBI_TASKS_PER_THREAD PARTICLES_PER_BUCKET
+#define CAMERA_RADIUS 10.0f
+
+#define SPATIAL_HASH_BUILD_MODE SPATIAL_HASH_BUILD_BUCKETS
+#define PARTICLE_LAYOUT PARTICLE_LAYOUT_AOS
+#define PARTICLE_SOLVER PARTICLE_SOLVER_JACOBI
+#define PARTICLE_RENDER_MODE PARTICLE_RENDER_IMPOSTORS
+
+// Sort the particles by Morton key every this many sim steps, 0 to disable
+#define MORTON_REORDER_INTERVAL 60
+
+// Remove the particles that left the kill bounds every this many sim steps, 0
+// to disable particle death. The walls keep particles inside the box in x and z
+// and above the floor, particles are spawned up to y = 335. The Morton reorder
+// keys over the same bounds.
+#define COMPACTION_INTERVAL 30
+#define KILL_BOUNDS_MIN glm::vec3(-20.0f, -20.0f, -20.0f)
+#define KILL_BOUNDS_MAX glm::vec3(120.0f, 400.0f, 120.0f)
+
+// Cache per-particle neighbour lists across the Jacobi iterations of a
+// substep. The skin is how much farther than a particle diameter the lists
+// look, it needs to cover how far particles move over the iterations. The
+// Gauss-Seidel solver walks the hash directly and doesn't use the lists.
+#define USE_NEIGHBOR_LISTS false
+#define NEIGHBOR_SKIN_RADIUS (0.25f * PARTICLE_RADIUS)
+
+// Let particles in settled cells sleep. A particle falls asleep once the
+// solver moves it slower than SLEEP_SPEED and no moving particle has come near
+// its cell for SLEEP_SUBSTEPS substeps. Sleeping particles still get hashed,
+// so awake particles collide with them, but skip integration and their own
+// contacts until a moving particle comes near or a wall pushes them. The sim
+// pass only touches their position and hash index.
+#define USE_PARTICLE_SLEEPING true
+#define SLEEP_SPEED (0.05f * PARTICLE_RADIUS / SIM_STEP_TIME)
+#define SLEEP_SUBSTEPS (30 * TIME_SUBSTEPS)
+
+// Solve the position-based fluids density constraint in the Jacobi
+// iterations, instead of only pushing overlapping spheres apart. The kernel
+// reaches a particle diameter, the same distance the 8 cell neighbourhood is
+// built around. The fluid settles where the density matches a lattice a bit
+// over half the kernel radius apart, so every particle has its lattice
+// neighbours inside the kernel. A cell then holds about 6 particles at rest
+// and more when compressed, which can fill a bucket, so the density
+// constraint always uses the prefix-sum build. The Gauss-Seidel solver keeps
+// the sphere contacts.
+#define USE_PBF_DENSITY true
+#define PBF_KERNEL_RADIUS (2.0f * PARTICLE_RADIUS)
+#define PBF_REST_SPACING (0.55f * PBF_KERNEL_RADIUS)
+#define PBF_RELAXATION 1.0f
+#define PBF_TENSILE_STRENGTH 0.1f
+#define PBF_TENSILE_DISTANCE (0.2f * PBF_KERNEL_RADIUS)
+
+#define HASH_BUILD_MODE                                                        \
+  (USE_PBF_DENSITY && PARTICLE_SOLVER == PARTICLE_SOLVER_JACOBI                \
+       ? SPATIAL_HASH_BUILD_PREFIX_SUM                                         \
+       : SPATIAL_HASH_BUILD_MODE)
+
+// Cull the particle instances against the view frustum and a max depth
+// pyramid of the previous frame's depth before drawing them, so the vertex
+// work scales with the visible particles instead of all of them. Toggleable
+// from the UI when enabled.
+#define USE_PARTICLE_CULLING true
+
+// Screen-space fluid rendering. The splatted depth is smoothed over about a
+// particle diameter, samples more than FLUID_DEPTH_RANGE in front of or
+// behind a pixel are kept out of its smoothing. Each iteration is one
+// horizontal and one vertical pass.
+#define FLUID_SMOOTHING_RADIUS (2.0f * PARTICLE_RADIUS)
+#define FLUID_DEPTH_RANGE (4.0f * PARTICLE_RADIUS)
+#define FLUID_SMOOTHING_ITERATIONS 2
+
+// Count slot occupancy, hash collisions, bucket overflows and free list
+// allocations during the bucket build and show them in the UI. The counters
+// are extra atomics in the build passes, leave this off when timing.
+#define HASH_TELEMETRY false
+
+// Readbacks requested past this many in flight are dropped
+#define MAX_READBACKS_IN_FLIGHT 8
+
+// Each thread of the block-scan pass scans this many consecutive slots
+#define CELL_SCAN_ITEMS_PER_THREAD 16
+#define CELL_SCAN_MIN_BLOCK_SIZE (MIN_LOCAL_SIZE_X * CELL_SCAN_ITEMS_PER_THREAD)
+// The block sums buffer is shared by the cell and live particle scans, the
+// hash has more slots than there are particles
+#define CELL_SCAN_BLOCK_COUNT                                                  \
+  ((MAX_SPATIAL_HASH_SIZE - 1) / CELL_SCAN_MIN_BLOCK_SIZE + 1)
 
 #define GEN_SHADER_DEBUG_INFO
 
@@ -57,7 +167,22 @@ struct DeferredPassPushConstants {
   uint32_t writeIndex;
 };
 
-ParticleSystem::ParticleSystem() {}
+ParticleSystem::ParticleSystem()
+    : m_hashBuildMode(HASH_BUILD_MODE),
+      m_particleBudget(DEFAULT_PARTICLE_BUDGET),
+      m_particleLayout(PARTICLE_LAYOUT),
+      m_reorderInterval(MORTON_REORDER_INTERVAL),
+      m_compactionInterval(COMPACTION_INTERVAL),
+      m_useNeighborLists(
+          USE_NEIGHBOR_LISTS && PARTICLE_SOLVER == PARTICLE_SOLVER_JACOBI),
+      m_useSleeping(USE_PARTICLE_SLEEPING),
+      m_solverMode(PARTICLE_SOLVER),
+      m_usePbfDensity(
+          USE_PBF_DENSITY && PARTICLE_SOLVER == PARTICLE_SOLVER_JACOBI),
+      m_useHashTelemetry(
+          HASH_TELEMETRY && HASH_BUILD_MODE == SPATIAL_HASH_BUILD_BUCKETS),
+      m_particleRenderMode(PARTICLE_RENDER_MODE),
+      m_useParticleCulling(USE_PARTICLE_CULLING) {}
 
 void ParticleSystem::initGame(Application& app) {
   const VkExtent2D& windowDims = app.getSwapChainExtent();
@@ -70,26 +195,11 @@ void ParticleSystem::initGame(Application& app) {
   // TODO: need to unbind these at shutdown
   InputManager& input = app.getInputManager();
 
-  // Download buffers to CPU
+  // Read the sim buffers back and validate the spatial hash, the results are
+  // printed a few frames later without stalling rendering
   input.addKeyBinding(
       {GLFW_KEY_D, GLFW_PRESS, GLFW_MOD_CONTROL},
-      [&app, that = this]() {
-        vkDeviceWaitIdle(app.getDevice());
-
-        // TODO: need to fix up how this works since a buffer heap is used now
-
-        // std::vector<Particle> particles;
-        // that->_particleBuffer.download(particles);
-
-        // std::vector<uint32_t> spatialHash;
-        // that->_cellToBucket.download(spatialHash);
-
-        // TODO: Verify that the ringbuffer usage is correct here before
-        // uncommenting SpatialHashUnitTests::runTests(
-        //     that->_simUniforms.getUniformBuffers()[app.getCurrentFrameRingBufferIndex()].getUniforms(),
-        //     particles,
-        //     spatialHash);
-      });
+      [that = this]() { that->m_flagUnitTests = true; });
 
   input.addKeyBinding(
       {GLFW_KEY_L, GLFW_PRESS, 0},
@@ -131,10 +241,41 @@ void ParticleSystem::initGame(Application& app) {
 #ifdef GEN_SHADER_DEBUG_INFO
   Shader::setShouldGenerateDebugInfo(true);
 #endif
+
+  SingleTimeCommandBuffer commandBuffer(app);
+  _createGlobalResources(app, commandBuffer);
+  _createSimResources(app, commandBuffer);
+  _createModels(app, commandBuffer);
 }
 
 void ParticleSystem::shutdownGame(Application& app) {
   m_pCameraController.reset();
+
+  m_models.clear();
+
+  m_computePasses.clear();
+  m_simUniforms = {};
+  m_chunks.clear();
+  m_freeChunkHandles.clear();
+  m_simCounters = {};
+  m_freeBucketCounter = {};
+  m_hashTelemetry = {};
+  m_pReadback.reset();
+  m_scanBlockSums = {};
+  m_mortonKeyCounts = {};
+  m_primitives = {};
+
+  m_sphere = {};
+
+  m_fluidDepthHandle = {};
+  m_hiZHandle = {};
+
+  m_globalResources = {};
+  m_ssr = {};
+  m_screenExtent = {};
+
+  m_globalUniforms = {};
+  m_heap = {};
 }
 
 void ParticleSystem::createRenderState(Application& app) {
@@ -145,9 +286,7 @@ void ParticleSystem::createRenderState(Application& app) {
   Gui::createRenderState(app);
 
   SingleTimeCommandBuffer commandBuffer(app);
-  _createGlobalResources(app, commandBuffer);
-  _createSimResources(app, commandBuffer);
-  _createModels(app, commandBuffer);
+  _createScreenResources(app, commandBuffer);
   _createGBufferPass(app);
   _createDeferredPass(app);
 }
@@ -155,34 +294,82 @@ void ParticleSystem::createRenderState(Application& app) {
 void ParticleSystem::destroyRenderState(Application& app) {
   Gui::destroyRenderState(app);
 
-  m_models.clear();
-
   m_gBufferPass = {};
   m_gBufferFrameBufferA = {};
   m_gBufferFrameBufferB = {};
 
-  m_computePasses.clear();
-  m_simUniforms = {};
-  m_particleBuffer = {};
-  m_spatialHash = {};
-  m_freeBucketCounter = {};
-  m_buckets = {};
-
-  m_sphere = {};
+  m_hiZ = {};
+  m_fluidDepth = {};
 
   m_deferredPass = {};
   m_swapChainFrameBuffers = {};
+}
 
-  m_globalResources = {};
-  m_globalUniforms = {};
+void ParticleSystem::_createScreenResources(
+    Application& app,
+    SingleTimeCommandBuffer& commandBuffer) {
+  const VkExtent2D& extent = app.getSwapChainExtent();
 
-  m_ssr = {};
-  m_heap = {};
+  // GlobalResources and the SSR reflection buffer register their own heap
+  // handles, the engine can't point existing ones at new targets. Swapchain
+  // re-creations that keep the extent keep them, only an actual resize
+  // rebuilds them and takes new handles.
+  if (extent.width != m_screenExtent.width ||
+      extent.height != m_screenExtent.height) {
+    GlobalResourcesBuilder resourcesBuilder{};
+    m_globalResources =
+        GlobalResources(app, commandBuffer, m_heap, resourcesBuilder);
+
+    // Set up SSR resources
+    m_ssr = ScreenSpaceReflection(
+        app,
+        commandBuffer,
+        m_heap.getDescriptorSetLayout());
+    m_ssr.getReflectionBuffer().registerToHeap(m_heap);
+  }
+
+  m_screenExtent = extent;
+
+  // Two screen-sized targets, the smoothing ping-pongs between them
+  m_fluidDepth =
+      StructuredBuffer<uint32_t>(app, 2 * extent.width * extent.height);
+  m_heap.updateStorageBuffer(
+      m_fluidDepthHandle,
+      m_fluidDepth.getAllocation().getBuffer(),
+      0,
+      m_fluidDepth.getSize());
+
+  if (m_useParticleCulling) {
+    // Level 0 is half the depth's resolution, rounded up, down to 1x1
+    uint32_t hiZSize = 0;
+    m_hiZLevelCount = 0;
+    for (uint32_t width = extent.width, height = extent.height;
+         width > 1 || height > 1;) {
+      width = (width + 1) / 2;
+      height = (height + 1) / 2;
+      hiZSize += width * height;
+      ++m_hiZLevelCount;
+    }
+
+    m_hiZ = StructuredBuffer<float>(app, hiZSize);
+    m_heap.updateStorageBuffer(
+        m_hiZHandle,
+        m_hiZ.getAllocation().getBuffer(),
+        0,
+        m_hiZ.getSize());
+
+    // The depth from before a resize doesn't match the pyramid
+    m_hasPrevDepth = false;
+    m_stats.visibleFraction = 1.0f;
+  }
 }
 
 static LiveValues s_liveValues;
+static int s_particleBudget = DEFAULT_PARTICLE_BUDGET;
+static int s_particleRenderMode = PARTICLE_RENDER_MODE;
+static bool s_cullParticles = true;
 
-static void updateUi() {
+static void updateUi(const SimStats& stats) {
   Gui::startRecordingImgui();
   const ImGuiViewport* main_viewport = ImGui::GetMainViewport();
   ImGui::SetNextWindowPos(
@@ -199,6 +386,68 @@ static void updateUi() {
     ImGui::Checkbox("##checkbox1", &s_liveValues.checkbox1);
     ImGui::Text("Checkbox2:");
     ImGui::Checkbox("##checkbox2", &s_liveValues.checkbox2);
+
+    ImGui::Separator();
+    ImGui::Text("Particle budget:");
+    ImGui::SliderInt(
+        "##particleBudget",
+        &s_particleBudget,
+        PARTICLES_PER_CHUNK,
+        MAX_PARTICLE_BUDGET);
+    ImGui::Text("Particle rendering:");
+    ImGui::RadioButton(
+        "Sphere mesh",
+        &s_particleRenderMode,
+        PARTICLE_RENDER_MESH);
+    ImGui::SameLine();
+    ImGui::RadioButton(
+        "Impostors",
+        &s_particleRenderMode,
+        PARTICLE_RENDER_IMPOSTORS);
+    ImGui::SameLine();
+    ImGui::RadioButton("Fluid", &s_particleRenderMode, PARTICLE_RENDER_FLUID);
+    // Switch between the two at the same particle count to compare them
+    ImGui::Text(
+        "Particle vertices: %.1f M/frame, frame time: %.2f ms",
+        stats.particleVertices * 1.0e-6,
+        1000.0f / ImGui::GetIO().Framerate);
+    ImGui::Checkbox("Cull particles", &s_cullParticles);
+    ImGui::SameLine();
+    ImGui::Text("Visible: %.1f%% of particles", 100.0f * stats.visibleFraction);
+    ImGui::Text(
+        "Sim chunks: %u, %.1f MB",
+        stats.chunkCount,
+        stats.chunkCount * stats.chunkBytes / (1024.0 * 1024.0));
+    ImGui::Text(
+        "Hash clear writes saved: %.1f MB/substep, %.2f GB total",
+        stats.hashClearBytesPerSubstep / (1024.0 * 1024.0),
+        stats.hashClearBytesSaved / (1024.0 * 1024.0 * 1024.0));
+    // Sleeping particles skip their solver contacts, so this is also roughly
+    // the share of the contact work saved
+    ImGui::Text(
+        "Asleep: %.1f%% of particles",
+        100.0f * stats.sleepingFraction);
+
+    if (stats.hashTelemetrySubsteps > 0) {
+      const HashTelemetry& telemetry = stats.hashTelemetry;
+      float substeps = static_cast<float>(stats.hashTelemetrySubsteps);
+      float occupiedSlots = telemetry.occupiedSlots / substeps;
+      ImGui::Text(
+          "Hash occupied slots: %.0f, %.1f%% load",
+          occupiedSlots,
+          100.0f * occupiedSlots /
+              (stats.chunkCount * SPATIAL_HASH_SLOTS_PER_CHUNK));
+      ImGui::Text(
+          "Colliding slots: %.0f, %.0f particles in them",
+          telemetry.collidingSlots / substeps,
+          telemetry.collidedParticles / substeps);
+      ImGui::Text(
+          "Overfull buckets: %.0f, %.0f particles spilled",
+          telemetry.overfullSlots / substeps,
+          telemetry.overflowedParticles / substeps);
+      ImGui::Text("Max slot particles: %u", telemetry.maxSlotParticles);
+      ImGui::Text("Free list skew: %.2fx mean", stats.freeListSkew);
+    }
   }
 
   ImGui::End();
@@ -207,15 +456,38 @@ static void updateUi() {
 }
 
 void ParticleSystem::tick(Application& app, const FrameContext& frame) {
-  updateUi();
+  if (m_useHashTelemetry)
+    _collectHashTelemetry();
+  if (m_useSleeping)
+    _collectSleepStats();
+  if (m_useParticleCulling)
+    _collectCullStats();
+
+  updateUi(m_stats);
+
+  m_particleRenderMode = static_cast<uint32_t>(s_particleRenderMode);
+  // The fluid surface is a single full-screen triangle
+  uint64_t verticesPerParticle = 0;
+  if (m_particleRenderMode == PARTICLE_RENDER_MESH)
+    verticesPerParticle = m_sphere.indices.getIndexCount();
+  else if (m_particleRenderMode == PARTICLE_RENDER_IMPOSTORS)
+    verticesPerParticle = 6;
+  m_stats.particleVertices = verticesPerParticle * m_activeParticleCount;
+  if (m_useParticleCulling && s_cullParticles)
+    m_stats.particleVertices = static_cast<uint64_t>(
+        m_stats.particleVertices * m_stats.visibleFraction);
+
+  // Lowering the budget below the live particle count starts over
+  m_particleBudget = static_cast<uint32_t>(s_particleBudget);
+  if (m_activeParticleCount > m_particleBudget) {
+    vkDeviceWaitIdle(app.getDevice());
+    _resetParticles(app, SingleTimeCommandBuffer(app));
+  }
 
-  // Use fixed delta time
+  _advanceSimClock(static_cast<float>(frame.deltaTime));
 
   const Camera& camera = m_pCameraController->getCamera();
 
-  // Use fixed timestep for physics
-  float deltaTime = 1.0f / 15.0f / float(TIME_SUBSTEPS);
-
   const glm::mat4& projection = camera.getProjection();
 
   uint32_t inputMask = app.getInputManager().getCurrentInputMask();
@@ -238,7 +510,48 @@ void ParticleSystem::tick(Application& app, const FrameContext& frame) {
   m_globalUniforms.getCurrentUniformBuffer(frame).updateUniforms(
       globalUniforms);
 
+  _updateSimUniforms(app, frame, inputMask);
+
+  // The next frame tests its particles against this frame's depth
+  m_prevViewProjection = globalUniforms.projection * globalUniforms.view;
+
+  m_push.globalResourcesHandle = m_globalResources.getHandle().index;
+}
+
+void ParticleSystem::_advanceSimClock(float frameTime) {
+  m_simTimeAccumulator += frameTime;
+
+  m_pendingSimSteps = 0;
+  while (m_simTimeAccumulator >= SIM_STEP_TIME &&
+         m_pendingSimSteps < MAX_SIM_STEPS_PER_FRAME) {
+    m_simTimeAccumulator -= SIM_STEP_TIME;
+    ++m_pendingSimSteps;
+  }
+
+  // Too far behind to catch up, drop the backlog
+  if (m_simTimeAccumulator >= SIM_STEP_TIME)
+    m_simTimeAccumulator = 0.0f;
+
+  // A reset has already shrunk the chunks, so it has to reach the GPU this
+  // frame. Otherwise the cull and draws would still run over the old particle
+  // count, into chunk handles that are no longer there.
+  if (m_flagReset && m_pendingSimSteps == 0) {
+    m_pendingSimSteps = 1;
+    m_simTimeAccumulator = 0.0f;
+  }
+
+  m_renderAlpha = m_simTimeAccumulator / SIM_STEP_TIME;
+}
+
+void ParticleSystem::_updateSimUniforms(
+    Application& app,
+    const FrameContext& frame,
+    uint32_t inputMask) {
+  // Use fixed timestep for physics
+  float deltaTime = SIM_STEP_TIME / float(TIME_SUBSTEPS);
+
   SimUniforms simUniforms{};
+  simUniforms.renderDelay = 1.0f - m_renderAlpha;
 
   // TODO: Just use spacing scale param??
   // can assume grid is world axis aligned and uniformly scaled on each dim
@@ -249,44 +562,109 @@ void ParticleSystem::tick(Application& app, const FrameContext& frame) {
   // simUniforms.gridToWorld[3] = glm::vec4(-100.0f, -100.0f, -100.0f, 1.0f);
   simUniforms.worldToGrid = glm::inverse(simUniforms.gridToWorld);
 
-  if (m_flagReset) {
+  // Only requests particles, the counters pass adds them on the GPU. Frames
+  // that don't step the sim don't emit, a pending reset always gets a step.
+  if (m_pendingSimSteps == 0) {
+    simUniforms.addedParticles = 0;
+  } else if (m_flagReset) {
     m_flagReset = false;
+    simUniforms.resetParticles = 1;
     simUniforms.addedParticles = m_activeParticleCount;
   } else if (inputMask & INPUT_BIT_RIGHT_MOUSE) {
-    simUniforms.addedParticles = 1000;
-
-    m_activeParticleCount += simUniforms.addedParticles;
-    if (m_activeParticleCount > PARTICLE_COUNT) {
-      simUniforms.addedParticles = PARTICLE_COUNT - m_activeParticleCount;
-      m_activeParticleCount = PARTICLE_COUNT;
+    // Compacted particles free up room under the budget without the CPU
+    // knowing, so keep asking for particles even once the chunks are full
+    simUniforms.addedParticles = EMITTED_PARTICLES_PER_FRAME;
+    m_activeParticleCount = std::min(
+        m_activeParticleCount + EMITTED_PARTICLES_PER_FRAME,
+        m_particleBudget);
+
+    // Grow the sim heaps to fit the new particles. Writing the new chunk's
+    // descriptors while the heap's set is bound to frames in flight would need
+    // UPDATE_AFTER_BIND or UPDATE_UNUSED_WHILE_PENDING, which nothing here
+    // checks the heap's layout for. Wait for the frames instead, same as a
+    // reset. A chunk holds many frames of emission, so this is rare.
+    if (m_activeParticleCount > m_chunks.size() * PARTICLES_PER_CHUNK) {
+      vkDeviceWaitIdle(app.getDevice());
+      _resizeSimChunks(
+          app,
+          SingleTimeCommandBuffer(app),
+          m_activeParticleCount);
     }
   } else {
     simUniforms.addedParticles = 0;
   }
 
-  simUniforms.particleCount = m_activeParticleCount;
-  simUniforms.particlesPerBuffer = PARTICLES_PER_BUFFER;
-  simUniforms.spatialHashSize = SPATIAL_HASH_SIZE;
-  simUniforms.spatialHashEntriesPerBuffer = SPATIAL_HASH_ENTRIES_PER_BUFFER;
-  simUniforms.particleBucketCount = PARTICLE_BUCKET_COUNT;
-  simUniforms.particleBucketsPerBuffer = PARTICLE_BUCKETS_PER_BUFFFER;
-  simUniforms.freeListsCount = m_freeBucketCounter.getCount();
+  uint32_t chunkCount = static_cast<uint32_t>(m_chunks.size());
+
+  simUniforms.particleCapacity =
+      std::min(chunkCount * PARTICLES_PER_CHUNK, m_particleBudget);
+  simUniforms.particlesPerBuffer = PARTICLES_PER_CHUNK;
+  simUniforms.spatialHashSize = chunkCount * SPATIAL_HASH_SLOTS_PER_CHUNK;
+  simUniforms.spatialHashEntriesPerBuffer = SPATIAL_HASH_SLOTS_PER_CHUNK;
 
   simUniforms.jacobiIters = JACOBI_ITERS;
   simUniforms.deltaTime = deltaTime;
   simUniforms.particleRadius = PARTICLE_RADIUS;
   simUniforms.time = frame.currentTime;
+  simUniforms.neighborSkinRadius = NEIGHBOR_SKIN_RADIUS;
+
+  simUniforms.simCounters = m_simCounters.getHandle().index;
+  simUniforms.particleIndexCount = m_sphere.indices.getIndexCount();
+  simUniforms.spawnSeed = m_seed;
+  simUniforms.killBoundsMin = KILL_BOUNDS_MIN;
+  simUniforms.killBoundsMax = KILL_BOUNDS_MAX;
+  simUniforms.sleepSpeed = SLEEP_SPEED;
+  simUniforms.sleepSubsteps = SLEEP_SUBSTEPS;
+  simUniforms.pbf = m_pbfParams;
+
+  simUniforms.screenWidth = m_screenExtent.width;
+  simUniforms.screenHeight = m_screenExtent.height;
+
+  if (m_particleRenderMode == PARTICLE_RENDER_FLUID) {
+    simUniforms.fluidDepth = m_fluidDepthHandle.index;
+    simUniforms.fluidSmoothingRadius = FLUID_SMOOTHING_RADIUS;
+    simUniforms.fluidDepthRange = FLUID_DEPTH_RANGE;
+    simUniforms.fluidSurface = 1;
+  }
 
-  simUniforms.particlesHeap = m_particleBuffer.getBuffer(0).getHandle().index;
-  simUniforms.spatialHashHeap = m_spatialHash.getBuffer(0).getHandle().index;
-  simUniforms.bucketHeap = m_buckets.getBuffer(0).getHandle().index;
-  simUniforms.nextFreeBucket = m_freeBucketCounter.getHandle().index;
+  if (m_useParticleCulling) {
+    simUniforms.hiZ = m_hiZHandle.index;
+    simUniforms.hiZDepthIndex = m_writeIndex ^ 1;
+    simUniforms.hiZLevelCount = m_hiZLevelCount;
+    simUniforms.hiZViewProjection = m_prevViewProjection;
+    simUniforms.cullParticles = s_cullParticles;
+    simUniforms.cullOcclusion = s_cullParticles && m_hasPrevDepth;
+  }
+
+  simUniforms.chunkCount = chunkCount;
+  for (uint32_t chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx)
+    simUniforms.chunkHandles[chunkIdx] = m_chunks[chunkIdx].firstHandle;
+
+  if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM) {
+    simUniforms.particleEntriesPerBuffer = PARTICLES_PER_CHUNK;
+  } else {
+    simUniforms.particleBucketCount = chunkCount * PARTICLES_PER_CHUNK;
+    simUniforms.particleBucketsPerBuffer = PARTICLES_PER_CHUNK;
+    simUniforms.freeListsCount = m_freeBucketCounter.getCount();
+    simUniforms.nextFreeBucket = m_freeBucketCounter.getHandle().index;
+    if (m_useHashTelemetry)
+      simUniforms.hashTelemetry = m_hashTelemetry.getHandle().index;
+  }
+
+  if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM ||
+      m_compactionInterval != 0)
+    simUniforms.scanBlockSums = m_scanBlockSums.getHandle().index;
+
+  if (m_reorderInterval != 0)
+    simUniforms.mortonKeyCounts = m_mortonKeyCounts.getHandle().index;
+
+  m_addedParticles = simUniforms.addedParticles;
 
   simUniforms.liveValues = s_liveValues;
 
   m_simUniforms.updateUniforms(simUniforms, frame);
+  m_lastSimUniforms = simUniforms;
 
-  m_push.globalResourcesHandle = m_globalResources.getHandle().index;
   m_push.globalUniformsHandle =
       m_globalUniforms.getCurrentBindlessHandle(frame).index;
   m_push.simUniformsHandle = m_simUniforms.getCurrentHandle(frame).index;
@@ -299,41 +677,221 @@ void ParticleSystem::_createModels(
 void ParticleSystem::_resetParticles(
     Application& app,
     VkCommandBuffer commandBuffer) {
-  for (uint32_t particleIdx = 0; particleIdx < PARTICLE_COUNT; ++particleIdx) {
-    uint32_t bufferIdx = particleIdx / PARTICLES_PER_BUFFER;
-    uint32_t localIdx = particleIdx % PARTICLES_PER_BUFFER;
+  m_activeParticleCount =
+      std::min<uint32_t>(INITIAL_PARTICLE_COUNT, m_particleBudget);
 
-    // glm::vec3 position(rand() % 10, rand() % 10, rand() % 10);
-    glm::vec3 position(rand() % 300, rand() % 3000, rand() % 300);
-    position *= 0.1f;
-    position += glm::vec3(35.0);
+  // New spawn positions on every reset
+  ++m_seed;
 
-    // position += glm::vec3(10.0f);
-    m_particleBuffer.getBuffer(bufferIdx).setElement(
-        Particle{// position
-                 position,
-                 0,
-                 position,
-                 // debug value
-                 0xfc3311},
-        localIdx);
-  }
+  // Reseed the chunks that are kept, the chunks grown since the last reset
+  // are released
+  uint32_t chunkCount = (m_activeParticleCount - 1) / PARTICLES_PER_CHUNK + 1;
+  for (uint32_t chunkIdx = 0;
+       chunkIdx < std::min<size_t>(chunkCount, m_chunks.size());
+       ++chunkIdx)
+    _seedParticles(app, commandBuffer, chunkIdx);
 
-  m_particleBuffer.upload(app, commandBuffer);
+  _resizeSimChunks(app, commandBuffer, m_activeParticleCount);
 
   m_flagReset = true;
 }
 
+void ParticleSystem::_seedParticles(
+    Application& app,
+    VkCommandBuffer commandBuffer,
+    uint32_t chunkIdx) {
+  SimChunk& chunk = m_chunks[chunkIdx];
+  uint32_t firstParticleIdx = chunkIdx * PARTICLES_PER_CHUNK;
+
+  // Each worker fills a disjoint range of the chunk's CPU-side copy, which
+  // upload() then stages in one copy per buffer
+  if (m_particleLayout == PARTICLE_LAYOUT_SOA) {
+    seedParticles(
+        m_seed,
+        firstParticleIdx,
+        PARTICLES_PER_CHUNK,
+        [&](uint32_t particleIdx, const glm::vec3& position) {
+          uint32_t localIdx = particleIdx - firstParticleIdx;
+          chunk.positions.setElement(glm::vec4(position, 1.0f), localIdx);
+          chunk.prevPositions.setElement(glm::vec4(position, 1.0f), localIdx);
+          chunk.globalIndices.setElement(0, localIdx);
+          chunk.debug.setElement(0xfc3311, localIdx);
+        });
+
+    chunk.positions.upload(app, commandBuffer);
+    chunk.prevPositions.upload(app, commandBuffer);
+    chunk.globalIndices.upload(app, commandBuffer);
+    chunk.debug.upload(app, commandBuffer);
+  } else {
+    seedParticles(
+        m_seed,
+        firstParticleIdx,
+        PARTICLES_PER_CHUNK,
+        [&](uint32_t particleIdx, const glm::vec3& position) {
+          chunk.particles.setElement(
+              Particle{// position
+                       position,
+                       0,
+                       position,
+                       // debug value
+                       0xfc3311},
+              particleIdx - firstParticleIdx);
+        });
+
+    chunk.particles.upload(app, commandBuffer);
+  }
+}
+
+void ParticleSystem::_resizeSimChunks(
+    Application& app,
+    VkCommandBuffer commandBuffer,
+    uint32_t particleCount) {
+  uint32_t chunkCount = (particleCount - 1) / PARTICLES_PER_CHUNK + 1;
+
+  // The heap can't release handles, so the released chunks' handles are
+  // handed to the next chunks grown
+  while (m_chunks.size() > chunkCount) {
+    m_freeChunkHandles.push_back(m_chunks.back().firstHandle);
+    m_chunks.pop_back();
+  }
+
+  while (m_chunks.size() < chunkCount)
+    _addSimChunk(app, commandBuffer);
+
+  // The hash is never cleared per-substep. The bucket build tags slots with
+  // an epoch instead, see _advanceHashEpoch, which skips the clear entirely.
+  // The prefix-sum scan zeroes the counts it consumes, so it still writes
+  // every slot and saves nothing.
+  m_stats.chunkCount = chunkCount;
+  m_stats.hashClearBytesPerSubstep =
+      m_hashBuildMode == SPATIAL_HASH_BUILD_BUCKETS
+          ? uint64_t(chunkCount) * SPATIAL_HASH_SLOTS_PER_CHUNK *
+                sizeof(uint32_t)
+          : 0;
+}
+
+void ParticleSystem::_addSimChunk(
+    Application& app,
+    VkCommandBuffer commandBuffer) {
+  SimChunk& chunk = m_chunks.emplace_back();
+  uint64_t chunkBytes = 0;
+
+  // Every chunk takes the same number of handles, so a released chunk's
+  // range fits this one
+  bool reuseHandles = !m_freeChunkHandles.empty();
+  if (reuseHandles) {
+    chunk.firstHandle = m_freeChunkHandles.back();
+    m_freeChunkHandles.pop_back();
+  }
+
+  // Handle order needs to match the CHUNK_*_OFFSET defines in
+  // SimResources.glsl
+  uint32_t handleCount = 0;
+  auto addBuffer = [&](auto& buffer, uint32_t count) {
+    buffer = std::decay_t<decltype(buffer)>(app, count);
+
+    BufferHandle handle{};
+    if (reuseHandles) {
+      handle.index = chunk.firstHandle + handleCount;
+    } else {
+      handle = m_heap.registerBuffer();
+      if (handleCount == 0)
+        chunk.firstHandle = handle.index;
+      else if (handle.index != chunk.firstHandle + handleCount)
+        throw std::runtime_error("Sim chunk handles aren't contiguous!");
+    }
+
+    m_heap.updateStorageBuffer(
+        handle,
+        buffer.getAllocation().getBuffer(),
+        0,
+        buffer.getSize());
+    ++handleCount;
+    chunkBytes += buffer.getSize();
+  };
+
+  if (m_particleLayout == PARTICLE_LAYOUT_SOA) {
+    addBuffer(chunk.positions, PARTICLES_PER_CHUNK);
+    addBuffer(chunk.prevPositions, PARTICLES_PER_CHUNK);
+    addBuffer(chunk.globalIndices, PARTICLES_PER_CHUNK);
+    addBuffer(chunk.debug, PARTICLES_PER_CHUNK);
+  } else {
+    addBuffer(chunk.particles, PARTICLES_PER_CHUNK);
+  }
+
+  // Written by the first substep of every step before it's read, so it's
+  // never seeded
+  addBuffer(chunk.stepPositions, PARTICLES_PER_CHUNK);
+
+  addBuffer(chunk.spatialHash, SPATIAL_HASH_SLOTS_PER_CHUNK);
+
+  if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM) {
+    // One extra slot at the end, the last chunk's holds the end of the last
+    // cell's range
+    addBuffer(chunk.cellStart, SPATIAL_HASH_SLOTS_PER_CHUNK + 1);
+
+    // Packed particle entries, sorted by spatial hash slot
+    addBuffer(chunk.particleEntries, PARTICLES_PER_CHUNK);
+
+    // The scan zeroes the counts it consumes, they only need to start out
+    // zeroed
+    chunk.spatialHash.zeroBuffer(commandBuffer);
+  } else {
+    // Epoch 0 is never handed out, so a zeroed slot reads as empty
+    addBuffer(chunk.spatialHashEpochs, SPATIAL_HASH_SLOTS_PER_CHUNK);
+    chunk.spatialHashEpochs.zeroBuffer(commandBuffer);
+
+    // Enough buckets for every particle to land in its own cell
+    addBuffer(chunk.buckets, PARTICLES_PER_CHUNK);
+
+    // The bucket alloc pass resets the occupied slots before every insert
+    if (m_useHashTelemetry)
+      addBuffer(chunk.slotTelemetry, SPATIAL_HASH_SLOTS_PER_CHUNK);
+  }
+
+  if (m_useParticleCulling)
+    addBuffer(chunk.visibleParticles, PARTICLES_PER_CHUNK);
+
+  if (m_useNeighborLists)
+    addBuffer(chunk.neighborLists, PARTICLES_PER_CHUNK * NEIGHBOR_LIST_SIZE);
+
+  // Every cell starts out having just moved at epoch 0
+  if (m_useSleeping) {
+    addBuffer(chunk.cellMotionEpochs, SPATIAL_HASH_SLOTS_PER_CHUNK);
+    chunk.cellMotionEpochs.zeroBuffer(commandBuffer);
+  }
+
+  // One per bucket entry, or per packed entry with the prefix-sum build
+  if (m_usePbfDensity)
+    addBuffer(
+        chunk.entryLambdas,
+        m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM
+            ? PARTICLES_PER_CHUNK
+            : PARTICLES_PER_CHUNK * PARTICLES_PER_BUCKET);
+
+  if (m_reorderInterval != 0 || m_compactionInterval != 0)
+    addBuffer(chunk.reorderScratch, PARTICLES_PER_CHUNK);
+
+  if (m_compactionInterval != 0)
+    addBuffer(chunk.liveOffsets, PARTICLES_PER_CHUNK);
+
+  m_stats.chunkBytes = chunkBytes;
+
+  _seedParticles(app, commandBuffer, m_chunks.size() - 1);
+}
+
 void ParticleSystem::_createGlobalResources(
     Application& app,
     SingleTimeCommandBuffer& commandBuffer) {
   m_heap = GlobalHeap(app);
-
-  GlobalResourcesBuilder resourcesBuilder{};
-  m_globalResources =
-      GlobalResources(app, commandBuffer, m_heap, resourcesBuilder);
   m_globalUniforms = GlobalUniformsResource(app, m_heap);
 
+  // The heap can't release handles, so the screen-sized buffers get theirs
+  // once and _createScreenResources rewrites them on every resize
+  m_fluidDepthHandle = m_heap.registerBuffer();
+  if (m_useParticleCulling)
+    m_hiZHandle = m_heap.registerBuffer();
+
   // TODO: Create LODs for particles
   ShapeUtilities::createSphere(
       app,
@@ -342,110 +900,240 @@ void ParticleSystem::_createGlobalResources(
       m_sphere.indices,
       6,
       1.3f * PARTICLE_RADIUS);
+}
 
-  // Set up SSR resources
-  m_ssr = ScreenSpaceReflection(
-      app,
-      commandBuffer,
-      m_heap.getDescriptorSetLayout());
-  m_ssr.getReflectionBuffer().registerToHeap(m_heap);
+void ParticleSystem::_createHeadlessResources(
+    Application& app,
+    SingleTimeCommandBuffer& commandBuffer,
+    uint32_t particleCount) {
+  m_heap = GlobalHeap(app);
+  m_globalUniforms = GlobalUniformsResource(app, m_heap);
+
+  // Nothing is drawn, so there is no depth to cull against either
+  m_useParticleCulling = false;
+
+  m_particleBudget =
+      std::clamp<uint32_t>(particleCount, 1, MAX_PARTICLE_BUDGET);
+  _createSimResources(app, commandBuffer);
+
+  // The reset flag is still set, so the first frame spawns all of them
+  m_activeParticleCount = m_particleBudget;
+  _resizeSimChunks(app, commandBuffer, m_activeParticleCount);
 }
 
 void ParticleSystem::_createSimResources(
     Application& app,
     SingleTimeCommandBuffer& commandBuffer) {
-  uint32_t particleBufferCount =
-      (PARTICLE_COUNT - 1) / PARTICLES_PER_BUFFER + 1;
-  std::vector<StructuredBuffer<Particle>> particleBufferHeap;
-  particleBufferHeap.reserve(particleBufferCount);
-
-  // For now the last buffer could be overallocated if the particles-per-buffer
-  // value doesn't perfectly divide the particle count
-  for (uint32_t bufferIdx = 0; bufferIdx < particleBufferCount; ++bufferIdx) {
-    particleBufferHeap.emplace_back(app, PARTICLES_PER_BUFFER);
-    particleBufferHeap.back().registerToHeap(m_heap);
+  // Zero particles until the first frame's counters pass spawns them
+  m_simCounters = StructuredBuffer<SimCounters>(
+      app,
+      1,
+      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  m_simCounters.registerToHeap(m_heap);
+  m_simCounters.zeroBuffer(commandBuffer);
+
+  if (m_hashBuildMode == SPATIAL_HASH_BUILD_BUCKETS) {
+    m_freeBucketCounter =
+        StructuredBuffer<uint32_t>(app, BUCKET_FREE_LIST_COUNT);
+    m_freeBucketCounter.registerToHeap(m_heap);
   }
 
-  m_particleBuffer =
-      StructuredBufferHeap<Particle>(std::move(particleBufferHeap));
+  if (m_useHashTelemetry) {
+    // Zeroed again after every copy out
+    m_hashTelemetry = StructuredBuffer<HashTelemetry>(app, 1);
+    m_hashTelemetry.registerToHeap(m_heap);
+    m_hashTelemetry.zeroBuffer(commandBuffer);
 
-  _resetParticles(app, commandBuffer);
-
-  // Need transfer bit for vkCmdFillBuffer
-  uint32_t spatialHashBufferCount =
-      (SPATIAL_HASH_SIZE - 1) / SPATIAL_HASH_ENTRIES_PER_BUFFER + 1;
-  std::vector<StructuredBuffer<uint32_t>> spatialHashHeap;
-  spatialHashHeap.reserve(spatialHashBufferCount);
-  for (uint32_t bufferIdx = 0; bufferIdx < spatialHashBufferCount;
-       ++bufferIdx) {
-    spatialHashHeap.emplace_back(app, SPATIAL_HASH_ENTRIES_PER_BUFFER);
-    spatialHashHeap.back().registerToHeap(m_heap);
+    m_hashTelemetryDelivered = false;
+    m_stats.hashTelemetrySubsteps = 0;
   }
 
-  m_spatialHash = StructuredBufferHeap<uint32_t>(std::move(spatialHashHeap));
+  m_pReadback = std::make_unique<AsyncReadback>(app, MAX_READBACKS_IN_FLIGHT);
+  m_barriers = BarrierBatcher(SIM_RESOURCE_COUNT);
+
+  if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM ||
+      m_compactionInterval != 0) {
+    m_scanBlockSums = StructuredBuffer<uint32_t>(app, CELL_SCAN_BLOCK_COUNT);
+    m_scanBlockSums.registerToHeap(m_heap);
+  }
 
-  m_freeBucketCounter = StructuredBuffer<uint32_t>(app, LOCAL_SIZE_X);
-  m_freeBucketCounter.registerToHeap(m_heap);
+  if (m_reorderInterval != 0) {
+    // Zeroed before each reorder counts into them
+    m_mortonKeyCounts = StructuredBuffer<uint32_t>(app, MORTON_KEY_COUNT);
+    m_mortonKeyCounts.registerToHeap(m_heap);
 
-  uint32_t bucketBufferCount =
-      (PARTICLE_BUCKET_COUNT - 1) / PARTICLE_BUCKETS_PER_BUFFFER + 1;
-  std::vector<StructuredBuffer<ParticleBucket>> bucketHeap;
-  bucketHeap.reserve(bucketBufferCount);
-  for (uint32_t bufferIdx = 0; bufferIdx < bucketBufferCount; ++bufferIdx) {
-    bucketHeap.emplace_back(app, PARTICLE_BUCKETS_PER_BUFFFER);
-    bucketHeap.back().registerToHeap(m_heap);
+    m_primitives = GpuPrimitives(app, m_heap, MORTON_KEY_COUNT);
   }
 
-  m_buckets = StructuredBufferHeap<ParticleBucket>(std::move(bucketHeap));
+  // Only the chunks for the initial particles are allocated up front, the
+  // rest are added as particles are emitted
+  m_chunks.reserve(MAX_SIM_CHUNKS);
+  m_freeChunkHandles.clear();
+  _resetParticles(app, commandBuffer);
 
   m_simUniforms = TransientUniforms<SimUniforms>(app);
   m_simUniforms.registerToHeap(m_heap);
 
-  ShaderDefines shaderDefs{};
-  shaderDefs.emplace("LOCAL_SIZE_X", std::to_string(LOCAL_SIZE_X));
-  {
-    ComputePipelineBuilder builder;
-    builder.setComputeShader(
-        GProjectDirectory + "/Shaders/ParticleSystem/ParticleSystem.comp.glsl",
-        shaderDefs);
-    builder.layoutBuilder.addDescriptorSet(m_heap.getDescriptorSetLayout())
-        .addPushConstants<PushConstants>();
-
-    m_computePasses.emplace_back(app, std::move(builder));
-  }
-
-  {
-    ComputePipelineBuilder builder;
-    builder.setComputeShader(
-        GProjectDirectory + "/Shaders/ParticleSystem/BucketAlloc.glsl",
-        shaderDefs);
-    builder.layoutBuilder.addDescriptorSet(m_heap.getDescriptorSetLayout())
-        .addPushConstants<PushConstants>();
-
-    m_computePasses.emplace_back(app, std::move(builder));
-  }
+  if (m_usePbfDensity)
+    m_pbfParams = computePbfParams(
+        PBF_KERNEL_RADIUS,
+        PBF_REST_SPACING,
+        PBF_RELAXATION,
+        PBF_TENSILE_STRENGTH,
+        PBF_TENSILE_DISTANCE);
+
+  VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+  subgroupProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+  VkPhysicalDeviceProperties2 deviceProperties{};
+  deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  deviceProperties.pNext = &subgroupProperties;
+  vkGetPhysicalDeviceProperties2(app.getPhysicalDevice(), &deviceProperties);
+  m_simSpecialization.localSizeX =
+      std::max<uint32_t>(MIN_LOCAL_SIZE_X, subgroupProperties.subgroupSize);
+  m_simSpecialization.tasksPerThread = JACOBI_TASKS_PER_THREAD;
+  m_simSpecialization.cameraRadius = CAMERA_RADIUS;
+
+  ShaderDefines& shaderDefs = m_simShaderDefs;
+  shaderDefs.clear();
+  if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM)
+    shaderDefs.emplace("SPATIAL_HASH_PREFIX_SUM", "");
+  if (m_particleLayout == PARTICLE_LAYOUT_SOA)
+    shaderDefs.emplace("PARTICLE_LAYOUT_SOA", "");
+  if (m_useNeighborLists)
+    shaderDefs.emplace("NEIGHBOR_LISTS", "");
+  if (m_useSleeping)
+    shaderDefs.emplace("PARTICLE_SLEEPING", "");
+  if (m_solverMode == PARTICLE_SOLVER_GAUSS_SEIDEL)
+    shaderDefs.emplace("SOLVER_GAUSS_SEIDEL", "");
+  if (m_usePbfDensity)
+    shaderDefs.emplace("PBF_DENSITY", "");
+  if (m_useHashTelemetry)
+    shaderDefs.emplace("HASH_TELEMETRY", "");
+  if (m_useParticleCulling)
+    shaderDefs.emplace("PARTICLE_CULLING", "");
+
+  _createSimPasses(app);
+}
 
-  {
-    ComputePipelineBuilder builder;
-    builder.setComputeShader(
-        GProjectDirectory + "/Shaders/ParticleSystem/CopyToBucket.glsl",
-        shaderDefs);
-    builder.layoutBuilder.addDescriptorSet(m_heap.getDescriptorSetLayout())
-        .addPushConstants<PushConstants>();
+void ParticleSystem::_createSimPasses(Application& app) {
+  // The scan block sums are only sized for blocks of MIN_LOCAL_SIZE_X threads
+  m_simSpecialization.localSizeX =
+      std::max<uint32_t>(m_simSpecialization.localSizeX, MIN_LOCAL_SIZE_X);
+
+  // ComputePipelineBuilder takes no VkSpecializationInfo, so the tunables
+  // are compiled in. Each variant is its own SPIR-V, but nothing else about
+  // the sim is re-created.
+  ShaderDefines shaderDefs = m_simShaderDefs;
+  shaderDefs.emplace(
+      "SIM_LOCAL_SIZE_X",
+      std::to_string(m_simSpecialization.localSizeX));
+  shaderDefs.emplace(
+      "SIM_TASKS_PER_THREAD",
+      std::to_string(m_simSpecialization.tasksPerThread));
+  shaderDefs.emplace(
+      "SIM_CAMERA_RADIUS",
+      std::to_string(m_simSpecialization.cameraRadius));
 
-    m_computePasses.emplace_back(app, std::move(builder));
-  }
+  m_computePasses.clear();
 
-  {
+  auto addComputePass = [&](const std::string& shaderPath,
+                            const ShaderDefines& defs) {
     ComputePipelineBuilder builder;
-    builder.setComputeShader(
-        GProjectDirectory +
-            "/Shaders/ParticleSystem/ProjectedJacobiStep.comp.glsl",
-        shaderDefs);
+    builder.setComputeShader(GProjectDirectory + shaderPath, defs);
     builder.layoutBuilder.addDescriptorSet(m_heap.getDescriptorSetLayout())
         .addPushConstants<PushConstants>();
 
     m_computePasses.emplace_back(app, std::move(builder));
+  };
+
+  // Order needs to match the *_PASS indices
+  addComputePass(
+      "/Shaders/ParticleSystem/ParticleSystem.comp.glsl",
+      shaderDefs);
+  addComputePass("/Shaders/ParticleSystem/BucketAlloc.glsl", shaderDefs);
+  addComputePass("/Shaders/ParticleSystem/CopyToBucket.glsl", shaderDefs);
+  addComputePass(
+      "/Shaders/ParticleSystem/ProjectedJacobiStep.comp.glsl",
+      shaderDefs);
+
+  auto addScanPasses = [&](const ShaderDefines& defs) {
+    for (uint32_t scanStage = 0; scanStage < 3; ++scanStage) {
+      ShaderDefines scanDefs = defs;
+      scanDefs.emplace("SCAN_STAGE", std::to_string(scanStage));
+      scanDefs.emplace(
+          "SCAN_ITEMS_PER_THREAD",
+          std::to_string(CELL_SCAN_ITEMS_PER_THREAD));
+      addComputePass("/Shaders/ParticleSystem/CellScan.comp.glsl", scanDefs);
+    }
+  };
+
+  auto addReorderPass = [&](uint32_t reorderStage) {
+    ShaderDefines reorderDefs = shaderDefs;
+    reorderDefs.emplace("REORDER_STAGE", std::to_string(reorderStage));
+    addComputePass(
+        "/Shaders/ParticleSystem/MortonReorder.comp.glsl",
+        reorderDefs);
+  };
+
+  addScanPasses(shaderDefs);
+
+  addReorderPass(0);
+  addReorderPass(1);
+  addReorderPass(2);
+
+  addComputePass(
+      "/Shaders/ParticleSystem/BuildNeighborList.comp.glsl",
+      shaderDefs);
+  addComputePass(
+      "/Shaders/ParticleSystem/GaussSeidelStep.comp.glsl",
+      shaderDefs);
+  addComputePass(
+      "/Shaders/ParticleSystem/UpdateSimCounters.comp.glsl",
+      shaderDefs);
+
+  auto addCompactPass = [&](uint32_t compactStage) {
+    ShaderDefines compactDefs = shaderDefs;
+    compactDefs.emplace("COMPACT_STAGE", std::to_string(compactStage));
+    addComputePass(
+        "/Shaders/ParticleSystem/CompactParticles.comp.glsl",
+        compactDefs);
+  };
+
+  addCompactPass(0);
+  ShaderDefines liveScanDefs = shaderDefs;
+  liveScanDefs.emplace("SCAN_LIVE_PARTICLES", "");
+  addScanPasses(liveScanDefs);
+  addCompactPass(1);
+  addCompactPass(2);
+
+  ShaderDefines compactedCountersDefs = shaderDefs;
+  compactedCountersDefs.emplace("AFTER_COMPACTION", "");
+  addComputePass(
+      "/Shaders/ParticleSystem/UpdateSimCounters.comp.glsl",
+      compactedCountersDefs);
+
+  addComputePass("/Shaders/ParticleSystem/PbfLambda.comp.glsl", shaderDefs);
+
+  addComputePass("/Shaders/ParticleSystem/HiZBuild.comp.glsl", shaderDefs);
+
+  auto addCullPass = [&](uint32_t cullStage) {
+    ShaderDefines cullDefs = shaderDefs;
+    cullDefs.emplace("CULL_STAGE", std::to_string(cullStage));
+    addComputePass(
+        "/Shaders/ParticleSystem/ParticleCull.comp.glsl",
+        cullDefs);
+  };
+
+  addCullPass(0);
+  addCullPass(1);
+
+  for (uint32_t fluidStage = 0; fluidStage < 3; ++fluidStage) {
+    ShaderDefines fluidDefs = shaderDefs;
+    fluidDefs.emplace("FLUID_STAGE", std::to_string(fluidStage));
+    addComputePass(
+        "/Shaders/ParticleSystem/FluidSurface.comp.glsl",
+        fluidDefs);
   }
 }
 
@@ -454,7 +1142,9 @@ void ParticleSystem::_createGBufferPass(Application& app) {
 
   // Render particles
   {
-    ShaderDefines defs{};
+    // The chunk offsets depend on every sim define
+    const ShaderDefines& defs = m_simShaderDefs;
+
     SubpassBuilder& subpassBuilder = subpassBuilders.emplace_back();
     GBufferResources::setupAttachments(subpassBuilder);
 
@@ -470,6 +1160,43 @@ void ParticleSystem::_createGBufferPass(Application& app) {
         .addPushConstants<PushConstants>();
   }
 
+  // Render particle impostors, the pass only draws in one of the two particle
+  // subpasses depending on the render mode
+  {
+    const ShaderDefines& defs = m_simShaderDefs;
+
+    SubpassBuilder& subpassBuilder = subpassBuilders.emplace_back();
+    GBufferResources::setupAttachments(subpassBuilder);
+
+    // The quads are generated from the vertex index and face the camera
+    // either way around, the fragment shader reads the camera too
+    subpassBuilder.pipelineBuilder.setPrimitiveType(PrimitiveType::TRIANGLES)
+        .setCullMode(VK_CULL_MODE_NONE)
+        .addVertexShader(
+            GProjectDirectory + "/Shaders/ParticleSystem/ParticleImpostor.vert",
+            defs)
+        .addFragmentShader(
+            GProjectDirectory + "/Shaders/ParticleSystem/ParticleImpostor.frag",
+            defs)
+        .layoutBuilder.addDescriptorSet(m_heap.getDescriptorSetLayout())
+        .addPushConstants<PushConstants>(VK_SHADER_STAGE_ALL);
+  }
+
+  // Render the screen-space fluid surface
+  {
+    SubpassBuilder& subpassBuilder = subpassBuilders.emplace_back();
+    GBufferResources::setupAttachments(subpassBuilder);
+
+    subpassBuilder.pipelineBuilder.setPrimitiveType(PrimitiveType::TRIANGLES)
+        .setCullMode(VK_CULL_MODE_FRONT_BIT)
+        .addVertexShader(GEngineDirectory + "/Shaders/Misc/FullScreenQuad.vert")
+        .addFragmentShader(
+            GProjectDirectory + "/Shaders/ParticleSystem/FluidSurface.frag",
+            m_simShaderDefs)
+        .layoutBuilder.addDescriptorSet(m_heap.getDescriptorSetLayout())
+        .addPushConstants<PushConstants>(VK_SHADER_STAGE_ALL);
+  }
+
   // Render floor
 #if 0
   {
@@ -576,11 +1303,41 @@ void ParticleSystem::_renderGBufferPass(
     pass.getDrawContext().bindDescriptorSets();
     pass.getDrawContext().updatePushConstants(m_push, 0);
 
-    pass.getDrawContext().bindIndexBuffer(m_sphere.indices);
-    pass.getDrawContext().bindVertexBuffer(m_sphere.vertices);
-    pass.getDrawContext().drawIndexed(
-        m_sphere.indices.getIndexCount(),
-        m_activeParticleCount);
+    // One instance per live particle, the count never leaves the GPU
+    if (m_particleRenderMode == PARTICLE_RENDER_MESH) {
+      pass.getDrawContext().bindIndexBuffer(m_sphere.indices);
+      pass.getDrawContext().bindVertexBuffer(m_sphere.vertices);
+      vkCmdDrawIndexedIndirect(
+          commandBuffer,
+          m_simCounters.getAllocation().getBuffer(),
+          offsetof(SimCounters, particleDraw),
+          1,
+          sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    // Draw particle impostors
+    pass.nextSubpass();
+    pass.setGlobalDescriptorSets(gsl::span(&globalDescriptorSet, 1));
+    pass.getDrawContext().bindDescriptorSets();
+    pass.getDrawContext().updatePushConstants(m_push, 0);
+    // The fluid surface leaves the particles closest to the camera to the
+    // impostors
+    if (m_particleRenderMode == PARTICLE_RENDER_IMPOSTORS ||
+        m_particleRenderMode == PARTICLE_RENDER_FLUID)
+      vkCmdDrawIndirect(
+          commandBuffer,
+          m_simCounters.getAllocation().getBuffer(),
+          offsetof(SimCounters, particleImpostorDraw),
+          1,
+          sizeof(VkDrawIndirectCommand));
+
+    // Draw the fluid surface
+    pass.nextSubpass();
+    pass.setGlobalDescriptorSets(gsl::span(&globalDescriptorSet, 1));
+    pass.getDrawContext().bindDescriptorSets();
+    pass.getDrawContext().updatePushConstants(m_push, 0);
+    if (m_particleRenderMode == PARTICLE_RENDER_FLUID)
+      pass.getDrawContext().draw(3);
 
     // Draw floor
 #if 0
@@ -597,6 +1354,47 @@ void ParticleSystem::_dispatchComputePass(
     VkCommandBuffer commandBuffer,
     uint32_t passIdx,
     uint32_t groupCount) {
+  _bindComputePass(commandBuffer, passIdx);
+
+  if (m_pPassTimer)
+    m_pPassTimer->beginDispatch(commandBuffer, passIdx);
+
+  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+  if (m_pPassTimer)
+    m_pPassTimer->endDispatch(commandBuffer);
+}
+
+void ParticleSystem::_dispatchParticlePass(
+    VkCommandBuffer commandBuffer,
+    uint32_t passIdx) {
+  // Particle passes read the count in the shader, besides the group count
+  m_barriers.read(
+      SIM_RESOURCE_COUNTERS,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+  _bindComputePass(commandBuffer, passIdx);
+
+  if (m_pPassTimer)
+    m_pPassTimer->beginDispatch(commandBuffer, passIdx);
+
+  vkCmdDispatchIndirect(
+      commandBuffer,
+      m_simCounters.getAllocation().getBuffer(),
+      offsetof(SimCounters, particleDispatch));
+
+  if (m_pPassTimer)
+    m_pPassTimer->endDispatch(commandBuffer);
+}
+
+void ParticleSystem::_bindComputePass(
+    VkCommandBuffer commandBuffer,
+    uint32_t passIdx) {
+  // One barrier for whatever the pass depends on, if anything
+  _declarePassAccesses(passIdx);
+  m_barriers.flush(commandBuffer);
+
   VkDescriptorSet set = m_heap.getDescriptorSet();
   m_computePasses[passIdx].bindPipeline(commandBuffer);
   vkCmdBindDescriptorSets(
@@ -616,324 +1414,816 @@ void ParticleSystem::_dispatchComputePass(
       0,
       sizeof(PushConstants),
       &m_push);
+}
 
-  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+void ParticleSystem::_declarePassAccesses(uint32_t passIdx) {
+  auto read = [&](uint32_t resource) {
+    m_barriers.read(
+        resource,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT);
+  };
+  auto write = [&](uint32_t resource) {
+    m_barriers.write(
+        resource,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT);
+  };
+  auto readWrite = [&](uint32_t resource) {
+    m_barriers.readWrite(resource, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  };
+
+  switch (passIdx) {
+  case SIM_PASS:
+    readWrite(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_ENTRIES);
+    readWrite(SIM_RESOURCE_HASH);
+    // Counts the sleeping particles
+    readWrite(SIM_RESOURCE_COUNTERS);
+    // Marks the cells that saw motion and tests the rest for sleep
+    readWrite(SIM_RESOURCE_CELL_MOTION);
+    break;
+  case BUCKET_ALLOC_PASS:
+    readWrite(SIM_RESOURCE_HASH);
+    readWrite(SIM_RESOURCE_FREE_LISTS);
+    readWrite(SIM_RESOURCE_HASH_TELEMETRY);
+    break;
+  case BUCKET_INSERT_PASS:
+    readWrite(SIM_RESOURCE_PARTICLES);
+    readWrite(SIM_RESOURCE_HASH);
+    write(SIM_RESOURCE_ENTRIES);
+    readWrite(SIM_RESOURCE_HASH_TELEMETRY);
+    break;
+  case JACOBI_STEP_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_HASH);
+    read(SIM_RESOURCE_NEIGHBOR_LISTS);
+    read(SIM_RESOURCE_ENTRY_LAMBDAS);
+    readWrite(SIM_RESOURCE_ENTRIES);
+    break;
+  case PBF_LAMBDA_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_HASH);
+    read(SIM_RESOURCE_NEIGHBOR_LISTS);
+    read(SIM_RESOURCE_ENTRIES);
+    write(SIM_RESOURCE_ENTRY_LAMBDAS);
+    break;
+  case CELL_SCAN_BLOCKS_PASS:
+  case CELL_SCAN_APPLY_PASS:
+    readWrite(SIM_RESOURCE_HASH);
+    readWrite(SIM_RESOURCE_SCAN_BLOCK_SUMS);
+    break;
+  case CELL_SCAN_BLOCK_SUMS_PASS:
+    readWrite(SIM_RESOURCE_SCAN_BLOCK_SUMS);
+    break;
+  case MORTON_KEYS_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    readWrite(SIM_RESOURCE_MORTON_KEYS);
+    break;
+  case MORTON_SCATTER_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    readWrite(SIM_RESOURCE_MORTON_KEYS);
+    write(SIM_RESOURCE_REORDER_SCRATCH);
+    break;
+  case MORTON_COPY_BACK_PASS:
+    read(SIM_RESOURCE_REORDER_SCRATCH);
+    write(SIM_RESOURCE_PARTICLES);
+    break;
+  case NEIGHBOR_LIST_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_HASH);
+    read(SIM_RESOURCE_ENTRIES);
+    write(SIM_RESOURCE_NEIGHBOR_LISTS);
+    break;
+  case GAUSS_SEIDEL_STEP_PASS:
+    read(SIM_RESOURCE_HASH);
+    readWrite(SIM_RESOURCE_ENTRIES);
+    break;
+  case SIM_COUNTERS_PASS:
+    readWrite(SIM_RESOURCE_COUNTERS);
+    break;
+  case COMPACT_FLAGS_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    write(SIM_RESOURCE_LIVE_OFFSETS);
+    break;
+  case LIVE_SCAN_BLOCKS_PASS:
+  case LIVE_SCAN_APPLY_PASS:
+    read(SIM_RESOURCE_COUNTERS);
+    readWrite(SIM_RESOURCE_LIVE_OFFSETS);
+    readWrite(SIM_RESOURCE_SCAN_BLOCK_SUMS);
+    break;
+  case LIVE_SCAN_BLOCK_SUMS_PASS:
+    read(SIM_RESOURCE_COUNTERS);
+    readWrite(SIM_RESOURCE_SCAN_BLOCK_SUMS);
+    break;
+  case COMPACT_SCATTER_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_LIVE_OFFSETS);
+    write(SIM_RESOURCE_REORDER_SCRATCH);
+    break;
+  case COMPACT_COPY_BACK_PASS:
+    read(SIM_RESOURCE_REORDER_SCRATCH);
+    read(SIM_RESOURCE_LIVE_OFFSETS);
+    write(SIM_RESOURCE_PARTICLES);
+    break;
+  case SIM_COUNTERS_COMPACTED_PASS:
+    read(SIM_RESOURCE_LIVE_OFFSETS);
+    readWrite(SIM_RESOURCE_COUNTERS);
+    break;
+  case HI_Z_PASS:
+    readWrite(SIM_RESOURCE_HI_Z);
+    break;
+  case CULL_RESET_PASS:
+    readWrite(SIM_RESOURCE_COUNTERS);
+    break;
+  case CULL_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_ENTRIES);
+    read(SIM_RESOURCE_HI_Z);
+    readWrite(SIM_RESOURCE_COUNTERS);
+    write(SIM_RESOURCE_VISIBLE_PARTICLES);
+    break;
+  case FLUID_CLEAR_PASS:
+    write(SIM_RESOURCE_FLUID_DEPTH);
+    break;
+  case FLUID_SPLAT_PASS:
+    read(SIM_RESOURCE_PARTICLES);
+    read(SIM_RESOURCE_ENTRIES);
+    readWrite(SIM_RESOURCE_FLUID_DEPTH);
+    break;
+  case FLUID_SMOOTH_PASS:
+    readWrite(SIM_RESOURCE_FLUID_DEPTH);
+    break;
+  }
 }
 
-void ParticleSystem::_readAfterWriteBarrier(VkCommandBuffer commandBuffer) {
+void ParticleSystem::_dispatchScan(
+    VkCommandBuffer commandBuffer,
+    uint32_t blocksPassIdx,
+    uint32_t slotCount) {
+  // Scan each block of slots locally and write out the block totals
+  uint32_t localSizeX = m_simSpecialization.localSizeX;
+  uint32_t blockSize = localSizeX * CELL_SCAN_ITEMS_PER_THREAD;
+  uint32_t blockCount = (slotCount - 1) / blockSize + 1;
+  _dispatchComputePass(commandBuffer, blocksPassIdx, blockCount);
+
+  // Turn the block totals into block offsets
+  _dispatchComputePass(commandBuffer, blocksPassIdx + 1, 1);
+
+  // Add the block offsets back into each slot
+  uint32_t groupCountX = (slotCount - 1) / localSizeX + 1;
+  _dispatchComputePass(commandBuffer, blocksPassIdx + 2, groupCountX);
+}
 
-  uint32_t particleBufferCount = m_particleBuffer.getSize();
-  uint32_t spatialHashBufferCount = m_spatialHash.getSize();
+void ParticleSystem::_reorderParticles(VkCommandBuffer commandBuffer) {
+  // The previous scatter left the key ranges' ends in the counts
+  m_barriers.write(
+      SIM_RESOURCE_MORTON_KEYS,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT);
+  m_barriers.flush(commandBuffer);
+  m_mortonKeyCounts.zeroBuffer(commandBuffer);
+
+  // Count the particles per Morton key
+  _dispatchParticlePass(commandBuffer, MORTON_KEYS_PASS);
+
+  // Scan the counts into the start of each key's range. The key space is
+  // fixed and lives in a single buffer, so the shared scan fits it as is.
+  // Declaring the scan's access as a compute write also makes the scatter
+  // wait on it.
+  m_barriers.readWrite(
+      SIM_RESOURCE_MORTON_KEYS,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  m_barriers.flush(commandBuffer);
+  m_primitives.exclusiveScan(
+      commandBuffer,
+      m_mortonKeyCounts.getHandle().index,
+      MORTON_KEY_COUNT);
 
-  static std::vector<VkBufferMemoryBarrier> postPresizeBarriers;
-  postPresizeBarriers.resize(particleBufferCount + spatialHashBufferCount);
+  // Scatter the particles into the scratch heap in key order
+  _dispatchParticlePass(commandBuffer, MORTON_SCATTER_PASS);
 
-  for (uint32_t bufferIdx = 0; bufferIdx < particleBufferCount; ++bufferIdx) {
-    const auto& buffer = m_particleBuffer.getBuffer(bufferIdx);
+  // Copy them back
+  _dispatchParticlePass(commandBuffer, MORTON_COPY_BACK_PASS);
+}
 
-    VkBufferMemoryBarrier& barrier = postPresizeBarriers[bufferIdx];
-    barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    barrier.buffer = buffer.getAllocation().getBuffer();
-    barrier.offset = 0;
-    barrier.size = buffer.getSize();
-    barrier.srcAccessMask =
-        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-    barrier.dstAccessMask =
-        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-  }
+void ParticleSystem::_advanceHashEpoch(VkCommandBuffer commandBuffer) {
+  ++m_hashEpoch;
 
-  for (uint32_t bufferIdx = 0; bufferIdx < spatialHashBufferCount;
-       ++bufferIdx) {
-    const auto& buffer = m_spatialHash.getBuffer(bufferIdx);
+  // Only once every ~4 billion substeps, the slot tags need to be reset
+  // before epoch 1 can be reused
+  if (m_hashEpoch == 0) {
+    if (m_hashBuildMode == SPATIAL_HASH_BUILD_BUCKETS)
+      m_barriers.write(
+          SIM_RESOURCE_HASH,
+          VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_ACCESS_TRANSFER_WRITE_BIT);
+    if (m_useSleeping)
+      m_barriers.write(
+          SIM_RESOURCE_CELL_MOTION,
+          VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_ACCESS_TRANSFER_WRITE_BIT);
+    m_barriers.flush(commandBuffer);
+
+    for (SimChunk& chunk : m_chunks) {
+      if (m_hashBuildMode == SPATIAL_HASH_BUILD_BUCKETS)
+        chunk.spatialHashEpochs.zeroBuffer(commandBuffer);
+      // Wakes every cell for the first few substeps of the new epochs
+      if (m_useSleeping)
+        chunk.cellMotionEpochs.zeroBuffer(commandBuffer);
+    }
 
-    VkBufferMemoryBarrier& barrier =
-        postPresizeBarriers[bufferIdx + particleBufferCount];
-    barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    barrier.buffer = buffer.getAllocation().getBuffer();
-    barrier.offset = 0;
-    barrier.size = buffer.getSize();
-    barrier.srcAccessMask =
-        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-    barrier.dstAccessMask =
-        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+    m_hashEpoch = 1;
   }
 
-  vkCmdPipelineBarrier(
-      commandBuffer,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      0,
-      0,
-      nullptr,
-      postPresizeBarriers.size(),
-      postPresizeBarriers.data(),
-      0,
-      nullptr);
+  m_push.hashEpoch = m_hashEpoch;
+  m_stats.hashClearBytesSaved += m_stats.hashClearBytesPerSubstep;
 }
 
-void ParticleSystem::_writeAfterReadBarrier(VkCommandBuffer commandBuffer) {
-  uint32_t particleBufferCount = m_particleBuffer.getSize();
-  uint32_t spatialHashBufferCount = m_spatialHash.getSize();
-
-  static std::vector<VkBufferMemoryBarrier> postBucketAllocBarriers;
-  postBucketAllocBarriers.resize(spatialHashBufferCount + 1);
-
-  for (uint32_t bufferIdx = 0; bufferIdx < spatialHashBufferCount;
-       ++bufferIdx) {
-    auto& buffer = m_spatialHash.getBuffer(bufferIdx);
-
-    VkBufferMemoryBarrier& barrier = postBucketAllocBarriers[bufferIdx];
-    barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    barrier.buffer = buffer.getAllocation().getBuffer();
-    barrier.offset = 0;
-    barrier.size = buffer.getSize();
-    barrier.srcAccessMask =
-        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-    barrier.dstAccessMask =
-        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-  }
-
-  // TODO: Do we even need this barrier??
-  VkBufferMemoryBarrier& barrier =
-      postBucketAllocBarriers[spatialHashBufferCount];
-  barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-  barrier.buffer = m_freeBucketCounter.getAllocation().getBuffer();
-  barrier.offset = 0;
-  barrier.size = m_freeBucketCounter.getSize();
-  barrier.srcAccessMask =
-      VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-  vkCmdPipelineBarrier(
-      commandBuffer,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-      0,
-      0,
-      nullptr,
-      postBucketAllocBarriers.size(),
-      postBucketAllocBarriers.data(),
-      0,
-      nullptr);
-}
-
-void ParticleSystem::draw(
-    Application& app,
-    VkCommandBuffer commandBuffer,
-    const FrameContext& frame) {
-
-  VkDescriptorSet set = m_heap.getDescriptorSet();
-
-  uint32_t spatialHashBufferCount = m_spatialHash.getSize();
-  uint32_t particleBufferCount = m_particleBuffer.getSize();
-  uint32_t bucketBufferCount = m_buckets.getSize();
+void ParticleSystem::_stepSim(VkCommandBuffer commandBuffer) {
+  uint32_t spatialHashSize =
+      static_cast<uint32_t>(m_chunks.size()) * SPATIAL_HASH_SLOTS_PER_CHUNK;
+
+  // Only the frame's first sim step emits and resets, later steps see no
+  // added particles
+  bool firstStep = m_push.simStep == 0;
+
+  // Every so often remove the dead particles, before this frame's particles
+  // are emitted behind the live ones. The unit tests always check a
+  // compaction. Reset frames are skipped, the chunks may have shrunk under
+  // the previous frame's count.
+  bool compact = m_compactionInterval != 0 &&
+                 (++m_stepsSinceCompaction >= m_compactionInterval ||
+                  (m_flagUnitTests && firstStep)) &&
+                 !(firstStep && m_lastSimUniforms.resetParticles);
+  if (compact) {
+    m_stepsSinceCompaction = 0;
+    _compactParticles(commandBuffer);
+  } else {
+    // Emit this frame's particles and size the particle passes and draw for
+    // the new count
+    _dispatchComputePass(commandBuffer, SIM_COUNTERS_PASS, 1);
+  }
 
-  // TODO: Clean-up rest of the barriers
-  // probably just need one, write-after-write type barrier between each compute
-  // pass... should be able to re-use same barrier function
+  // Periodically sort the particles along a Z-order curve, so that particles
+  // close in space are close in memory. Steps that spawn particles are
+  // skipped, the sim pass picks out new particles by their index.
+  if (m_reorderInterval != 0 && ++m_stepsSinceReorder >= m_reorderInterval &&
+      !(firstStep && m_addedParticles != 0)) {
+    m_stepsSinceReorder = 0;
+    _reorderParticles(commandBuffer);
+  }
 
   for (uint32_t substep = 0; substep < TIME_SUBSTEPS; ++substep) {
-    // Reset the spatial hash and prepare the buffers for read/write
-    {
-      static std::vector<VkBufferMemoryBarrier> spatialHashResetBarriers;
-      spatialHashResetBarriers.resize(spatialHashBufferCount);
-
-      for (uint32_t bufferIdx = 0; bufferIdx < spatialHashBufferCount;
-           ++bufferIdx) {
-        const auto& buffer = m_spatialHash.getBuffer(bufferIdx);
-
-        VkBufferMemoryBarrier& barrier = spatialHashResetBarriers[bufferIdx];
-        barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-        barrier.buffer = buffer.getAllocation().getBuffer();
-        barrier.offset = 0;
-        barrier.size = buffer.getSize();
-        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        vkCmdPipelineBarrier(
-            commandBuffer,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT,
-            0,
-            0,
-            nullptr,
-            1,
-            &barrier,
-            0,
-            nullptr);
-
-        vkCmdFillBuffer(
-            commandBuffer,
-            buffer.getAllocation().getBuffer(),
-            0,
-            buffer.getSize(),
-            0xFFFFFFFF);
-
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask =
-            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
-      }
-
-      vkCmdPipelineBarrier(
-          commandBuffer,
-          VK_PIPELINE_STAGE_TRANSFER_BIT,
-          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-          0,
-          0,
-          nullptr,
-          spatialHashResetBarriers.size(),
-          spatialHashResetBarriers.data(),
-          0,
-          nullptr);
-    }
+    // No need to clear the spatial hash, stale slots from the previous
+    // substep read as empty under the new epoch
+    _advanceHashEpoch(commandBuffer);
 
     // Particle simulation and cell bucket pre-sizing pass
     // - Update particles with new positions
+    // - Save the solved positions the step starts from, on the first substep
     // - Update particles with new grid cell hash
     // - Increment spatial hash bucket count for each particle
-    {
-      uint32_t groupCountX = (m_activeParticleCount - 1) / LOCAL_SIZE_X + 1;
-      _dispatchComputePass(commandBuffer, SIM_PASS, groupCountX);
-
-      _readAfterWriteBarrier(commandBuffer);
-    }
-
-    // Bucket alloc pass
-    // - Allocate a bucket from free list
-    // - Write bucket start idx to spatial hash grid cell
-    {
-      uint32_t groupCountX = (SPATIAL_HASH_SIZE - 1) / LOCAL_SIZE_X + 1;
-
+    m_push.iteration = substep;
+    _dispatchParticlePass(commandBuffer, SIM_PASS);
+
+    if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM) {
+      // Cell scan passes
+      // - Scan the per-cell particle counts into the end of each cell's range
+      _dispatchScan(commandBuffer, CELL_SCAN_BLOCKS_PASS, spatialHashSize);
+    } else {
+      // Bucket alloc pass
+      // - Allocate a bucket from free list for slots tagged this substep
+      // - Write bucket start idx to spatial hash grid cell
+      uint32_t groupCountX =
+          (spatialHashSize - 1) / m_simSpecialization.localSizeX + 1;
       _dispatchComputePass(commandBuffer, BUCKET_ALLOC_PASS, groupCountX);
-      _writeAfterReadBarrier(commandBuffer);
     }
 
     // Copy to particles bucket pass
     // - Copy particle to bucket
     // - Update bucket offset in spatial hash
     // - Update particle with new global index
-    {
-      uint32_t groupCountX = (m_activeParticleCount - 1) / LOCAL_SIZE_X + 1;
-      _dispatchComputePass(commandBuffer, BUCKET_INSERT_PASS, groupCountX);
-
-      static std::vector<VkBufferMemoryBarrier> postBucketInsertBarriers;
-      postBucketInsertBarriers.resize(
-          spatialHashBufferCount + bucketBufferCount + particleBufferCount);
-
-      for (uint32_t bufferIdx = 0; bufferIdx < spatialHashBufferCount;
-           ++bufferIdx) {
-        auto& buffer = m_spatialHash.getBuffer(bufferIdx);
-
-        VkBufferMemoryBarrier& barrier = postBucketInsertBarriers[bufferIdx];
-        barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-        barrier.buffer = buffer.getAllocation().getBuffer();
-        barrier.offset = 0;
-        barrier.size = buffer.getSize();
-        barrier.srcAccessMask =
-            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-      }
+    _dispatchParticlePass(commandBuffer, BUCKET_INSERT_PASS);
 
-      for (uint32_t bufferIdx = 0; bufferIdx < bucketBufferCount; ++bufferIdx) {
-        auto& buffer = m_buckets.getBuffer(bufferIdx);
-
-        VkBufferMemoryBarrier& barrier =
-            postBucketInsertBarriers[spatialHashBufferCount + bufferIdx];
-        barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-        barrier.buffer = buffer.getAllocation().getBuffer();
-        barrier.offset = 0;
-        barrier.size = buffer.getSize();
-        barrier.srcAccessMask =
-            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-        barrier.dstAccessMask =
-            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-      }
+    // Neighbour list pass
+    // - Cache the bucket entries near each particle for the Jacobi iterations
+    if (m_useNeighborLists)
+      _dispatchParticlePass(commandBuffer, NEIGHBOR_LIST_PASS);
+
+    // Dispatch jacobi iterations for collision resolution
+    if (m_solverMode == PARTICLE_SOLVER_JACOBI) {
+      for (uint32_t iter = 0; iter < JACOBI_ITERS; ++iter) {
+        m_push.iteration = iter;
 
-      for (uint32_t bufferIdx = 0; bufferIdx < particleBufferCount;
-           ++bufferIdx) {
-        auto& buffer = m_particleBuffer.getBuffer(bufferIdx);
-
-        VkBufferMemoryBarrier& barrier = postBucketInsertBarriers
-            [spatialHashBufferCount + bucketBufferCount + bufferIdx];
-        barrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-        barrier.buffer = buffer.getAllocation().getBuffer();
-        barrier.offset = 0;
-        barrier.size = buffer.getSize();
-        barrier.srcAccessMask =
-            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        // Density constraint multipliers of this iterate, for the Jacobi
+        // step to move the particles by
+        if (m_usePbfDensity)
+          _dispatchParticlePass(commandBuffer, PBF_LAMBDA_PASS);
+
+        _dispatchParticlePass(commandBuffer, JACOBI_STEP_PASS);
+      }
+    } else {
+      // Gauss-Seidel iterations, one dispatch per cell colour
+      // - Each thread updates the particles of one hash slot in place
+      uint32_t groupCountX =
+          (spatialHashSize - 1) / m_simSpecialization.localSizeX + 1;
+      for (uint32_t iter = 0; iter < JACOBI_ITERS; ++iter) {
+        for (uint32_t color = 0; color < CELL_COLOR_COUNT; ++color) {
+          m_push.iteration = CELL_COLOR_COUNT * iter + color;
+          _dispatchComputePass(
+              commandBuffer,
+              GAUSS_SEIDEL_STEP_PASS,
+              groupCountX);
+        }
       }
+    }
+  }
 
-      vkCmdPipelineBarrier(
+  if (m_useHashTelemetry)
+    _copyOutHashTelemetry(commandBuffer);
+
+  if (m_useSleeping)
+    _copyOutSleepStats(commandBuffer);
+}
+
+void ParticleSystem::_compactParticles(VkCommandBuffer commandBuffer) {
+  // The two readbacks are delivered in order on the readback worker, so the
+  // particles from before are always in place for the check
+  auto pParticlesBefore = std::make_shared<std::vector<Particle>>();
+  bool validate =
+      m_flagUnitTests &&
+      _readBackParticles(
           commandBuffer,
-          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-          0,
-          0,
-          nullptr,
-          postBucketInsertBarriers.size(),
-          postBucketInsertBarriers.data(),
-          0,
-          nullptr);
-    }
+          [pParticlesBefore](
+              const SimCounters& /*counters*/,
+              std::vector<Particle>&& particles) {
+            *pParticlesBefore = std::move(particles);
+          });
 
-    // Dispatch jacobi iterations for collision resolution
-    {
-      uint32_t groupCountX = (m_activeParticleCount - 1) / LOCAL_SIZE_X + 1;
-
-      static std::vector<VkBufferMemoryBarrier> collisionStepBarriers;
-      collisionStepBarriers.resize(bucketBufferCount);
-
-      for (uint32_t bufferIdx = 0; bufferIdx < bucketBufferCount; ++bufferIdx) {
-        VkBufferMemoryBarrier& collisionStepBarrier =
-            collisionStepBarriers[bufferIdx];
-        collisionStepBarrier = {VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-        collisionStepBarrier.buffer =
-            m_buckets.getBuffer(bufferIdx).getAllocation().getBuffer();
-        collisionStepBarrier.offset = 0;
-        collisionStepBarrier.size = m_buckets.getBuffer(bufferIdx).getSize();
-        collisionStepBarrier.srcAccessMask =
-            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-        collisionStepBarrier.dstAccessMask =
-            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
-      }
+  // Flag the live particles
+  _dispatchParticlePass(commandBuffer, COMPACT_FLAGS_PASS);
+
+  // Scan the flags into the packed indices. Only the GPU knows the count, so
+  // the scan is sized for the most particles there could be.
+  _dispatchScan(commandBuffer, LIVE_SCAN_BLOCKS_PASS, m_activeParticleCount);
+
+  // Scatter the live particles into the scratch heap, packed
+  _dispatchParticlePass(commandBuffer, COMPACT_SCATTER_PASS);
+
+  // Copy them back
+  _dispatchParticlePass(commandBuffer, COMPACT_COPY_BACK_PASS);
 
-      m_computePasses[JACOBI_STEP_PASS].bindPipeline(commandBuffer);
-      vkCmdBindDescriptorSets(
+  // Shrink the count to the live particles, then emit this frame's particles
+  // behind them
+  _dispatchComputePass(commandBuffer, SIM_COUNTERS_COMPACTED_PASS, 1);
+
+  if (validate)
+    _readBackParticles(
+        commandBuffer,
+        [pParticlesBefore, simUniforms = m_lastSimUniforms](
+            const SimCounters& counters,
+            std::vector<Particle>&& particles) {
+          SpatialHashUnitTests::runCompactionTests(
+              simUniforms,
+              *pParticlesBefore,
+              particles,
+              counters.particleCount - counters.addedParticles);
+        });
+}
+
+void ParticleSystem::_copyOutHashTelemetry(VkCommandBuffer commandBuffer) {
+  m_barriers.read(
+      SIM_RESOURCE_HASH_TELEMETRY,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.flush(commandBuffer);
+
+  // Skipped for this frame if the readbacks are backed up
+  m_pReadback->request(
+      commandBuffer,
+      {{m_hashTelemetry.getAllocation().getBuffer(),
+        0,
+        sizeof(HashTelemetry)}},
+      [that = this](ReadbackData&& data) {
+        std::lock_guard<std::mutex> lock(that->m_hashTelemetryMutex);
+        std::memcpy(
+            &that->m_deliveredHashTelemetry,
+            data[0].data(),
+            sizeof(HashTelemetry));
+        that->m_hashTelemetryDelivered = true;
+      });
+
+  // Start the next frame's counts from zero once the copy is done with them
+  m_barriers.write(
+      SIM_RESOURCE_HASH_TELEMETRY,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT);
+  m_barriers.flush(commandBuffer);
+  m_hashTelemetry.zeroBuffer(commandBuffer);
+}
+
+void ParticleSystem::_collectHashTelemetry() {
+  {
+    std::lock_guard<std::mutex> lock(m_hashTelemetryMutex);
+    if (!m_hashTelemetryDelivered)
+      return;
+
+    m_stats.hashTelemetry = m_deliveredHashTelemetry;
+    m_hashTelemetryDelivered = false;
+  }
+
+  m_stats.hashTelemetrySubsteps = _getSubstepsPerFrame();
+
+  uint64_t totalAllocs = 0;
+  uint32_t maxAllocs = 0;
+  for (uint32_t allocs : m_stats.hashTelemetry.freeListAllocs) {
+    totalAllocs += allocs;
+    maxAllocs = std::max(maxAllocs, allocs);
+  }
+
+  m_stats.freeListSkew =
+      totalAllocs == 0
+          ? 1.0f
+          : float(maxAllocs) * BUCKET_FREE_LIST_COUNT / float(totalAllocs);
+}
+
+void ParticleSystem::_copyOutSleepStats(VkCommandBuffer commandBuffer) {
+  m_barriers.read(
+      SIM_RESOURCE_COUNTERS,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.flush(commandBuffer);
+
+  // Skipped for this step if the readbacks are backed up
+  m_pReadback->request(
+      commandBuffer,
+      {{m_simCounters.getAllocation().getBuffer(), 0, sizeof(SimCounters)}},
+      [that = this, substeps = _getSubstepsPerFrame()](ReadbackData&& data) {
+        std::lock_guard<std::mutex> lock(that->m_sleepStatsMutex);
+        SimCounters& counters = that->m_deliveredSleepCounters;
+        std::memcpy(&counters, data[0].data(), sizeof(SimCounters));
+        that->m_deliveredSleepingParticleSubsteps += counters.sleepingParticles;
+        that->m_deliveredParticleSubsteps +=
+            uint64_t(counters.particleCount) * substeps;
+        that->m_sleepStatsDelivered = true;
+      });
+}
+
+void ParticleSystem::_collectSleepStats() {
+  SimCounters counters;
+  {
+    std::lock_guard<std::mutex> lock(m_sleepStatsMutex);
+    if (!m_sleepStatsDelivered)
+      return;
+
+    counters = m_deliveredSleepCounters;
+    m_stats.sleepingParticleSubsteps = m_deliveredSleepingParticleSubsteps;
+    m_stats.particleSubsteps = m_deliveredParticleSubsteps;
+    m_sleepStatsDelivered = false;
+  }
+
+  uint64_t particleSubsteps =
+      uint64_t(counters.particleCount) * _getSubstepsPerFrame();
+  m_stats.sleepingFraction =
+      particleSubsteps == 0
+          ? 0.0f
+          : float(double(counters.sleepingParticles) / particleSubsteps);
+}
+
+void ParticleSystem::_cullParticles(VkCommandBuffer commandBuffer) {
+  // Start the draws' instance counts over, or set them to every particle
+  // with culling toggled off
+  _dispatchComputePass(commandBuffer, CULL_RESET_PASS, 1);
+
+  if (m_lastSimUniforms.cullOcclusion) {
+    // The previous frame's depth is still in its texture layout, but its
+    // writes only had to be visible to the deferred pass
+    VkMemoryBarrier depthBarrier{};
+    depthBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1,
+        &depthBarrier,
+        0,
+        nullptr,
+        0,
+        nullptr);
+
+    // Reduce the depth one level at a time, one thread per texel
+    uint32_t width = m_lastSimUniforms.screenWidth;
+    uint32_t height = m_lastSimUniforms.screenHeight;
+    for (uint32_t level = 0; level < m_hiZLevelCount; ++level) {
+      width = (width + 1) / 2;
+      height = (height + 1) / 2;
+      m_push.iteration = level;
+      _dispatchComputePass(
           commandBuffer,
-          VK_PIPELINE_BIND_POINT_COMPUTE,
-          m_computePasses[JACOBI_STEP_PASS].getLayout(),
-          0,
-          1,
-          &set,
-          0,
-          nullptr);
-      for (uint32_t iter = 0; iter < JACOBI_ITERS; ++iter) {
-        vkCmdPipelineBarrier(
-            commandBuffer,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            0,
-            0,
-            nullptr,
-            collisionStepBarriers.size(),
-            collisionStepBarriers.data(),
-            0,
-            nullptr);
+          HI_Z_PASS,
+          (width * height - 1) / m_simSpecialization.localSizeX + 1);
+    }
+  }
 
-        m_push.iteration = iter;
-        vkCmdPushConstants(
-            commandBuffer,
-            m_computePasses[JACOBI_STEP_PASS].getLayout(),
-            VK_SHADER_STAGE_ALL,
-            0,
-            sizeof(PushConstants),
-            &m_push);
-        vkCmdDispatch(commandBuffer, groupCountX, 1, 1);
-      }
+  // Append the visible particles to the draws
+  if (m_lastSimUniforms.cullParticles)
+    _dispatchParticlePass(commandBuffer, CULL_PASS);
+
+  _copyOutCullStats(commandBuffer);
+}
+
+void ParticleSystem::_renderFluidDepth(VkCommandBuffer commandBuffer) {
+  uint32_t pixelCount = m_screenExtent.width * m_screenExtent.height;
+  uint32_t pixelGroupCount =
+      (pixelCount - 1) / m_simSpecialization.localSizeX + 1;
+
+  _dispatchComputePass(commandBuffer, FLUID_CLEAR_PASS, pixelGroupCount);
+
+  // Splat every particle's nearest depth
+  _dispatchParticlePass(commandBuffer, FLUID_SPLAT_PASS);
+
+  // Alternate horizontal and vertical passes, an even number of them ends up
+  // back in the first target
+  for (uint32_t iter = 0; iter < 2 * FLUID_SMOOTHING_ITERATIONS; ++iter) {
+    m_push.iteration = iter;
+    _dispatchComputePass(commandBuffer, FLUID_SMOOTH_PASS, pixelGroupCount);
+  }
+}
+
+void ParticleSystem::_copyOutCullStats(VkCommandBuffer commandBuffer) {
+  m_barriers.read(
+      SIM_RESOURCE_COUNTERS,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.flush(commandBuffer);
+
+  // Skipped for this frame if the readbacks are backed up
+  m_pReadback->request(
+      commandBuffer,
+      {{m_simCounters.getAllocation().getBuffer(), 0, sizeof(SimCounters)}},
+      [that = this](ReadbackData&& data) {
+        std::lock_guard<std::mutex> lock(that->m_cullStatsMutex);
+        std::memcpy(
+            &that->m_deliveredCullCounters,
+            data[0].data(),
+            sizeof(SimCounters));
+        that->m_cullStatsDelivered = true;
+      });
+}
+
+void ParticleSystem::_collectCullStats() {
+  SimCounters counters;
+  {
+    std::lock_guard<std::mutex> lock(m_cullStatsMutex);
+    if (!m_cullStatsDelivered)
+      return;
+
+    counters = m_deliveredCullCounters;
+    m_cullStatsDelivered = false;
+  }
+
+  m_stats.visibleFraction =
+      counters.particleCount == 0
+          ? 1.0f
+          : float(counters.particleDraw.instanceCount) /
+                float(counters.particleCount);
+}
+
+namespace {
+template <typename TBuffer>
+void addReadbackRegion(
+    const TBuffer& buffer,
+    std::vector<ReadbackRegion>& regions) {
+  regions.push_back({buffer.getAllocation().getBuffer(), 0, buffer.getSize()});
+}
+
+// Adds the regions of a chunk's particle fields, in the order
+// appendReadbackParticles reads them
+void addParticleReadbackRegions(
+    const SimChunk& chunk,
+    uint32_t particleLayout,
+    std::vector<ReadbackRegion>& regions) {
+  if (particleLayout == PARTICLE_LAYOUT_SOA) {
+    addReadbackRegion(chunk.positions, regions);
+    addReadbackRegion(chunk.prevPositions, regions);
+    addReadbackRegion(chunk.globalIndices, regions);
+  } else {
+    addReadbackRegion(chunk.particles, regions);
+  }
+}
+
+// Appends a chunk's particles from the regions starting at regionIdx and
+// steps past them. The SoA layout's debug colours aren't read back.
+void appendReadbackParticles(
+    const ReadbackData& data,
+    size_t& regionIdx,
+    uint32_t particleLayout,
+    std::vector<Particle>& particles) {
+  if (particleLayout == PARTICLE_LAYOUT_SOA) {
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> prevPositions;
+    std::vector<uint32_t> globalIndices;
+    appendReadbackRegion(data[regionIdx++], positions);
+    appendReadbackRegion(data[regionIdx++], prevPositions);
+    appendReadbackRegion(data[regionIdx++], globalIndices);
+
+    for (size_t i = 0; i < positions.size(); ++i) {
+      Particle& particle = particles.emplace_back();
+      particle.position = glm::vec3(positions[i]);
+      particle.globalIndex = globalIndices[i];
+      particle.prevPosition = glm::vec3(prevPositions[i]);
+      particle.debug = 0;
+    }
+  } else {
+    appendReadbackRegion(data[regionIdx++], particles);
+  }
+}
+} // namespace
+
+bool ParticleSystem::_readBackParticles(
+    VkCommandBuffer commandBuffer,
+    std::function<void(const SimCounters&, std::vector<Particle>&&)>&&
+        callback) {
+  std::vector<ReadbackRegion> regions;
+  addReadbackRegion(m_simCounters, regions);
+  for (const SimChunk& chunk : m_chunks)
+    addParticleReadbackRegions(chunk, m_particleLayout, regions);
+
+  m_barriers.read(
+      SIM_RESOURCE_PARTICLES,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.read(
+      SIM_RESOURCE_COUNTERS,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.flush(commandBuffer);
+
+  return m_pReadback->request(
+      commandBuffer,
+      regions,
+      [callback = std::move(callback),
+       particleLayout = m_particleLayout](ReadbackData&& data) {
+        SimCounters counters;
+        std::memcpy(&counters, data[0].data(), sizeof(SimCounters));
+
+        std::vector<Particle> particles;
+        size_t regionIdx = 1;
+        while (regionIdx < data.size())
+          appendReadbackParticles(data, regionIdx, particleLayout, particles);
+        particles.resize(counters.particleCount);
+
+        callback(counters, std::move(particles));
+      });
+}
+
+void ParticleSystem::_readBackForUnitTests(VkCommandBuffer commandBuffer) {
+  // The counters, then per chunk: the particle fields, then the spatial hash
+  // buffers
+  std::vector<ReadbackRegion> regions;
+  addReadbackRegion(m_simCounters, regions);
+
+  for (const SimChunk& chunk : m_chunks) {
+    addParticleReadbackRegions(chunk, m_particleLayout, regions);
+
+    if (m_hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM) {
+      addReadbackRegion(chunk.cellStart, regions);
+    } else {
+      addReadbackRegion(chunk.spatialHash, regions);
+      addReadbackRegion(chunk.spatialHashEpochs, regions);
     }
   }
 
+  m_barriers.read(
+      SIM_RESOURCE_PARTICLES,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.read(
+      SIM_RESOURCE_HASH,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.read(
+      SIM_RESOURCE_COUNTERS,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT);
+  m_barriers.flush(commandBuffer);
+
+  bool requested = m_pReadback->request(
+      commandBuffer,
+      regions,
+      [simUniforms = m_lastSimUniforms,
+       hashEpoch = m_hashEpoch,
+       particleLayout = m_particleLayout,
+       hashBuildMode = m_hashBuildMode](ReadbackData&& data) {
+        std::vector<Particle> particles;
+        std::vector<uint32_t> spatialHash;
+        std::vector<uint32_t> spatialHashEpochs;
+        std::vector<uint32_t> cellStarts;
+
+        SimCounters counters;
+        std::memcpy(&counters, data[0].data(), sizeof(SimCounters));
+
+        size_t regionIdx = 1;
+        for (uint32_t chunkIdx = 0; chunkIdx < simUniforms.chunkCount;
+             ++chunkIdx) {
+          appendReadbackParticles(data, regionIdx, particleLayout, particles);
+
+          if (hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM) {
+            // Only the last chunk's extra slot is used, for the end of the
+            // last range
+            appendReadbackRegion(data[regionIdx++], cellStarts);
+            if (chunkIdx + 1 < simUniforms.chunkCount)
+              cellStarts.pop_back();
+          } else {
+            appendReadbackRegion(data[regionIdx++], spatialHash);
+            appendReadbackRegion(data[regionIdx++], spatialHashEpochs);
+          }
+        }
+
+        particles.resize(counters.particleCount);
+
+        if (hashBuildMode == SPATIAL_HASH_BUILD_PREFIX_SUM)
+          SpatialHashUnitTests::runPrefixSumTests(
+              simUniforms,
+              particles,
+              cellStarts);
+        else
+          SpatialHashUnitTests::runTests(
+              simUniforms,
+              hashEpoch,
+              particles,
+              spatialHash,
+              spatialHashEpochs);
+      });
+
+  if (!requested)
+    std::cout << "Readbacks are backed up, skipping the spatial hash tests"
+              << std::endl;
+}
+
+uint32_t ParticleSystem::_getSubstepsPerFrame() const {
+  return TIME_SUBSTEPS;
+}
+
+float ParticleSystem::_getSimStepTime() const { return SIM_STEP_TIME; }
+
+void ParticleSystem::draw(
+    Application& app,
+    VkCommandBuffer commandBuffer,
+    const FrameContext& frame) {
+
+  VkDescriptorSet set = m_heap.getDescriptorSet();
+
+  // Zero steps when the frame rate is above the sim rate, the draw then just
+  // interpolates further towards the latest step
+  for (uint32_t step = 0; step < m_pendingSimSteps; ++step) {
+    m_push.simStep = step;
+    _stepSim(commandBuffer);
+  }
+  m_push.simStep = 0;
+
+  if (m_flagUnitTests && m_pendingSimSteps != 0) {
+    m_flagUnitTests = false;
+    _readBackForUnitTests(commandBuffer);
+  }
+
+  // Needs the previous frame's depth before the GBuffer pass starts writing
+  // into the other one
+  if (m_useParticleCulling)
+    _cullParticles(commandBuffer);
+
+  if (m_particleRenderMode == PARTICLE_RENDER_FLUID) {
+    _renderFluidDepth(commandBuffer);
+    m_barriers.read(
+        SIM_RESOURCE_FLUID_DEPTH,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT);
+  }
+
+  // The particle draws read the particles and their solved entries in the
+  // vertex shader, and their instance count from the counters
+  m_barriers.read(
+      SIM_RESOURCE_PARTICLES,
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT);
+  m_barriers.read(
+      SIM_RESOURCE_ENTRIES,
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT);
+  m_barriers.read(
+      SIM_RESOURCE_VISIBLE_PARTICLES,
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT);
+  m_barriers.read(
+      SIM_RESOURCE_COUNTERS,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+  m_barriers.flush(commandBuffer);
+
   m_globalResources.getGBuffer().transitionToAttachment(commandBuffer);
 
   _renderGBufferPass(app, commandBuffer, frame);
@@ -970,6 +2260,7 @@ void ParticleSystem::draw(
     }
 
     m_writeIndex ^= 1;
+    m_hasPrevDepth = true;
   }
 
   Gui::draw(app, frame, commandBuffer);
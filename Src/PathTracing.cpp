@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -35,6 +36,11 @@ namespace AltheaDemo {
 namespace PathTracing {
 
 namespace {
+uint32_t getReservoirBufferCount(const VkExtent2D& extent) {
+  uint32_t reservoirCount = 2 * extent.width * extent.height;
+  return (reservoirCount - 1) / RESERVOIR_COUNT_PER_BUFFER + 1;
+}
+
 struct GBufferPush {
   uint32_t matrixBufferHandle;
   uint32_t primConstantsBuffer;
@@ -102,10 +108,40 @@ void PathTracing::initGame(Application& app) {
           exposure = static_cast<float>(y);
         }
       });
+
+  // The scene and its acceleration structure outlive swapchain re-creation
+  SingleTimeCommandBuffer commandBuffer(app);
+  createGlobalResources(app, commandBuffer);
+  createSamplingPasses(app, commandBuffer);
+
+  // The heap can't release handles, so the screen-sized resources get theirs
+  // once and createScreenResources rewrites them on every resize
+  m_rtTarget.targetImageHandle = m_heap.registerImage();
+  m_rtTarget.targetTextureHandle = m_heap.registerTexture();
+  registerReservoirHandles(getReservoirBufferCount(windowDims));
 }
 
 void PathTracing::shutdownGame(Application& app) {
   m_pCameraController.reset();
+
+  m_models.clear();
+
+  m_accelerationStructure = {};
+  m_giUniforms = {};
+
+  m_directSamplingPass = {};
+  m_spatialResamplingPass = {};
+
+  m_globalUniforms = {};
+  m_pointLights = {};
+
+  m_rtTarget = {};
+  m_reservoirHandles.clear();
+
+  m_globalResources = {};
+  m_globalResourcesExtent = {};
+
+  m_heap = {};
 }
 
 void PathTracing::createRenderState(Application& app) {
@@ -116,35 +152,26 @@ void PathTracing::createRenderState(Application& app) {
   Gui::createRenderState(app);
 
   SingleTimeCommandBuffer commandBuffer(app);
-  createGlobalResources(app, commandBuffer);
+  createScreenResources(app, commandBuffer);
   createGBufferPass(app, commandBuffer);
-  createSamplingPasses(app, commandBuffer);
+  createDisplayPass(app);
+
+  // The reservoirs start over
+  m_frameNumber = 0;
 }
 
 void PathTracing::destroyRenderState(Application& app) {
-  m_models.clear();
-
   Gui::destroyRenderState(app);
 
-  m_accelerationStructure = {};
-  m_rtTarget = {};
-  m_giUniforms = {};
+  m_rtTarget.target = {};
 
   m_gBufferPass = {};
   m_gBufferFrameBufferA = {};
   m_gBufferFrameBufferB = {};
-  m_directSamplingPass = {};
-  m_spatialResamplingPass = {};
   m_displayPass = {};
   m_displayPassSwapChainFrameBuffers = {};
 
-  m_globalResources = {};
-  m_globalUniforms = {};
-  m_pointLights = {};
-
   m_reservoirHeap.clear();
-
-  m_heap = {};
 }
 
 static GlobalIllumination::LiveEditValues s_liveValues{};
@@ -257,7 +284,7 @@ void PathTracing::tick(Application& app, const FrameContext& frame) {
 
   giUniforms.writeIndex = m_targetIndex;
 
-  giUniforms.reservoirHeap = m_reservoirHeap[0].getHandle().index;
+  giUniforms.reservoirHeap = m_reservoirHandles[0].index;
   giUniforms.reservoirsPerBuffer = RESERVOIR_COUNT_PER_BUFFER;
 
   giUniforms.frameNumber = m_frameNumber;
@@ -342,30 +369,95 @@ void PathTracing::createGlobalResources(
     }
   }
 
-  GlobalResourcesBuilder resourcesBuilder{};
-  resourcesBuilder.shadowMapArrayHandle = m_pointLights.getShadowMapHandle();
-  m_globalResources =
-      GlobalResources(app, commandBuffer, m_heap, resourcesBuilder);
   m_globalUniforms = GlobalUniformsResource(app, m_heap);
+}
 
+void PathTracing::createScreenResources(
+    Application& app,
+    SingleTimeCommandBuffer& commandBuffer) {
   // TODO: Make this buffer smaller...
   VkExtent2D extent = app.getSwapChainExtent();
 
+  // GlobalResources registers its own heap handles, the engine can't point
+  // them at a new GBuffer. Only an actual resize rebuilds it.
+  if (extent.width != m_globalResourcesExtent.width ||
+      extent.height != m_globalResourcesExtent.height) {
+    GlobalResourcesBuilder resourcesBuilder{};
+    resourcesBuilder.shadowMapArrayHandle = m_pointLights.getShadowMapHandle();
+    m_globalResources =
+        GlobalResources(app, commandBuffer, m_heap, resourcesBuilder);
+    m_globalResourcesExtent = extent;
+  }
+
   {
-    uint32_t reservoirCount = 2 * extent.width * extent.height;
-    uint32_t bufferCount =
-        (reservoirCount - 1) / RESERVOIR_COUNT_PER_BUFFER + 1;
+    uint32_t bufferCount = getReservoirBufferCount(extent);
+
+    // Only a window larger than any before it needs a longer range
+    if (bufferCount > m_reservoirHandles.size())
+      registerReservoirHandles(bufferCount);
 
     m_reservoirHeap.reserve(bufferCount);
+    m_reservoirBarriers = BarrierBatcher(1);
 
     for (uint32_t bufferIdx = 0; bufferIdx < bufferCount; ++bufferIdx) {
       auto& buffer =
           m_reservoirHeap.emplace_back(app, RESERVOIR_COUNT_PER_BUFFER);
       buffer.zeroBuffer(commandBuffer);
-      // These buffers are registered sequentially, we use this assumption in
-      // the shader
-      buffer.registerToHeap(m_heap);
+      m_heap.updateStorageBuffer(
+          m_reservoirHandles[bufferIdx],
+          buffer.getAllocation().getBuffer(),
+          0,
+          buffer.getSize());
     }
+
+    m_reservoirBarriers.write(
+        0,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT);
+    m_reservoirBarriers.flush(commandBuffer);
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    ImageOptions imageOptions{};
+    imageOptions.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    imageOptions.width = app.getSwapChainExtent().width;
+    imageOptions.height = app.getSwapChainExtent().height;
+    imageOptions.usage =
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    ImageViewOptions viewOptions{};
+    viewOptions.format = imageOptions.format;
+
+    SamplerOptions samplerOptions{};
+    samplerOptions.minFilter = VK_FILTER_NEAREST;
+    samplerOptions.magFilter = VK_FILTER_NEAREST;
+
+    m_rtTarget.target.image = Image(app, imageOptions);
+    m_rtTarget.target.view =
+        ImageView(app, m_rtTarget.target.image, viewOptions);
+    m_rtTarget.target.sampler = Sampler(app, samplerOptions);
+
+    m_heap.updateStorageImage(
+        m_rtTarget.targetImageHandle,
+        m_rtTarget.target.view,
+        m_rtTarget.target.sampler);
+
+    m_heap.updateTexture(
+        m_rtTarget.targetTextureHandle,
+        m_rtTarget.target.view,
+        m_rtTarget.target.sampler);
+  }
+}
+
+void PathTracing::registerReservoirHandles(uint32_t bufferCount) {
+  m_reservoirHandles.clear();
+  m_reservoirHandles.reserve(bufferCount);
+  for (uint32_t bufferIdx = 0; bufferIdx < bufferCount; ++bufferIdx) {
+    BufferHandle handle = m_heap.registerBuffer();
+    if (bufferIdx != 0 &&
+        handle.index != m_reservoirHandles[0].index + bufferIdx)
+      throw std::runtime_error("Reservoir handles aren't contiguous!");
+    m_reservoirHandles.push_back(handle);
   }
 }
 
@@ -422,39 +514,6 @@ void PathTracing::createSamplingPasses(
   m_giUniforms = TransientUniforms<GlobalIllumination::Uniforms>(app);
   m_giUniforms.registerToHeap(m_heap);
 
-  for (int i = 0; i < 2; ++i) {
-    ImageOptions imageOptions{};
-    imageOptions.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-    imageOptions.width = app.getSwapChainExtent().width;
-    imageOptions.height = app.getSwapChainExtent().height;
-    imageOptions.usage =
-        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-    ImageViewOptions viewOptions{};
-    viewOptions.format = imageOptions.format;
-
-    SamplerOptions samplerOptions{};
-    samplerOptions.minFilter = VK_FILTER_NEAREST;
-    samplerOptions.magFilter = VK_FILTER_NEAREST;
-
-    m_rtTarget.target.image = Image(app, imageOptions);
-    m_rtTarget.target.view =
-        ImageView(app, m_rtTarget.target.image, viewOptions);
-    m_rtTarget.target.sampler = Sampler(app, samplerOptions);
-
-    m_rtTarget.targetImageHandle = m_heap.registerImage();
-    m_heap.updateStorageImage(
-        m_rtTarget.targetImageHandle,
-        m_rtTarget.target.view,
-        m_rtTarget.target.sampler);
-
-    m_rtTarget.targetTextureHandle = m_heap.registerTexture();
-    m_heap.updateTexture(
-        m_rtTarget.targetTextureHandle,
-        m_rtTarget.target.view,
-        m_rtTarget.target.sampler);
-  }
-
   ShaderDefines defs;
   RayTracingPipelineBuilder builder{};
   builder.setRayGenShader(
@@ -482,8 +541,9 @@ void PathTracing::createSamplingPasses(
 
   m_spatialResamplingPass =
       RayTracingPipeline(app, RayTracingPipelineBuilder(builder));
+}
 
-  // Display Pass
+void PathTracing::createDisplayPass(Application& app) {
   VkClearValue colorClear;
   colorClear.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
   VkClearValue depthClear;
@@ -585,6 +645,10 @@ void PathTracing::draw(
       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
 
   // Direct Sampling
+  m_reservoirBarriers.readWrite(
+      0,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+  m_reservoirBarriers.flush(commandBuffer);
   {
     RTPush push{};
     push.globalResourcesHandle = m_globalResources.getHandle().index;
@@ -615,9 +679,11 @@ void PathTracing::draw(
     m_directSamplingPass.traceRays(app.getSwapChainExtent(), commandBuffer);
   }
 
-  reservoirBarrier(commandBuffer);
-
   // Spatial Resampling
+  m_reservoirBarriers.readWrite(
+      0,
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR);
+  m_reservoirBarriers.flush(commandBuffer);
   {
     RTPush push{};
     push.globalResourcesHandle = m_globalResources.getHandle().index;
@@ -648,7 +714,11 @@ void PathTracing::draw(
     m_spatialResamplingPass.traceRays(app.getSwapChainExtent(), commandBuffer);
   }
 
-  reservoirBarrier(commandBuffer);
+  m_reservoirBarriers.read(
+      0,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_ACCESS_SHADER_READ_BIT);
+  m_reservoirBarriers.flush(commandBuffer);
 
   m_rtTarget.target.image.transitionLayout(
       commandBuffer,
@@ -684,29 +754,5 @@ void PathTracing::draw(
 
   m_targetIndex ^= 1;
 }
-
-void PathTracing::reservoirBarrier(VkCommandBuffer commandBuffer) {
-  for (auto& buffer : m_reservoirHeap) {
-    VkBufferMemoryBarrier barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    barrier.buffer = buffer.getAllocation().getBuffer();
-    barrier.offset = 0;
-    barrier.size = buffer.getSize();
-    barrier.srcAccessMask =
-        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        0,
-        0,
-        nullptr,
-        1,
-        &barrier,
-        0,
-        nullptr);
-  }
-}
 } // namespace PathTracing
 } // namespace AltheaDemo
\ No newline at end of file
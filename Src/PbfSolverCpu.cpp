@@ -0,0 +1,269 @@
+#include "PbfSolverCpu.h"
+
+#include "ParallelFor.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+namespace {
+// Same as poly6Kernel in PBFluids.glsl
+float poly6Kernel(const PbfParams& params, float d2) {
+  float h = params.kernelRadius;
+  float f = std::max(h * h - d2, 0.0f);
+  return params.poly6Scale * f * f * f;
+}
+
+// Same as spikyKernelGrad in PBFluids.glsl
+glm::vec3
+spikyKernelGrad(const PbfParams& params, const glm::vec3& r, float d2) {
+  float h = params.kernelRadius;
+  if (d2 <= 0.0f || d2 >= h * h)
+    return glm::vec3(0.0f);
+
+  float d = std::sqrt(d2);
+  float f = h - d;
+  return (params.spikyGradScale * f * f / d) * r;
+}
+
+// Same as tensileCorrection in PBFluids.glsl
+float tensileCorrection(const PbfParams& params, float d2) {
+  float w = poly6Kernel(params, d2) * params.tensileInvKernel;
+  w *= w;
+  return -params.tensileStrength * w * w;
+}
+} // namespace
+
+PbfParams computePbfParams(
+    float kernelRadius,
+    float restSpacing,
+    float relaxation,
+    float tensileStrength,
+    float tensileDistance) {
+  float h = kernelRadius;
+  float h3 = h * h * h;
+  float h6 = h3 * h3;
+
+  PbfParams params{};
+  params.kernelRadius = h;
+  params.poly6Scale = 315.0f / (64.0f * glm::pi<float>() * h6 * h3);
+  params.spikyGradScale = -45.0f / (glm::pi<float>() * h6);
+  params.relaxation = relaxation;
+  params.tensileStrength = tensileStrength;
+  params.tensileInvKernel =
+      1.0f / poly6Kernel(params, tensileDistance * tensileDistance);
+
+  // Every lattice point within the kernel radius, including the particle
+  // itself
+  int extent = static_cast<int>(h / restSpacing);
+  float restDensity = 0.0f;
+  for (int i = -extent; i <= extent; ++i) {
+    for (int j = -extent; j <= extent; ++j) {
+      for (int k = -extent; k <= extent; ++k) {
+        float d2 = restSpacing * restSpacing * float(i * i + j * j + k * k);
+        restDensity += poly6Kernel(params, d2);
+      }
+    }
+  }
+  params.restDensity = restDensity;
+
+  return params;
+}
+
+void PbfSolverCpu::init(
+    const SpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<uint32_t>& globalIndices,
+    const PbfParams& params) {
+  _init(spatialHash, worldToGrid, globalIndices, params);
+}
+
+void PbfSolverCpu::init(
+    const SortedSpatialHashCpu& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<uint32_t>& globalIndices,
+    const PbfParams& params) {
+  _init(spatialHash, worldToGrid, globalIndices, params);
+}
+
+template <typename TSpatialHash>
+void PbfSolverCpu::_init(
+    const TSpatialHash& spatialHash,
+    const glm::mat4& worldToGrid,
+    const std::vector<uint32_t>& globalIndices,
+    const PbfParams& params) {
+  m_worldToGrid = worldToGrid;
+  m_params = params;
+
+  uint32_t spatialHashSize = spatialHash.getSpatialHashSize();
+  m_rangeStarts.resize(spatialHashSize);
+  m_rangeEnds.resize(spatialHashSize);
+  parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+    for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx)
+      spatialHash.getCellRange(
+          slotIdx,
+          m_rangeStarts[slotIdx],
+          m_rangeEnds[slotIdx]);
+  });
+
+  uint32_t entryCount = 0;
+  for (uint32_t globalIdx : globalIndices)
+    entryCount = std::max(entryCount, globalIdx + 1);
+
+  m_positions.resize(entryCount);
+  m_lambdas.assign(entryCount, 0.0f);
+  uint32_t particleCount = static_cast<uint32_t>(globalIndices.size());
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      uint32_t globalIdx = globalIndices[particleIdx];
+      m_positions[globalIdx] = spatialHash.getPosition(globalIdx);
+    }
+  });
+}
+
+template <typename TFunc>
+void PbfSolverCpu::_forEachNeighbor(
+    uint32_t globalParticleIdx,
+    const glm::vec3& particlePos,
+    TFunc&& fn) const {
+  glm::ivec3 gridCell = computeNeighborhoodBaseCell(m_worldToGrid, particlePos);
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  for (int i = 0; i < 8; ++i) {
+    uint32_t slotIdx = hashCoords(
+                           gridCell.x + (i >> 2),
+                           gridCell.y + ((i >> 1) & 1),
+                           gridCell.z + (i & 1)) %
+                       spatialHashSize;
+    for (uint32_t otherIdx = m_rangeStarts[slotIdx];
+         otherIdx < m_rangeEnds[slotIdx];
+         ++otherIdx) {
+      if (otherIdx != globalParticleIdx)
+        fn(otherIdx);
+    }
+  }
+}
+
+template <typename TFunc>
+void PbfSolverCpu::_forEachParticle(TFunc&& fn) const {
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+    for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx) {
+      for (uint32_t globalIdx = m_rangeStarts[slotIdx];
+           globalIdx < m_rangeEnds[slotIdx];
+           ++globalIdx)
+        fn(globalIdx);
+    }
+  });
+}
+
+float PbfSolverCpu::_computeDensity(uint32_t globalParticleIdx) const {
+  glm::vec3 particlePos = m_positions[globalParticleIdx];
+  float h2 = m_params.kernelRadius * m_params.kernelRadius;
+
+  float density = poly6Kernel(m_params, 0.0f);
+  _forEachNeighbor(globalParticleIdx, particlePos, [&](uint32_t otherIdx) {
+    glm::vec3 r = particlePos - m_positions[otherIdx];
+    float d2 = glm::dot(r, r);
+    if (d2 < h2)
+      density += poly6Kernel(m_params, d2);
+  });
+
+  return density;
+}
+
+void PbfSolverCpu::jacobiIteration() {
+  m_prevIterate = m_positions;
+
+  float h2 = m_params.kernelRadius * m_params.kernelRadius;
+  float invRestDensity = 1.0f / m_params.restDensity;
+
+  // Same as PbfLambda.comp.glsl
+  _forEachParticle([&](uint32_t globalIdx) {
+    glm::vec3 particlePos = m_prevIterate[globalIdx];
+
+    float density = poly6Kernel(m_params, 0.0f);
+    glm::vec3 gradSum(0.0f);
+    float gradSqSum = 0.0f;
+    _forEachNeighbor(globalIdx, particlePos, [&](uint32_t otherIdx) {
+      glm::vec3 r = particlePos - m_prevIterate[otherIdx];
+      float d2 = glm::dot(r, r);
+      if (d2 >= h2)
+        return;
+
+      density += poly6Kernel(m_params, d2);
+
+      glm::vec3 grad = spikyKernelGrad(m_params, r, d2);
+      gradSum += grad;
+      gradSqSum += glm::dot(grad, grad);
+    });
+
+    // Same as computeLambda in PBFluids.glsl
+    float constraint = std::max(density * invRestDensity - 1.0f, 0.0f);
+    float gradNormSq = (glm::dot(gradSum, gradSum) + gradSqSum) *
+                       invRestDensity * invRestDensity;
+    m_lambdas[globalIdx] = -constraint / (gradNormSq + m_params.relaxation);
+  });
+
+  // Same as the PBF_DENSITY path of ProjectedJacobiStep.comp.glsl
+  _forEachParticle([&](uint32_t globalIdx) {
+    glm::vec3 particlePos = m_prevIterate[globalIdx];
+    float lambda = m_lambdas[globalIdx];
+
+    glm::vec3 densityDisp(0.0f);
+    _forEachNeighbor(globalIdx, particlePos, [&](uint32_t otherIdx) {
+      glm::vec3 r = particlePos - m_prevIterate[otherIdx];
+      float d2 = glm::dot(r, r);
+      if (d2 >= h2)
+        return;
+
+      densityDisp += (lambda + m_lambdas[otherIdx] +
+                      tensileCorrection(m_params, d2)) *
+                     spikyKernelGrad(m_params, r, d2);
+    });
+
+    m_positions[globalIdx] = particlePos + densityDisp * invRestDensity;
+  });
+}
+
+double PbfSolverCpu::computeCompression() const {
+  std::atomic<uint64_t> compression{0};
+  std::atomic<uint32_t> particleCount{0};
+
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_rangeStarts.size());
+  parallelFor(spatialHashSize, [&](uint32_t start, uint32_t end) {
+    double localCompression = 0.0;
+    uint32_t localParticleCount = 0;
+    for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx) {
+      for (uint32_t globalIdx = m_rangeStarts[slotIdx];
+           globalIdx < m_rangeEnds[slotIdx];
+           ++globalIdx) {
+        float density = _computeDensity(globalIdx);
+        localCompression +=
+            std::max(density / m_params.restDensity - 1.0f, 0.0f);
+        ++localParticleCount;
+      }
+    }
+
+    // Summed in millionths, atomic doubles can't be added to before C++20
+    compression.fetch_add(
+        static_cast<uint64_t>(localCompression * 1.0e6),
+        std::memory_order_relaxed);
+    particleCount.fetch_add(localParticleCount, std::memory_order_relaxed);
+  });
+
+  uint32_t count = particleCount.load();
+  if (count == 0)
+    return 0.0;
+
+  return 1.0e-6 * static_cast<double>(compression.load()) / double(count);
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
@@ -0,0 +1,176 @@
+#include "PrimitivesCpu.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// 8-bit digits, the per-tile counts of a pass still fit in L1
+#define RADIX_BITS_CPU 8
+#define RADIX_DIGIT_COUNT_CPU (1 << RADIX_BITS_CPU)
+
+// Independent partial sums per segment, enough to fill a 256-bit register
+#define REDUCE_LANES 8
+
+namespace AltheaDemo {
+namespace {
+// Splits [0, count) into a few contiguous tiles per worker, unlike
+// parallelFor the tile boundaries are known up front so that per-tile results
+// can be combined in order
+struct Tiles {
+  uint32_t count;
+  uint32_t tileCount;
+  uint32_t tileSize;
+
+  Tiles(uint32_t count_, uint32_t minTileSize) : count(count_) {
+    uint32_t maxTiles = (count - 1) / minTileSize + 1;
+    tileCount = std::min(getWorkerCount() * 4, maxTiles);
+    tileSize = (count - 1) / tileCount + 1;
+  }
+
+  uint32_t getStart(uint32_t tileIdx) const {
+    return std::min(tileIdx * tileSize, count);
+  }
+  uint32_t getEnd(uint32_t tileIdx) const {
+    return std::min(getStart(tileIdx) + tileSize, count);
+  }
+
+  template <typename TFunc> void forEach(TFunc&& fn) const {
+    parallelFor(
+        tileCount,
+        [&](uint32_t start, uint32_t end) {
+          for (uint32_t tileIdx = start; tileIdx < end; ++tileIdx)
+            fn(tileIdx, getStart(tileIdx), getEnd(tileIdx));
+        },
+        1);
+  }
+};
+} // namespace
+
+void exclusiveScanCpu(std::vector<uint32_t>& values) {
+  uint32_t count = static_cast<uint32_t>(values.size());
+  if (count == 0)
+    return;
+
+  // Same structure as Shaders/Primitives/Scan.comp.glsl: sum the tiles, scan
+  // the tile sums, scan each tile from its offset
+  Tiles tiles(count, 1 << 16);
+  std::vector<uint32_t> tileOffsets(tiles.tileCount);
+
+  uint32_t* pValues = values.data();
+  tiles.forEach([&](uint32_t tileIdx, uint32_t start, uint32_t end) {
+    uint32_t sum = 0;
+    for (uint32_t idx = start; idx < end; ++idx)
+      sum += pValues[idx];
+    tileOffsets[tileIdx] = sum;
+  });
+
+  uint32_t total = 0;
+  for (uint32_t& tileOffset : tileOffsets) {
+    uint32_t sum = tileOffset;
+    tileOffset = total;
+    total += sum;
+  }
+
+  tiles.forEach([&](uint32_t tileIdx, uint32_t start, uint32_t end) {
+    uint32_t offset = tileOffsets[tileIdx];
+    for (uint32_t idx = start; idx < end; ++idx) {
+      uint32_t value = pValues[idx];
+      pValues[idx] = offset;
+      offset += value;
+    }
+  });
+}
+
+void sortKeyValuesCpu(
+    std::vector<uint32_t>& keys,
+    std::vector<uint32_t>& values,
+    uint32_t keyBits) {
+  uint32_t count = static_cast<uint32_t>(keys.size());
+  if (count <= 1 || keyBits == 0)
+    return;
+
+  Tiles tiles(count, 1 << 16);
+  uint32_t passCount =
+      (std::min(keyBits, 32u) - 1) / RADIX_BITS_CPU + 1;
+
+  // Digit-major, same as Shaders/Primitives/RadixSort.comp.glsl, so an
+  // exclusive scan gives each tile its first destination per digit in order
+  std::vector<uint32_t> histogram(RADIX_DIGIT_COUNT_CPU * tiles.tileCount);
+  std::vector<uint32_t> keysOut(count);
+  std::vector<uint32_t> valuesOut(count);
+
+  for (uint32_t passIdx = 0; passIdx < passCount; ++passIdx) {
+    uint32_t digitShift = passIdx * RADIX_BITS_CPU;
+    const uint32_t* pKeys = keys.data();
+    const uint32_t* pValues = values.data();
+
+    tiles.forEach([&](uint32_t tileIdx, uint32_t start, uint32_t end) {
+      uint32_t digitCounts[RADIX_DIGIT_COUNT_CPU]{};
+      for (uint32_t idx = start; idx < end; ++idx)
+        ++digitCounts[(pKeys[idx] >> digitShift) & (RADIX_DIGIT_COUNT_CPU - 1)];
+
+      for (uint32_t digit = 0; digit < RADIX_DIGIT_COUNT_CPU; ++digit)
+        histogram[digit * tiles.tileCount + tileIdx] = digitCounts[digit];
+    });
+
+    exclusiveScanCpu(histogram);
+
+    tiles.forEach([&](uint32_t tileIdx, uint32_t start, uint32_t end) {
+      uint32_t digitOffsets[RADIX_DIGIT_COUNT_CPU];
+      for (uint32_t digit = 0; digit < RADIX_DIGIT_COUNT_CPU; ++digit)
+        digitOffsets[digit] = histogram[digit * tiles.tileCount + tileIdx];
+
+      for (uint32_t idx = start; idx < end; ++idx) {
+        uint32_t key = pKeys[idx];
+        uint32_t dstIdx =
+            digitOffsets[(key >> digitShift) & (RADIX_DIGIT_COUNT_CPU - 1)]++;
+        keysOut[dstIdx] = key;
+        valuesOut[dstIdx] = pValues[idx];
+      }
+    });
+
+    keys.swap(keysOut);
+    values.swap(valuesOut);
+  }
+}
+
+void segmentedReduceCpu(
+    const std::vector<float>& values,
+    const std::vector<uint32_t>& segmentOffsets,
+    std::vector<float>& sums) {
+  uint32_t segmentCount =
+      segmentOffsets.empty()
+          ? 0
+          : static_cast<uint32_t>(segmentOffsets.size()) - 1;
+  sums.resize(segmentCount);
+
+  const float* pValues = values.data();
+  parallelFor(
+      segmentCount,
+      [&](uint32_t start, uint32_t end) {
+        for (uint32_t segmentIdx = start; segmentIdx < end; ++segmentIdx) {
+          uint32_t idx = segmentOffsets[segmentIdx];
+          uint32_t segmentEnd = segmentOffsets[segmentIdx + 1];
+
+          // Floats aren't reassociated by the compiler, so the lanes are
+          // spelled out for it to vectorize
+          float lanes[REDUCE_LANES]{};
+          for (; idx + REDUCE_LANES <= segmentEnd; idx += REDUCE_LANES)
+            for (uint32_t lane = 0; lane < REDUCE_LANES; ++lane)
+              lanes[lane] += pValues[idx + lane];
+
+          float sum = 0.0f;
+          for (uint32_t lane = 0; lane < REDUCE_LANES; ++lane)
+            sum += lanes[lane];
+          for (; idx < segmentEnd; ++idx)
+            sum += pValues[idx];
+
+          sums[segmentIdx] = sum;
+        }
+      },
+      64);
+}
+
+} // namespace AltheaDemo
@@ -0,0 +1,378 @@
+#include "SpatialHashCpu.h"
+
+#include "ParallelFor.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#define INVALID_INDEX 0xFFFFFFFF
+
+namespace AltheaDemo {
+namespace ParticleSystem {
+
+uint32_t hashCoords(int32_t x, int32_t y, int32_t z) {
+  // GLSL int multiplication wraps, do the same with unsigned arithmetic to
+  // avoid signed overflow
+  int32_t h = static_cast<int32_t>(
+      (static_cast<uint32_t>(x) * 92837111u) ^
+      (static_cast<uint32_t>(y) * 689287499u) ^
+      (static_cast<uint32_t>(z) * 283923481u));
+
+  // GLSL abs(INT_MIN) stays INT_MIN, which reinterprets as 0x80000000
+  return h < 0 ? 0u - static_cast<uint32_t>(h) : static_cast<uint32_t>(h);
+}
+
+glm::ivec3 computeGridCell(const glm::mat4& worldToGrid, const glm::vec3& pos) {
+  glm::vec3 gridPos = glm::vec3(worldToGrid * glm::vec4(pos, 1.0f));
+  return glm::ivec3(glm::floor(gridPos));
+}
+
+glm::ivec3
+computeNeighborhoodBaseCell(const glm::mat4& worldToGrid, const glm::vec3& pos) {
+  glm::vec3 gridPos = glm::vec3(worldToGrid * glm::vec4(pos, 1.0f));
+  glm::vec3 gridCellF = glm::floor(gridPos);
+  glm::ivec3 gridCell(gridCellF);
+  glm::vec3 cellLocalPos = gridPos - gridCellF;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (cellLocalPos[axis] < 0.5f)
+      --gridCell[axis];
+  }
+
+  return gridCell;
+}
+
+SpatialHashStats computeSpatialHashStats(
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    uint32_t spatialHashSize) {
+  SpatialHashStats stats{};
+
+  std::vector<uint32_t> slotCounts(spatialHashSize);
+  // The first cell seen in each slot, later cells that differ from it
+  // collided
+  std::vector<glm::ivec3> slotCells(spatialHashSize);
+  std::vector<bool> slotsColliding(spatialHashSize);
+  for (const glm::vec3& position : cellPositions) {
+    glm::ivec3 gridCell = computeGridCell(worldToGrid, position);
+    uint32_t slotIdx =
+        hashCoords(gridCell.x, gridCell.y, gridCell.z) % spatialHashSize;
+
+    uint32_t count = ++slotCounts[slotIdx];
+    if (count == 1) {
+      slotCells[slotIdx] = gridCell;
+      ++stats.occupiedSlots;
+    } else if (slotCells[slotIdx] != gridCell && !slotsColliding[slotIdx]) {
+      slotsColliding[slotIdx] = true;
+      ++stats.collidingSlots;
+    }
+
+    if (count == PARTICLES_PER_BUCKET + 1)
+      ++stats.overfullSlots;
+
+    stats.maxSlotParticles = std::max(stats.maxSlotParticles, count);
+  }
+
+  return stats;
+}
+
+SpatialHashCpu::SpatialHashCpu(
+    uint32_t spatialHashSize,
+    uint32_t particleBucketCount,
+    uint32_t freeListsCount)
+    : m_spatialHash(spatialHashSize),
+      m_epochs(spatialHashSize),
+      m_freeLists(freeListsCount),
+      m_buckets(particleBucketCount) {
+  clear();
+}
+
+void SpatialHashCpu::build(
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    const std::vector<glm::vec3>& insertPositions,
+    std::vector<uint32_t>& globalIndices) {
+  std::vector<uint32_t> slotIndices;
+
+  clear();
+  countParticles(worldToGrid, cellPositions, slotIndices);
+  allocateBuckets();
+  insertParticles(insertPositions, slotIndices, globalIndices);
+}
+
+void SpatialHashCpu::clear() {
+  // Epoch 0 is what the slot tags start out as, the tags only need to be
+  // reset when the counter wraps around
+  if (++m_epoch == 0) {
+    parallelFor(
+        static_cast<uint32_t>(m_epochs.size()),
+        [&](uint32_t start, uint32_t end) {
+          for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx)
+            m_epochs[slotIdx].store(0, std::memory_order_relaxed);
+        });
+    m_epoch = 1;
+  }
+}
+
+void SpatialHashCpu::countParticles(
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& positions,
+    std::vector<uint32_t>& slotIndices) {
+  uint32_t particleCount = static_cast<uint32_t>(positions.size());
+  slotIndices.resize(particleCount);
+
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      glm::ivec3 cell = computeGridCell(worldToGrid, positions[particleIdx]);
+      slotIndices[particleIdx] =
+          incrementCellParticleCount(cell.x, cell.y, cell.z);
+    }
+  });
+}
+
+void SpatialHashCpu::allocateBuckets() {
+  // The GPU pass resets the free lists from its first few threads
+  for (std::atomic<uint32_t>& freeList : m_freeLists)
+    freeList.store(0, std::memory_order_relaxed);
+
+  parallelFor(
+      static_cast<uint32_t>(m_spatialHash.size()),
+      [&](uint32_t start, uint32_t end) {
+        for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx)
+          allocateBucketForCell(slotIdx);
+      });
+}
+
+void SpatialHashCpu::insertParticles(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<uint32_t>& slotIndices,
+    std::vector<uint32_t>& globalIndices) {
+  uint32_t particleCount = static_cast<uint32_t>(positions.size());
+  globalIndices.resize(particleCount);
+
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx)
+      globalIndices[particleIdx] = hashInsertPosition(
+          slotIndices[particleIdx],
+          positions[particleIdx]);
+  });
+}
+
+uint32_t
+SpatialHashCpu::incrementCellParticleCount(int32_t i, int32_t j, int32_t k) {
+  uint32_t slotIdx =
+      hashCoords(i, j, k) % static_cast<uint32_t>(m_spatialHash.size());
+
+  // The bucket build only cares whether a cell is occupied
+  m_epochs[slotIdx].store(m_epoch, std::memory_order_relaxed);
+
+  return slotIdx;
+}
+
+void SpatialHashCpu::allocateBucketForCell(uint32_t slotIdx) {
+  if (m_epochs[slotIdx].load(std::memory_order_relaxed) == m_epoch) {
+    uint32_t freeListsCount = static_cast<uint32_t>(m_freeLists.size());
+    uint32_t freeListIdx = slotIdx % freeListsCount;
+    uint32_t freeListCounter =
+        m_freeLists[freeListIdx].fetch_add(1, std::memory_order_relaxed);
+    uint32_t bucketIdx = (freeListCounter * freeListsCount + freeListIdx) %
+                         static_cast<uint32_t>(m_buckets.size());
+    uint32_t globalIdx = bucketIdx << 4;
+
+    m_spatialHash[slotIdx].store(globalIdx, std::memory_order_relaxed);
+  }
+}
+
+uint32_t SpatialHashCpu::hashInsertPosition(
+    uint32_t slotIdx,
+    const glm::vec3& position) {
+  uint32_t particleGlobalIdx =
+      m_spatialHash[slotIdx].fetch_add(1, std::memory_order_relaxed);
+
+  // Cells with more than PARTICLES_PER_BUCKET particles spill into the next
+  // bucket, same as on the GPU. Writes past the last bucket are dropped, which
+  // is what robust buffer access does with the equivalent GPU write.
+  uint32_t bucketIdx = particleGlobalIdx >> 4;
+  if (bucketIdx < m_buckets.size()) {
+    float* entry =
+        m_buckets[bucketIdx].particles[particleGlobalIdx & 0xF].positions;
+    entry[0] = position.x;
+    entry[1] = position.y;
+    entry[2] = position.z;
+  }
+
+  return particleGlobalIdx;
+}
+
+uint32_t SpatialHashCpu::getSlot(uint32_t slotIdx) const {
+  if (m_epochs[slotIdx].load(std::memory_order_relaxed) != m_epoch)
+    return INVALID_INDEX;
+  return m_spatialHash[slotIdx].load(std::memory_order_relaxed);
+}
+
+void SpatialHashCpu::getCellRange(
+    uint32_t slotIdx,
+    uint32_t& rangeStart,
+    uint32_t& rangeEnd) const {
+  uint32_t bucketEnd = getSlot(slotIdx);
+  if (bucketEnd == INVALID_INDEX) {
+    rangeStart = 0;
+    rangeEnd = 0;
+  } else {
+    // Same as the GPU, a full bucket's end maps back to its own bucket
+    rangeStart = (bucketEnd - 1) & ~0xFu;
+    rangeEnd = bucketEnd;
+  }
+}
+
+glm::vec3 SpatialHashCpu::getPosition(uint32_t globalParticleIdx) const {
+  const float* entry =
+      m_buckets[globalParticleIdx >> 4]
+          .particles[globalParticleIdx & 0xF]
+          .positions;
+  return glm::vec3(entry[0], entry[1], entry[2]);
+}
+
+void SpatialHashCpu::copySpatialHash(std::vector<uint32_t>& spatialHash) const {
+  spatialHash.resize(m_spatialHash.size());
+  for (uint32_t slotIdx = 0; slotIdx < m_spatialHash.size(); ++slotIdx)
+    spatialHash[slotIdx] = getSlot(slotIdx);
+}
+
+SortedSpatialHashCpu::SortedSpatialHashCpu(
+    uint32_t spatialHashSize,
+    uint32_t particleCapacity)
+    : m_cellCounts(spatialHashSize),
+      m_cellStart(spatialHashSize + 1),
+      m_particleEntries(particleCapacity) {
+  clear();
+}
+
+void SortedSpatialHashCpu::build(
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& cellPositions,
+    const std::vector<glm::vec3>& insertPositions,
+    std::vector<uint32_t>& globalIndices) {
+  std::vector<uint32_t> slotIndices;
+
+  countParticles(worldToGrid, cellPositions, slotIndices);
+  scanCellCounts();
+  scatterParticles(insertPositions, slotIndices, globalIndices);
+}
+
+void SortedSpatialHashCpu::clear() {
+  parallelFor(
+      static_cast<uint32_t>(m_cellCounts.size()),
+      [&](uint32_t start, uint32_t end) {
+        for (uint32_t slotIdx = start; slotIdx < end; ++slotIdx)
+          m_cellCounts[slotIdx].store(0, std::memory_order_relaxed);
+      });
+}
+
+void SortedSpatialHashCpu::countParticles(
+    const glm::mat4& worldToGrid,
+    const std::vector<glm::vec3>& positions,
+    std::vector<uint32_t>& slotIndices) {
+  uint32_t particleCount = static_cast<uint32_t>(positions.size());
+  uint32_t spatialHashSize = static_cast<uint32_t>(m_cellCounts.size());
+  slotIndices.resize(particleCount);
+
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      glm::ivec3 cell = computeGridCell(worldToGrid, positions[particleIdx]);
+      uint32_t slotIdx = hashCoords(cell.x, cell.y, cell.z) % spatialHashSize;
+      m_cellCounts[slotIdx].fetch_add(1, std::memory_order_relaxed);
+      slotIndices[particleIdx] = slotIdx;
+    }
+  });
+}
+
+void SortedSpatialHashCpu::scanCellCounts() {
+  // Same structure as CellScan.comp.glsl: scan blocks locally, scan the block
+  // totals, add the block offsets back in
+  uint32_t slotCount = static_cast<uint32_t>(m_cellCounts.size());
+  uint32_t blockCount = std::min(getWorkerCount() * 4, slotCount);
+  uint32_t blockSize = (slotCount - 1) / blockCount + 1;
+  std::vector<uint32_t> blockSums(blockCount);
+
+  auto forEachBlock = [&](auto&& fn) {
+    parallelFor(
+        blockCount,
+        [&](uint32_t start, uint32_t end) {
+          for (uint32_t blockIdx = start; blockIdx < end; ++blockIdx) {
+            uint32_t firstSlot = std::min(blockIdx * blockSize, slotCount);
+            uint32_t lastSlot = std::min(firstSlot + blockSize, slotCount);
+            fn(blockIdx, firstSlot, lastSlot);
+          }
+        },
+        1);
+  };
+
+  forEachBlock([&](uint32_t blockIdx, uint32_t firstSlot, uint32_t lastSlot) {
+    uint32_t sum = 0;
+    for (uint32_t slotIdx = firstSlot; slotIdx < lastSlot; ++slotIdx) {
+      sum += m_cellCounts[slotIdx].exchange(0, std::memory_order_relaxed);
+      m_cellStart[slotIdx].store(sum, std::memory_order_relaxed);
+    }
+    blockSums[blockIdx] = sum;
+  });
+
+  uint32_t total = 0;
+  for (uint32_t& blockSum : blockSums) {
+    uint32_t sum = blockSum;
+    blockSum = total;
+    total += sum;
+  }
+
+  forEachBlock([&](uint32_t blockIdx, uint32_t firstSlot, uint32_t lastSlot) {
+    for (uint32_t slotIdx = firstSlot; slotIdx < lastSlot; ++slotIdx)
+      m_cellStart[slotIdx].fetch_add(
+          blockSums[blockIdx],
+          std::memory_order_relaxed);
+  });
+
+  m_cellStart[slotCount].store(total, std::memory_order_relaxed);
+}
+
+void SortedSpatialHashCpu::scatterParticles(
+    const std::vector<glm::vec3>& positions,
+    const std::vector<uint32_t>& slotIndices,
+    std::vector<uint32_t>& globalIndices) {
+  uint32_t particleCount = static_cast<uint32_t>(positions.size());
+  globalIndices.resize(particleCount);
+
+  parallelFor(particleCount, [&](uint32_t start, uint32_t end) {
+    for (uint32_t particleIdx = start; particleIdx < end; ++particleIdx) {
+      uint32_t globalIdx =
+          m_cellStart[slotIndices[particleIdx]].fetch_sub(
+              1,
+              std::memory_order_relaxed) -
+          1;
+
+      const glm::vec3& position = positions[particleIdx];
+      float* entry = m_particleEntries[globalIdx].positions;
+      entry[0] = position.x;
+      entry[1] = position.y;
+      entry[2] = position.z;
+
+      globalIndices[particleIdx] = globalIdx;
+    }
+  });
+}
+
+glm::vec3 SortedSpatialHashCpu::getPosition(uint32_t globalParticleIdx) const {
+  const float* entry = m_particleEntries[globalParticleIdx].positions;
+  return glm::vec3(entry[0], entry[1], entry[2]);
+}
+
+void SortedSpatialHashCpu::copyCellStarts(
+    std::vector<uint32_t>& cellStarts) const {
+  cellStarts.resize(m_cellStart.size());
+  for (size_t slotIdx = 0; slotIdx < m_cellStart.size(); ++slotIdx)
+    cellStarts[slotIdx] = m_cellStart[slotIdx].load(std::memory_order_relaxed);
+}
+
+} // namespace ParticleSystem
+} // namespace AltheaDemo
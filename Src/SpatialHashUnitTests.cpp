@@ -1,67 +1,218 @@
 #include "SpatialHashUnitTests.h"
+
+#include "ParticleCompaction.h"
 #include "ParticleSystem.h"
+#include "SpatialHashCpu.h"
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <iostream>
+
 namespace AltheaDemo {
 namespace ParticleSystem {
 
-#define CELL_HASH_MASK 0xFFFF0000
-#define PARTICLE_IDX_MASK 0x0000FFFF
-
-static uint32_t hashCoords(int x, int y, int z) {
-  return static_cast<uint32_t>(glm::abs((x * 92837111) ^ (y * 689287499) ^ (z * 283923481))) << 16;
-}
+#define INVALID_INDEX 0xFFFFFFFF
 
 /*static*/
 void SpatialHashUnitTests::runTests(
     const SimUniforms& simUniforms,
+    uint32_t hashEpoch,
     const std::vector<Particle>& particles,
-    const std::vector<uint32_t>& spatialHash) {
+    const std::vector<uint32_t>& spatialHash,
+    const std::vector<uint32_t>& spatialHashEpochs) {
 
   uint32_t particleCount = static_cast<uint32_t>(particles.size());
   uint32_t spatialHashSize = static_cast<uint32_t>(spatialHash.size());
 
-  // Verfy that the non-empty slots in the spatial hash have ascending keys
-  {
-
-    uint32_t prevHash = 0;
-    for (uint32_t slotIdx = 0; slotIdx < spatialHashSize; ++slotIdx) {
-      uint32_t entry = spatialHash[slotIdx];
-
-      // ignore empty slots
-      if (entry == 0xFFFFFFFF)
-      {
-        // If we hit an empty slot, reset the prevHash tracker
-        // Only non-empty regions need to be ascending
-        prevHash = 0;
-        continue;
-      }
-
-      uint32_t cellHash = entry & CELL_HASH_MASK;
-
-      // uint32_t curEntryLocation = (cellHash >> 16) % spatialHashSize;
-      // uint32_t prevEntryLocation = (prevHash >> 16) % spatialHashSize;
-      // TODO: This fails when rollovers are inserted into the front of the map...
-      // if (curEntryLocation < prevEntryLocation)
-      // if (cellHash < prevHash)
-      //   __debugbreak();
-
-      // Doesn't account for rollovers
-      // if (slotIdx < curEntryLocation)
-      //   __debugbreak();
-      prevHash = cellHash;
+  // The sim pass hashes the particle position before integrating it, that
+  // position is what ends up in prevPosition
+  std::vector<glm::vec3> cellPositions(particleCount);
+  std::vector<glm::vec3> insertPositions(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
+    cellPositions[particleIdx] = particles[particleIdx].prevPosition;
+    insertPositions[particleIdx] = particles[particleIdx].position;
+  }
+
+  // Rebuild the same spatial hash on the CPU
+  SpatialHashCpu cpuHash(
+      spatialHashSize,
+      simUniforms.particleBucketCount,
+      simUniforms.freeListsCount);
+  std::vector<uint32_t> slotIndices;
+  std::vector<uint32_t> globalIndices;
+  cpuHash.countParticles(
+      simUniforms.worldToGrid,
+      cellPositions,
+      slotIndices);
+
+  // The bucket build does not keep per-cell counts around, tally them here
+  std::vector<uint32_t> cellCounts(spatialHashSize);
+  for (uint32_t slotIdx : slotIndices)
+    ++cellCounts[slotIdx];
+
+  // Slots tagged with an older epoch are stale, treat them as empty
+  std::vector<uint32_t> gpuHash(spatialHashSize);
+  for (uint32_t slotIdx = 0; slotIdx < spatialHashSize; ++slotIdx)
+    gpuHash[slotIdx] = spatialHashEpochs[slotIdx] == hashEpoch
+                           ? spatialHash[slotIdx]
+                           : INVALID_INDEX;
+
+  cpuHash.allocateBuckets();
+  cpuHash.insertParticles(insertPositions, slotIndices, globalIndices);
+
+  // Verify that the GPU and CPU agree on which slots are occupied and on how
+  // many particles landed in each one. Bucket indices depend on the order the
+  // free lists were hit in, so only the bucket-local part is compared.
+  uint32_t occupancyMismatches = 0;
+  uint32_t countMismatches = 0;
+  uint32_t misalignedBuckets = 0;
+  uint32_t overflowingCells = 0;
+  for (uint32_t slotIdx = 0; slotIdx < spatialHashSize; ++slotIdx) {
+    uint32_t gpuEnd = gpuHash[slotIdx];
+    uint32_t count = cellCounts[slotIdx];
+
+    if ((gpuEnd == INVALID_INDEX) != (count == 0)) {
+      ++occupancyMismatches;
+      continue;
     }
+
+    if (count == 0)
+      continue;
+
+    if (count > PARTICLES_PER_BUCKET)
+      ++overflowingCells;
+
+    if ((gpuEnd & 0xF) != (cpuHash.getSlot(slotIdx) & 0xF))
+      ++countMismatches;
+
+    if (((gpuEnd - count) & 0xF) != 0)
+      ++misalignedBuckets;
   }
 
   // CPU implementation of spatial hash search
   // Verify that each particle can find itself
-  {
-    // for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
-    //   findSlot(simUniforms, spatialHash, particles, particleIdx);
-    // }
+  uint32_t lostParticles = 0;
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
+    uint32_t slotIdx = slotIndices[particleIdx];
+    uint32_t bucketEnd = gpuHash[slotIdx];
+    uint32_t bucketStart = bucketEnd - cellCounts[slotIdx];
+    uint32_t globalIdx = particles[particleIdx].globalIndex;
+
+    if (bucketEnd == INVALID_INDEX || globalIdx < bucketStart ||
+        globalIdx >= bucketEnd)
+      ++lostParticles;
   }
+
+  std::cout << "SpatialHashUnitTests: " << particleCount << " particles, "
+            << spatialHashSize << " slots\n"
+            << "  occupancy mismatches: " << occupancyMismatches << "\n"
+            << "  count mismatches: " << countMismatches << "\n"
+            << "  misaligned buckets: " << misalignedBuckets << "\n"
+            << "  overflowing cells: " << overflowingCells << "\n"
+            << "  particles not found in their cell: " << lostParticles
+            << std::endl;
+}
+
+/*static*/
+void SpatialHashUnitTests::runPrefixSumTests(
+    const SimUniforms& simUniforms,
+    const std::vector<Particle>& particles,
+    const std::vector<uint32_t>& cellStarts) {
+
+  uint32_t particleCount = static_cast<uint32_t>(particles.size());
+  uint32_t spatialHashSize = static_cast<uint32_t>(cellStarts.size()) - 1;
+
+  std::vector<glm::vec3> cellPositions(particleCount);
+  std::vector<glm::vec3> insertPositions(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
+    cellPositions[particleIdx] = particles[particleIdx].prevPosition;
+    insertPositions[particleIdx] = particles[particleIdx].position;
+  }
+
+  SortedSpatialHashCpu cpuHash(spatialHashSize, particleCount);
+  std::vector<uint32_t> slotIndices;
+  std::vector<uint32_t> globalIndices;
+  cpuHash.countParticles(
+      simUniforms.worldToGrid,
+      cellPositions,
+      slotIndices);
+  cpuHash.scanCellCounts();
+  cpuHash.scatterParticles(insertPositions, slotIndices, globalIndices);
+
+  // The scan is deterministic, so the cell ranges must match exactly
+  std::vector<uint32_t> expectedCellStarts;
+  cpuHash.copyCellStarts(expectedCellStarts);
+
+  uint32_t rangeMismatches = 0;
+  for (uint32_t slotIdx = 0; slotIdx <= spatialHashSize; ++slotIdx) {
+    if (cellStarts[slotIdx] != expectedCellStarts[slotIdx])
+      ++rangeMismatches;
+  }
+
+  // Each particle's packed entry must lie in its own cell's range and no two
+  // particles can share an entry
+  uint32_t lostParticles = 0;
+  uint32_t duplicateEntries = 0;
+  std::vector<bool> entryUsed(particleCount);
+  for (uint32_t particleIdx = 0; particleIdx < particleCount; ++particleIdx) {
+    uint32_t slotIdx = slotIndices[particleIdx];
+    uint32_t globalIdx = particles[particleIdx].globalIndex;
+
+    if (globalIdx < cellStarts[slotIdx] ||
+        globalIdx >= cellStarts[slotIdx + 1]) {
+      ++lostParticles;
+      continue;
+    }
+
+    if (entryUsed[globalIdx])
+      ++duplicateEntries;
+    entryUsed[globalIdx] = true;
+  }
+
+  std::cout << "SpatialHashUnitTests (prefix sum): " << particleCount
+            << " particles, " << spatialHashSize << " slots\n"
+            << "  cell range mismatches: " << rangeMismatches << "\n"
+            << "  particles not found in their cell: " << lostParticles
+            << "\n"
+            << "  duplicate entries: " << duplicateEntries << std::endl;
+}
+
+/*static*/
+void SpatialHashUnitTests::runCompactionTests(
+    const SimUniforms& simUniforms,
+    const std::vector<Particle>& particlesBefore,
+    const std::vector<Particle>& particlesAfter,
+    uint32_t liveParticleCount) {
+  std::vector<Particle> expectedParticles;
+  compactParticles(
+      simUniforms.killBoundsMin,
+      simUniforms.killBoundsMax,
+      particlesBefore,
+      expectedParticles);
+  uint32_t expectedCount = static_cast<uint32_t>(expectedParticles.size());
+
+  // The particles are only moved, so they must match exactly
+  uint32_t particleMismatches = 0;
+  uint32_t comparedCount = std::min(
+      expectedCount,
+      static_cast<uint32_t>(particlesAfter.size()));
+  for (uint32_t particleIdx = 0; particleIdx < comparedCount; ++particleIdx) {
+    const Particle& expected = expectedParticles[particleIdx];
+    const Particle& particle = particlesAfter[particleIdx];
+    if (particle.position != expected.position ||
+        particle.prevPosition != expected.prevPosition ||
+        particle.globalIndex != expected.globalIndex)
+      ++particleMismatches;
+  }
+
+  std::cout << "SpatialHashUnitTests (compaction): "
+            << particlesBefore.size() << " particles, "
+            << particlesBefore.size() - expectedCount << " killed\n"
+            << "  live count: " << liveParticleCount << ", expected "
+            << expectedCount << "\n"
+            << "  particle mismatches: " << particleMismatches << std::endl;
 }
 
 } // namespace ParticleSystem
-} // namespace AltheaDemo
\ No newline at end of file
+} // namespace AltheaDemo
@@ -31,6 +31,13 @@ using namespace AltheaEngine;
 #define DISPLAY_MODE_SH 1
 #define DISPLAY_MODE_GRAPH 2
 
+// Needs to match FitLegendre.comp.glsl
+#define LEGENDRE_COEFF_COUNT 16
+#define LEGENDRE_FIT_STEPS 100
+
+#define LEGENDRE_COEFFS_RESOURCE 0
+#define LEGENDRE_TERMS_RESOURCE 1
+
 namespace AltheaDemo {
 namespace SphericalHarmonics {
 namespace {
@@ -110,9 +117,12 @@ void SphericalHarmonics::destroyRenderState(Application& app) {
   this->_legendreUniforms = {};
   this->_shCoeffs = {};
   this->_legendreCoeffs = {};
+  this->_legendreTerms = {};
+  this->_legendreSegments = {};
 
   this->_shPass = {};
   this->_fitLegendre = {};
+  this->_primitives = {};
   this->_renderPass = {};
   this->_swapChainFrameBuffers = {};
 
@@ -279,6 +289,21 @@ void SphericalHarmonics::_createGlobalResources(
   this->_legendreCoeffs = StructuredBuffer<CoeffSet>(app, 1);
   this->_legendreCoeffs.registerToHeap(this->_globalHeap);
 
+  this->_legendreTerms = StructuredBuffer<float>(
+      app,
+      LEGENDRE_COEFF_COUNT * LEGENDRE_FIT_STEPS);
+  this->_legendreTerms.registerToHeap(this->_globalHeap);
+
+  // One segment of integration steps per coefficient
+  this->_legendreSegments =
+      StructuredBuffer<uint32_t>(app, LEGENDRE_COEFF_COUNT + 1);
+  this->_legendreSegments.registerToHeap(this->_globalHeap);
+  for (uint32_t i = 0; i <= LEGENDRE_COEFF_COUNT; ++i)
+    this->_legendreSegments.setElement(i * LEGENDRE_FIT_STEPS, i);
+  this->_legendreSegments.upload(app, (VkCommandBuffer)commandBuffer);
+
+  this->_legendreBarriers = BarrierBatcher(2);
+
   this->_shUniforms = TransientUniforms<SHUniforms>(app);
   this->_shUniforms.registerToHeap(this->_globalHeap);
 
@@ -287,6 +312,8 @@ void SphericalHarmonics::_createGlobalResources(
 
   this->_legendreUniformValues.coeffBuffer =
       this->_legendreCoeffs.getHandle().index;
+  this->_legendreUniformValues.termsBuffer =
+      this->_legendreTerms.getHandle().index;
 }
 
 void SphericalHarmonics::_createGraph(Application& app) {
@@ -408,8 +435,11 @@ void SphericalHarmonics::_createComputePass(Application& app) {
         this->_globalHeap.getDescriptorSetLayout());
     builder.layoutBuilder.addPushConstants<uint32_t>(VK_SHADER_STAGE_ALL);
 
-    this->_fitLegendre = ComputePipeline(app, std::move(builder));
+    this->_shPass = ComputePipeline(app, std::move(builder));
   }
+
+  // Only reductions, no scratch needed
+  this->_primitives = GpuPrimitives(app, this->_globalHeap, 0);
 }
 
 void SphericalHarmonics::_createRenderPass(Application& app) {
@@ -488,6 +518,12 @@ void SphericalHarmonics::draw(
 
   // Compute passes
   {
+    this->_legendreBarriers.write(
+        LEGENDRE_TERMS_RESOURCE,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT);
+    this->_legendreBarriers.flush(commandBuffer);
+
     vkCmdBindPipeline(
         commandBuffer,
         VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -509,26 +545,32 @@ void SphericalHarmonics::draw(
         0,
         sizeof(uint32_t),
         &push);
-    vkCmdDispatch(commandBuffer, 1, 1, 1); // local size 16x1x1
+    // A workgroup per coefficient, a thread per integration step
+    vkCmdDispatch(commandBuffer, LEGENDRE_COEFF_COUNT, 1, 1);
 
-    VkBufferMemoryBarrier barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    barrier.buffer = this->_legendreCoeffs.getAllocation().getBuffer();
-    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    barrier.offset = 0;
-    barrier.size = this->_legendreCoeffs.getSize();
+    // Sum each coefficient's steps
+    this->_legendreBarriers.read(
+        LEGENDRE_TERMS_RESOURCE,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT);
+    this->_legendreBarriers.write(
+        LEGENDRE_COEFFS_RESOURCE,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT);
+    this->_legendreBarriers.flush(commandBuffer);
 
-    vkCmdPipelineBarrier(
+    this->_primitives.segmentedReduce(
         commandBuffer,
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        this->_legendreTerms.getHandle().index,
+        this->_legendreSegments.getHandle().index,
+        this->_legendreCoeffs.getHandle().index,
+        LEGENDRE_COEFF_COUNT);
+
+    this->_legendreBarriers.read(
+        LEGENDRE_COEFFS_RESOURCE,
         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-        0,
-        0,
-        nullptr,
-        1,
-        &barrier,
-        0,
-        nullptr);
+        VK_ACCESS_SHADER_READ_BIT);
+    this->_legendreBarriers.flush(commandBuffer);
   }
 
   // Graph pass
@@ -1,21 +1,58 @@
+#include "Benchmarks.h"
 #include "DemoScene.h"
 #include "RayTracingDemo.h"
 #include "RayTracedReflectionsDemo.h"
 #include "BindlessDemo.h"
 #include "PathTracing.h"
 #include "DiffuseProbes.h"
+#include "GpuPrimitivesBenchmark.h"
+#include "HeadlessSimBenchmark.h"
 #include "ParticleSystem.h"
 #include "SphericalHarmonics.h"
 
 #include <Althea/Application.h>
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 using namespace AltheaEngine;
 using namespace AltheaDemo;
 
-int main() {
+int main(int argc, char** argv) {
+  // CPU-only benchmarks, no window or device needed
+  if (argc > 2 && std::string(argv[1]) == "--bench") {
+    return Benchmarks::run(
+        argv[2],
+        std::vector<std::string>(argv + 3, argv + argc));
+  }
+
   Application app("Althea Demo", "../..", "../../Extern/Althea");
+
+  // GPU sim benchmark, steps the particle sim without running the game loop
+  if (argc > 1 && std::string(argv[1]) == "--sim-bench") {
+    try {
+      return ParticleSystem::HeadlessSimBenchmark::run(
+          app,
+          std::vector<std::string>(argv + 2, argv + argc));
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // GPU compute primitives benchmark, checked against the CPU twins
+  if (argc > 1 && std::string(argv[1]) == "--primitives-bench") {
+    try {
+      return GpuPrimitivesBenchmark::run(
+          app,
+          std::vector<std::string>(argv + 2, argv + argc));
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   //app.createGame<DemoScene::DemoScene>(); // BROKEN
   app.createGame<RayTracingDemo::RayTracingDemo>();
   // app.createGame<RayTracedReflectionsDemo::RayTracedReflectionsDemo>();